@@ -29,6 +29,8 @@ void display_menu1() {
        << NONE << L_YELLOW "*" NONE << endl
        << L_YELLOW "*" << NONE << L_BLUE << "------------聊天(chat-)-----------"
        << NONE << L_YELLOW "*" NONE << endl
+       << L_YELLOW "*" << NONE << L_BLUE << "------------搜索记录(search-)-----"
+       << NONE << L_YELLOW "*" NONE << endl
        << L_YELLOW "*" << NONE << L_BLUE << "------------好友列表(list-f)------"
        << NONE << L_YELLOW "*" NONE << endl
        << L_YELLOW "*" << NONE << L_BLUE << "------------群聊列表(list-g)------"
@@ -44,6 +44,8 @@ using namespace std;
 #define SENDFILE_G 34
 #define RECVFILE_G 35
 #define DISSOLVE 36
+#define SEARCH 37
+#define HISTORY 38
 
 string get_login();
 string get_uid();
@@ -258,6 +260,15 @@ Command get_command(string my_uid) {
       string option0(input.begin() + 6, input.end());
       Command command(my_uid, ABOUTGROUP, {option0});
       return command;
+    } else if (input.find("search-") == 0 &&
+               (input.find('-', 7) == 10 || input.find('-', 7) == 11) &&
+               input.size() > input.find('-', 7) + 1) {
+      // search-好友uid或群号-关键词，从第1页看起
+      size_t dash = input.find('-', 7);
+      string option0(input.begin() + 7, input.begin() + dash);
+      string option1(input.begin() + dash + 1, input.end());
+      Command command(my_uid, SEARCH, {option0, option1, "1"});
+      return command;
     } else if (input == "menu") {
       display_menu1();
       cout << "就决定是你了：" << endl;
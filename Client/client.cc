@@ -49,11 +49,11 @@ int main() {
   bool display = true;
   // 循环展示未读消息界面，并获取用户输入，进行交互，展示服务器回复
   while (true) {
-    // 如果上一次的操作不是展示未读消息界面，就在每一次循环获取用户输入开始前展示未读消息，是的话就不展示
+    // 如果上一次的操作不是展示未读消息界面，就在每一次循环获取用户输入开始前展示未读消息，是的话就不展示；
+    // 未读概要由服务器推送，展示的是本地的一份，不用再向服务器查询
     if (display) {
-      Command command0(my_uid, NEWMESSAGE, {"newmessage"});
       cout << L_YELLOW << "\n********************" << NONE << endl;
-      NewMessage(cfd_class, command0);
+      ShowUnread();
       cout << L_YELLOW << "********************" << NONE << endl;
     }
     display = true;
@@ -97,7 +97,7 @@ int main() {
       break;
     case NEWMESSAGE:
       cout << L_YELLOW << "\n********************" << NONE << endl;
-      NewMessage(cfd_class, command);
+      ShowUnread();
       cout << L_YELLOW << "********************" << NONE << endl;
       display = false;
       break;
@@ -143,6 +143,9 @@ int main() {
     case DISSOLVE:
       Dissolve(cfd_class, command);
       break;
+    case SEARCH:
+      Search(cfd_class, command);
+      break;
     case INFOXXXX:
       InfoXXXX(cfd_class, command);
       break;
@@ -4,6 +4,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <fcntl.h>
 #include <iostream>
 #include <pthread.h>
@@ -13,6 +14,8 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <utility>
+#include <vector>
 
 void my_error(const char *errorMsg);
 void *recvfunc(void *arg);
@@ -31,7 +34,7 @@ bool ExitChatGroup(TcpSocket cfd_class, Command command);
 bool ShieldFriend(TcpSocket cfd_class, Command command);
 bool DeleteFriend(TcpSocket cfd_class, Command command);
 bool Restorefriend(TcpSocket cfd_class, Command command);
-bool NewMessage(TcpSocket cfd_class, Command command);
+void ShowUnread();
 bool LookSystem(TcpSocket cfd_class, Command command);
 bool LookNotice(TcpSocket cfd_class, Command command);
 bool RefuseAddFriend(TcpSocket cfd_class, Command command);
@@ -46,13 +49,67 @@ bool ExitGroup(TcpSocket cfd_class, Command command);
 bool DisplyMember(TcpSocket cfd_class, Command command);
 bool RemoveMember(TcpSocket cfd_class, Command command);
 bool Dissolve(TcpSocket cfd_class, Command command);
+bool Search(TcpSocket cfd_class, Command command);
+void LoadOlder(TcpSocket cfd_class, Command command,
+               unsigned long long &older);
+bool OlderFrame(const string &msg, unsigned long long &older);
 bool InfoXXXX(TcpSocket cfd_class, Command command);
 
+// 服务器推来的未读概要，名目按第一次出现的顺序排；通知线程写，主循环读
+struct UnreadView {
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t arrived = PTHREAD_COND_INITIALIZER;
+  bool ready = false; // 登录后的第一帧到了
+  vector<pair<string, string>> counts;
+};
+UnreadView unread_view;
+// 未读概要的推送帧："@unread 系统消息=1 来自1234的未读消息=3 -来自201的未读消息"，
+// 只带变了的名目，前缀-表示这个名目没有了
+void ApplyUnread(const string &frame) {
+  pthread_mutex_lock(&unread_view.lock);
+  auto &counts = unread_view.counts;
+  size_t pos = frame.find(' ');
+  while (pos != string::npos) {
+    size_t next = frame.find(' ', pos + 1);
+    string item = frame.substr(pos + 1, next == string::npos ? string::npos
+                                                             : next - pos - 1);
+    pos = next;
+    bool removed = !item.empty() && item[0] == '-';
+    size_t eq = item.rfind('=');
+    string field = removed ? item.substr(1) : item.substr(0, eq);
+    auto it = counts.begin();
+    while (it != counts.end() && it->first != field) {
+      it++;
+    }
+    if (removed) {
+      if (it != counts.end()) {
+        counts.erase(it);
+      }
+    } else if (eq != string::npos) {
+      if (it != counts.end()) {
+        it->second = item.substr(eq + 1);
+      } else {
+        counts.push_back({field, item.substr(eq + 1)});
+      }
+    }
+  }
+  unread_view.ready = true;
+  pthread_cond_broadcast(&unread_view.arrived);
+  pthread_mutex_unlock(&unread_view.lock);
+}
 struct RecvArg {
   string myuid;
   int recv_fd = -1;
   RecvArg(string Myuid, int Recv_uid) : myuid(Myuid), recv_fd(Recv_uid) {}
 };
+// 服务器忙不过来时不执行命令，只回一个"busy"，后面不会再有这条命令的回复
+bool Busy(const string &reply) {
+  if (reply != "busy") {
+    return false;
+  }
+  cout << "服务器繁忙，请稍后再试." << endl;
+  return true;
+}
 void my_error(const char *errorMsg) {
   cout << errorMsg << endl;
   strerror(errno);
@@ -76,6 +133,28 @@ void *recvfunc(void *arg) {
       delete recv_arg;
       exit(0);
     }
+    // 未读概要变了，只更新本地的概要，展示菜单前再显示
+    if (message.compare(0, 7, "@unread") == 0) {
+      ApplyUnread(message);
+      continue;
+    }
+    // 好友上下线的推送帧："@presence +1234 -5678"
+    if (message.compare(0, 9, "@presence") == 0) {
+      size_t pos = message.find(' ');
+      while (pos != string::npos && pos + 1 < message.size()) {
+        size_t next = message.find(' ', pos + 1);
+        string uid = message.substr(pos + 2, next == string::npos
+                                                 ? string::npos
+                                                 : next - pos - 2);
+        if (message[pos + 1] == '+') {
+          cout << L_GREEN << "好友" << uid << "上线了" << NONE << endl;
+        } else {
+          cout << L_WHITE << "好友" << uid << "下线了" << NONE << endl;
+        }
+        pos = next;
+      }
+      continue;
+    }
     cout << message << endl;
   }
   return nullptr;
@@ -103,6 +182,8 @@ string Login(TcpSocket cfd_class) {
   // cout << check << endl;
   if (check == "close" || check == "-1") {
     exit(0);
+  } else if (Busy(check)) {
+    return "false";
   } else if (check == "incorrect") {
     cout << "账号或密码错误." << endl;
     return "false";
@@ -155,6 +236,8 @@ bool Register(TcpSocket cfd_class) {
   if (new_uid == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(new_uid)) {
+    return false;
   }
   cout << "您注册的uid为: " << new_uid << endl
        << "忘记后无法找回，请牢记." << endl;
@@ -170,6 +253,8 @@ bool AddFriend(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "ok") {
     cout << "好友添加申请已发送,等待通过." << endl;
     return true;
@@ -197,6 +282,8 @@ bool AddGroup(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "ok") {
     cout << "群聊添加申请已发送,等待通过." << endl;
     return true;
@@ -221,6 +308,8 @@ bool AgreeAddFriend(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "ok") {
     cout << "已通过" << command.m_option[0] << "的好友申请." << endl;
     return true;
@@ -255,6 +344,8 @@ bool ListFriend(TcpSocket cfd_class, Command command) {
     } else if (Friend == "close") {
       cout << "服务器已关闭." << endl;
       exit(0);
+    } else if (Busy(Friend)) {
+      return false;
     } else {
       cout << Friend << endl;
     }
@@ -272,6 +363,8 @@ bool ChatFriend(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "none") {
     cout << "您还没有好友." << endl;
     return false;
@@ -283,6 +376,7 @@ bool ChatFriend(TcpSocket cfd_class, Command command) {
   // 有这个好友就打印历史聊天记录
   else if (check == "have") {
     string HistoryMsg;
+    unsigned long long older = 0; // 归档里还没看过的更早消息数
     while (true) {
       HistoryMsg = cfd_class.recvMsg();
       if (HistoryMsg == "close" || HistoryMsg == "-1") {
@@ -291,7 +385,7 @@ bool ChatFriend(TcpSocket cfd_class, Command command) {
       }
       if (HistoryMsg == "以上为历史聊天记录") {
         break;
-      } else {
+      } else if (!OlderFrame(HistoryMsg, older)) {
         cout << HistoryMsg << endl;
       }
     }
@@ -305,8 +399,18 @@ bool ChatFriend(TcpSocket cfd_class, Command command) {
       // 用户想退出聊天界面，送请求并等待服务器处理完毕
       if (msg == "#") {
         Command command_exit(command.m_uid, EXITCHAT, {"空"});
-        ExitChatFriend(cfd_class, command_exit);
-        break;
+        // 退出请求被服务器丢掉时还在聊天里，可以再输入#退出
+        if (ExitChatFriend(cfd_class, command_exit)) {
+          break;
+        }
+        continue;
+      }
+      // 往前翻一页归档的历史
+      if (msg == "^") {
+        Command command_older(command.m_uid, HISTORY,
+                              {"friend", command.m_option[0], ""});
+        LoadOlder(cfd_class, command_older, older);
+        continue;
       }
 
       // 如果是发文件
@@ -345,6 +449,10 @@ bool ChatFriend(TcpSocket cfd_class, Command command) {
           if (check_create == "close") {
             cout << "服务器已关闭." << endl;
             exit(0);
+          } else if (Busy(check_create)) {
+            // 服务器没有接这个文件，内容不能发过去
+            close(filefd);
+            continue;
           }
           sendfile(cfd_class.getfd(), filefd, NULL, stat_buf.st_size);
           close(filefd);
@@ -383,6 +491,8 @@ bool ChatFriend(TcpSocket cfd_class, Command command) {
         if (check_begin == "close") {
           cout << "服务器已关闭." << endl;
           exit(0);
+        } else if (Busy(check_begin)) {
+          continue;
         } else if (check_begin == "no") {
           cout << "对方未给您发送该文件." << endl;
           continue;
@@ -433,6 +543,8 @@ bool ChatFriend(TcpSocket cfd_class, Command command) {
       if (check == "close") {
         cout << "服务器已关闭." << endl;
         exit(0);
+      } else if (Busy(check)) {
+        continue;
       } else if (check == "ok") {
         continue;
       } else if (check == "nohave") {
@@ -453,6 +565,8 @@ bool ChatGroup(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "none") {
     cout << "您还没有加入任何群聊." << endl;
     return false;
@@ -463,12 +577,16 @@ bool ChatGroup(TcpSocket cfd_class, Command command) {
   // 有这个群聊就打印历史聊天记录
   else if (check == "have") {
     string HistoryMsg;
+    unsigned long long older = 0; // 归档里还没看过的更早消息数
     while (true) {
       HistoryMsg = cfd_class.recvMsg();
       if (HistoryMsg == "close" || HistoryMsg == "-1") {
         cout << "服务器已关闭." << endl;
         exit(0);
       }
+      if (OlderFrame(HistoryMsg, older)) {
+        continue;
+      }
       cout << HistoryMsg << endl;
       if (HistoryMsg == "以上为历史聊天记录") {
         break;
@@ -483,8 +601,18 @@ bool ChatGroup(TcpSocket cfd_class, Command command) {
       // 用户想退出聊天界面，送请求并等待服务器处理完毕
       if (msg == "#") {
         Command command_exit(command.m_uid, EXITGROUPCHAT, {"空"});
-        ExitChatGroup(cfd_class, command_exit);
-        break;
+        // 退出请求被服务器丢掉时还在聊天里，可以再输入#退出
+        if (ExitChatGroup(cfd_class, command_exit)) {
+          break;
+        }
+        continue;
+      }
+      // 往前翻一页归档的历史
+      if (msg == "^") {
+        Command command_older(command.m_uid, HISTORY,
+                              {"group", command.m_option[0], ""});
+        LoadOlder(cfd_class, command_older, older);
+        continue;
       }
       // 如果是发文件
       if (msg == "$") {
@@ -522,6 +650,10 @@ bool ChatGroup(TcpSocket cfd_class, Command command) {
           if (check_create == "close") {
             cout << "服务器已关闭." << endl;
             exit(0);
+          } else if (Busy(check_create)) {
+            // 服务器没有接这个文件，内容不能发过去
+            close(filefd);
+            continue;
           }
           sendfile(cfd_class.getfd(), filefd, NULL, stat_buf.st_size);
           close(filefd);
@@ -560,6 +692,8 @@ bool ChatGroup(TcpSocket cfd_class, Command command) {
         if (check_begin == "close") {
           cout << "服务器已关闭." << endl;
           exit(0);
+        } else if (Busy(check_begin)) {
+          continue;
         } else if (check_begin == "no") {
           cout << "对方未给您发送该文件." << endl;
           continue;
@@ -610,6 +744,8 @@ bool ChatGroup(TcpSocket cfd_class, Command command) {
       if (check == "close") {
         cout << "服务器已关闭." << endl;
         exit(0);
+      } else if (Busy(check)) {
+        continue;
       } else if (check == "ok") {
         continue;
       } else if (check == "nohave") {
@@ -620,6 +756,7 @@ bool ChatGroup(TcpSocket cfd_class, Command command) {
   }
   return true;
 }
+// 只有请求被服务器丢掉时返回false，这时还留在聊天里
 bool ExitChatFriend(TcpSocket cfd_class, Command command) {
   int ret = cfd_class.sendMsg(command.To_Json()); // 发送退出聊天请求
   if (ret == 0 || ret == -1) {
@@ -630,16 +767,18 @@ bool ExitChatFriend(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "ok") {
     system("clear");
     cout << "已退出聊天" << endl;
     return true;
   } else if (check == "no") {
     cout << L_WHITE << "无效的操作，请重新输入." << NONE << endl;
-    return false;
   }
-  return false;
+  return true;
 }
+// 只有请求被服务器丢掉时返回false，这时还留在聊天里
 bool ExitChatGroup(TcpSocket cfd_class, Command command) {
   int ret = cfd_class.sendMsg(command.To_Json()); // 发送退出聊天请求
   if (ret == 0 || ret == -1) {
@@ -650,15 +789,16 @@ bool ExitChatGroup(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "ok") {
     system("clear");
     cout << "已退出聊天" << endl;
     return true;
   } else if (check == "no") {
     cout << L_WHITE << "无效的操作，请重新输入." << NONE << endl;
-    return false;
   }
-  return false;
+  return true;
 }
 bool ShieldFriend(TcpSocket cfd_class, Command command) {
   int ret = cfd_class.sendMsg(command.To_Json());
@@ -670,6 +810,8 @@ bool ShieldFriend(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "no") {
     cout << "未找到该好友." << endl;
     return false;
@@ -693,6 +835,8 @@ bool DeleteFriend(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "nofind") {
     cout << "未找到该好友." << endl;
     return false;
@@ -712,6 +856,8 @@ bool Restorefriend(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "nohave") {
     cout << "未找到该好友." << endl;
     return false;
@@ -726,27 +872,23 @@ bool Restorefriend(TcpSocket cfd_class, Command command) {
   }
   return false;
 }
-bool NewMessage(TcpSocket cfd_class, Command command) {
-  int ret = cfd_class.sendMsg(command.To_Json());
-  if (ret == 0 || ret == -1) {
-    cout << "服务器已关闭." << endl;
-    exit(0);
+// 展示本地的未读概要，不再向服务器查询；刚登录时等第一帧推过来，最多等2秒
+void ShowUnread() {
+  pthread_mutex_lock(&unread_view.lock);
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 2;
+  while (!unread_view.ready &&
+         pthread_cond_timedwait(&unread_view.arrived, &unread_view.lock,
+                                &deadline) == 0) {
   }
-  while (true) {
-    string oneline = cfd_class.recvMsg();
-    if (oneline == "end") {
-      break;
-    } else if (oneline == "none") {
-      cout << "您当前没有未读消息" << endl;
-      break;
-    } else if (oneline == "close") {
-      cout << "服务器已关闭." << endl;
-      exit(0);
-    } else {
-      cout << oneline << endl;
-    }
+  if (unread_view.counts.empty()) {
+    cout << "您当前没有未读消息" << endl;
   }
-  return true;
+  for (auto &[field, n] : unread_view.counts) {
+    cout << field << "：" << n << endl;
+  }
+  pthread_mutex_unlock(&unread_view.lock);
 }
 bool LookSystem(TcpSocket cfd_class, Command command) {
   int ret = cfd_class.sendMsg(command.To_Json());
@@ -765,6 +907,8 @@ bool LookSystem(TcpSocket cfd_class, Command command) {
     } else if (SysMsg == "close") {
       cout << "服务器已关闭." << endl;
       exit(0);
+    } else if (Busy(SysMsg)) {
+      return false;
     } else {
       cout << SysMsg << endl;
     }
@@ -788,6 +932,8 @@ bool LookNotice(TcpSocket cfd_class, Command command) {
     } else if (notice == "close") {
       cout << "服务器已关闭." << endl;
       exit(0);
+    } else if (Busy(notice)) {
+      return false;
     } else {
       cout << notice << endl;
     }
@@ -804,6 +950,8 @@ bool RefuseAddFriend(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "ok") {
     cout << "已拒绝" << command.m_option[0] << "的好友申请" << endl;
     return true;
@@ -845,6 +993,8 @@ bool CreateGroup(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check.find("nofind") == 0) {
     string nofriend(check.begin() + 6, check.end());
     cout << "应输入好友的uid并以空格分割." << endl;
@@ -872,6 +1022,8 @@ bool ListGroup(TcpSocket cfd_class, Command command) {
     } else if (Group == "close") {
       cout << "服务器已关闭." << endl;
       exit(0);
+    } else if (Busy(Group)) {
+      return false;
     } else {
       cout << Group << endl;
     }
@@ -888,6 +1040,8 @@ bool AboutGroup(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "ok") {
 
   } else if (check == "nohave") {
@@ -996,6 +1150,8 @@ bool RequestList(TcpSocket cfd_class, Command command) {
     if (apply == "close") {
       cout << "服务器已关闭." << endl;
       exit(0);
+    } else if (Busy(apply)) {
+      return false;
     } else if (apply == "none") {
       cout << "当前还没有入群申请" << endl;
       return false;
@@ -1021,6 +1177,8 @@ bool PassApply(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "cannot") {
     cout << "您在此群聊中无此权限." << endl;
     return false;
@@ -1051,6 +1209,8 @@ bool DenyApply(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "cannot") {
     cout << "您在此群聊中无此权限." << endl;
     return false;
@@ -1081,6 +1241,8 @@ bool SetMember(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "cannot") {
     cout << "您在此群聊中无此权限." << endl;
     return false;
@@ -1114,6 +1276,8 @@ bool ExitGroup(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "cannot") {
     cout << "身为群主，您无法退群，只能转让群或解散群." << endl;
     return false;
@@ -1139,6 +1303,8 @@ bool DisplyMember(TcpSocket cfd_class, Command command) {
     } else if (memeber == "close") {
       cout << "服务器已关闭." << endl;
       exit(0);
+    } else if (Busy(memeber)) {
+      return false;
     } else {
       cout << memeber << endl;
     }
@@ -1155,6 +1321,8 @@ bool RemoveMember(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "ok") {
     cout << "已将其移出群聊." << endl;
     return false;
@@ -1182,6 +1350,8 @@ bool Dissolve(TcpSocket cfd_class, Command command) {
   if (check == "close") {
     cout << "服务器已关闭." << endl;
     exit(0);
+  } else if (Busy(check)) {
+    return false;
   } else if (check == "ok") {
     cout << "已解散该群聊." << endl;
     return false;
@@ -1194,4 +1364,93 @@ bool Dissolve(TcpSocket cfd_class, Command command) {
   }
   return true;
 }
+// 搜索聊天记录，还有下一页时问用户是否继续看
+// 历史记录里的"@older N"帧：归档里还有N条更早的消息，记下并提示怎么翻看
+bool OlderFrame(const string &msg, unsigned long long &older) {
+  if (msg.compare(0, 7, "@older ") != 0) {
+    return false;
+  }
+  older = strtoull(msg.c_str() + 7, NULL, 10);
+  if (older > 0) {
+    cout << "还有" << older << "条更早的消息，输入^往前翻看." << endl;
+  }
+  return true;
+}
+// 聊天界面里往前翻一页：command的最后一项填成还没看过的条数，翻完后更新older
+void LoadOlder(TcpSocket cfd_class, Command command,
+               unsigned long long &older) {
+  if (older == 0) {
+    cout << "没有更早的消息了." << endl;
+    return;
+  }
+  command.m_option.back() = to_string(older);
+  int ret = cfd_class.sendMsg(command.To_Json());
+  if (ret == 0 || ret == -1) {
+    cout << "服务器已关闭." << endl;
+    exit(0);
+  }
+  string reply = cfd_class.recvMsg();
+  if (Busy(reply)) {
+    return;
+  } else if (reply == "nofind") {
+    cout << "已经不能查看这段聊天记录了." << endl;
+    return;
+  }
+  cout << "————更早的消息————" << endl;
+  unsigned long long left = older;
+  while (reply != "end") {
+    if (reply == "close" || reply == "-1") {
+      cout << "服务器已关闭." << endl;
+      exit(0);
+    }
+    // 剩余条数的提示放到这一页后面再打印
+    if (reply.compare(0, 7, "@older ") == 0) {
+      left = strtoull(reply.c_str() + 7, NULL, 10);
+    } else {
+      cout << reply << endl;
+    }
+    reply = cfd_class.recvMsg();
+  }
+  older = left;
+  cout << (older > 0 ? "还有" + to_string(older) + "条更早的消息，输入^继续翻看."
+                     : string("没有更早的消息了."))
+       << endl;
+}
+bool Search(TcpSocket cfd_class, Command command) {
+  while (true) {
+    int ret = cfd_class.sendMsg(command.To_Json());
+    if (ret == 0 || ret == -1) {
+      cout << "服务器已关闭." << endl;
+      exit(0);
+    }
+    string result = cfd_class.recvMsg();
+    if (Busy(result)) {
+      return false;
+    } else if (result == "nofind") {
+      cout << "没有这个好友或群聊." << endl;
+      return false;
+    } else if (result == "none") {
+      cout << "没有找到相关的聊天记录." << endl;
+      return false;
+    }
+    while (result != "end" && result != "more") {
+      if (result == "close") {
+        cout << "服务器已关闭." << endl;
+        exit(0);
+      }
+      cout << result << endl;
+      result = cfd_class.recvMsg();
+    }
+    if (result == "end") {
+      return true;
+    }
+    cout << "输入n查看下一页，其他返回：" << endl;
+    string next;
+    getline(cin, next);
+    if (next != "n") {
+      return true;
+    }
+    command.m_option[2] = to_string(stoi(command.m_option[2]) + 1);
+  }
+}
 bool InfoXXXX(TcpSocket cfd_class, Command command) { return true; }
\ No newline at end of file
@@ -0,0 +1,249 @@
+#include "Affinity.hpp"
+#include "Log.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// mbind的内存策略（避免依赖libnuma的头文件）
+#define CHATROOM_MPOL_PREFERRED 1
+
+vector<cpu_set_t> Affinity::s_nodes;
+bool Affinity::s_pinReactor = false;
+cpu_set_t Affinity::s_reactor;
+vector<cpu_set_t> Affinity::s_workers;
+
+bool Affinity::parseCpuList(const string &list, cpu_set_t *set) {
+  CPU_ZERO(set);
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = list.find(',', pos);
+    if (end == string::npos) {
+      end = list.size();
+    }
+    string item = list.substr(pos, end - pos);
+    pos = end + 1;
+    if (item.empty()) {
+      continue;
+    }
+    char *next = nullptr;
+    long first = strtol(item.c_str(), &next, 10);
+    long last = first;
+    if (next == item.c_str()) {
+      return false;
+    }
+    if (*next == '-') {
+      const char *p = next + 1;
+      last = strtol(p, &next, 10);
+      if (next == p) {
+        return false;
+      }
+    }
+    if ((*next != '\0' && *next != '\n') || first < 0 || last < first ||
+        last >= CPU_SETSIZE) {
+      return false;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      CPU_SET(cpu, set);
+    }
+  }
+  return CPU_COUNT(set) > 0;
+}
+
+string Affinity::formatCpuSet(const cpu_set_t *set) {
+  string out;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, set)) {
+      continue;
+    }
+    int last = cpu;
+    while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set)) {
+      last++;
+    }
+    if (!out.empty()) {
+      out += ",";
+    }
+    out += to_string(cpu);
+    if (last != cpu) {
+      out += "-" + to_string(last);
+    }
+    cpu = last;
+  }
+  return out;
+}
+
+void Affinity::init() {
+  // 从sysfs读取每个NUMA节点的CPU列表，读不到就当作单节点
+  s_nodes.clear();
+  for (int node = 0;; node++) {
+    ifstream in("/sys/devices/system/node/node" + to_string(node) +
+                "/cpulist");
+    string list;
+    if (!in || !getline(in, list)) {
+      break;
+    }
+    cpu_set_t set;
+    if (parseCpuList(list, &set)) {
+      s_nodes.push_back(set);
+    } else {
+      CPU_ZERO(&set); // 无CPU的内存节点，保留编号
+      s_nodes.push_back(set);
+    }
+  }
+  if (s_nodes.empty()) {
+    cpu_set_t all;
+    CPU_ZERO(&all);
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    for (long cpu = 0; cpu < n && cpu < CPU_SETSIZE; cpu++) {
+      CPU_SET(cpu, &all);
+    }
+    s_nodes.push_back(all);
+  }
+  for (size_t node = 0; node < s_nodes.size(); node++) {
+    LOG_INFO("NUMA节点{}: CPU {}", node, formatCpuSet(&s_nodes[node]));
+  }
+
+  const char *reactor = getenv("CHATROOM_REACTOR_CPUS");
+  s_pinReactor = false;
+  if (reactor != nullptr && *reactor != '\0') {
+    if (parseCpuList(reactor, &s_reactor)) {
+      s_pinReactor = true;
+      LOG_INFO("反应堆线程CPU: {}", formatCpuSet(&s_reactor));
+    } else {
+      LOG_WARN("CHATROOM_REACTOR_CPUS格式错误: {}", reactor);
+    }
+  }
+
+  s_workers.clear();
+  const char *workers = getenv("CHATROOM_WORKER_CPUS");
+  if (workers != nullptr && string(workers) == "auto") {
+    // 每个NUMA节点一组，去掉反应堆占用的CPU
+    for (const cpu_set_t &node : s_nodes) {
+      cpu_set_t group = node;
+      if (s_pinReactor) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+          if (CPU_ISSET(cpu, &s_reactor)) {
+            CPU_CLR(cpu, &group);
+          }
+        }
+      }
+      if (CPU_COUNT(&group) > 0) {
+        s_workers.push_back(group);
+      }
+    }
+  } else if (workers != nullptr && *workers != '\0') {
+    string groups(workers);
+    size_t pos = 0;
+    while (pos <= groups.size()) {
+      size_t end = groups.find(';', pos);
+      if (end == string::npos) {
+        end = groups.size();
+      }
+      cpu_set_t group;
+      string item = groups.substr(pos, end - pos);
+      if (parseCpuList(item, &group)) {
+        s_workers.push_back(group);
+      } else if (!item.empty()) {
+        LOG_WARN("CHATROOM_WORKER_CPUS中的工作组格式错误: {}", item);
+      }
+      pos = end + 1;
+    }
+  }
+  for (size_t i = 0; i < s_workers.size(); i++) {
+    LOG_INFO("工作线程组{}: CPU {}", i, formatCpuSet(&s_workers[i]));
+  }
+  if (!s_pinReactor && s_workers.empty()) {
+    LOG_INFO("未配置CPU绑定，线程由内核调度");
+  }
+}
+
+int Affinity::nodeOfCpu(int cpu) {
+  for (size_t node = 0; node < s_nodes.size(); node++) {
+    if (CPU_ISSET(cpu, &s_nodes[node])) {
+      return node;
+    }
+  }
+  return 0;
+}
+
+int Affinity::currentNode() {
+  int cpu = sched_getcpu();
+  return cpu < 0 ? 0 : nodeOfCpu(cpu);
+}
+
+void Affinity::pin(const cpu_set_t *set, const string &who) {
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), set);
+  if (ret != 0) {
+    LOG_WARN("{}绑定CPU {}失败: {}", who, formatCpuSet(set), strerror(ret));
+    return;
+  }
+  // 绑定后让出一次CPU，使线程迁移到目标CPU上再做后续的就近分配
+  sched_yield();
+  LOG_INFO("{}(线程{})绑定到CPU {}，NUMA节点{}", who, Logger::threadId(),
+           formatCpuSet(set), currentNode());
+}
+
+void Affinity::pinReactor() {
+  if (s_pinReactor) {
+    pin(&s_reactor, "反应堆线程");
+  }
+}
+
+void Affinity::pinWorker(int index) {
+  if (!s_workers.empty()) {
+    pin(&s_workers[index % s_workers.size()],
+        "工作线程" + to_string(index));
+  }
+}
+
+void *Affinity::allocLocal(size_t size) {
+  void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    return nullptr;
+  }
+  // 优先使用当前节点的内存（单节点或内核不支持时忽略失败），再按首次访问原则触碰每一页
+  if (s_nodes.size() > 1) {
+    unsigned long mask = 1ul << currentNode();
+    syscall(SYS_mbind, p, size, CHATROOM_MPOL_PREFERRED, &mask,
+            sizeof(mask) * 8, 0);
+  }
+  memset(p, 0, size);
+  return p;
+}
+
+void Affinity::freeLocal(void *p, size_t size) {
+  if (p != nullptr) {
+    munmap(p, size);
+  }
+}
+
+// 线程退出时归还缓冲区
+struct ThreadBuffer {
+  char *buf = nullptr;
+  bool local = false; // 是否由allocLocal分配
+  ~ThreadBuffer() {
+    if (local) {
+      Affinity::freeLocal(buf, Affinity::THREAD_BUFFER_SIZE);
+    } else {
+      delete[] buf;
+    }
+  }
+};
+static thread_local ThreadBuffer t_buffer;
+
+char *Affinity::threadBuffer() {
+  if (t_buffer.buf == nullptr) {
+    t_buffer.buf = static_cast<char *>(allocLocal(THREAD_BUFFER_SIZE));
+    t_buffer.local = t_buffer.buf != nullptr;
+    // mmap失败（如地址空间或映射数达到上限）时退回普通堆内存，只是失去就近分配
+    if (t_buffer.buf == nullptr) {
+      LOG_WARN("线程{}就近分配收发缓冲区失败，改用堆内存", Logger::threadId());
+      t_buffer.buf = new char[THREAD_BUFFER_SIZE];
+    }
+  }
+  return t_buffer.buf;
+}
@@ -0,0 +1,49 @@
+#ifndef AFFINITY_HPP
+#define AFFINITY_HPP
+
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// CPU绑定与NUMA就近分配
+// 通过环境变量配置（都不设置时不做任何绑定）：
+//   CHATROOM_REACTOR_CPUS  反应堆(主)线程可用的CPU，如 "0" 或 "0-1"
+//   CHATROOM_WORKER_CPUS   工作线程组，组之间用';'分隔，如 "2-7;10-15"，
+//                          工作线程按创建顺序轮流分到各组；
+//                          写 "auto" 则每个NUMA节点一组（去掉反应堆占用的CPU）
+class Affinity {
+public:
+  // 读取NUMA拓扑和环境变量配置，并打印拓扑与绑定方案
+  static void init();
+  // 把当前线程绑定到反应堆CPU集合
+  static void pinReactor();
+  // 把当前线程绑定到第index个工作线程所属的组，可直接作为线程池的线程初始化函数
+  static void pinWorker(int index);
+  // 当前线程所在的NUMA节点
+  static int currentNode();
+  // 在当前线程所在的NUMA节点上分配内存（按页），freeLocal释放
+  static void *allocLocal(size_t size);
+  static void freeLocal(void *p, size_t size);
+  // 每个线程一块就近分配的收发缓冲区，大小为THREAD_BUFFER_SIZE；
+  // 就近分配失败时退回堆内存，从不返回nullptr
+  static char *threadBuffer();
+  // 解析 "0-3,8,10-11" 格式的CPU列表，失败返回false
+  static bool parseCpuList(const string &list, cpu_set_t *set);
+  static string formatCpuSet(const cpu_set_t *set);
+
+  static const size_t THREAD_BUFFER_SIZE = 64 * 1024;
+
+private:
+  static int nodeOfCpu(int cpu);
+  static void pin(const cpu_set_t *set, const string &who);
+
+  static vector<cpu_set_t> s_nodes;   // 每个NUMA节点的CPU集合
+  static bool s_pinReactor;           // 是否配置了反应堆CPU
+  static cpu_set_t s_reactor;         // 反应堆CPU集合
+  static vector<cpu_set_t> s_workers; // 工作线程组的CPU集合
+};
+
+#endif
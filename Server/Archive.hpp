@@ -0,0 +1,655 @@
+#ifndef ARCHIVE_HPP
+#define ARCHIVE_HPP
+
+#include "Log.hpp"
+#include "redis.hpp"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#define HISTORY_HOT_MAX 200   // 每个会话留在redis里的最近消息数
+#define HISTORY_HOT_SLACK 50  // 多出这么多条才归档一次，攒成一批
+#define ARCHIVE_SEGMENT_BYTES (1 << 20) // 段文件超过这么大就开新段
+#define ARCHIVE_INDEX_EVERY 64          // 稀疏索引每隔这么多条记录记一项
+#define ARCHIVE_SCAN_MS 1000            // 检查有新消息的会话的间隔
+#define ARCHIVE_PROGRESS "历史归档进度" // 会话的键 -> 已归档并移出redis的条数
+
+using namespace std;
+
+// 聊天记录的冷热分层：redis里每个会话（私聊记录列表、群聊消息队列）只留最近的消息，
+// 更早的由后台线程成批搬进本地磁盘上的归档。进入聊天只展示redis里的最近消息，
+// 更早的由客户端按需往前翻页，每页按id区间从归档读，不会为一次进入聊天读完整个归档。
+// 会话里的消息从最早的一条起编号0,1,2...，归档里是[0, 进度)，redis列表里是之后的全部。
+// 归档按会话分目录，目录下是只追加的段文件"<首条id>.seg"和它的稀疏索引"<首条id>.idx"：
+// 段文件里每条记录是 长度(4) 校验和(4) id(8) 时间(8) 内容，校验和是id、时间和内容的CRC32；
+// 索引每ARCHIVE_INDEX_EVERY条记一项(id, 时间, 偏移)，按id或时间定位时先查索引再顺序扫描。
+// 先把记录写进归档并落盘，再在一个事务里裁掉redis列表、推进进度；中途崩溃时归档里会多出
+// 进度之后的记录，下次归档这个会话前截掉
+class Archive {
+public:
+  struct Record {
+    uint64_t id;
+    int64_t time; // 私聊记录取发送时间，其它取归档时间
+    string data;
+  };
+
+  Archive() = default;
+  ~Archive();
+  // 打开归档目录并启动归档线程；目录建不起来时不归档，redis里的历史保持原样
+  bool start(RedisPool *pool, const string &dir);
+  bool enabled() const { return m_running; }
+  // key有新消息，由归档线程稍后检查是否需要归档
+  void touch(const string &key);
+  // 归档里id在[from, to)内的记录，从旧到新；只读和区间相交的段，段内从稀疏索引定位
+  vector<Record> read(const string &key, uint64_t from, uint64_t to);
+  // 会话留在redis里的最近消息，从旧到新：hot是LRANGE key 0 -1的回复
+  vector<string> recent(const string &key, const RedisReply &hot);
+  // 会话被删除，删掉它的归档和进度
+  void drop(const string &key);
+
+  // 记录的编解码，搜索索引的文件也用这套格式
+  static uint32_t crc32(uint32_t crc, const char *data, size_t n);
+  static string encode(const string &key); // 会话的键转成目录名
+  static void pack(string &buf, const Record &rec);
+  // 从buf[pos]解析一条记录，残缺或校验和不对时返回false
+  static bool unpack(const string &buf, size_t &pos, Record &rec);
+
+private:
+  struct Entry {
+    uint64_t id;
+    int64_t time;
+    uint64_t offset;
+  };
+  struct Segment {
+    uint64_t first = 0; // 首条记录的id
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    vector<Entry> index;
+  };
+  struct Log {
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    bool loaded = false;
+    string dir;
+    vector<Segment> segments;
+    uint64_t total() const {
+      return segments.empty() ? 0
+                              : segments.back().first + segments.back().count;
+    }
+  };
+
+  Log &logOf(const string &key);
+  string path(const Log &log, uint64_t first, const char *ext) const;
+  // 第一次用到时读入段和索引，修复最后一段的残缺尾部；调用方持有log.lock
+  void load(Log &log);
+  void recover(Log &log, Segment &seg);
+  bool append(Log &log, const vector<Record> &records);
+  void truncate(Log &log, uint64_t id); // 删掉id及之后的记录
+  vector<Record> scan(const Log &log, const Segment &seg, uint64_t from,
+                      uint64_t to);
+  void archiveOne(Redis *conn, const string &key);
+  static void *worker(void *arg);
+
+  static int64_t timeOf(string_view data);
+
+  RedisPool *m_pool = nullptr;
+  string m_dir;
+  pthread_t m_thread;
+  bool m_running = false;
+  pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER; // 保护m_logs和m_dirty
+  pthread_cond_t m_wake = PTHREAD_COND_INITIALIZER;
+  unordered_map<string, unique_ptr<Log>> m_logs;
+  unordered_set<string> m_dirty; // 有新消息、等待检查的会话
+};
+
+extern Archive archive;
+
+#define ARCHIVE_HEADER 24 // 长度 校验和 id 时间
+
+Archive::~Archive() {
+  if (m_running) {
+    pthread_mutex_lock(&m_lock);
+    m_running = false;
+    pthread_cond_signal(&m_wake);
+    pthread_mutex_unlock(&m_lock);
+    pthread_join(m_thread, NULL);
+  }
+}
+
+bool Archive::start(RedisPool *pool, const string &dir) {
+  m_pool = pool;
+  if (dir.empty()) {
+    LOG_INFO("未设置归档目录，历史消息全部留在redis");
+    return false;
+  }
+  if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+    LOG_ERROR("归档目录{}创建失败: {}，历史消息全部留在redis", dir,
+              strerror(errno));
+    return false;
+  }
+  m_dir = dir;
+  m_running = true;
+  pthread_create(&m_thread, NULL, worker, this);
+  LOG_INFO("历史消息归档到{}，每个会话在redis里保留最近{}条", dir,
+           HISTORY_HOT_MAX);
+  return true;
+}
+
+void Archive::touch(const string &key) {
+  if (!m_running) {
+    return;
+  }
+  pthread_mutex_lock(&m_lock);
+  m_dirty.insert(key);
+  pthread_mutex_unlock(&m_lock);
+}
+
+uint32_t Archive::crc32(uint32_t crc, const char *data, size_t n) {
+  static const array<uint32_t, 256> table = [] {
+    array<uint32_t, 256> t;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+  crc = ~crc;
+  for (size_t i = 0; i < n; i++) {
+    crc = table[(crc ^ (uint8_t)data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+// 字母数字、'_'、'-'和多字节的UTF-8字符原样保留，其余字节写成%XX，键里的'/'和'.'不会变成路径
+string Archive::encode(const string &key) {
+  string name;
+  char hex[4];
+  for (unsigned char c : key) {
+    if (isalnum(c) || c == '_' || c == '-' || c >= 0x80) {
+      name += c;
+    } else {
+      snprintf(hex, sizeof(hex), "%%%02X", c);
+      name += hex;
+    }
+  }
+  return name;
+}
+
+// 私聊记录是Message的json，带发送时间；群聊消息是展示用的字符串，没有可用的时间
+int64_t Archive::timeOf(string_view data) {
+  size_t pos = data.find("\"t_time\":\"");
+  if (pos != string_view::npos) {
+    return atoll(string(data.substr(pos + 10, 20)).c_str());
+  }
+  return time(NULL);
+}
+
+void Archive::pack(string &buf, const Record &rec) {
+  char head[ARCHIVE_HEADER];
+  uint32_t len = rec.data.size();
+  memcpy(head, &len, 4);
+  memcpy(head + 8, &rec.id, 8);
+  memcpy(head + 16, &rec.time, 8);
+  uint32_t crc = crc32(0, head + 8, 16);
+  crc = crc32(crc, rec.data.data(), rec.data.size());
+  memcpy(head + 4, &crc, 4);
+  buf.append(head, ARCHIVE_HEADER);
+  buf += rec.data;
+}
+
+bool Archive::unpack(const string &buf, size_t &pos, Record &rec) {
+  if (buf.size() - pos < ARCHIVE_HEADER) {
+    return false;
+  }
+  const char *head = buf.data() + pos;
+  uint32_t len, crc;
+  memcpy(&len, head, 4);
+  memcpy(&crc, head + 4, 4);
+  if (buf.size() - pos - ARCHIVE_HEADER < len) {
+    return false;
+  }
+  const char *body = head + ARCHIVE_HEADER;
+  if (crc32(crc32(0, head + 8, 16), body, len) != crc) {
+    return false;
+  }
+  memcpy(&rec.id, head + 8, 8);
+  memcpy(&rec.time, head + 16, 8);
+  rec.data.assign(body, len);
+  pos += ARCHIVE_HEADER + len;
+  return true;
+}
+
+// 读文件的[offset, end)，end超过文件大小时读到末尾
+static bool ReadFile(const string &file, uint64_t offset, string &buf,
+                     uint64_t end = UINT64_MAX) {
+  int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  end = min(end, (uint64_t)st.st_size);
+  buf.resize(end > offset ? end - offset : 0);
+  size_t done = 0;
+  while (done < buf.size()) {
+    ssize_t n = pread(fd, &buf[done], buf.size() - done, offset + done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+  buf.resize(done);
+  close(fd);
+  return true;
+}
+
+static bool WriteAll(int fd, const string &buf) {
+  size_t done = 0;
+  while (done < buf.size()) {
+    ssize_t n = write(fd, buf.data() + done, buf.size() - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+Archive::Log &Archive::logOf(const string &key) {
+  pthread_mutex_lock(&m_lock);
+  unique_ptr<Log> &log = m_logs[key];
+  if (log == nullptr) {
+    log.reset(new Log);
+    log->dir = m_dir + "/" + encode(key);
+  }
+  Log &ref = *log;
+  pthread_mutex_unlock(&m_lock);
+  return ref;
+}
+
+string Archive::path(const Log &log, uint64_t first, const char *ext) const {
+  char name[32];
+  snprintf(name, sizeof(name), "/%020llu.%s", (unsigned long long)first, ext);
+  return log.dir + name;
+}
+
+void Archive::load(Log &log) {
+  if (log.loaded) {
+    return;
+  }
+  log.loaded = true;
+  DIR *dir = opendir(log.dir.c_str());
+  if (dir == nullptr) {
+    return; // 还没有归档过
+  }
+  vector<uint64_t> firsts;
+  while (struct dirent *ent = readdir(dir)) {
+    unsigned long long first;
+    char ext[8];
+    if (sscanf(ent->d_name, "%20llu.%3s", &first, ext) == 2 &&
+        strcmp(ext, "seg") == 0) {
+      firsts.push_back(first);
+    }
+  }
+  closedir(dir);
+  sort(firsts.begin(), firsts.end());
+  for (size_t i = 0; i < firsts.size(); i++) {
+    Segment seg;
+    seg.first = firsts[i];
+    struct stat st;
+    if (stat(path(log, seg.first, "seg").c_str(), &st) == 0) {
+      seg.bytes = st.st_size;
+    }
+    string idx;
+    ReadFile(path(log, seg.first, "idx"), 0, idx);
+    for (size_t pos = 0; pos + sizeof(Entry) <= idx.size();
+         pos += sizeof(Entry)) {
+      Entry e;
+      memcpy(&e, idx.data() + pos, sizeof(Entry));
+      seg.index.push_back(e);
+    }
+    if (i + 1 < firsts.size()) {
+      seg.count = firsts[i + 1] - seg.first;
+    } else {
+      recover(log, seg);
+    }
+    log.segments.push_back(std::move(seg));
+  }
+}
+
+// 最后一段可能写到一半就崩溃了：从最后一个索引项往后逐条校验，截掉残缺的尾部，补上缺的索引项
+void Archive::recover(Log &log, Segment &seg) {
+  string segPath = path(log, seg.first, "seg");
+  while (true) {
+    while (!seg.index.empty() && seg.index.back().offset >= seg.bytes) {
+      seg.index.pop_back();
+    }
+    Entry start = seg.index.empty() ? Entry{seg.first, 0, 0} : seg.index.back();
+    string buf;
+    ReadFile(segPath, start.offset, buf);
+    size_t pos = 0;
+    uint64_t next = start.id;
+    Record rec;
+    vector<Entry> added;
+    while (pos < buf.size()) {
+      size_t at = pos;
+      if (!unpack(buf, pos, rec) || rec.id != next) {
+        pos = at;
+        break;
+      }
+      bool indexed = !seg.index.empty() && rec.id == start.id;
+      if (!indexed && (rec.id - seg.first) % ARCHIVE_INDEX_EVERY == 0) {
+        added.push_back({rec.id, rec.time, start.offset + at});
+      }
+      next++;
+    }
+    if (pos == 0 && !seg.index.empty()) {
+      // 索引项指向的记录本身是坏的，退到前一个索引项重来
+      seg.index.pop_back();
+      continue;
+    }
+    uint64_t end = start.offset + pos;
+    if (end < seg.bytes) {
+      LOG_WARN("归档{}的末尾{}字节不完整，已截掉", segPath, seg.bytes - end);
+      ::truncate(segPath.c_str(), end);
+      seg.bytes = end;
+    }
+    seg.index.insert(seg.index.end(), added.begin(), added.end());
+    seg.count = next - seg.first;
+    break;
+  }
+  // 索引文件按修复后的内容重写
+  string idx((const char *)seg.index.data(), seg.index.size() * sizeof(Entry));
+  int fd = open(path(log, seg.first, "idx").c_str(),
+                O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd >= 0) {
+    WriteAll(fd, idx);
+    close(fd);
+  }
+}
+
+bool Archive::append(Log &log, const vector<Record> &records) {
+  if (mkdir(log.dir.c_str(), 0755) < 0 && errno != EEXIST) {
+    LOG_ERROR("归档目录{}创建失败: {}", log.dir, strerror(errno));
+    return false;
+  }
+  size_t i = 0;
+  while (i < records.size()) {
+    if (log.segments.empty() ||
+        log.segments.back().bytes >= ARCHIVE_SEGMENT_BYTES) {
+      Segment seg;
+      seg.first = log.total();
+      log.segments.push_back(seg);
+    }
+    Segment &seg = log.segments.back();
+    // 这一段能装下的记录一次写完
+    string data, idx;
+    uint64_t bytes = seg.bytes;
+    vector<Entry> added;
+    for (; i < records.size() && bytes + data.size() < ARCHIVE_SEGMENT_BYTES;
+         i++) {
+      const Record &rec = records[i];
+      if ((rec.id - seg.first) % ARCHIVE_INDEX_EVERY == 0) {
+        added.push_back({rec.id, rec.time, bytes + data.size()});
+      }
+      pack(data, rec);
+    }
+    idx.assign((const char *)added.data(), added.size() * sizeof(Entry));
+    int segFd = open(path(log, seg.first, "seg").c_str(),
+                     O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    int idxFd = open(path(log, seg.first, "idx").c_str(),
+                     O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    bool ok = segFd >= 0 && idxFd >= 0 && WriteAll(segFd, data) &&
+              WriteAll(idxFd, idx) && fdatasync(segFd) == 0 &&
+              fdatasync(idxFd) == 0;
+    if (segFd >= 0) {
+      close(segFd);
+    }
+    if (idxFd >= 0) {
+      close(idxFd);
+    }
+    if (!ok) {
+      // 写了多少不确定，下次从磁盘重新读入
+      LOG_ERROR("写归档{}失败: {}", log.dir, strerror(errno));
+      log.segments.clear();
+      log.loaded = false;
+      return false;
+    }
+    seg.bytes += data.size();
+    seg.count = records[i - 1].id + 1 - seg.first;
+    seg.index.insert(seg.index.end(), added.begin(), added.end());
+  }
+  return true;
+}
+
+void Archive::truncate(Log &log, uint64_t id) {
+  while (!log.segments.empty() && log.total() > id) {
+    Segment &seg = log.segments.back();
+    if (seg.first >= id && log.segments.size() > 1) {
+      unlink(path(log, seg.first, "seg").c_str());
+      unlink(path(log, seg.first, "idx").c_str());
+      log.segments.pop_back();
+      continue;
+    }
+    // 从不晚于id的最后一个索引项往后找到id所在的偏移
+    auto it = upper_bound(seg.index.begin(), seg.index.end(), id,
+                          [](uint64_t v, const Entry &e) { return v < e.id; });
+    uint64_t offset = it == seg.index.begin() ? 0 : prev(it)->offset;
+    uint64_t at = it == seg.index.begin() ? seg.first : prev(it)->id;
+    string buf;
+    ReadFile(path(log, seg.first, "seg"), offset, buf);
+    size_t pos = 0;
+    Record rec;
+    while (at < id && unpack(buf, pos, rec)) {
+      at++;
+    }
+    seg.index.erase(it, seg.index.end());
+    seg.bytes = offset + pos;
+    seg.count = id - seg.first;
+    ::truncate(path(log, seg.first, "seg").c_str(), seg.bytes);
+    ::truncate(path(log, seg.first, "idx").c_str(),
+               seg.index.size() * sizeof(Entry));
+    LOG_WARN("归档{}里多出进度之后的记录，截到{}条", log.dir, id);
+  }
+}
+
+vector<Archive::Record> Archive::scan(const Log &log, const Segment &seg,
+                                      uint64_t from, uint64_t to) {
+  vector<Record> out;
+  auto it = upper_bound(seg.index.begin(), seg.index.end(), from,
+                        [](uint64_t v, const Entry &e) { return v < e.id; });
+  uint64_t offset = it == seg.index.begin() ? 0 : prev(it)->offset;
+  // 读到第一个不早于to的索引项为止，区间之后的记录不读
+  auto stop = lower_bound(seg.index.begin(), seg.index.end(), to,
+                          [](const Entry &e, uint64_t v) { return e.id < v; });
+  uint64_t end = stop == seg.index.end() ? UINT64_MAX : stop->offset;
+  string buf;
+  if (!ReadFile(path(log, seg.first, "seg"), offset, buf, end)) {
+    LOG_ERROR("归档{}读取失败: {}", path(log, seg.first, "seg"),
+              strerror(errno));
+    return out;
+  }
+  size_t pos = 0;
+  Record rec;
+  while (unpack(buf, pos, rec) && rec.id < to) {
+    if (rec.id >= from) {
+      out.push_back(std::move(rec));
+    }
+  }
+  return out;
+}
+
+vector<Archive::Record> Archive::read(const string &key, uint64_t from,
+                                      uint64_t to) {
+  vector<Record> out;
+  if (m_dir.empty() || from >= to) {
+    return out;
+  }
+  Log &log = logOf(key);
+  pthread_mutex_lock(&log.lock);
+  load(log);
+  for (const Segment &seg : log.segments) {
+    if (seg.first + seg.count <= from || seg.first >= to) {
+      continue;
+    }
+    vector<Record> part = scan(log, seg, from, to);
+    out.insert(out.end(), make_move_iterator(part.begin()),
+               make_move_iterator(part.end()));
+  }
+  pthread_mutex_unlock(&log.lock);
+  return out;
+}
+
+vector<string> Archive::recent(const string &key, const RedisReply &hot) {
+  vector<string> out;
+  out.reserve(hot.size());
+  for (size_t i = hot.size(); i > 0; i--) {
+    out.emplace_back(hot.view(i - 1));
+  }
+  // 很久没有新消息的会话也在被读到时归档
+  if (hot.size() > HISTORY_HOT_MAX + HISTORY_HOT_SLACK) {
+    touch(key);
+  }
+  return out;
+}
+
+void Archive::drop(const string &key) {
+  if (!m_dir.empty()) {
+    Log &log = logOf(key);
+    pthread_mutex_lock(&log.lock);
+    load(log);
+    for (const Segment &seg : log.segments) {
+      unlink(path(log, seg.first, "seg").c_str());
+      unlink(path(log, seg.first, "idx").c_str());
+    }
+    rmdir(log.dir.c_str());
+    log.segments.clear();
+    pthread_mutex_unlock(&log.lock);
+  }
+  if (m_pool != nullptr) {
+    Redis *conn = m_pool->acquire();
+    conn->delhash(ARCHIVE_PROGRESS, key);
+    m_pool->release(conn);
+  }
+}
+
+void Archive::archiveOne(Redis *conn, const string &key) {
+  Log &log = logOf(key);
+  pthread_mutex_lock(&log.lock);
+  load(log);
+  RedisBatch state(conn);
+  state.add({"HGET", ARCHIVE_PROGRESS, key});
+  state.add({"LLEN", key});
+  long long len = 0;
+  if (state.exec()) {
+    len = state.integer(1);
+  }
+  uint64_t done = strtoull(state.str(0).c_str(), NULL, 10);
+  if (len <= HISTORY_HOT_MAX + HISTORY_HOT_SLACK) {
+    pthread_mutex_unlock(&log.lock);
+    return;
+  }
+  // 列表头部是最新的消息，只搬走尾部最早的k条；
+  // 期间新消息只会加在头部，按从尾部数的下标裁剪不受影响
+  long long k = len - HISTORY_HOT_MAX;
+  RedisBatch tail(conn);
+  tail.add({"LRANGE", key, to_string(-k), "-1"});
+  redisReply *items = tail.exec() ? tail.reply(0) : nullptr;
+  if (items == nullptr || items->type != REDIS_REPLY_ARRAY ||
+      (long long)items->elements != k) {
+    pthread_mutex_unlock(&log.lock);
+    return;
+  }
+  if (log.total() > done) {
+    truncate(log, done);
+  }
+  if (log.total() < done) {
+    LOG_ERROR("会话{}的归档只有{}条，少于进度{}，暂停归档该会话", key,
+              log.total(), done);
+    pthread_mutex_unlock(&log.lock);
+    return;
+  }
+  vector<Record> records;
+  records.reserve(k);
+  for (long long j = k - 1; j >= 0; j--) {
+    string_view data = RedisReply::viewOf(items->element[j]);
+    records.push_back({done + records.size(), timeOf(data), string(data)});
+  }
+  if (append(log, records)) {
+    RedisBatch trim(conn, true);
+    trim.add({"LTRIM", key, "0", to_string(-k - 1)});
+    trim.add({"HSET", ARCHIVE_PROGRESS, key, to_string(done + k)});
+    if (trim.exec()) {
+      LOG_DEBUG("会话{}归档{}条消息，共{}条", key, k, done + k);
+    } else {
+      LOG_WARN("会话{}归档后裁剪redis列表失败，下次重试", key);
+    }
+  }
+  pthread_mutex_unlock(&log.lock);
+}
+
+void *Archive::worker(void *arg) {
+  Archive *self = static_cast<Archive *>(arg);
+  while (true) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += ARCHIVE_SCAN_MS * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    pthread_mutex_lock(&self->m_lock);
+    if (self->m_running) {
+      pthread_cond_timedwait(&self->m_wake, &self->m_lock, &deadline);
+    }
+    bool running = self->m_running;
+    unordered_set<string> dirty;
+    dirty.swap(self->m_dirty);
+    pthread_mutex_unlock(&self->m_lock);
+    if (!running) {
+      break;
+    }
+    if (dirty.empty()) {
+      continue;
+    }
+    // 一次往返取回所有有新消息的会话的长度，只处理超出上限的
+    vector<string> keys(dirty.begin(), dirty.end());
+    Redis *conn = self->m_pool->acquire();
+    RedisBatch lens(conn);
+    for (const string &key : keys) {
+      lens.add({"LLEN", key});
+    }
+    if (lens.exec()) {
+      for (size_t i = 0; i < keys.size(); i++) {
+        if (lens.integer(i) > HISTORY_HOT_MAX + HISTORY_HOT_SLACK) {
+          self->archiveOne(conn, keys[i]);
+        }
+      }
+    }
+    self->m_pool->release(conn);
+  }
+  return NULL;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#include "Coroutine.hpp"
+#include "Log.hpp"
+#include <cerrno>
+#include <cstring>
+
+int CoReactor::s_epfd = -1;
+pthread_mutex_t CoReactor::s_lock = PTHREAD_MUTEX_INITIALIZER;
+unordered_map<int, coroutine_handle<>> CoReactor::s_waiters;
+
+void CoReactor::init(int epfd) { s_epfd = epfd; }
+
+bool CoReactor::watch(int fd, uint32_t events, coroutine_handle<> h) {
+  struct epoll_event ev;
+  ev.data.fd = fd;
+  ev.events = events | EPOLLONESHOT;
+  // 先登记再上符，反应堆一旦看到事件就一定能在表里找到等待者
+  pthread_mutex_lock(&s_lock);
+  s_waiters[fd] = h;
+  int ret = epoll_ctl(s_epfd, EPOLL_CTL_ADD, fd, &ev);
+  if (ret == -1 && errno == EEXIST) {
+    ret = epoll_ctl(s_epfd, EPOLL_CTL_MOD, fd, &ev);
+  }
+  if (ret == -1) {
+    s_waiters.erase(fd);
+    pthread_mutex_unlock(&s_lock);
+    LOG_WARN("协程等待套接字{}失败: {}", fd, strerror(errno));
+    return false;
+  }
+  pthread_mutex_unlock(&s_lock);
+  return true;
+}
+
+bool CoReactor::take(int fd, coroutine_handle<> &h) {
+  pthread_mutex_lock(&s_lock);
+  auto it = s_waiters.find(fd);
+  if (it == s_waiters.end()) {
+    pthread_mutex_unlock(&s_lock);
+    return false;
+  }
+  h = it->second;
+  s_waiters.erase(it);
+  epoll_ctl(s_epfd, EPOLL_CTL_DEL, fd, NULL);
+  pthread_mutex_unlock(&s_lock);
+  return true;
+}
+
+size_t CoReactor::waiting() {
+  pthread_mutex_lock(&s_lock);
+  size_t n = s_waiters.size();
+  pthread_mutex_unlock(&s_lock);
+  return n;
+}
@@ -0,0 +1,154 @@
+#ifndef COROUTINE_HPP
+#define COROUTINE_HPP
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <unordered_map>
+#include <utility>
+
+using namespace std;
+
+// 协程任务的公共部分：惰性启动，结束时直接切回等待它的协程（对称转移，不占栈）
+struct CoPromiseBase {
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    coroutine_handle<> await_suspend(coroutine_handle<P> h) noexcept {
+      return h.promise().m_continuation;
+    }
+    void await_resume() noexcept {}
+  };
+  suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { m_exception = current_exception(); }
+
+  coroutine_handle<> m_continuation = noop_coroutine(); // 等待本任务的协程
+  exception_ptr m_exception;
+};
+
+// 可被co_await的协程任务，co_await时才开始执行，返回co_return的值
+template <typename T> class CoTask {
+public:
+  struct promise_type : CoPromiseBase {
+    CoTask get_return_object() {
+      return CoTask(coroutine_handle<promise_type>::from_promise(*this));
+    }
+    void return_value(T value) { m_value = std::move(value); }
+    T m_value;
+  };
+
+  CoTask(CoTask &&other) noexcept : m_handle(exchange(other.m_handle, {})) {}
+  CoTask(const CoTask &) = delete;
+  ~CoTask() {
+    if (m_handle) {
+      m_handle.destroy();
+    }
+  }
+
+  bool await_ready() const noexcept { return false; }
+  coroutine_handle<> await_suspend(coroutine_handle<> caller) noexcept {
+    m_handle.promise().m_continuation = caller;
+    return m_handle;
+  }
+  T await_resume() {
+    if (m_handle.promise().m_exception) {
+      rethrow_exception(m_handle.promise().m_exception);
+    }
+    return std::move(m_handle.promise().m_value);
+  }
+
+private:
+  explicit CoTask(coroutine_handle<promise_type> h) : m_handle(h) {}
+  coroutine_handle<promise_type> m_handle;
+};
+
+template <> class CoTask<void> {
+public:
+  struct promise_type : CoPromiseBase {
+    CoTask get_return_object() {
+      return CoTask(coroutine_handle<promise_type>::from_promise(*this));
+    }
+    void return_void() {}
+  };
+
+  CoTask(CoTask &&other) noexcept : m_handle(exchange(other.m_handle, {})) {}
+  CoTask(const CoTask &) = delete;
+  ~CoTask() {
+    if (m_handle) {
+      m_handle.destroy();
+    }
+  }
+
+  bool await_ready() const noexcept { return false; }
+  coroutine_handle<> await_suspend(coroutine_handle<> caller) noexcept {
+    m_handle.promise().m_continuation = caller;
+    return m_handle;
+  }
+  void await_resume() {
+    if (m_handle.promise().m_exception) {
+      rethrow_exception(m_handle.promise().m_exception);
+    }
+  }
+
+private:
+  explicit CoTask(coroutine_handle<promise_type> h) : m_handle(h) {}
+  coroutine_handle<promise_type> m_handle;
+};
+
+// 立即开始执行、结束后自行销毁的顶层协程，用于从普通函数里启动一个CoTask
+struct CoDetached {
+  struct promise_type {
+    CoDetached get_return_object() { return {}; }
+    suspend_never initial_suspend() noexcept { return {}; }
+    suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { terminate(); }
+  };
+};
+
+// 协程的fd等待表：协程挂起前把(fd, 句柄)登记进来，并把fd以一次性事件挂到反应堆的epoll上；
+// 反应堆发现fd就绪时先查这张表，有等待者就摘符并把句柄交给线程池恢复
+class CoReactor {
+public:
+  // 设置反应堆的epoll实例
+  static void init(int epfd);
+  // 登记h等待fd上的events事件，登记失败（如fd已关闭）返回false，调用方不应挂起
+  static bool watch(int fd, uint32_t events, coroutine_handle<> h);
+  // 反应堆调用：fd上有协程在等待则摘符、取出句柄并返回true
+  static bool take(int fd, coroutine_handle<> &h);
+  // 当前挂起等待I/O的协程数
+  static size_t waiting();
+
+private:
+  static int s_epfd;
+  static pthread_mutex_t s_lock;
+  static unordered_map<int, coroutine_handle<>> s_waiters;
+};
+
+// 等待fd可读/可写的awaitable，恢复时可能已换到另一个工作线程。
+// co_await的结果为false表示没能登记到epoll（如fd已关闭或epoll监听数达到上限），
+// 协程没有挂起，fd也不会再就绪，调用方应结束处理并断开连接，不能重试
+struct FdAwaiter {
+  int fd;
+  uint32_t events;
+  bool watched = true;
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(coroutine_handle<> h) {
+    // 登记成功后协程可能立刻在别的线程被恢复，之后不能再访问本对象，
+    // 所以只在失败（协程不挂起）时写watched
+    if (!CoReactor::watch(fd, events, h)) {
+      watched = false;
+      return false;
+    }
+    return true;
+  }
+  [[nodiscard]] bool await_resume() const noexcept { return watched; }
+};
+
+inline FdAwaiter readable(int fd) { return FdAwaiter{fd, EPOLLIN}; }
+inline FdAwaiter writable(int fd) { return FdAwaiter{fd, EPOLLOUT}; }
+
+#endif
@@ -0,0 +1,275 @@
+#ifndef FAN_OUT_HPP
+#define FAN_OUT_HPP
+
+#include "../lib/TCPSocket.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <poll.h>
+#include <pthread.h>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#define FANOUT_WORKERS 2              // 推送线程数
+#define FANOUT_MAX_BACKLOG (4 << 20)  // 单个套接字积压的上限，超过后丢弃新推送
+
+using namespace std;
+
+// 通知套接字的推送引擎：处理函数只把消息放进对方的发送队列，由推送线程非阻塞地发出去，
+// 客户端收得慢时消息在队列里等待，不再占住处理命令的工作线程。
+// 套接字按fd分给推送线程，同一个套接字的消息总由同一个线程按入队顺序发送；
+// 一次群发按线程分组，每个线程只加一次锁、唤醒一次，大群的推送分摊到所有推送线程上
+class FanOut {
+public:
+  struct Push {
+    int fd;
+    string msg;
+  };
+  struct Stats {
+    uint64_t pushed = 0;  // 入队的消息数
+    uint64_t dropped = 0; // 积压超限或套接字出错丢弃的消息数
+  };
+
+  FanOut() = default;
+  ~FanOut();
+  // 启动推送线程；没有启动时push直接阻塞发送
+  void start(int workers = FANOUT_WORKERS);
+  // 给fd推送一条消息，格式与TcpSocket::sendMsg相同，fd小于0时忽略
+  void push(int fd, const string &msg);
+  // 一批推送，按推送线程分组后一起入队
+  void pushAll(const vector<Push> &pushes);
+  // 套接字已关闭，丢弃还没发出的消息，避免fd被复用后发给别人
+  void forget(int fd);
+  Stats stats();
+
+private:
+  struct Job {
+    int fd;
+    string frame; // 带4字节长度头的完整消息
+    bool drop;    // forget
+  };
+  struct Outbox {
+    string buf;
+    bool warned = false; // 本轮积压是否已经告警
+  };
+  struct Worker {
+    FanOut *owner = nullptr;
+    pthread_t thread;
+    int wakefd = -1;
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    vector<Job> inbox;
+    unordered_map<int, Outbox> outbox; // 只有推送线程访问
+  };
+
+  Worker &workerOf(int fd) { return m_workers[fd % m_workers.size()]; }
+  void post(Worker &worker, vector<Job> &jobs);
+  static string frame(const string &msg);
+  // 尽量发送buf，发不动时返回true，套接字出错返回false
+  static bool send(int fd, string &buf);
+  static void *run(void *arg);
+
+  vector<Worker> m_workers;
+  atomic<bool> m_running{false};
+  atomic<uint64_t> m_pushed{0};
+  atomic<uint64_t> m_dropped{0};
+};
+
+// 通知套接字的推送句柄，用法和TcpSocket一样，消息交给FanOut排队发送
+class PushSocket {
+public:
+  explicit PushSocket(int fd) : m_fd(fd) {}
+  int sendMsg(const string &msg);
+
+private:
+  int m_fd;
+};
+
+extern FanOut fanOut;
+
+FanOut::~FanOut() {
+  if (!m_running) {
+    return;
+  }
+  m_running = false;
+  for (Worker &worker : m_workers) {
+    uint64_t one = 1;
+    write(worker.wakefd, &one, sizeof(one));
+    pthread_join(worker.thread, NULL);
+    close(worker.wakefd);
+  }
+}
+
+void FanOut::start(int workers) {
+  m_workers = vector<Worker>(max(workers, 1));
+  m_running = true;
+  for (Worker &worker : m_workers) {
+    worker.owner = this;
+    worker.wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pthread_create(&worker.thread, NULL, run, &worker);
+  }
+}
+
+string FanOut::frame(const string &msg) {
+  string data(4 + msg.size(), '\0');
+  uint32_t bigLen = htonl(msg.size());
+  memcpy(&data[0], &bigLen, 4);
+  memcpy(&data[4], msg.data(), msg.size());
+  return data;
+}
+
+void FanOut::post(Worker &worker, vector<Job> &jobs) {
+  pthread_mutex_lock(&worker.lock);
+  bool idle = worker.inbox.empty();
+  if (idle) {
+    worker.inbox.swap(jobs);
+  } else {
+    for (Job &job : jobs) {
+      worker.inbox.push_back(std::move(job));
+    }
+  }
+  pthread_mutex_unlock(&worker.lock);
+  // 队列原来不空时推送线程已经被唤醒过，还没取走
+  if (idle) {
+    uint64_t one = 1;
+    write(worker.wakefd, &one, sizeof(one));
+  }
+}
+
+void FanOut::push(int fd, const string &msg) {
+  if (fd < 0) {
+    return;
+  }
+  m_pushed++;
+  if (m_workers.empty()) {
+    TcpSocket(fd).sendMsg(msg);
+    return;
+  }
+  vector<Job> jobs;
+  jobs.push_back({fd, frame(msg), false});
+  post(workerOf(fd), jobs);
+}
+
+void FanOut::pushAll(const vector<Push> &pushes) {
+  if (m_workers.empty()) {
+    for (const Push &p : pushes) {
+      push(p.fd, p.msg);
+    }
+    return;
+  }
+  vector<vector<Job>> groups(m_workers.size());
+  for (const Push &p : pushes) {
+    if (p.fd >= 0) {
+      groups[p.fd % m_workers.size()].push_back({p.fd, frame(p.msg), false});
+    }
+  }
+  for (size_t i = 0; i < groups.size(); i++) {
+    if (!groups[i].empty()) {
+      m_pushed += groups[i].size();
+      post(m_workers[i], groups[i]);
+    }
+  }
+}
+
+void FanOut::forget(int fd) {
+  if (fd < 0 || m_workers.empty()) {
+    return;
+  }
+  vector<Job> jobs;
+  jobs.push_back({fd, "", true});
+  post(workerOf(fd), jobs);
+}
+
+FanOut::Stats FanOut::stats() {
+  Stats s;
+  s.pushed = m_pushed;
+  s.dropped = m_dropped;
+  return s;
+}
+
+bool FanOut::send(int fd, string &buf) {
+  size_t done = 0;
+  while (done < buf.size()) {
+    ssize_t n = ::send(fd, buf.data() + done, buf.size() - done,
+                       MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n > 0) {
+      done += n;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else {
+      return false;
+    }
+  }
+  buf.erase(0, done);
+  return true;
+}
+
+void *FanOut::run(void *arg) {
+  Worker &worker = *static_cast<Worker *>(arg);
+  FanOut *self = worker.owner;
+  vector<Job> jobs;
+  vector<struct pollfd> fds;
+  while (self->m_running) {
+    // 等新消息，或者等积压的套接字可写
+    fds.assign(1, {worker.wakefd, POLLIN, 0});
+    for (auto &[fd, box] : worker.outbox) {
+      fds.push_back({fd, POLLOUT, 0});
+    }
+    if (poll(fds.data(), fds.size(), 1000) < 0 && errno != EINTR) {
+      LOG_ERROR("推送线程poll失败: {}", strerror(errno));
+      sleep(1);
+      continue;
+    }
+    uint64_t n;
+    read(worker.wakefd, &n, sizeof(n));
+    pthread_mutex_lock(&worker.lock);
+    jobs.swap(worker.inbox);
+    pthread_mutex_unlock(&worker.lock);
+    for (Job &job : jobs) {
+      if (job.drop) {
+        worker.outbox.erase(job.fd);
+        continue;
+      }
+      Outbox &box = worker.outbox[job.fd];
+      if (box.buf.size() + job.frame.size() > FANOUT_MAX_BACKLOG) {
+        self->m_dropped++;
+        if (!box.warned) {
+          LOG_WARN("通知套接字{}积压超过{}字节，丢弃新的推送", job.fd,
+                   FANOUT_MAX_BACKLOG);
+          box.warned = true;
+        }
+        continue;
+      }
+      box.buf += job.frame;
+    }
+    jobs.clear();
+    for (auto it = worker.outbox.begin(); it != worker.outbox.end();) {
+      if (!send(it->first, it->second.buf)) {
+        // 对端已断开，等reactor发现后forget
+        self->m_dropped++;
+        it = worker.outbox.erase(it);
+      } else if (it->second.buf.empty()) {
+        it = worker.outbox.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  return NULL;
+}
+
+int PushSocket::sendMsg(const string &msg) {
+  fanOut.push(m_fd, msg);
+  return msg.size() + 4;
+}
+
+#endif
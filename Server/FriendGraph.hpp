@@ -0,0 +1,482 @@
+#ifndef FRIEND_GRAPH_HPP
+#define FRIEND_GRAPH_HPP
+
+#include "Log.hpp"
+#include "redis.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <pthread.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define FRIEND_GRAPH_SHARDS 16       // 好友图的分片数
+#define FRIEND_GRAPH_CAPACITY 16384  // 最多常驻的用户数
+
+using namespace std;
+
+// 好友关系的进程内索引：每个用户的好友是一个升序的uid数组，备注拼在一个串里按偏移取，
+// 屏蔽标记是按数组下标的位图。成员、备注和屏蔽的查询是一次二分，列表是一次遍历。
+// 用户第一次被问到时从redis整体读入（好友列表和屏蔽列表两条命令），之后常驻内存，
+// 容量有限，和用户缓存一样按CLOCK算法淘汰。
+// 屏蔽、解除屏蔽和删除好友经由这里写：先写redis再改内存，写redis时不持锁，
+// 因为进程内存储的写回调会同步回到keyChanged。屏蔽状态变没变以SADD/SREM的返回为准；
+// 写redis前后分片的版本变了，说明期间有别的写，改内存的先后不一定和写redis的一致，
+// 这时不改内存里的这份，直接作废；
+// 同意好友申请在脚本里改redis，改完调用invalidate让双方下次重新读入。
+// 好友列表在别处被直接改动的，经由用户缓存订阅的键事件调用keyChanged失效；
+// 屏蔽列表只经由这里写，它的事件（包括删空时的del）不理会，免得自己的写把自己失效掉
+class FriendGraph {
+public:
+  struct Friend {
+    string uid;
+    string remark;
+    bool blocked; // 我屏蔽了他
+  };
+  struct Stats {
+    uint64_t users = 0;  // 常驻的用户数
+    uint64_t edges = 0;  // 常驻的好友关系数（单向）
+    uint64_t hits = 0;
+    uint64_t misses = 0;    // 需要从redis读入的次数
+    uint64_t evictions = 0; // 容量满被淘汰的用户数
+  };
+
+  FriendGraph();
+
+  // 读，不在内存里时用当前线程的redis连接读入
+  bool isFriend(const string &uid, const string &f);
+  // f是uid的好友时取出uid给他的备注
+  bool remarkOf(const string &uid, const string &f, string &remark);
+  // uid是否屏蔽了f
+  bool isBlocked(const string &uid, const string &f);
+  size_t count(const string &uid);
+  vector<Friend> list(const string &uid);
+
+  // 协程里用异步连接读入：loaded为false时记下version，
+  // co_await asyncBatch(fetch(uid))，再fill(uid, 两条回复, version)
+  bool loaded(const string &uid);
+  uint64_t version(const string &uid);
+  static vector<vector<string>> fetch(const string &uid);
+  void fill(const string &uid, const redisReply *friends,
+            const redisReply *blocked, uint64_t ver);
+
+  // 写，同时改redis和内存；block和unblock在状态没有变化时返回false
+  bool block(const string &uid, const string &f);
+  bool unblock(const string &uid, const string &f);
+  // 双方互删，连同双方的屏蔽标记
+  void unfriend(const string &uid, const string &f);
+  // redis里的好友关系被别处改过，下次从redis重新读入
+  void invalidate(const string &uid);
+  // 某人的好友列表被改动就失效他，空键表示全部失效
+  void keyChanged(string_view key);
+  void clear();
+  Stats stats();
+
+  // uid转成数组里存的数字：必须是不以0开头的十进制数，不然返回false
+  static bool idOf(string_view uid, uint32_t &id);
+
+private:
+  struct Adjacency {
+    vector<uint32_t> ids;     // 好友uid，升序
+    vector<uint32_t> offsets; // 第i个好友的备注是remarks[offsets[i], offsets[i+1])
+    string remarks;
+    vector<uint64_t> blocked; // 第i位为1表示屏蔽了第i个好友
+
+    // f在ids里的下标，不是好友时返回-1
+    int find(const string &f) const;
+    string_view remark(int i) const {
+      return string_view(remarks).substr(offsets[i],
+                                         offsets[i + 1] - offsets[i]);
+    }
+    bool isBlocked(int i) const { return blocked[i / 64] >> (i % 64) & 1; }
+    void setBlocked(int i, bool on);
+    void erase(int i);
+  };
+  struct Slot {
+    string uid;
+    Adjacency adj;
+    bool used = false;
+    bool ref = false; // CLOCK的访问位
+  };
+  struct Shard {
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    vector<Slot> slots;
+    unordered_map<string, size_t> index; // uid -> 槽号
+    size_t hand = 0;                     // CLOCK的指针
+    uint64_t gen = 0; // 每次有用户被写或失效就加一，读redis前后对比判断是否过期
+  };
+
+  Shard &shardOf(const string &uid);
+  static Adjacency build(const redisReply *friends, const redisReply *blocked);
+  // 下面三个都要持分片的锁调用
+  Adjacency *find(Shard &shard, const string &uid);
+  void place(Shard &shard, const string &uid, Adjacency &&adj);
+  void drop(Shard &shard, const string &uid);
+  // 屏蔽或解除屏蔽，redis里的状态真的变了才返回true
+  bool setBlocked(const string &uid, const string &f, bool on);
+  // 在uid的邻接表上执行fn，不在内存里时先读入
+  template <typename Fn> auto read(const string &uid, Fn fn);
+
+  Shard m_shards[FRIEND_GRAPH_SHARDS];
+  atomic<uint64_t> m_hits{0};
+  atomic<uint64_t> m_misses{0};
+  atomic<uint64_t> m_evictions{0};
+};
+
+FriendGraph::FriendGraph() {
+  for (Shard &shard : m_shards) {
+    shard.slots.resize(FRIEND_GRAPH_CAPACITY / FRIEND_GRAPH_SHARDS);
+  }
+}
+
+bool FriendGraph::idOf(string_view uid, uint32_t &id) {
+  if (uid.empty() || uid.size() > 9 || uid[0] == '0') {
+    return false;
+  }
+  id = 0;
+  for (char c : uid) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    id = id * 10 + (c - '0');
+  }
+  return true;
+}
+
+int FriendGraph::Adjacency::find(const string &f) const {
+  uint32_t id;
+  if (!idOf(f, id)) {
+    return -1;
+  }
+  auto it = lower_bound(ids.begin(), ids.end(), id);
+  return it != ids.end() && *it == id ? it - ids.begin() : -1;
+}
+
+void FriendGraph::Adjacency::setBlocked(int i, bool on) {
+  if (on) {
+    blocked[i / 64] |= 1ull << (i % 64);
+  } else {
+    blocked[i / 64] &= ~(1ull << (i % 64));
+  }
+}
+
+// 删掉第i个好友：后面的备注前移，屏蔽位跟着下标整体前移一位
+void FriendGraph::Adjacency::erase(int i) {
+  uint32_t len = offsets[i + 1] - offsets[i];
+  remarks.erase(offsets[i], len);
+  for (size_t k = i + 1; k < offsets.size(); k++) {
+    offsets[k - 1] = offsets[k] - len;
+  }
+  offsets.pop_back();
+  for (size_t k = i; k + 1 < ids.size(); k++) {
+    ids[k] = ids[k + 1];
+    setBlocked(k, isBlocked(k + 1));
+  }
+  setBlocked(ids.size() - 1, false);
+  ids.pop_back();
+  blocked.resize((ids.size() + 63) / 64);
+}
+
+FriendGraph::Shard &FriendGraph::shardOf(const string &uid) {
+  return m_shards[hash<string>()(uid) % FRIEND_GRAPH_SHARDS];
+}
+
+FriendGraph::Adjacency *FriendGraph::find(Shard &shard, const string &uid) {
+  auto it = shard.index.find(uid);
+  if (it == shard.index.end()) {
+    return nullptr;
+  }
+  Slot &slot = shard.slots[it->second];
+  slot.ref = true;
+  return &slot.adj;
+}
+
+void FriendGraph::place(Shard &shard, const string &uid, Adjacency &&adj) {
+  auto it = shard.index.find(uid);
+  if (it != shard.index.end()) {
+    shard.slots[it->second].adj = std::move(adj);
+    return;
+  }
+  // CLOCK：跳过最近访问过的槽（清掉访问位），淘汰第一个没访问过的
+  size_t n = shard.slots.size();
+  while (shard.slots[shard.hand].used && shard.slots[shard.hand].ref) {
+    shard.slots[shard.hand].ref = false;
+    shard.hand = (shard.hand + 1) % n;
+  }
+  Slot &slot = shard.slots[shard.hand];
+  if (slot.used) {
+    shard.index.erase(slot.uid);
+    m_evictions++;
+  }
+  slot.uid = uid;
+  slot.adj = std::move(adj);
+  slot.used = true;
+  slot.ref = false;
+  shard.index[uid] = shard.hand;
+  shard.hand = (shard.hand + 1) % n;
+}
+
+void FriendGraph::drop(Shard &shard, const string &uid) {
+  auto it = shard.index.find(uid);
+  if (it == shard.index.end()) {
+    return;
+  }
+  Slot &slot = shard.slots[it->second];
+  slot.used = false;
+  slot.ref = false;
+  slot.adj = Adjacency();
+  shard.index.erase(it);
+}
+
+vector<vector<string>> FriendGraph::fetch(const string &uid) {
+  return {{"HGETALL", uid + "的好友列表"}, {"SMEMBERS", uid + "的屏蔽列表"}};
+}
+
+FriendGraph::Adjacency FriendGraph::build(const redisReply *friends,
+                                          const redisReply *blocked) {
+  vector<pair<uint32_t, string_view>> sorted;
+  for (size_t i = 0; friends != nullptr && i + 1 < friends->elements; i += 2) {
+    uint32_t id;
+    string_view f = RedisReply::viewOf(friends->element[i]);
+    if (!idOf(f, id)) {
+      LOG_WARN("好友列表里的uid {}不是数字，跳过", string(f));
+      continue;
+    }
+    sorted.push_back({id, RedisReply::viewOf(friends->element[i + 1])});
+  }
+  sort(sorted.begin(), sorted.end());
+  Adjacency adj;
+  adj.ids.reserve(sorted.size());
+  adj.offsets.reserve(sorted.size() + 1);
+  for (const auto &kv : sorted) {
+    adj.ids.push_back(kv.first);
+    adj.offsets.push_back(adj.remarks.size());
+    adj.remarks += kv.second;
+  }
+  adj.offsets.push_back(adj.remarks.size());
+  adj.blocked.assign((adj.ids.size() + 63) / 64, 0);
+  // 屏蔽列表里不是好友的uid（旧数据）忽略
+  for (size_t i = 0; blocked != nullptr && i < blocked->elements; i++) {
+    int k = adj.find(string(RedisReply::viewOf(blocked->element[i])));
+    if (k >= 0) {
+      adj.setBlocked(k, true);
+    }
+  }
+  return adj;
+}
+
+bool FriendGraph::loaded(const string &uid) {
+  Shard &shard = shardOf(uid);
+  pthread_mutex_lock(&shard.lock);
+  bool found = shard.index.count(uid) != 0;
+  pthread_mutex_unlock(&shard.lock);
+  return found;
+}
+
+uint64_t FriendGraph::version(const string &uid) {
+  Shard &shard = shardOf(uid);
+  pthread_mutex_lock(&shard.lock);
+  uint64_t gen = shard.gen;
+  pthread_mutex_unlock(&shard.lock);
+  return gen;
+}
+
+void FriendGraph::fill(const string &uid, const redisReply *friends,
+                       const redisReply *blocked, uint64_t ver) {
+  if (friends == nullptr || friends->type != REDIS_REPLY_ARRAY ||
+      blocked == nullptr || blocked->type != REDIS_REPLY_ARRAY) {
+    return;
+  }
+  Adjacency adj = build(friends, blocked);
+  Shard &shard = shardOf(uid);
+  pthread_mutex_lock(&shard.lock);
+  // 读redis期间这个分片有写入或失效，读回的可能已经旧了，不放进来
+  if (shard.gen == ver) {
+    place(shard, uid, std::move(adj));
+  }
+  pthread_mutex_unlock(&shard.lock);
+}
+
+template <typename Fn> auto FriendGraph::read(const string &uid, Fn fn) {
+  Shard &shard = shardOf(uid);
+  pthread_mutex_lock(&shard.lock);
+  Adjacency *found = find(shard, uid);
+  if (found != nullptr) {
+    auto result = fn(*found);
+    pthread_mutex_unlock(&shard.lock);
+    m_hits++;
+    return result;
+  }
+  uint64_t ver = shard.gen;
+  pthread_mutex_unlock(&shard.lock);
+  m_misses++;
+  RedisBatch batch(redis);
+  for (const auto &cmd : fetch(uid)) {
+    batch.add(cmd);
+  }
+  if (!batch.exec()) {
+    return fn(Adjacency{{}, {0}, "", {}});
+  }
+  // 放进内存之前先用读回的这份回答，读入被作废时答案也是读redis那一刻的
+  Adjacency adj = build(batch.reply(0), batch.reply(1));
+  auto result = fn(adj);
+  pthread_mutex_lock(&shard.lock);
+  if (shard.gen == ver) {
+    place(shard, uid, std::move(adj));
+  }
+  pthread_mutex_unlock(&shard.lock);
+  return result;
+}
+
+bool FriendGraph::isFriend(const string &uid, const string &f) {
+  return read(uid, [&](const Adjacency &adj) { return adj.find(f) >= 0; });
+}
+
+bool FriendGraph::remarkOf(const string &uid, const string &f,
+                           string &remark) {
+  return read(uid, [&](const Adjacency &adj) {
+    int i = adj.find(f);
+    if (i >= 0) {
+      remark = adj.remark(i);
+    }
+    return i >= 0;
+  });
+}
+
+bool FriendGraph::isBlocked(const string &uid, const string &f) {
+  return read(uid, [&](const Adjacency &adj) {
+    int i = adj.find(f);
+    return i >= 0 && adj.isBlocked(i);
+  });
+}
+
+size_t FriendGraph::count(const string &uid) {
+  return read(uid, [](const Adjacency &adj) { return adj.ids.size(); });
+}
+
+vector<FriendGraph::Friend> FriendGraph::list(const string &uid) {
+  return read(uid, [](const Adjacency &adj) {
+    vector<Friend> out;
+    out.reserve(adj.ids.size());
+    for (size_t i = 0; i < adj.ids.size(); i++) {
+      out.push_back(
+          {to_string(adj.ids[i]), string(adj.remark(i)), adj.isBlocked(i)});
+    }
+    return out;
+  });
+}
+
+bool FriendGraph::block(const string &uid, const string &f) {
+  return setBlocked(uid, f, true);
+}
+
+bool FriendGraph::unblock(const string &uid, const string &f) {
+  return setBlocked(uid, f, false);
+}
+
+bool FriendGraph::setBlocked(const string &uid, const string &f, bool on) {
+  Shard &shard = shardOf(uid);
+  pthread_mutex_lock(&shard.lock);
+  uint64_t ver = shard.gen;
+  pthread_mutex_unlock(&shard.lock);
+  // 并发的两次屏蔽只有一次SADD返回1，另一次当作已经屏蔽
+  RedisBatch batch(redis);
+  batch.add({on ? "SADD" : "SREM", uid + "的屏蔽列表", f});
+  if (!batch.exec() || batch.integer(0) == 0) {
+    return false;
+  }
+  pthread_mutex_lock(&shard.lock);
+  if (shard.gen == ver) {
+    Adjacency *adj = find(shard, uid);
+    int i = adj != nullptr ? adj->find(f) : -1;
+    if (i >= 0) {
+      adj->setBlocked(i, on);
+    }
+  } else {
+    drop(shard, uid);
+  }
+  shard.gen++;
+  pthread_mutex_unlock(&shard.lock);
+  return true;
+}
+
+void FriendGraph::unfriend(const string &uid, const string &f) {
+  for (const auto &side : {make_pair(&uid, &f), make_pair(&f, &uid)}) {
+    const string &me = *side.first;
+    const string &other = *side.second;
+    Shard &shard = shardOf(me);
+    pthread_mutex_lock(&shard.lock);
+    uint64_t ver = shard.gen;
+    pthread_mutex_unlock(&shard.lock);
+    RedisBatch batch(redis);
+    batch.add({"HDEL", me + "的好友列表", other});
+    batch.add({"SREM", me + "的屏蔽列表", other});
+    batch.exec();
+    pthread_mutex_lock(&shard.lock);
+    Adjacency *adj = shard.gen == ver ? find(shard, me) : nullptr;
+    if (adj != nullptr) {
+      int i = adj->find(other);
+      if (i >= 0) {
+        adj->erase(i);
+      }
+    } else {
+      drop(shard, me);
+    }
+    shard.gen++;
+    pthread_mutex_unlock(&shard.lock);
+  }
+}
+
+void FriendGraph::invalidate(const string &uid) {
+  Shard &shard = shardOf(uid);
+  pthread_mutex_lock(&shard.lock);
+  drop(shard, uid);
+  shard.gen++;
+  pthread_mutex_unlock(&shard.lock);
+}
+
+void FriendGraph::keyChanged(string_view key) {
+  if (key.empty()) {
+    clear();
+    return;
+  }
+  string_view suffix = "的好友列表";
+  if (key.size() > suffix.size() &&
+      key.substr(key.size() - suffix.size()) == suffix) {
+    invalidate(string(key.substr(0, key.size() - suffix.size())));
+  }
+}
+
+void FriendGraph::clear() {
+  for (Shard &shard : m_shards) {
+    pthread_mutex_lock(&shard.lock);
+    for (Slot &slot : shard.slots) {
+      slot = Slot();
+    }
+    shard.index.clear();
+    shard.gen++;
+    pthread_mutex_unlock(&shard.lock);
+  }
+}
+
+FriendGraph::Stats FriendGraph::stats() {
+  Stats stats;
+  for (Shard &shard : m_shards) {
+    pthread_mutex_lock(&shard.lock);
+    stats.users += shard.index.size();
+    for (const auto &kv : shard.index) {
+      stats.edges += shard.slots[kv.second].adj.ids.size();
+    }
+    pthread_mutex_unlock(&shard.lock);
+  }
+  stats.hits = m_hits;
+  stats.misses = m_misses;
+  stats.evictions = m_evictions;
+  return stats;
+}
+
+#endif
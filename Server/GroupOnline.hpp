@@ -0,0 +1,290 @@
+#ifndef GROUP_ONLINE_HPP
+#define GROUP_ONLINE_HPP
+
+#include "redis.hpp"
+#include <atomic>
+#include <pthread.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#define GROUP_ONLINE_RETRY 3 // 读群聊列表期间被改动时最多重读的次数
+
+using namespace std;
+
+// 每个群当前在线的成员和其中正在群里聊天的成员的进程内索引，群消息的推送只遍历它，
+// 不再读出整个群成员列表、逐个查在线状态。登录时读出用户的群聊列表登记进各群，
+// 断开时从各群摘掉；进群、退群、被移出和解散由处理函数写完redis后告诉它，
+// ChatGroup和ExitChatGroup改正在聊天的标记。不在线的成员什么都不用做，
+// 他们的未读数由群的消息序号和各自的已读位置算出。
+// 别处直接改了某人的群聊列表时，键事件经用户缓存转过来，后台线程重读这个人的群聊列表
+class GroupOnline {
+public:
+  struct Member {
+    string uid;
+    bool viewing; // 正在这个群里聊天
+  };
+
+  ~GroupOnline();
+  // 启动重读线程，从pool借连接
+  void start(RedisPool *pool);
+  // uid登录：用当前线程的redis读出群聊列表，登记进每个群
+  void login(const string &uid);
+  void logout(const string &uid);
+  // 写完redis之后调用，uid不在线时忽略
+  void join(const string &gid, const string &uid);
+  void leave(const string &gid, const string &uid);
+  void dissolve(const string &gid);
+  // uid的聊天对象改成了群gid，或者不再是任何群
+  void enter(const string &uid, const string &gid);
+  void exit(const string &uid);
+  // gid当前在线的成员
+  vector<Member> online(const string &gid);
+  // 用户缓存转来的非uid键的变化，空键表示订阅断过，所有人都要重读
+  void keyChanged(string_view key);
+
+private:
+  struct User {
+    unordered_set<string> groups;
+    string viewing;   // 正在聊天的群，没有为空串
+    uint64_t gen = 0; // 群聊列表每改一次+1，读群聊列表期间变了就重读
+  };
+
+  // 读uid的群聊列表替换他的登记，调用者要有借到的redis
+  void load(const string &uid);
+  // 下面两个都要在写锁里调用
+  void attach(const string &gid, const string &uid, User &user);
+  void detach(const string &gid, const string &uid);
+  static void *worker(void *arg);
+
+  pthread_rwlock_t m_lock = PTHREAD_RWLOCK_INITIALIZER; // 保护下面两项
+  unordered_map<string, User> m_users;                  // 在线用户
+  unordered_map<string, unordered_map<string, bool>> m_groups; // 群 -> 在线成员
+  RedisPool *m_pool = nullptr;
+  pthread_t m_thread;
+  atomic<bool> m_running{false};
+  pthread_mutex_t m_staleLock = PTHREAD_MUTEX_INITIALIZER; // 保护m_stale
+  pthread_cond_t m_wake = PTHREAD_COND_INITIALIZER;
+  unordered_set<string> m_stale; // 等待重读群聊列表的在线用户
+};
+
+GroupOnline::~GroupOnline() {
+  if (m_running) {
+    pthread_mutex_lock(&m_staleLock);
+    m_running = false;
+    pthread_cond_signal(&m_wake);
+    pthread_mutex_unlock(&m_staleLock);
+    pthread_join(m_thread, NULL);
+  }
+}
+
+void GroupOnline::start(RedisPool *pool) {
+  m_pool = pool;
+  m_running = true;
+  pthread_create(&m_thread, NULL, worker, this);
+}
+
+void GroupOnline::attach(const string &gid, const string &uid, User &user) {
+  user.groups.insert(gid);
+  m_groups[gid][uid] = user.viewing == gid;
+}
+
+void GroupOnline::detach(const string &gid, const string &uid) {
+  auto it = m_groups.find(gid);
+  if (it != m_groups.end()) {
+    it->second.erase(uid);
+    if (it->second.empty()) {
+      m_groups.erase(it);
+    }
+  }
+}
+
+void GroupOnline::login(const string &uid) {
+  pthread_rwlock_wrlock(&m_lock);
+  auto it = m_users.find(uid);
+  if (it != m_users.end()) {
+    for (const string &gid : it->second.groups) {
+      detach(gid, uid);
+    }
+  }
+  m_users[uid] = User();
+  pthread_rwlock_unlock(&m_lock);
+  load(uid);
+}
+
+void GroupOnline::logout(const string &uid) {
+  pthread_rwlock_wrlock(&m_lock);
+  auto it = m_users.find(uid);
+  if (it != m_users.end()) {
+    for (const string &gid : it->second.groups) {
+      detach(gid, uid);
+    }
+    m_users.erase(it);
+  }
+  pthread_rwlock_unlock(&m_lock);
+}
+
+void GroupOnline::load(const string &uid) {
+  for (int retry = 0;; retry++) {
+    pthread_rwlock_rdlock(&m_lock);
+    auto it = m_users.find(uid);
+    bool online = it != m_users.end();
+    uint64_t gen = online ? it->second.gen : 0;
+    pthread_rwlock_unlock(&m_lock);
+    if (!online) {
+      return;
+    }
+    // 读redis时不拿锁，内存存储的写回调会转回来
+    RedisReply groups = redis->hkeys(uid + "的群聊列表");
+    pthread_rwlock_wrlock(&m_lock);
+    it = m_users.find(uid);
+    if (it == m_users.end()) {
+      pthread_rwlock_unlock(&m_lock);
+      return;
+    }
+    if (it->second.gen != gen && retry < GROUP_ONLINE_RETRY) {
+      pthread_rwlock_unlock(&m_lock);
+      continue;
+    }
+    User &user = it->second;
+    unordered_set<string> now;
+    for (size_t i = 0; i < groups.size(); i++) {
+      now.insert(string(groups.view(i)));
+    }
+    for (const string &gid : user.groups) {
+      if (now.count(gid) == 0) {
+        detach(gid, uid);
+      }
+    }
+    user.groups.clear();
+    for (const string &gid : now) {
+      attach(gid, uid, user);
+    }
+    user.gen++;
+    pthread_rwlock_unlock(&m_lock);
+    return;
+  }
+}
+
+void GroupOnline::join(const string &gid, const string &uid) {
+  pthread_rwlock_wrlock(&m_lock);
+  auto it = m_users.find(uid);
+  if (it != m_users.end()) {
+    attach(gid, uid, it->second);
+    it->second.gen++;
+  }
+  pthread_rwlock_unlock(&m_lock);
+}
+
+void GroupOnline::leave(const string &gid, const string &uid) {
+  pthread_rwlock_wrlock(&m_lock);
+  auto it = m_users.find(uid);
+  if (it != m_users.end()) {
+    it->second.groups.erase(gid);
+    it->second.gen++;
+    detach(gid, uid);
+  }
+  pthread_rwlock_unlock(&m_lock);
+}
+
+void GroupOnline::dissolve(const string &gid) {
+  pthread_rwlock_wrlock(&m_lock);
+  auto g = m_groups.find(gid);
+  if (g != m_groups.end()) {
+    for (const auto &kv : g->second) {
+      auto it = m_users.find(kv.first);
+      if (it != m_users.end()) {
+        it->second.groups.erase(gid);
+        it->second.gen++;
+      }
+    }
+    m_groups.erase(g);
+  }
+  pthread_rwlock_unlock(&m_lock);
+}
+
+void GroupOnline::enter(const string &uid, const string &gid) {
+  pthread_rwlock_wrlock(&m_lock);
+  auto it = m_users.find(uid);
+  if (it != m_users.end()) {
+    User &user = it->second;
+    if (user.groups.count(user.viewing) != 0) {
+      m_groups[user.viewing][uid] = false;
+    }
+    user.viewing = gid;
+    if (user.groups.count(gid) != 0) {
+      m_groups[gid][uid] = true;
+    }
+  }
+  pthread_rwlock_unlock(&m_lock);
+}
+
+void GroupOnline::exit(const string &uid) { enter(uid, ""); }
+
+vector<GroupOnline::Member> GroupOnline::online(const string &gid) {
+  vector<Member> members;
+  pthread_rwlock_rdlock(&m_lock);
+  auto g = m_groups.find(gid);
+  if (g != m_groups.end()) {
+    members.reserve(g->second.size());
+    for (const auto &kv : g->second) {
+      members.push_back({kv.first, kv.second});
+    }
+  }
+  pthread_rwlock_unlock(&m_lock);
+  return members;
+}
+
+void GroupOnline::keyChanged(string_view key) {
+  static const string_view suffix = "的群聊列表";
+  if (!m_running) {
+    return;
+  }
+  vector<string> stale;
+  pthread_rwlock_rdlock(&m_lock);
+  if (key.empty()) {
+    for (const auto &kv : m_users) {
+      stale.push_back(kv.first);
+    }
+  } else if (key.size() > suffix.size() &&
+             key.substr(key.size() - suffix.size()) == suffix) {
+    string uid(key.substr(0, key.size() - suffix.size()));
+    if (m_users.count(uid) != 0) {
+      stale.push_back(uid);
+    }
+  }
+  pthread_rwlock_unlock(&m_lock);
+  if (stale.empty()) {
+    return;
+  }
+  pthread_mutex_lock(&m_staleLock);
+  m_stale.insert(stale.begin(), stale.end());
+  pthread_cond_signal(&m_wake);
+  pthread_mutex_unlock(&m_staleLock);
+}
+
+void *GroupOnline::worker(void *arg) {
+  GroupOnline *self = static_cast<GroupOnline *>(arg);
+  while (true) {
+    pthread_mutex_lock(&self->m_staleLock);
+    while (self->m_running && self->m_stale.empty()) {
+      pthread_cond_wait(&self->m_wake, &self->m_staleLock);
+    }
+    unordered_set<string> stale;
+    stale.swap(self->m_stale);
+    bool running = self->m_running;
+    pthread_mutex_unlock(&self->m_staleLock);
+    if (!running) {
+      break;
+    }
+    RedisGuard guard(*self->m_pool);
+    for (const string &uid : stale) {
+      self->load(uid);
+    }
+  }
+  return NULL;
+}
+
+#endif
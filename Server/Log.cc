@@ -0,0 +1,206 @@
+#include "Log.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <new>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+atomic<int> Logger::s_level(LOG_ACTIVE_LEVEL);
+
+static pthread_mutex_t g_ringsLock = PTHREAD_MUTEX_INITIALIZER;
+static vector<LogRing *> g_rings; // 所有线程的环形缓冲区
+static pthread_t g_writer;
+static atomic<bool> g_running(false);
+static int g_fd = 1;
+
+static const char *const g_levelName[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+
+// 本线程的缓冲区。指针本身没有析构函数，线程退出的任何阶段都能安全读它
+static thread_local LogRing *t_ring = nullptr;
+static thread_local bool t_exited = false;
+// 线程退出时把缓冲区交给写线程：标记退役后由写线程排空并释放，
+// 本线程随即忘掉这个指针；之后其它thread_local析构里再打的日志直接丢掉，
+// 不会写进已经被写线程释放的缓冲区
+struct RingRetirer {
+  bool armed = false;
+  ~RingRetirer() {
+    if (t_ring != nullptr) {
+      t_ring->m_retired.store(true, memory_order_release);
+      t_ring = nullptr;
+    }
+    t_exited = true;
+  }
+};
+static thread_local RingRetirer t_retirer;
+
+size_t LogRing::drain(vector<LogRecord> &out) {
+  uint64_t tail = m_tail.load(memory_order_relaxed);
+  uint64_t head = m_head.load(memory_order_acquire);
+  for (uint64_t i = tail; i != head; i++) {
+    out.push_back(m_slots[i & (LOG_RING_SIZE - 1)]);
+  }
+  m_tail.store(head, memory_order_release);
+  return head - tail;
+}
+
+uint32_t Logger::threadId() {
+  static thread_local uint32_t tid = 0;
+  if (tid == 0) {
+    tid = static_cast<uint32_t>(syscall(SYS_gettid));
+  }
+  return tid;
+}
+
+uint64_t Logger::now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+LogRing *Logger::localRing() {
+  if (t_ring == nullptr) {
+    if (t_exited) {
+      return nullptr;
+    }
+    // 缓冲区由所属线程首次分配并初始化，按首次访问原则落在本线程的内存节点
+    void *mem = nullptr;
+    if (posix_memalign(&mem, 64, sizeof(LogRing)) != 0) {
+      abort();
+    }
+    t_ring = new (mem) LogRing(threadId());
+    // 访问一次退出处理对象，让它在本线程构造并登记析构
+    t_retirer.armed = true;
+    pthread_mutex_lock(&g_ringsLock);
+    g_rings.push_back(t_ring);
+    pthread_mutex_unlock(&g_ringsLock);
+  }
+  return t_ring;
+}
+
+void Logger::putStr(LogRecord *rec, LogArg &a, const char *p, size_t n) {
+  size_t room = LOG_INLINE_BYTES - rec->used;
+  if (n > room) {
+    n = room;
+  }
+  a.type = LogArg::STR;
+  a.s.off = rec->used;
+  a.s.len = n;
+  memcpy(rec->data + rec->used, p, n);
+  rec->used += n;
+}
+
+void Logger::format(const LogRecord &rec, string &line) {
+  char head[64];
+  time_t sec = rec.ts / 1000000000ull;
+  struct tm tm;
+  localtime_r(&sec, &tm);
+  size_t n = strftime(head, sizeof(head), "%Y-%m-%d %H:%M:%S", &tm);
+  snprintf(head + n, sizeof(head) - n, ".%06u %s [%u] ",
+           unsigned(rec.ts % 1000000000ull / 1000), g_levelName[rec.level],
+           rec.tid);
+  line += head;
+  int argi = 0;
+  for (const char *p = rec.fmt; *p != '\0'; p++) {
+    if (p[0] == '{' && p[1] == '}' && argi < rec.argc) {
+      const LogArg &a = rec.args[argi++];
+      switch (a.type) {
+      case LogArg::INT:
+        line += to_string(a.i);
+        break;
+      case LogArg::UINT:
+        line += to_string(a.u);
+        break;
+      case LogArg::DOUBLE:
+        line += to_string(a.d);
+        break;
+      case LogArg::STR:
+        line.append(rec.data + a.s.off, a.s.len);
+        break;
+      }
+      p++;
+    } else {
+      line += *p;
+    }
+  }
+  line += '\n';
+}
+
+// 排空所有缓冲区，按时间排序后格式化写出，返回处理的记录数
+size_t Logger::drainOnce(string &buf) {
+  static vector<LogRecord> batch;
+  vector<LogRing *> rings;
+  pthread_mutex_lock(&g_ringsLock);
+  rings = g_rings;
+  pthread_mutex_unlock(&g_ringsLock);
+
+  batch.clear();
+  for (LogRing *ring : rings) {
+    // 先读退役标记再排空，保证退役前写入的记录都被取走
+    bool retired = ring->m_retired.load(memory_order_acquire);
+    ring->drain(batch);
+    uint64_t dropped = ring->takeDropped();
+    if (dropped > 0) {
+      buf += "[log] 线程" + to_string(ring->tid()) + "的日志缓冲区已满，丢弃" +
+             to_string(dropped) + "条日志\n";
+    }
+    if (retired) {
+      pthread_mutex_lock(&g_ringsLock);
+      g_rings.erase(find(g_rings.begin(), g_rings.end(), ring));
+      pthread_mutex_unlock(&g_ringsLock);
+      ring->~LogRing();
+      free(ring);
+    }
+  }
+  stable_sort(batch.begin(), batch.end(),
+              [](const LogRecord &a, const LogRecord &b) {
+                return a.ts < b.ts;
+              });
+  for (const LogRecord &rec : batch) {
+    format(rec, buf);
+  }
+  if (!buf.empty()) {
+    size_t off = 0;
+    while (off < buf.size()) {
+      ssize_t n = write(g_fd, buf.data() + off, buf.size() - off);
+      if (n <= 0) {
+        break;
+      }
+      off += n;
+    }
+    buf.clear();
+  }
+  return batch.size();
+}
+
+// 后台写线程：空闲时逐步退避，最长睡眠10ms
+void *Logger::writer(void *) {
+  string buf;
+  useconds_t idle = 100;
+  while (g_running.load(memory_order_acquire)) {
+    if (drainOnce(buf) > 0) {
+      idle = 100;
+    } else {
+      usleep(idle);
+      idle = min<useconds_t>(idle * 2, 10000);
+    }
+  }
+  drainOnce(buf);
+  return nullptr;
+}
+
+void Logger::start(int level, int fd) {
+  setLevel(level);
+  g_fd = fd;
+  if (!g_running.exchange(true)) {
+    pthread_create(&g_writer, NULL, writer, NULL);
+  }
+}
+
+void Logger::stop() {
+  if (g_running.exchange(false)) {
+    pthread_join(g_writer, NULL);
+  }
+}
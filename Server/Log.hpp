@@ -0,0 +1,217 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <pthread.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// 日志级别
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_OFF 4
+
+// 编译期日志级别，低于该级别的日志调用在编译时整个被删掉（参数也不会求值）
+#ifndef LOG_ACTIVE_LEVEL
+#define LOG_ACTIVE_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_MAX_ARGS 6       // 一条日志最多携带的参数个数
+#define LOG_INLINE_BYTES 136 // 一条日志里字符串参数的内联存储大小
+#define LOG_RING_SIZE 1024   // 每个线程环形缓冲区的槽数(2的幂)
+
+using namespace std;
+
+// 延迟格式化的参数：热路径上只拷贝原始值，格式化交给后台写线程
+struct LogArg {
+  enum Type : uint8_t { INT, UINT, DOUBLE, STR };
+  Type type;
+  union {
+    long long i;
+    unsigned long long u;
+    double d;
+    struct {
+      uint16_t off;
+      uint16_t len;
+    } s;
+  };
+};
+
+// 一条日志记录，固定256字节，直接放在环形缓冲区的槽里
+struct LogRecord {
+  uint64_t ts;     // 纳秒时间戳
+  const char *fmt; // 格式串，必须是字符串字面量，用{}占位
+  uint32_t tid;    // 产生日志的线程号
+  uint8_t level;
+  uint8_t argc;
+  uint16_t used; // data已用字节数
+  LogArg args[LOG_MAX_ARGS];
+  char data[LOG_INLINE_BYTES];
+};
+
+// 单生产者单消费者无锁环形缓冲区，每个线程一个，由后台写线程消费
+class LogRing {
+public:
+  LogRing(uint32_t tid) : m_tid(tid) {}
+  uint32_t tid() const { return m_tid; }
+  // 生产者：取一个空槽，满了返回nullptr（丢弃并计数，不阻塞业务线程）
+  LogRecord *claim() {
+    uint64_t head = m_head.load(memory_order_relaxed);
+    if (head - m_tail.load(memory_order_acquire) >= LOG_RING_SIZE) {
+      m_dropped.fetch_add(1, memory_order_relaxed);
+      return nullptr;
+    }
+    return &m_slots[head & (LOG_RING_SIZE - 1)];
+  }
+  // 生产者：发布刚写好的槽
+  void publish() {
+    m_head.store(m_head.load(memory_order_relaxed) + 1, memory_order_release);
+  }
+  // 消费者：把当前所有可读记录拷出来
+  size_t drain(vector<LogRecord> &out);
+  uint64_t takeDropped() { return m_dropped.exchange(0); }
+  bool empty() const {
+    return m_head.load(memory_order_acquire) ==
+           m_tail.load(memory_order_relaxed);
+  }
+  atomic<bool> m_retired{false}; // 线程已退出，写线程排空后回收
+
+private:
+  uint32_t m_tid;
+  alignas(64) atomic<uint64_t> m_head{0};
+  alignas(64) atomic<uint64_t> m_tail{0};
+  alignas(64) atomic<uint64_t> m_dropped{0};
+  LogRecord m_slots[LOG_RING_SIZE];
+};
+
+class Logger {
+public:
+  // 启动后台写线程，fd为输出的文件描述符（默认标准输出）
+  static void start(int level = LOG_ACTIVE_LEVEL, int fd = 1);
+  // 排空所有缓冲区并停止写线程
+  static void stop();
+  static void setLevel(int level) { s_level.store(level); }
+  static bool enabled(int level) {
+    return level >= s_level.load(memory_order_relaxed);
+  }
+  // 记录一条日志，只做参数拷贝
+  template <typename... Args>
+  static void log(int level, const char *fmt, const Args &...args) {
+    LogRing *ring = localRing();
+    LogRecord *rec = ring != nullptr ? ring->claim() : nullptr;
+    if (rec == nullptr) {
+      return;
+    }
+    rec->ts = now();
+    rec->fmt = fmt;
+    rec->tid = ring->tid();
+    rec->level = level;
+    rec->argc = 0;
+    rec->used = 0;
+    capture(rec, args...);
+    ring->publish();
+  }
+  // 把一条记录格式化成一行文本（写线程调用）
+  static void format(const LogRecord &rec, string &line);
+  // 当前线程号（gettid），线程内缓存
+  static uint32_t threadId();
+
+private:
+  // 本线程的缓冲区，线程已进入退出阶段时返回nullptr
+  static LogRing *localRing();
+  static uint64_t now();
+  static void *writer(void *arg);
+  static size_t drainOnce(string &buf);
+
+  static void capture(LogRecord *) {}
+  template <typename T, typename... Rest>
+  static void capture(LogRecord *rec, const T &first, const Rest &...rest) {
+    if (rec->argc < LOG_MAX_ARGS) {
+      put(rec, rec->args[rec->argc++], first);
+    }
+    capture(rec, rest...);
+  }
+  template <typename T>
+  static typename enable_if<is_integral<T>::value && is_signed<T>::value>::type
+  put(LogRecord *, LogArg &a, const T &v) {
+    a.type = LogArg::INT;
+    a.i = v;
+  }
+  template <typename T>
+  static
+      typename enable_if<is_integral<T>::value && !is_signed<T>::value>::type
+      put(LogRecord *, LogArg &a, const T &v) {
+    a.type = LogArg::UINT;
+    a.u = v;
+  }
+  template <typename T>
+  static typename enable_if<is_floating_point<T>::value>::type
+  put(LogRecord *, LogArg &a, const T &v) {
+    a.type = LogArg::DOUBLE;
+    a.d = v;
+  }
+  static void put(LogRecord *rec, LogArg &a, const string &v) {
+    putStr(rec, a, v.data(), v.size());
+  }
+  static void put(LogRecord *rec, LogArg &a, const char *v) {
+    putStr(rec, a, v, v ? strlen(v) : 0);
+  }
+  static void putStr(LogRecord *rec, LogArg &a, const char *p, size_t n);
+
+  static atomic<int> s_level;
+};
+
+#if LOG_ACTIVE_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...)                                                         \
+  do {                                                                         \
+    if (Logger::enabled(LOG_LEVEL_DEBUG))                                      \
+      Logger::log(LOG_LEVEL_DEBUG, __VA_ARGS__);                               \
+  } while (0)
+#else
+#define LOG_DEBUG(...)                                                         \
+  do {                                                                         \
+  } while (0)
+#endif
+
+#if LOG_ACTIVE_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...)                                                          \
+  do {                                                                         \
+    if (Logger::enabled(LOG_LEVEL_INFO))                                       \
+      Logger::log(LOG_LEVEL_INFO, __VA_ARGS__);                                \
+  } while (0)
+#else
+#define LOG_INFO(...)                                                          \
+  do {                                                                         \
+  } while (0)
+#endif
+
+#if LOG_ACTIVE_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...)                                                          \
+  do {                                                                         \
+    if (Logger::enabled(LOG_LEVEL_WARN))                                       \
+      Logger::log(LOG_LEVEL_WARN, __VA_ARGS__);                                \
+  } while (0)
+#else
+#define LOG_WARN(...)                                                          \
+  do {                                                                         \
+  } while (0)
+#endif
+
+#if LOG_ACTIVE_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...)                                                         \
+  do {                                                                         \
+    if (Logger::enabled(LOG_LEVEL_ERROR))                                      \
+      Logger::log(LOG_LEVEL_ERROR, __VA_ARGS__);                               \
+  } while (0)
+#else
+#define LOG_ERROR(...)                                                         \
+  do {                                                                         \
+  } while (0)
+#endif
+
+#endif
@@ -0,0 +1,953 @@
+#ifndef MEM_STORAGE_HPP
+#define MEM_STORAGE_HPP
+
+#include "Log.hpp"
+#include "Storage.hpp"
+#include "redis.hpp"
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
+#include <functional>
+#include <pthread.h>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define MEM_SHARDS 64          // 键空间的分片数
+#define MEM_AOF_FSYNC_MS 1000  // AOF两次fsync的最小间隔
+
+// 值的类型
+#define MEM_STRING 0
+#define MEM_HASH 1
+#define MEM_SET 2
+#define MEM_LIST 3
+
+using namespace std;
+
+// 字符串键的哈希，支持直接用string_view查找
+struct MemKeyHash {
+  using is_transparent = void;
+  size_t operator()(string_view s) const { return hash<string_view>()(s); }
+};
+template <typename T>
+using MemMap = unordered_map<string, T, MemKeyHash, equal_to<>>;
+
+// 按插入顺序保存的字段表，哈希表和集合（值为空）共用。
+// redis的小哈希表和集合按插入顺序返回元素，处理函数依赖这一点（如倒序展示系统消息）。
+// 删除只把字段标成空位，不移动后面的字段；空位超过一半时一次压缩掉，删除均摊O(1)
+struct MemFields {
+  struct Item {
+    string field;
+    string value;
+    bool live = true;
+  };
+  vector<Item> items; // 含空位，遍历用each
+  MemMap<size_t> pos; // 字段 -> 在items中的下标
+  size_t dead = 0;    // items里的空位数
+
+  string *find(string_view field) {
+    auto it = pos.find(field);
+    return it == pos.end() ? nullptr : &items[it->second].value;
+  }
+  // 新字段返回true
+  bool set(string_view field, string_view value) {
+    string *old = find(field);
+    if (old != nullptr) {
+      old->assign(value);
+      return false;
+    }
+    pos.emplace(string(field), items.size());
+    items.push_back({string(field), string(value)});
+    return true;
+  }
+  bool erase(string_view field) {
+    auto it = pos.find(field);
+    if (it == pos.end()) {
+      return false;
+    }
+    Item &item = items[it->second];
+    pos.erase(it);
+    item.live = false;
+    string().swap(item.field);
+    string().swap(item.value);
+    dead++;
+    // 末尾的空位直接去掉
+    while (!items.empty() && !items.back().live) {
+      items.pop_back();
+      dead--;
+    }
+    if (dead > items.size() / 2) {
+      compact();
+    }
+    return true;
+  }
+  // 按插入顺序遍历现存的字段
+  template <typename F> void each(F f) const {
+    for (const Item &item : items) {
+      if (item.live) {
+        f(item.field, item.value);
+      }
+    }
+  }
+  size_t size() const { return items.size() - dead; }
+
+private:
+  // 去掉所有空位，重排下标
+  void compact() {
+    size_t j = 0;
+    for (size_t i = 0; i < items.size(); i++) {
+      if (!items[i].live) {
+        continue;
+      }
+      if (i != j) {
+        items[j] = std::move(items[i]);
+        pos.find(items[j].field)->second = j;
+      }
+      j++;
+    }
+    items.resize(j);
+    dead = 0;
+  }
+};
+
+// 内嵌的内存存储：在进程里执行处理函数用到的redis命令，省掉网络往返，也不需要redis-server。
+// 键空间按键名分成MEM_SHARDS片，普通命令持全局读锁和所在分片的锁并发执行；
+// 事务、脚本和多键命令持全局写锁独占执行。
+// 可选AOF：写命令按RESP格式追加到文件，每秒fsync一次，启动时重放恢复数据
+class MemStorage : public Storage {
+public:
+  MemStorage();
+  ~MemStorage();
+  // 打开AOF文件，先重放已有的命令，之后的写命令追加进去；不调用时数据只在内存里
+  bool open(const string &aofPath);
+  // 键被写命令修改后的回调，代替redis的键事件通知
+  void setWriteHook(function<void(const string &key)> hook) { m_hook = hook; }
+  size_t keyCount();
+
+  redisReply *execute(const string_view *argv, size_t argc) override;
+  bool pipeline(const vector<vector<string>> &cmds, bool transaction,
+                vector<redisReply *> &replies) override;
+  // 没有Lua，脚本执行它的native函数
+  bool loadScript(RedisScript &) override { return true; }
+  redisReply *eval(const RedisScript &script,
+                   const vector<string> &args) override;
+
+private:
+  struct Value {
+    int type = MEM_STRING;
+    string str;
+    MemFields fields;
+    deque<string> list;
+  };
+  struct Shard {
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    MemMap<Value> data;
+  };
+  // 写命令的副作用：要追加的AOF记录和被修改的键
+  struct Effects {
+    string aof;
+    vector<string> keys;
+  };
+  using Handler = redisReply *(MemStorage::*)(const string_view *argv,
+                                               size_t argc, bool &wrote);
+  struct CommandInfo {
+    Handler handler;
+    size_t minArgc;
+    bool multiKey; // 参数里的每个键都可能被修改，需要独占执行
+  };
+
+  Shard &shardOf(string_view key) {
+    return m_shards[MemKeyHash()(key) % MEM_SHARDS];
+  }
+  const CommandInfo *find(string_view name);
+  // 调用方已持有需要的锁；fx非空时记下写命令的副作用
+  redisReply *dispatch(const string_view *argv, size_t argc, Effects *fx);
+  // 独占执行时的开始和结束：结束时把副作用写入AOF（包在MULTI/EXEC里）并通知
+  void beginExclusive(Effects &fx);
+  void endExclusive(Effects &fx);
+  void commitAof(const string &records);
+  void notify(const vector<string> &keys);
+  static void appendRecord(string &buf, const string_view *argv, size_t argc);
+  bool replay(const string &path);
+  static void *aofWriter(void *arg);
+  bool writeAof(const string &buf);
+
+  // 取键的值：不存在返回nullptr，类型不对时返回nullptr并设置err
+  Value *lookup(string_view key, int type, redisReply *&err);
+  // 取键的值，不存在时新建
+  Value *obtain(string_view key, int type, redisReply *&err);
+  void remove(string_view key);
+
+  redisReply *cmdPing(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdGet(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdSet(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdIncr(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdDel(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdHset(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdHget(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdHmget(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdHgetall(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdHkeys(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdHlen(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdHexists(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdHdel(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdHincrby(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdSadd(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdSrem(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdSismember(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdSmembers(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdScard(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdLpush(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdLrange(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdLlen(const string_view *argv, size_t argc, bool &wrote);
+  redisReply *cmdLtrim(const string_view *argv, size_t argc, bool &wrote);
+
+  Shard m_shards[MEM_SHARDS];
+  // 普通命令持读锁，独占执行持写锁
+  pthread_rwlock_t m_global = PTHREAD_RWLOCK_INITIALIZER;
+  MemMap<CommandInfo> m_commands;
+  function<void(const string &key)> m_hook;
+  // AOF
+  int m_aofFd = -1;
+  pthread_mutex_t m_aofLock = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t m_aofReady = PTHREAD_COND_INITIALIZER;
+  string m_aofBuf; // 还没交给内核的记录
+  pthread_t m_aofThread;
+  atomic<bool> m_running{false};
+  // 独占执行期间（事务、脚本）本线程的副作用，嵌套的命令不再加锁
+  static thread_local Effects *t_effects;
+};
+
+thread_local MemStorage::Effects *MemStorage::t_effects = nullptr;
+
+static redisReply *WrongType() {
+  return MakeError(
+      "WRONGTYPE Operation against a key holding the wrong kind of value");
+}
+
+static redisReply *NotInteger() {
+  return MakeError("ERR value is not an integer or out of range");
+}
+
+static bool ToInteger(string_view s, long long &n) {
+  auto [end, ec] = from_chars(s.data(), s.data() + s.size(), n);
+  return ec == errc() && end == s.data() + s.size() && !s.empty();
+}
+
+// 把redis风格的下标区间（负数从末尾算）换成[start, stop]，区间为空时返回false
+static bool ToRange(long long len, long long &start, long long &stop) {
+  if (start < 0) {
+    start += len;
+  }
+  if (stop < 0) {
+    stop += len;
+  }
+  if (start < 0) {
+    start = 0;
+  }
+  if (stop >= len) {
+    stop = len - 1;
+  }
+  return start <= stop && start < len;
+}
+
+MemStorage::MemStorage() {
+  m_commands = {
+      {"PING", {&MemStorage::cmdPing, 1, false}},
+      {"GET", {&MemStorage::cmdGet, 2, false}},
+      {"SET", {&MemStorage::cmdSet, 3, false}},
+      {"INCR", {&MemStorage::cmdIncr, 2, false}},
+      {"DEL", {&MemStorage::cmdDel, 2, true}},
+      {"UNLINK", {&MemStorage::cmdDel, 2, true}},
+      {"HSET", {&MemStorage::cmdHset, 4, false}},
+      {"HGET", {&MemStorage::cmdHget, 3, false}},
+      {"HMGET", {&MemStorage::cmdHmget, 3, false}},
+      {"HGETALL", {&MemStorage::cmdHgetall, 2, false}},
+      {"HKEYS", {&MemStorage::cmdHkeys, 2, false}},
+      {"HLEN", {&MemStorage::cmdHlen, 2, false}},
+      {"HEXISTS", {&MemStorage::cmdHexists, 3, false}},
+      {"HDEL", {&MemStorage::cmdHdel, 3, false}},
+      {"HINCRBY", {&MemStorage::cmdHincrby, 4, false}},
+      {"SADD", {&MemStorage::cmdSadd, 3, false}},
+      {"SREM", {&MemStorage::cmdSrem, 3, false}},
+      {"SISMEMBER", {&MemStorage::cmdSismember, 3, false}},
+      {"SMEMBERS", {&MemStorage::cmdSmembers, 2, false}},
+      {"SCARD", {&MemStorage::cmdScard, 2, false}},
+      {"LPUSH", {&MemStorage::cmdLpush, 3, false}},
+      {"LRANGE", {&MemStorage::cmdLrange, 4, false}},
+      {"LLEN", {&MemStorage::cmdLlen, 2, false}},
+      {"LTRIM", {&MemStorage::cmdLtrim, 4, false}},
+  };
+}
+
+MemStorage::~MemStorage() {
+  if (m_running) {
+    pthread_mutex_lock(&m_aofLock);
+    m_running = false;
+    pthread_cond_signal(&m_aofReady);
+    pthread_mutex_unlock(&m_aofLock);
+    pthread_join(m_aofThread, NULL);
+  }
+  if (m_aofFd != -1) {
+    writeAof(m_aofBuf);
+    fdatasync(m_aofFd);
+    close(m_aofFd);
+  }
+}
+
+bool MemStorage::open(const string &aofPath) {
+  if (!replay(aofPath)) {
+    return false;
+  }
+  m_aofFd = ::open(aofPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (m_aofFd == -1) {
+    LOG_ERROR("打开AOF文件{}失败: {}", aofPath, strerror(errno));
+    return false;
+  }
+  m_running = true;
+  pthread_create(&m_aofThread, NULL, aofWriter, this);
+  LOG_INFO("内嵌存储: 从AOF恢复{}个键", keyCount());
+  return true;
+}
+
+size_t MemStorage::keyCount() {
+  size_t n = 0;
+  for (Shard &shard : m_shards) {
+    pthread_mutex_lock(&shard.lock);
+    n += shard.data.size();
+    pthread_mutex_unlock(&shard.lock);
+  }
+  return n;
+}
+
+const MemStorage::CommandInfo *MemStorage::find(string_view name) {
+  char upper[16] = {};
+  if (name.size() >= sizeof(upper)) {
+    return nullptr;
+  }
+  for (size_t i = 0; i < name.size(); i++) {
+    upper[i] = toupper((unsigned char)name[i]);
+  }
+  auto it = m_commands.find(string_view(upper, name.size()));
+  return it == m_commands.end() ? nullptr : &it->second;
+}
+
+redisReply *MemStorage::dispatch(const string_view *argv, size_t argc,
+                                 Effects *fx) {
+  const CommandInfo *info = argc == 0 ? nullptr : find(argv[0]);
+  if (info == nullptr) {
+    return MakeError("ERR unknown command '" +
+                     string(argc == 0 ? "" : argv[0]) + "'");
+  }
+  if (argc < info->minArgc) {
+    return MakeError("ERR wrong number of arguments for '" + string(argv[0]) +
+                     "' command");
+  }
+  bool wrote = false;
+  redisReply *r = (this->*info->handler)(argv, argc, wrote);
+  if (wrote && fx != nullptr) {
+    if (m_aofFd != -1) {
+      appendRecord(fx->aof, argv, argc);
+    }
+    for (size_t i = 1; i < (info->multiKey ? argc : 2); i++) {
+      fx->keys.emplace_back(argv[i]);
+    }
+  }
+  return r;
+}
+
+redisReply *MemStorage::execute(const string_view *argv, size_t argc) {
+  // 事务或脚本里的命令，已经独占
+  if (t_effects != nullptr) {
+    return dispatch(argv, argc, t_effects);
+  }
+  const CommandInfo *info = argc == 0 ? nullptr : find(argv[0]);
+  if (info == nullptr || argc < 2 || info->multiKey) {
+    Effects fx;
+    beginExclusive(fx);
+    redisReply *r = dispatch(argv, argc, &fx);
+    endExclusive(fx);
+    return r;
+  }
+  Effects fx;
+  Shard &shard = shardOf(argv[1]);
+  pthread_rwlock_rdlock(&m_global);
+  pthread_mutex_lock(&shard.lock);
+  redisReply *r = dispatch(argv, argc, &fx);
+  // 同一个键的写命令在分片锁内追加，AOF里的顺序和执行顺序一致
+  if (!fx.aof.empty()) {
+    commitAof(fx.aof);
+  }
+  pthread_mutex_unlock(&shard.lock);
+  pthread_rwlock_unlock(&m_global);
+  notify(fx.keys);
+  return r;
+}
+
+bool MemStorage::pipeline(const vector<vector<string>> &cmds, bool transaction,
+                          vector<redisReply *> &replies) {
+  if (!transaction) {
+    for (const vector<string> &cmd : cmds) {
+      vector<string_view> argv(cmd.begin(), cmd.end());
+      replies.push_back(execute(argv.data(), argv.size()));
+    }
+    return true;
+  }
+  vector<redisReply *> results;
+  Effects fx;
+  beginExclusive(fx);
+  for (const vector<string> &cmd : cmds) {
+    vector<string_view> argv(cmd.begin(), cmd.end());
+    results.push_back(dispatch(argv.data(), argv.size(), &fx));
+  }
+  endExclusive(fx);
+  replies.push_back(MakeArray(results));
+  return true;
+}
+
+redisReply *MemStorage::eval(const RedisScript &script,
+                             const vector<string> &args) {
+  if (script.native() == nullptr) {
+    return MakeError("ERR script " + script.name() +
+                     " has no native implementation");
+  }
+  Effects fx;
+  beginExclusive(fx);
+  Redis db(this);
+  redisReply *r = script.native()(db, args);
+  endExclusive(fx);
+  return r;
+}
+
+void MemStorage::beginExclusive(Effects &fx) {
+  pthread_rwlock_wrlock(&m_global);
+  t_effects = &fx;
+}
+
+void MemStorage::endExclusive(Effects &fx) {
+  t_effects = nullptr;
+  if (!fx.aof.empty()) {
+    string records;
+    string_view multi[] = {"MULTI"}, exec[] = {"EXEC"};
+    appendRecord(records, multi, 1);
+    records += fx.aof;
+    appendRecord(records, exec, 1);
+    commitAof(records);
+  }
+  pthread_rwlock_unlock(&m_global);
+  notify(fx.keys);
+}
+
+void MemStorage::commitAof(const string &records) {
+  pthread_mutex_lock(&m_aofLock);
+  if (m_aofBuf.empty()) {
+    pthread_cond_signal(&m_aofReady);
+  }
+  m_aofBuf += records;
+  pthread_mutex_unlock(&m_aofLock);
+}
+
+void MemStorage::notify(const vector<string> &keys) {
+  if (m_hook) {
+    for (const string &key : keys) {
+      m_hook(key);
+    }
+  }
+}
+
+// 按RESP数组格式追加一条命令，与redis的AOF格式相同
+void MemStorage::appendRecord(string &buf, const string_view *argv,
+                              size_t argc) {
+  // 逐段追加，不拼临时串
+  buf += '*';
+  buf += to_string(argc);
+  buf += "\r\n";
+  for (size_t i = 0; i < argc; i++) {
+    buf += '$';
+    buf += to_string(argv[i].size());
+    buf += "\r\n";
+    buf.append(argv[i]);
+    buf += "\r\n";
+  }
+}
+
+// 把buf交给内核，返回是否写成功
+bool MemStorage::writeAof(const string &buf) {
+  size_t done = 0;
+  while (done < buf.size()) {
+    ssize_t n = write(m_aofFd, buf.data() + done, buf.size() - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      LOG_ERROR("写AOF失败: {}", strerror(errno));
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+// 与redis的appendfsync everysec相同：有新记录就写给内核，进程崩溃不丢数据；
+// fsync每秒最多一次，机器掉电最多丢一秒
+void *MemStorage::aofWriter(void *arg) {
+  MemStorage *self = static_cast<MemStorage *>(arg);
+  time_t lastSync = time(NULL);
+  bool dirty = false;
+  pthread_mutex_lock(&self->m_aofLock);
+  while (self->m_running) {
+    if (self->m_aofBuf.empty()) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += MEM_AOF_FSYNC_MS / 1000;
+      pthread_cond_timedwait(&self->m_aofReady, &self->m_aofLock, &deadline);
+    }
+    string buf;
+    buf.swap(self->m_aofBuf);
+    pthread_mutex_unlock(&self->m_aofLock);
+    dirty |= !buf.empty() && self->writeAof(buf);
+    if (dirty && (time(NULL) - lastSync) * 1000 >= MEM_AOF_FSYNC_MS) {
+      fdatasync(self->m_aofFd);
+      lastSync = time(NULL);
+      dirty = false;
+    }
+    pthread_mutex_lock(&self->m_aofLock);
+  }
+  pthread_mutex_unlock(&self->m_aofLock);
+  return NULL;
+}
+
+// 重放AOF：MULTI和EXEC之间的命令到EXEC才一起执行；
+// 文件末尾不完整的记录或没有EXEC的事务（写到一半时崩溃）被截掉
+bool MemStorage::replay(const string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return errno == ENOENT;
+  }
+  string data;
+  char chunk[65536];
+  ssize_t n;
+  while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+    data.append(chunk, n);
+  }
+  close(fd);
+  size_t pos = 0, good = 0, commands = 0;
+  vector<vector<string_view>> queued;
+  bool inMulti = false;
+  // 读一行到\r\n，返回行内容，不完整时返回false
+  auto readLine = [&](string_view &line) {
+    size_t end = data.find("\r\n", pos);
+    if (end == string::npos) {
+      return false;
+    }
+    line = string_view(data).substr(pos, end - pos);
+    pos = end + 2;
+    return true;
+  };
+  while (pos < data.size()) {
+    string_view line;
+    long long argc;
+    if (!readLine(line) || line.empty() || line[0] != '*' ||
+        !ToInteger(line.substr(1), argc)) {
+      break;
+    }
+    vector<string_view> argv;
+    bool complete = true;
+    for (long long i = 0; i < argc && complete; i++) {
+      long long len;
+      if (!readLine(line) || line.empty() || line[0] != '$' ||
+          !ToInteger(line.substr(1), len) || pos + len + 2 > data.size()) {
+        complete = false;
+        break;
+      }
+      argv.push_back(string_view(data).substr(pos, len));
+      pos += len + 2;
+    }
+    if (!complete || argv.empty()) {
+      break;
+    }
+    if (argv[0] == "MULTI") {
+      inMulti = true;
+    } else if (argv[0] == "EXEC") {
+      for (vector<string_view> &cmd : queued) {
+        freeReplyObject(dispatch(cmd.data(), cmd.size(), nullptr));
+      }
+      commands += queued.size();
+      queued.clear();
+      inMulti = false;
+    } else if (inMulti) {
+      queued.push_back(argv);
+    } else {
+      freeReplyObject(dispatch(argv.data(), argv.size(), nullptr));
+      commands++;
+    }
+    if (!inMulti) {
+      good = pos;
+    }
+  }
+  if (good < data.size()) {
+    LOG_WARN("AOF末尾有{}字节不完整，已截掉", data.size() - good);
+    if (truncate(path.c_str(), good) != 0) {
+      LOG_ERROR("截断AOF失败: {}", strerror(errno));
+      return false;
+    }
+  }
+  LOG_INFO("AOF重放{}条命令", commands);
+  return true;
+}
+
+MemStorage::Value *MemStorage::lookup(string_view key, int type,
+                                      redisReply *&err) {
+  MemMap<Value> &data = shardOf(key).data;
+  auto it = data.find(key);
+  if (it == data.end()) {
+    return nullptr;
+  }
+  if (it->second.type != type) {
+    err = WrongType();
+    return nullptr;
+  }
+  return &it->second;
+}
+
+MemStorage::Value *MemStorage::obtain(string_view key, int type,
+                                      redisReply *&err) {
+  MemMap<Value> &data = shardOf(key).data;
+  auto it = data.find(key);
+  if (it == data.end()) {
+    it = data.emplace(string(key), Value()).first;
+    it->second.type = type;
+  } else if (it->second.type != type) {
+    err = WrongType();
+    return nullptr;
+  }
+  return &it->second;
+}
+
+void MemStorage::remove(string_view key) {
+  MemMap<Value> &data = shardOf(key).data;
+  auto it = data.find(key);
+  if (it != data.end()) {
+    data.erase(it);
+  }
+}
+
+redisReply *MemStorage::cmdPing(const string_view *, size_t, bool &) {
+  return MakeStatus("PONG");
+}
+
+redisReply *MemStorage::cmdGet(const string_view *argv, size_t, bool &) {
+  redisReply *err = nullptr;
+  Value *v = lookup(argv[1], MEM_STRING, err);
+  if (err != nullptr) {
+    return err;
+  }
+  return v == nullptr ? MakeNil() : MakeString(v->str);
+}
+
+redisReply *MemStorage::cmdSet(const string_view *argv, size_t, bool &wrote) {
+  remove(argv[1]);
+  redisReply *err = nullptr;
+  obtain(argv[1], MEM_STRING, err)->str = argv[2];
+  wrote = true;
+  return MakeStatus("OK");
+}
+
+redisReply *MemStorage::cmdIncr(const string_view *argv, size_t, bool &wrote) {
+  redisReply *err = nullptr;
+  Value *v = obtain(argv[1], MEM_STRING, err);
+  if (err != nullptr) {
+    return err;
+  }
+  long long n = 0;
+  if (!v->str.empty() && !ToInteger(v->str, n)) {
+    return NotInteger();
+  }
+  v->str = to_string(++n);
+  wrote = true;
+  return MakeInteger(n);
+}
+
+redisReply *MemStorage::cmdDel(const string_view *argv, size_t argc,
+                               bool &wrote) {
+  long long removed = 0;
+  for (size_t i = 1; i < argc; i++) {
+    MemMap<Value> &data = shardOf(argv[i]).data;
+    auto it = data.find(argv[i]);
+    if (it != data.end()) {
+      data.erase(it);
+      removed++;
+    }
+  }
+  wrote = removed > 0;
+  return MakeInteger(removed);
+}
+
+redisReply *MemStorage::cmdHset(const string_view *argv, size_t argc,
+                                bool &wrote) {
+  if (argc % 2 != 0) {
+    return MakeError("ERR wrong number of arguments for 'hset' command");
+  }
+  redisReply *err = nullptr;
+  Value *v = obtain(argv[1], MEM_HASH, err);
+  if (err != nullptr) {
+    return err;
+  }
+  long long added = 0;
+  for (size_t i = 2; i + 1 < argc; i += 2) {
+    added += v->fields.set(argv[i], argv[i + 1]);
+  }
+  wrote = true;
+  return MakeInteger(added);
+}
+
+redisReply *MemStorage::cmdHget(const string_view *argv, size_t, bool &) {
+  redisReply *err = nullptr;
+  Value *v = lookup(argv[1], MEM_HASH, err);
+  if (err != nullptr) {
+    return err;
+  }
+  string *value = v == nullptr ? nullptr : v->fields.find(argv[2]);
+  return value == nullptr ? MakeNil() : MakeString(*value);
+}
+
+redisReply *MemStorage::cmdHmget(const string_view *argv, size_t argc, bool &) {
+  redisReply *err = nullptr;
+  Value *v = lookup(argv[1], MEM_HASH, err);
+  if (err != nullptr) {
+    return err;
+  }
+  vector<redisReply *> values;
+  for (size_t i = 2; i < argc; i++) {
+    string *value = v == nullptr ? nullptr : v->fields.find(argv[i]);
+    values.push_back(value == nullptr ? MakeNil() : MakeString(*value));
+  }
+  return MakeArray(values);
+}
+
+redisReply *MemStorage::cmdHgetall(const string_view *argv, size_t, bool &) {
+  redisReply *err = nullptr;
+  Value *v = lookup(argv[1], MEM_HASH, err);
+  if (err != nullptr) {
+    return err;
+  }
+  vector<redisReply *> items;
+  if (v != nullptr) {
+    v->fields.each([&](const string &field, const string &value) {
+      items.push_back(MakeString(field));
+      items.push_back(MakeString(value));
+    });
+  }
+  return MakeArray(items);
+}
+
+redisReply *MemStorage::cmdHkeys(const string_view *argv, size_t, bool &) {
+  redisReply *err = nullptr;
+  Value *v = lookup(argv[1], MEM_HASH, err);
+  if (err != nullptr) {
+    return err;
+  }
+  vector<redisReply *> keys;
+  if (v != nullptr) {
+    v->fields.each([&](const string &field, const string &) {
+      keys.push_back(MakeString(field));
+    });
+  }
+  return MakeArray(keys);
+}
+
+redisReply *MemStorage::cmdHlen(const string_view *argv, size_t, bool &) {
+  redisReply *err = nullptr;
+  Value *v = lookup(argv[1], MEM_HASH, err);
+  if (err != nullptr) {
+    return err;
+  }
+  return MakeInteger(v == nullptr ? 0 : v->fields.size());
+}
+
+redisReply *MemStorage::cmdHexists(const string_view *argv, size_t, bool &) {
+  redisReply *err = nullptr;
+  Value *v = lookup(argv[1], MEM_HASH, err);
+  if (err != nullptr) {
+    return err;
+  }
+  return MakeInteger(v != nullptr && v->fields.find(argv[2]) != nullptr);
+}
+
+redisReply *MemStorage::cmdHdel(const string_view *argv, size_t argc,
+                                bool &wrote) {
+  redisReply *err = nullptr;
+  Value *v = lookup(argv[1], MEM_HASH, err);
+  if (err != nullptr || v == nullptr) {
+    return err != nullptr ? err : MakeInteger(0);
+  }
+  long long removed = 0;
+  for (size_t i = 2; i < argc; i++) {
+    removed += v->fields.erase(argv[i]);
+  }
+  if (v->fields.size() == 0) {
+    remove(argv[1]);
+  }
+  wrote = removed > 0;
+  return MakeInteger(removed);
+}
+
+redisReply *MemStorage::cmdHincrby(const string_view *argv, size_t,
+                                   bool &wrote) {
+  long long delta, n = 0;
+  if (!ToInteger(argv[3], delta)) {
+    return NotInteger();
+  }
+  redisReply *err = nullptr;
+  Value *v = obtain(argv[1], MEM_HASH, err);
+  if (err != nullptr) {
+    return err;
+  }
+  string *value = v->fields.find(argv[2]);
+  if (value != nullptr && !ToInteger(*value, n)) {
+    return MakeError("ERR hash value is not an integer");
+  }
+  n += delta;
+  v->fields.set(argv[2], to_string(n));
+  wrote = true;
+  return MakeInteger(n);
+}
+
+redisReply *MemStorage::cmdSadd(const string_view *argv, size_t argc,
+                                bool &wrote) {
+  redisReply *err = nullptr;
+  Value *v = obtain(argv[1], MEM_SET, err);
+  if (err != nullptr) {
+    return err;
+  }
+  long long added = 0;
+  for (size_t i = 2; i < argc; i++) {
+    added += v->fields.set(argv[i], "");
+  }
+  wrote = added > 0;
+  return MakeInteger(added);
+}
+
+redisReply *MemStorage::cmdSrem(const string_view *argv, size_t argc,
+                                bool &wrote) {
+  redisReply *err = nullptr;
+  Value *v = lookup(argv[1], MEM_SET, err);
+  if (err != nullptr || v == nullptr) {
+    return err != nullptr ? err : MakeInteger(0);
+  }
+  long long removed = 0;
+  for (size_t i = 2; i < argc; i++) {
+    removed += v->fields.erase(argv[i]);
+  }
+  if (v->fields.size() == 0) {
+    remove(argv[1]);
+  }
+  wrote = removed > 0;
+  return MakeInteger(removed);
+}
+
+redisReply *MemStorage::cmdSismember(const string_view *argv, size_t, bool &) {
+  redisReply *err = nullptr;
+  Value *v = lookup(argv[1], MEM_SET, err);
+  if (err != nullptr) {
+    return err;
+  }
+  return MakeInteger(v != nullptr && v->fields.find(argv[2]) != nullptr);
+}
+
+redisReply *MemStorage::cmdSmembers(const string_view *argv, size_t, bool &) {
+  redisReply *err = nullptr;
+  Value *v = lookup(argv[1], MEM_SET, err);
+  if (err != nullptr) {
+    return err;
+  }
+  vector<redisReply *> members;
+  if (v != nullptr) {
+    v->fields.each([&](const string &member, const string &) {
+      members.push_back(MakeString(member));
+    });
+  }
+  return MakeArray(members);
+}
+
+redisReply *MemStorage::cmdScard(const string_view *argv, size_t, bool &) {
+  redisReply *err = nullptr;
+  Value *v = lookup(argv[1], MEM_SET, err);
+  if (err != nullptr) {
+    return err;
+  }
+  return MakeInteger(v == nullptr ? 0 : v->fields.size());
+}
+
+redisReply *MemStorage::cmdLpush(const string_view *argv, size_t argc,
+                                 bool &wrote) {
+  redisReply *err = nullptr;
+  Value *v = obtain(argv[1], MEM_LIST, err);
+  if (err != nullptr) {
+    return err;
+  }
+  for (size_t i = 2; i < argc; i++) {
+    v->list.emplace_front(argv[i]);
+  }
+  wrote = true;
+  return MakeInteger(v->list.size());
+}
+
+redisReply *MemStorage::cmdLrange(const string_view *argv, size_t, bool &) {
+  long long start, stop;
+  if (!ToInteger(argv[2], start) || !ToInteger(argv[3], stop)) {
+    return NotInteger();
+  }
+  redisReply *err = nullptr;
+  Value *v = lookup(argv[1], MEM_LIST, err);
+  if (err != nullptr) {
+    return err;
+  }
+  vector<redisReply *> items;
+  if (v != nullptr && ToRange(v->list.size(), start, stop)) {
+    for (long long i = start; i <= stop; i++) {
+      items.push_back(MakeString(v->list[i]));
+    }
+  }
+  return MakeArray(items);
+}
+
+redisReply *MemStorage::cmdLlen(const string_view *argv, size_t, bool &) {
+  redisReply *err = nullptr;
+  Value *v = lookup(argv[1], MEM_LIST, err);
+  if (err != nullptr) {
+    return err;
+  }
+  return MakeInteger(v == nullptr ? 0 : v->list.size());
+}
+
+redisReply *MemStorage::cmdLtrim(const string_view *argv, size_t, bool &wrote) {
+  long long start, stop;
+  if (!ToInteger(argv[2], start) || !ToInteger(argv[3], stop)) {
+    return NotInteger();
+  }
+  redisReply *err = nullptr;
+  Value *v = lookup(argv[1], MEM_LIST, err);
+  if (err != nullptr || v == nullptr) {
+    return err != nullptr ? err : MakeStatus("OK");
+  }
+  if (!ToRange(v->list.size(), start, stop)) {
+    remove(argv[1]);
+  } else {
+    v->list.erase(v->list.begin() + stop + 1, v->list.end());
+    v->list.erase(v->list.begin(), v->list.begin() + start);
+  }
+  wrote = true;
+  return MakeStatus("OK");
+}
+
+#endif
@@ -3,7 +3,24 @@
 
 #include "../lib/Color.hpp"
 #include "../lib/Command.hpp"
+#include "Affinity.hpp"
+#include "Archive.hpp"
+#include "Coroutine.hpp"
+#include "FanOut.hpp"
+#include "FriendGraph.hpp"
+#include "GroupOnline.hpp"
+#include "Log.hpp"
+#include "MemStorage.hpp"
+#include "Presence.hpp"
 #include "TCPServer.hpp"
+#include "RedisAsync.hpp"
+#include "Scripts.hpp"
+#include "SearchIndex.hpp"
+#include "Session.hpp"
+#include "TaskQueue.hpp"
+#include "UnreadCounter.hpp"
+#include "UnreadSummary.hpp"
+#include "UserCache.hpp"
 #include "redis.hpp"
 #include <bits/types/FILE.h>
 #include <cstdio>
@@ -13,6 +30,8 @@
 #include <sys/epoll.h>
 #include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <unordered_map>
+#include <unordered_set>
 
 #define SETRECVFD -1
 #define QUIT 0
@@ -52,37 +71,86 @@
 #define SENDFILE_G 34
 #define RECVFILE_G 35
 #define DISSOLVE 36
+#define SEARCH 37
+#define HISTORY 38
+
+// 线程池的调度通道
+#define LANE_INTERACTIVE 0 // 登录、聊天消息等交互命令
+#define LANE_HISTORY 1     // 列表和历史记录
+#define LANE_BULK 2        // 文件传输
+#define LANE_ADMIN 3       // 群管理
+
+#define HISTORY_PAGE 64   // 历史记录每帧打包的行数
+#define HISTORY_OLDER 100 // 聊天里往前翻一次从归档读的消息数
+#define OLDER_FRAME "@older" // 归档里还有多少条更早的消息
 
 using namespace std;
-extern Redis redis;
+extern RedisPool redisPool; // 处理命令时从这里借连接，借到的连接为当前线程的redis
+extern UnreadCounter unreadCounter; // 未读计数都经过这里修改
+extern UserCache userCache;         // 热点用户字段的缓存
+extern FanOut fanOut;               // 通知套接字的推送都经过这里
+extern Archive archive;             // 历史消息的冷热分层
+extern SearchIndex searchIndex;     // 聊天记录的全文索引
+extern Presence presence;           // 在线状态的位图
+extern FriendGraph friendGraph;     // 好友关系的进程内索引
+extern GroupOnline groupOnline;     // 各群在线成员的索引
+extern UnreadSummary unreadSummary; // 在线用户的未读概要
 extern int epfd;
 struct Argc_func {
 public:
   Argc_func(TcpSocket fd_class, string command_string)
       : cfd_class(fd_class), command_string(command_string) {}
+  // 恢复一个等待I/O的协程
+  Argc_func(coroutine_handle<> handle) : cfd_class(-1), handle(handle) {}
   TcpSocket cfd_class;
   string command_string;
+  coroutine_handle<> handle; // 非空时任务函数只恢复该协程
 };
 
 void my_error(const char *errorMsg); // 错误函数
 string GetNowTime();                 // h获得当前时间
+string FormatTime(time_t t);         // 消息里展示的时间格式
+string GroupHead(const string &gid); // 群的消息序号
+string RenderChat(const Message &rec, const string &viewer,
+                  const string &name); // 按查看者展示一条私聊记录
+int LaneOf(int flag);                // 命令所属的调度通道
+vector<LaneConfig> ChatLanes();      // 调度通道配置
 void taskfunc(void *arg);            // 处理一条命令的任务函数
+void ShedTask(void *arg);            // 命令被丢弃时的快速失败回复
+void RearmFd(int fd);                // 命令处理完后把客户端的符重新挂回epoll
+void AbortConn(int fd);              // 协程等不到套接字就绪时断开连接
+CoDetached coTaskfunc(CoTask<void> handler, int fd); // 运行协程处理函数
 void Login(TcpSocket cfd_class, Command command);
 void Register(TcpSocket cfd_class, Command command);
 void AddFriend(TcpSocket cfd_class, Command command);
 void AddGroup(TcpSocket cfd_class, Command command);
 void AgreeAddFriend(TcpSocket cfd_class, Command command);
-void ListFriend(TcpSocket cfd_class, Command command);
-void ChatFriend(TcpSocket cfd_class, Command command);
-void ChatGroup(TcpSocket cfd_class, Command command);
+struct ChatHistory {
+  vector<string> recent; // redis里的最近消息，从旧到新
+  uint64_t archived = 0; // 归档里更早的消息数
+};
+CoTask<ChatHistory> LoadHistory(string key, int lane); // 进入聊天时展示的历史
+void SendFriendLines(TcpSocket &cfd_class, const string &uid,
+                     const string &name, const vector<string> &msgs);
+CoTask<void> SendGroupLines(TcpSocket cfd_class, string uid,
+                            vector<string> msgs, int lane);
+CoTask<void> LoadFriends(string uid, int lane); // 好友关系读进内存
+CoTask<unordered_map<string, string>>
+LoadNicknames(vector<string> uids, int lane); // 一批用户的昵称
+CoTask<void> ListFriend(TcpSocket cfd_class, Command command);
+CoTask<void> ChatFriend(TcpSocket cfd_class, Command command);
+CoTask<void> ChatGroup(TcpSocket cfd_class, Command command);
+CoTask<void> History(TcpSocket cfd_class, Command command);
 void FriendMsg(TcpSocket cfd_class, Command command);
 void GroupMsg(TcpSocket cfd_class, Command command);
+void PushGroup(const string &gid, const string &me, const string &show,
+               const string &notice); // 群消息推给在线的其他成员
 void ExitChatGroup(TcpSocket cfd_class, Command command);
 void ExitChatFriend(TcpSocket cfd_class, Command command);
 void ShieldFriend(TcpSocket cfd_class, Command command);
 void DeleteFriend(TcpSocket cfd_class, Command command);
 void Restorefriend(TcpSocket cfd_class, Command command);
-void NewMessage(TcpSocket cfd_class, Command command);
+CoTask<void> NewMessage(TcpSocket cfd_class, Command command);
 void LookSystem(TcpSocket cfd_class, Command command);
 void LookNotice(TcpSocket cfd_class, Command command);
 void RefuseAddFriend(TcpSocket cfd_class, Command command);
@@ -98,31 +166,135 @@ void ExitGroup(TcpSocket cfd_class, Command command);
 void DisplyMember(TcpSocket cfd_class, Command command);
 void RemoveMember(TcpSocket cfd_class, Command command);
 void InfoXXXX(TcpSocket cfd_class, Command command);
-void SendFile(TcpSocket cfd_class, Command command);
-void RecvFile(TcpSocket cfd_class, Command command);
-void SendFile_G(TcpSocket cfd_class, Command command);
-void RecvFile_G(TcpSocket cfd_class, Command command);
+CoTask<void> SendFile(TcpSocket cfd_class, Command command);
+CoTask<void> RecvFile(TcpSocket cfd_class, Command command);
+CoTask<void> SendFile_G(TcpSocket cfd_class, Command command);
+CoTask<void> RecvFile_G(TcpSocket cfd_class, Command command);
 void Dissolve(TcpSocket cfd_class, Command command);
+CoTask<void> Search(TcpSocket cfd_class, Command command);
 
 void my_error(const char *errorMsg) {
-  cout << errorMsg << endl;
-  strerror(errno);
+  LOG_ERROR("{}: {}", errorMsg, strerror(errno));
+  Logger::stop();
   exit(1);
 }
-string GetNowTime() {
-  time_t nowtime;
-  struct tm *p;
-  time(&nowtime);
-  p = localtime(&nowtime);
-  string t = "-";
-  string now_time = TILT + t + to_string(p->tm_hour) + ":" +
-                    to_string(p->tm_min) + t + to_string(p->tm_mon + 1) + "." +
+string GetNowTime() { return FormatTime(time(NULL)); }
+string FormatTime(time_t t) {
+  struct tm tm;
+  localtime_r(&t, &tm);
+  struct tm *p = &tm;
+  string s = "-";
+  string now_time = TILT + s + to_string(p->tm_hour) + ":" +
+                    to_string(p->tm_min) + s + to_string(p->tm_mon + 1) + "." +
                     to_string(p->tm_mday) + NONE;
   return now_time;
 }
+// 私聊记录两人共用一份，自己发的展示成"我"，对方发的用查看者给对方的备注，
+// 改了备注历史记录也跟着变；发送时被屏蔽的记录对接收者不展示，返回空串
+string RenderChat(const Message &rec, const string &viewer,
+                  const string &name) {
+  if (rec.kind == MSG_BEGIN) {
+    return "*********************";
+  }
+  bool mine = rec.SendUid == viewer;
+  if (rec.hidden && !mine) {
+    return "";
+  }
+  string who = mine ? "我" : name;
+  string when = ".........." + FormatTime(atol(rec.t_time.c_str()));
+  if (rec.kind == MSG_SENDFILE) {
+    return who + "发送了文件：" + rec.content + when;
+  }
+  if (rec.kind == MSG_RECVFILE) {
+    return who + "接收了文件：" + rec.content + when;
+  }
+  return who + "：" + rec.content + when;
+}
+// 群聊的未读数不逐个成员计数：每条群消息让群的消息序号+1，成员在"uid的群聊已读"里
+// 记下读到的序号，未读数就是两者之差，发一条消息的开销与群的大小无关
+string GroupHead(const string &gid) {
+  string head = redis->getValue(gid + "的消息序号");
+  return head.empty() ? "0" : head;
+}
+int LaneOf(int flag) {
+  switch (flag) {
+  case LISTFRIEND:
+  case CHATFRIEND:
+  case CHATGROUP:
+  case LOOKSYSTEM:
+  case LOOKNOTICE:
+  case LISTGROUP:
+  case ABOUTGROUP:
+  case REQUSTLIST:
+  case DISPLAYMEMBER:
+  case SEARCH:
+  case HISTORY:
+    return LANE_HISTORY;
+  case SENDFILE:
+  case RECVFILE:
+  case SENDFILE_G:
+  case RECVFILE_G:
+    return LANE_BULK;
+  case CREATEGROUP:
+  case PASSAPPLY:
+  case DENYAPPLY:
+  case SETMEMBER:
+  case EXITGROUP:
+  case REMOVEMEMBER:
+  case DISSOLVE:
+    return LANE_ADMIN;
+  default:
+    return LANE_INTERACTIVE;
+  }
+}
+// 默认配置可用环境变量CHATROOM_LANES覆盖，按通道顺序写"权重:保留线程数[:截止时间ms[:SLO ms]]"，
+// 用';'分隔，如"8:1:3000:1000;4:0;1:0;2:0"
+// 文件传输通道还承载协程的恢复，不能设截止时间
+vector<LaneConfig> ChatLanes() {
+  vector<LaneConfig> lanes = {{"交互", 8, 1, 3000, 1000},
+                              {"列表历史", 4, 0, 5000, 2000},
+                              {"文件传输", 1, 0, 0, 0},
+                              {"群管理", 2, 0, 5000, 0}};
+  const char *env = getenv("CHATROOM_LANES");
+  if (env == nullptr) {
+    return lanes;
+  }
+  string conf(env);
+  size_t pos = 0;
+  for (LaneConfig &lane : lanes) {
+    if (pos > conf.size()) {
+      break;
+    }
+    size_t end = conf.find(';', pos);
+    if (end == string::npos) {
+      end = conf.size();
+    }
+    string item = conf.substr(pos, end - pos);
+    pos = end + 1;
+    int weight, reserved;
+    int deadlineMs = lane.deadlineMs, sloMs = lane.sloMs;
+    if (sscanf(item.c_str(), "%d:%d:%d:%d", &weight, &reserved, &deadlineMs,
+               &sloMs) >= 2) {
+      lane.weight = weight;
+      lane.reserved = reserved;
+      lane.deadlineMs = deadlineMs;
+      lane.sloMs = sloMs;
+    } else if (!item.empty()) {
+      LOG_WARN("CHATROOM_LANES中的通道配置格式错误: {}", item);
+    }
+  }
+  return lanes;
+}
 // 任务函数，获取客户端发来的命令，解析命令进入不同模块，并进行回复
 void taskfunc(void *arg) {
   Argc_func *argc_func = static_cast<Argc_func *>(arg);
+  // 本次处理期间借用一个redis连接，协程挂起时随任务结束一起归还，恢复时重新借
+  RedisGuard redisGuard(redisPool);
+  // 协程等待的I/O已就绪，在当前工作线程上继续执行它
+  if (argc_func->handle) {
+    argc_func->handle.resume();
+    return;
+  }
   Command command; // Command类存客户端的命令内容
   TcpSocket cfd_class = argc_func->cfd_class; // TcpSocket类用于通信
   command.From_Json(
@@ -147,14 +319,14 @@ void taskfunc(void *arg) {
     AgreeAddFriend(cfd_class, command);
     break;
   case LISTFRIEND:
-    ListFriend(cfd_class, command);
-    break;
+    coTaskfunc(ListFriend(cfd_class, command), cfd_class.getfd());
+    return;
   case CHATFRIEND:
-    ChatFriend(cfd_class, command);
-    break;
+    coTaskfunc(ChatFriend(cfd_class, command), cfd_class.getfd());
+    return;
   case CHATGROUP:
-    ChatGroup(cfd_class, command);
-    break;
+    coTaskfunc(ChatGroup(cfd_class, command), cfd_class.getfd());
+    return;
   case FRIENDMSG:
     FriendMsg(cfd_class, command);
     break;
@@ -177,8 +349,8 @@ void taskfunc(void *arg) {
     Restorefriend(cfd_class, command);
     break;
   case NEWMESSAGE:
-    NewMessage(cfd_class, command);
-    break;
+    coTaskfunc(NewMessage(cfd_class, command), cfd_class.getfd());
+    return;
   case LOOKSYSTEM:
     LookSystem(cfd_class, command);
     break;
@@ -222,45 +394,99 @@ void taskfunc(void *arg) {
     InfoXXXX(cfd_class, command);
     break;
   case SENDFILE:
-    SendFile(cfd_class, command);
-    break;
+    coTaskfunc(SendFile(cfd_class, command), cfd_class.getfd());
+    return;
   case RECVFILE:
-    RecvFile(cfd_class, command);
-    break;
+    coTaskfunc(RecvFile(cfd_class, command), cfd_class.getfd());
+    return;
   case SENDFILE_G:
-    SendFile_G(cfd_class, command);
-    break;
+    coTaskfunc(SendFile_G(cfd_class, command), cfd_class.getfd());
+    return;
   case RECVFILE_G:
-    RecvFile_G(cfd_class, command);
-    break;
+    coTaskfunc(RecvFile_G(cfd_class, command), cfd_class.getfd());
+    return;
   case DISSOLVE:
     Dissolve(cfd_class, command);
     break;
+  case SEARCH:
+    coTaskfunc(Search(cfd_class, command), cfd_class.getfd());
+    return;
+  case HISTORY:
+    coTaskfunc(History(cfd_class, command), cfd_class.getfd());
+    return;
   }
+  RearmFd(cfd_class.getfd());
+}
+// 命令排队超时或因过载被拒绝：回复"busy"让客户端不必一直等，并上符接收下一条命令。
+// 过载时由反应堆直接调用，所以回复只能非阻塞地发一次：客户端每条命令只等一个回复，
+// 发送缓冲区正常是空的，一帧总能写完；写不进去或只写进一部分说明客户端早就不读了，
+// 半帧会让后面的回复错位，干脆断开连接。写完或断开之后才上符
+void ShedTask(void *arg) {
+  Argc_func *argc_func = static_cast<Argc_func *>(arg);
+  // 协程已经在处理中途，不能丢弃，照常恢复；恢复的任务入队时已标为不可丢弃，
+  // 这里只是兜底，和taskfunc一样先借连接
+  if (argc_func->handle) {
+    RedisGuard redisGuard(redisPool);
+    argc_func->handle.resume();
+    return;
+  }
+  LOG_DEBUG("丢弃命令: {}", argc_func->command_string);
+  int fd = argc_func->cfd_class.getfd();
+  // 按sendMsg的格式成帧：4字节大端长度 + "busy"
+  static const char frame[] = {0, 0, 0, 4, 'b', 'u', 's', 'y'};
+  ssize_t n;
+  do {
+    n = send(fd, frame, sizeof(frame), MSG_DONTWAIT | MSG_NOSIGNAL);
+  } while (n == -1 && errno == EINTR);
+  if (n != static_cast<ssize_t>(sizeof(frame))) {
+    AbortConn(fd);
+  }
+  RearmFd(fd);
+}
+void RearmFd(int fd) {
   struct epoll_event temp;
-  temp.data.fd = cfd_class.getfd();
+  temp.data.fd = fd;
   temp.events = EPOLLIN;
-  epoll_ctl(epfd, EPOLL_CTL_ADD, cfd_class.getfd(), &temp);
+  epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &temp);
+}
+// 关闭连接的双向读写，但不关符：协程结束后照常上符，反应堆读到断开，
+// 走和客户端主动断开一样的下线清理
+void AbortConn(int fd) {
+  LOG_WARN("套接字{}无法等待就绪，断开连接", fd);
+  shutdown(fd, SHUT_RDWR);
+}
+// 协程处理函数在等待I/O时会让出工作线程，全部执行完后才上符接收下一条命令
+CoDetached coTaskfunc(CoTask<void> handler, int fd) {
+  co_await handler;
+  RearmFd(fd);
 }
 void Login(TcpSocket cfd_class, Command command) {
-  // 从数据库调取对应数据进行核对，并回复结果
-  if (!redis.sismember("用户uid集合",
-                       command.m_uid)) { // 如果没有账号，返回错误
+  // 从数据库调取对应数据进行核对，并回复结果：账号是否存在、密码、在线状态一次取回
+  RedisBatch check(redis);
+  check.add({"SISMEMBER", "用户uid集合", command.m_uid});
+  check.add({"HGET", command.m_uid, "密码"});
+  check.add({"HEXISTS", Session::onlineKey(), command.m_uid});
+  check.exec();
+  if (check.integer(0) == 0) { // 如果没有账号，返回错误
     cfd_class.sendMsg("incorrect");
   } else { // 否则账号存在，通过uid找到这个用户的哈希表，进行密码匹配和登录工作
-    string pwd = redis.gethash(command.m_uid, "密码");
+    string pwd = check.str(1);
     if (pwd != command.m_option[0]) { // 密码错误
       cfd_class.sendMsg("incorrect");
-    } else if (redis.gethash(command.m_uid, "在线状态") != "-1") { // 用户在登录
+    } else if (check.integer(2) != 0) { // 用户在登录
       cfd_class.sendMsg("online");
-    } else { // 可以登录，并改变登录状态
-      redis.hsetValue(command.m_uid, "在线状态", to_string(cfd_class.getfd()));
-      redis.hsetValue("fd-uid对应表", to_string(cfd_class.getfd()),
-                      command.m_uid);
-      redis.hsetValue(command.m_uid, "聊天对象", "0");
-      redis.hsetValue(command.m_uid, "通知套接字", "-1");
+    } else { // 可以登录，并在一个事务里改变登录状态
+      string fd = to_string(cfd_class.getfd());
+      RedisBatch login(redis, true);
+      login.add({"HSET", command.m_uid, "聊天对象", "0", "通知套接字", "-1"});
+      login.add({"HSET", Session::onlineKey(), command.m_uid, fd});
+      login.add({"HSET", Session::fdKey(), fd, command.m_uid});
+      login.exec();
+      userCache.invalidate(command.m_uid);
+      presence.set(command.m_uid, true);
+      groupOnline.login(command.m_uid);
       cfd_class.sendMsg("ok");
-      cout << "用户" << command.m_uid << "登录成功" << endl;
+      LOG_INFO("用户{}登录成功", command.m_uid);
     }
   }
   return;
@@ -269,54 +495,43 @@ void Register(TcpSocket cfd_class, Command command) {
   srand((unsigned)time(NULL));
   while (true) {
     string new_uid = to_string((rand() + 1111) % 10000);
-    if (redis.sismember(
+    if (redis->sismember(
             "用户uid集合",
             new_uid)) { // 直到随机一个未注册  uid发过去，并建立账号基本信息
       continue;
     } else if (stoi(new_uid) < 1000) {
       continue;
     } else {
-      redis.saddvalue("用户uid集合", new_uid);
-      redis.hsetValue(new_uid, "账号", new_uid);
-      redis.hsetValue(new_uid, "密码", command.m_option[0]);
-      redis.hsetValue(new_uid, "昵称", new_uid);
-      redis.hsetValue(new_uid, "在线状态", "-1");
-      redis.hsetValue(new_uid, "性别", "未知");
-      redis.hsetValue(new_uid, "其他信息", "无");
-      redis.hsetValue(new_uid, "通知套接字", "-1");
-      redis.hsetValue(new_uid, "聊天对象", "无");
-      redis.hsetValue(new_uid + "的未读消息", "系统消息", "0");
-      redis.hsetValue(new_uid + "的未读消息", "通知消息", "0");
+      // 账号基本信息在一个事务里一次写入
+      RedisBatch account(redis, true);
+      account.add({"SADD", "用户uid集合", new_uid});
+      account.add({"HSET", new_uid, "账号", new_uid, "密码",
+                   command.m_option[0], "昵称", new_uid, "性别", "未知",
+                   "其他信息", "无", "通知套接字", "-1", "聊天对象", "无"});
+      account.add({"HSET", new_uid + "的未读消息", "系统消息", "0", "通知消息",
+                   "0"});
+      account.exec();
       cfd_class.sendMsg(new_uid);
-      cout << "用户" << new_uid << "注册成功" << endl;
+      LOG_INFO("用户{}注册成功", new_uid);
       return;
     }
   }
 }
 void AddFriend(TcpSocket cfd_class, Command command) {
   // 账号不存在就通知客户端并返回
-  if (!redis.sismember("用户uid集合", command.m_option[0])) {
+  if (!redis->sismember("用户uid集合", command.m_option[0])) {
     cfd_class.sendMsg("nofind");
     return;
   }
-  // 判断账号是否已经是自己的好友
-  int friendNum = redis.hlen(command.m_uid + "的好友列表"); // 获得好友数量
-  if (friendNum !=
-      0) { // 好友数量不为0时，列表中可能已经有准好友，为0时肯定没有，跳过此步骤
-    redisReply **f_uid =
-        redis.hkeys(command.m_uid + "的好友列表"); // 得到好友列表
-    for (int i = 0; i < friendNum; i++) { // 遍历好友列表，看看账号是否在里面
-      if (f_uid[i]->str ==
-          command.m_option[0]) { // 账号已在列表中就告诉客户端并停止添加好友
-        cfd_class.sendMsg("had");
-        return;
-      }
-    }
+  // 账号已经是自己的好友就告诉客户端并停止添加好友
+  if (friendGraph.isFriend(command.m_uid, command.m_option[0])) {
+    cfd_class.sendMsg("had");
+    return;
   }
   // 自己的系统消息里如果有对方发来的未处理的申请，就不能发送申请，通知客户端
-  if (redis.hashexists(command.m_uid + "的系统消息", command.m_option[0])) {
+  if (redis->hashexists(command.m_uid + "的系统消息", command.m_option[0])) {
     string msg =
-        redis.gethash(command.m_uid + "的系统消息", command.m_option[0]);
+        redis->gethash(command.m_uid + "的系统消息", command.m_option[0]);
     string pass(msg.end() - 11, msg.end());
     if (pass == "(未处理)") {
       cfd_class.sendMsg("cannot1");
@@ -324,9 +539,9 @@ void AddFriend(TcpSocket cfd_class, Command command) {
     }
   }
   // 对方的系统消息里如果自己发过去的未处理的申请，就不能发送申请，通知客户端
-  if (redis.hashexists(command.m_option[0] + "的系统消息", command.m_uid)) {
+  if (redis->hashexists(command.m_option[0] + "的系统消息", command.m_uid)) {
     string msg =
-        redis.gethash(command.m_option[0] + "的系统消息", command.m_uid);
+        redis->gethash(command.m_option[0] + "的系统消息", command.m_uid);
     string pass(msg.end() - 11, msg.end());
     if (pass == "(未处理)") {
       cfd_class.sendMsg("cannot2");
@@ -338,522 +553,555 @@ void AddFriend(TcpSocket cfd_class, Command command) {
   string wait = "(未处理)";
   string apply = "来自" + command.m_uid + "的好友申请：" + command.m_option[1] +
                  GetNowTime() + wait;
-  redis.hsetValue(command.m_option[0] + "的系统消息", command.m_uid, apply);
+  redis->hsetValue(command.m_option[0] + "的系统消息", command.m_uid, apply);
   // 被申请者未读消息中的系统消息数量+1
-  string num = redis.gethash(command.m_option[0] + "的未读消息", "系统消息");
-  redis.hsetValue(command.m_option[0] + "的未读消息", "系统消息",
-                  to_string(stoi(num) + 1));
+  unreadCounter.add(command.m_option[0], "系统消息");
   // 如果准好友在线，给他的通知套接字一个提醒
-  string online = redis.gethash(command.m_option[0], "在线状态");
+  string online = userCache.get(command.m_option[0], UF_ONLINE);
   if (online != "-1") {
-    string friend_recvfd = redis.gethash(command.m_option[0], "通知套接字");
-    TcpSocket friendFd_class(stoi(friend_recvfd));
+    string friend_recvfd = userCache.get(command.m_option[0], UF_NOTIFY_FD);
+    PushSocket friendFd_class(stoi(friend_recvfd));
     friendFd_class.sendMsg("收到一条好友申请." + GetNowTime());
   }
   cfd_class.sendMsg("ok");
 }
 void AddGroup(TcpSocket cfd_class, Command command) {
-  // 群聊不存在，通知客户端
-  if (!redis.sismember("群聊集合", command.m_option[0])) {
-    cfd_class.sendMsg("nofind");
-    return;
-  }
-  // 群聊存在,判断用户是否已在该群聊里
-  int GroupNum = redis.hlen(command.m_uid + "的群聊列表");
-  if (GroupNum !=
-      0) { // 群聊数量不为0时，列表中可能已经有该群聊,为0时可定没有，跳过此步骤
-    redisReply **g_uid =
-        redis.hkeys(command.m_uid + "的群聊列表"); // 得到群聊列表
-    for (int i = 0; i < GroupNum; i++) { // 遍历群聊列表，看看该群聊是否在里面
-      if (g_uid[i]->str ==
-          command
-              .m_option[0]) { // 该群聊已在列表中就告诉客户端并停止申请添加群聊
-        cfd_class.sendMsg("had");
-        return;
-      }
-    }
-  }
-  // 用户不在群聊里，就查看该群聊的申请队列里是否已有该用户未处理的申请消息
-  if (redis.hashexists(command.m_option[0] + "的申请列表", command.m_uid)) {
-    string msg =
-        redis.gethash(command.m_option[0] + "的申请列表", command.m_uid);
-    string pass(msg.end() - 11, msg.end());
-    if (pass == "(未处理)") {
-      cfd_class.sendMsg("cannot");
-      return;
-    }
-  }
-  // 没有未处理的申请就添加申请进该群聊的申请队列
+  // 群聊是否存在、是否已在群里、是否有未处理的申请，写入申请并通知群主和管理员，在一个脚本里完成
   string wait = "(未处理)";
   string apply = "来自" + command.m_uid + "的入群申请：" + command.m_option[1] +
                  GetNowTime() + wait;
-  redis.hsetValue(command.m_option[0] + "的申请列表", command.m_uid, apply);
-  // 该群聊管理员和群主的未读消息中的通知消息数量 + 1
-  int num = redis.hlen(command.m_option[0] + "的群成员列表");
-  redisReply **members = redis.hkeys(command.m_option[0] + "的群成员列表");
-  for (int i = 0; i < num; i++) {
-    cout << "0" << endl;
-    string position =
-        redis.gethash(command.m_option[0] + "的群成员列表", members[i]->str);
-    if (position == "管理员" || position == "群主") {
-      string num = redis.gethash(
-          members[i]->str + static_cast<string>("的未读消息"), "通知消息");
-      redis.hsetValue(members[i]->str + string("的未读消息"), "通知消息",
-                      to_string(stoi(num) + 1));
-      redis.lpush(members[i]->str + static_cast<string>("的通知消息"),
-                  "您管理的群聊" + command.m_option[0] + "收到用户" +
-                      command.m_uid + "的入群申请." + GetNowTime());
-      // 如果群主或者管理员在线，给他的通知套接字一个提醒
-      string online = redis.gethash(members[i]->str, "在线状态");
-      if (online != "-1") {
-        string friend_recvfd = redis.gethash(members[i]->str, "通知套接字");
-        TcpSocket friendFd_class(stoi(friend_recvfd));
-        friendFd_class.sendMsg("您管理的群" + command.m_option[0] +
-                               "收到一条入群申请.");
-      }
+  string notice = "您管理的群聊" + command.m_option[0] + "收到用户" +
+                  command.m_uid + "的入群申请." + GetNowTime();
+  RedisReply result =
+      redis->eval(AddGroupScript, {command.m_uid, command.m_option[0], apply,
+                                   notice, Session::onlineKey()});
+  if (result.size() == 0) {
+    cfd_class.sendMsg("fail");
+    return;
+  }
+  // 群聊不存在(nofind)、已在群里(had)、已有未处理的申请(cannot)时通知客户端
+  if (result.view(0) != "ok") {
+    cfd_class.sendMsg(result[0]->str);
+    return;
+  }
+  // 群主和管理员的未读消息中的通知消息数量+1，在线的给他的通知套接字一个提醒
+  for (size_t i = 1; i + 1 < result.size(); i += 2) {
+    unreadCounter.add(result[i]->str, "通知消息");
+    if (result.view(i + 1) != "-1") {
+      PushSocket friendFd_class(stoi(result[i + 1]->str));
+      friendFd_class.sendMsg("您管理的群" + command.m_option[0] +
+                             "收到一条入群申请.");
     }
   }
   cfd_class.sendMsg("ok");
 }
 void AgreeAddFriend(TcpSocket cfd_class, Command command) {
-  // 看看自己的好友列表里是否已有该好友，没有就可以同意申请，有就不可以同意申请，回复had
-  if (redis.hlen(command.m_uid + "的好友列表") != 0 ||
-      !redis.hashexists(command.m_uid + "的好友列表", command.m_option[0])) {
-    // 系统消息列表里有没有他的申请
-    if (!redis.hashexists(command.m_uid + "的系统消息", command.m_option[0])) {
-      cfd_class.sendMsg("nofind");
-      return;
-    }
-    // 如果系统消息列表里有申请者的申请,但是已经处理过了，就不能在处理,只能处理申请状态为未处理的申请
-    string msg =
-        redis.gethash(command.m_uid + "的系统消息", command.m_option[0]);
-    string state(msg.end() - 11, msg.end());
-    if (state == "(已拒绝)" || state == "(已通过)") {
-      cfd_class.sendMsg("haddeal");
-      return;
-    }
-    // 更改自己这边的申请者的申请状态为已通过
-    string pass = "(已通过)";
-    string newmsg(msg.begin(), msg.end() - 11);
-    string Newmsg = newmsg + pass;
-    redis.hsetValue(command.m_uid + "的系统消息", command.m_option[0], Newmsg);
-    // 同意者的系统消息数量-1
-    string nownum = redis.gethash(command.m_uid + "的未读消息", "系统消息");
-    redis.hsetValue(command.m_uid + "的未读消息", "系统消息",
-                    (to_string(stoi(nownum) - 1)));
-    // 同意者的信息完善
-    string friend_mark0 = redis.gethash(command.m_option[0],
-                                        "昵称"); // 获得申请者的昵称作为默认备注
-    redis.hsetValue(
-        command.m_uid + "的好友列表", command.m_option[0],
-        friend_mark0); // 在同意者好友列表里插入申请者的uid和默认备注
-    redis.lpush(command.m_uid + "--" + command.m_option[0],
-                "*********************"); // 为同意者建一个聊天会话
-    // 申请者的信息完善
-    string friend_mark1 =
-        redis.gethash(command.m_uid, "昵称"); // 获得同意者的昵称
-    redis.hsetValue(
-        command.m_option[0] + "的好友列表", command.m_uid,
-        friend_mark1); // 在申请者的好友列表里插入申请者的uid和默认备注
-    redis.lpush(command.m_option[0] + "--" + command.m_uid,
-                "*********************"); // 为申请者建一个聊天会话
-    // 在申请者的通知消息里写入通过消息
-    redis.lpush(command.m_option[0] + "的通知消息",
-                command.m_uid + "通过了您的好友申请." + GetNowTime());
-    // 申请者未读消息中的通知消息数量+1
-    string num1 = redis.gethash(command.m_option[0] + "的未读消息", "通知消息");
-    redis.hsetValue(command.m_option[0] + "的未读消息", "通知消息",
-                    to_string(stoi(num1) + 1));
-    // 如果申请者在线，给他的通知套接字一个提醒
-    string online = redis.gethash(command.m_option[0], "在线状态");
-    if (online != "-1") {
-      string friend_recvfd = redis.gethash(command.m_option[0], "通知套接字");
-      TcpSocket friendFd_class(stoi(friend_recvfd));
-      friendFd_class.sendMsg(command.m_uid + "通过了您的好友申请.");
-    }
-  } else {
-    cfd_class.sendMsg("had");
+  // 检查申请状态并完善双方的好友信息，在一个脚本里原子完成
+  RedisReply result = redis->eval(
+      AgreeFriendScript,
+      {command.m_uid, command.m_option[0],
+       command.m_uid + "通过了您的好友申请." + GetNowTime(),
+       Message(command.m_uid, command.m_option[0], "", to_string(time(NULL)),
+               MSG_BEGIN)
+           .To_Json(),
+       Session::onlineKey()});
+  if (result.size() == 0) {
+    cfd_class.sendMsg("fail");
     return;
   }
+  // 已是好友(had)、没有申请(nofind)、申请已处理过(haddeal)时通知客户端
+  if (result.view(0) != "ok") {
+    cfd_class.sendMsg(result[0]->str);
+    return;
+  }
+  // 脚本改了双方的好友列表，下次重新读入
+  friendGraph.invalidate(command.m_uid);
+  friendGraph.invalidate(command.m_option[0]);
+  // 同意者的系统消息数量-1，申请者的通知消息数量+1
+  unreadCounter.add(command.m_uid, "系统消息", -1);
+  unreadCounter.add(command.m_option[0], "通知消息");
+  // 如果申请者在线，给他的通知套接字一个提醒
+  if (result.view(1) != "-1") {
+    PushSocket friendFd_class(stoi(result[2]->str));
+    friendFd_class.sendMsg(command.m_uid + "通过了您的好友申请.");
+  }
   cfd_class.sendMsg("ok");
   return;
 }
-void ListFriend(TcpSocket cfd_class, Command command) {
-  int friendNum =
-      redis.hlen(command.m_uid + "的好友列表"); // 获得好友列表的好友数量
-  if (friendNum == 0) {
+CoTask<void> ListFriend(TcpSocket cfd_class, Command command) {
+  // 好友、备注和屏蔽标记从好友图里一次取出，在线状态直接查进程内的位图
+  co_await LoadFriends(command.m_uid, LaneOf(command.m_flag));
+  vector<FriendGraph::Friend> friends = friendGraph.list(command.m_uid);
+  if (friends.empty()) {
     cfd_class.sendMsg("none");
-  } else {
-    // 好友数量不为0，就遍历好友列表，根据在线状态发送要展示的内容
-    redisReply **f_uid = redis.hkeys(command.m_uid + "的好友列表");
-    for (int i = 0; i < friendNum; i++) {
-      string friend_mark =
-          redis.gethash(command.m_uid + "的好友列表", f_uid[i]->str);
-      string isonline = redis.gethash(f_uid[i]->str, "在线状态");
-      if (!redis.sismember(command.m_uid + "的屏蔽列表", f_uid[i]->str)) {
-        if (isonline != "-1") {
-          cfd_class.sendMsg(L_GREEN + friend_mark + NONE + "(" + f_uid[i]->str +
-                            ")");
-        } else {
-          cfd_class.sendMsg(L_WHITE + friend_mark + NONE + "(" + f_uid[i]->str +
-                            ")");
-        }
-      }
+    co_return;
+  }
+  // 遍历好友列表，根据在线状态发送要展示的内容
+  for (const FriendGraph::Friend &f : friends) {
+    if (f.blocked) {
+      continue;
     }
-    cfd_class.sendMsg("end");
+    const char *color = presence.isOnline(f.uid) ? L_GREEN : L_WHITE;
+    cfd_class.sendMsg(color + f.remark + NONE + "(" + f.uid + ")");
+  }
+  cfd_class.sendMsg("end");
+}
+// 协程里先用异步连接把uid的好友关系读进好友图，之后对它的读不再访问redis
+CoTask<void> LoadFriends(string uid, int lane) {
+  if (friendGraph.loaded(uid)) {
+    co_return;
+  }
+  uint64_t ver = friendGraph.version(uid);
+  vector<vector<string>> query = FriendGraph::fetch(uid);
+  vector<RedisReply> got = co_await asyncBatch(query, lane);
+  friendGraph.fill(uid, got[0].get(), got[1].get(), ver);
+}
+// 昵称先查缓存，不命中的用户的整条记录用一个pipeline读回并填进缓存
+CoTask<unordered_map<string, string>> LoadNicknames(vector<string> uids,
+                                                    int lane) {
+  unordered_map<string, string> names;
+  vector<string> miss;
+  vector<uint64_t> vers;
+  vector<size_t> offsets; // 每个用户的命令在query里的起点
+  vector<vector<string>> query;
+  for (const string &uid : uids) {
+    if (userCache.lookup(uid, UF_NICKNAME, names[uid])) {
+      continue;
+    }
+    miss.push_back(uid);
+    vers.push_back(userCache.version(uid));
+    offsets.push_back(query.size());
+    for (vector<string> &cmd : UserCache::fetch(uid)) {
+      query.push_back(std::move(cmd));
+    }
+  }
+  if (miss.empty()) {
+    co_return names;
+  }
+  vector<RedisReply> got = co_await asyncBatch(query, lane);
+  for (size_t i = 0; i < miss.size(); i++) {
+    UserCache::Profile profile =
+        UserCache::parse(got[offsets[i]], got[offsets[i] + 1]);
+    userCache.fill(miss[i], profile, vers[i]);
+    names[miss[i]] = profile[UF_NICKNAME];
   }
+  co_return names;
 }
-void ChatFriend(TcpSocket cfd_class, Command command) {
-  // 好友数量是否为0
-  if (redis.hlen(command.m_uid + "的好友列表") == 0) {
+// 进入聊天时展示redis里的最近消息，归档里更早的只报条数，由客户端按需用HISTORY往前翻。
+// 列表和进度要对得上：前后各读一次进度，归档线程恰好在中间裁剪了列表就重读
+CoTask<ChatHistory> LoadHistory(string key, int lane) {
+  vector<vector<string>> query = {{"HGET", ARCHIVE_PROGRESS, key},
+                                  {"LRANGE", key, "0", "-1"},
+                                  {"HGET", ARCHIVE_PROGRESS, key}};
+  for (int retry = 0;; retry++) {
+    vector<RedisReply> got = co_await asyncBatch(query, lane);
+    if (got[0].view() == got[2].view() || retry == 2) {
+      ChatHistory history;
+      history.recent = archive.recent(key, got[1]);
+      history.archived = strtoull(got[2].str().c_str(), NULL, 10);
+      co_return history;
+    }
+  }
+}
+// 按查看者展示一批私聊记录，被屏蔽而看不到的跳过
+void SendFriendLines(TcpSocket &cfd_class, const string &uid,
+                     const string &name, const vector<string> &msgs) {
+  for (const string &item : msgs) {
+    Message rec;
+    rec.From_Json(item);
+    string line = RenderChat(rec, uid, name);
+    if (!line.empty()) {
+      cfd_class.sendMsg(line);
+    }
+  }
+}
+// 展示一批群聊消息：发送者换成昵称，每HISTORY_PAGE行用换行连成一帧发送，客户端照原样打印
+CoTask<void> SendGroupLines(TcpSocket cfd_class, string uid,
+                            vector<string> msgs, int lane) {
+  // 先拆出每行的发送者，不重复的发送者的昵称一次取回
+  vector<pair<string_view, string_view>> lines; // 发送者、内容
+  vector<string> senders;
+  unordered_set<string_view> seen;
+  for (const string &msg : msgs) {
+    size_t sep = msg.find("：");
+    if (msg == "begin" || sep == string::npos) {
+      continue;
+    }
+    string_view view(msg);
+    lines.push_back({view.substr(0, sep), view.substr(sep + 3)});
+    if (lines.back().first != uid && seen.insert(lines.back().first).second) {
+      senders.push_back(string(lines.back().first));
+    }
+  }
+  unordered_map<string, string> names =
+      co_await LoadNicknames(std::move(senders), lane);
+  string page;
+  for (size_t i = 0; i < lines.size(); i++) {
+    const auto &[sender, end] = lines[i];
+    page += sender == uid ? "我" : names[string(sender)];
+    page += "：";
+    page += end;
+    if ((i + 1) % HISTORY_PAGE == 0 || i + 1 == lines.size()) {
+      cfd_class.sendMsg(page);
+      page.clear();
+    } else {
+      page += "\n";
+    }
+  }
+}
+CoTask<void> ChatFriend(TcpSocket cfd_class, Command command) {
+  int lane = LaneOf(command.m_flag);
+  string unread = "来自" + command.m_option[0] + "的未读消息";
+  // 好友数量和我给好友的备注从好友图里查
+  co_await LoadFriends(command.m_uid, lane);
+  if (friendGraph.count(command.m_uid) == 0) {
     cfd_class.sendMsg("none");
-    return;
+    co_return;
   }
   // 好友列表列是否有这个好友
-  if (!redis.hashexists(command.m_uid + "的好友列表", command.m_option[0])) {
+  string name;
+  if (!friendGraph.remarkOf(command.m_uid, command.m_option[0], name)) {
     cfd_class.sendMsg("nofind");
   } else {
     cfd_class.sendMsg("have");
-    // 好友列表里有这个人就发送历史聊天记录，并把客户端的的聊天对象改为该好友
-    int HistoryMsgNum = redis.llen(command.m_uid + "--" + command.m_option[0]);
-    redisReply **MsgHistory =
-        redis.lrange(command.m_uid + "--" + command.m_option[0]);
-    for (int i = HistoryMsgNum - 1; i >= 0; i--) {
-      cfd_class.sendMsg(MsgHistory[i]->str);
+    // 好友列表里有这个人就发送历史聊天记录，并把客户端的的聊天对象改为该好友；
+    // 旧版本按人分开存的"我--好友"列表还在的话先展示它，再展示两人共用的记录
+    RedisReply Legacy = co_await asyncCommand(
+        lane, "LRANGE", command.m_uid + "--" + command.m_option[0], "0", "-1");
+    for (int i = (int)Legacy.size() - 1; i >= 0; i--) {
+      cfd_class.sendMsg(Legacy[i]->str);
     }
-    redis.hsetValue(command.m_uid, "聊天对象", command.m_option[0]);
+    ChatHistory history = co_await LoadHistory(
+        ChatLogKey(command.m_uid, command.m_option[0]), lane);
+    if (history.archived > 0) {
+      cfd_class.sendMsg(OLDER_FRAME " " + to_string(history.archived));
+    }
+    SendFriendLines(cfd_class, command.m_uid, name, history.recent);
+    vector<vector<string>> enter = {
+        {"HSET", command.m_uid, "聊天对象", command.m_option[0]},
+        {"HEXISTS", command.m_uid + "的未读消息", unread}};
+    vector<RedisReply> done = co_await asyncBatch(enter, lane);
+    userCache.invalidate(command.m_uid);
+    groupOnline.exit(command.m_uid);
     // 将我的未读消息列表里来自好友的未读消息数量清零
-    if (redis.hashexists(command.m_uid + "的未读消息",
-                         "来自" + command.m_option[0] + "的未读消息")) {
-      redis.hsetValue(command.m_uid + "的未读消息",
-                      "来自" + command.m_option[0] + "的未读消息", "0");
+    if (done[1].integer() != 0 ||
+        unreadCounter.hasPending(command.m_uid, unread)) {
+      unreadCounter.reset(command.m_uid, unread);
     }
     cfd_class.sendMsg("以上为历史聊天记录");
   }
-  return;
+  co_return;
 }
-void ChatGroup(TcpSocket cfd_class, Command command) {
+CoTask<void> ChatGroup(TcpSocket cfd_class, Command command) {
+  int lane = LaneOf(command.m_flag);
+  string unread = "来自" + command.m_option[0] + "的未读消息";
+  // 群聊数量、群聊列表里是否有这个群聊和消息序号一次取回
+  vector<vector<string>> query = {
+      {"HLEN", command.m_uid + "的群聊列表"},
+      {"HEXISTS", command.m_uid + "的群聊列表", command.m_option[0]},
+      {"GET", command.m_option[0] + "的消息序号"}};
+  vector<RedisReply> check = co_await asyncBatch(query, lane);
   // 群聊数量是否为0
-  if (redis.hlen(command.m_uid + "的群聊列表") == 0) {
+  if (check[0].integer() == 0) {
     cfd_class.sendMsg("none");
-    return;
+    co_return;
   }
   // 群聊列表列是否有这个群聊
-  if (!redis.hashexists(command.m_uid + "的群聊列表", command.m_option[0])) {
+  if (check[1].integer() == 0) {
     cfd_class.sendMsg("nofind");
   } else {
     cfd_class.sendMsg("have");
     // 群聊列表里有这个人就发送历史聊天记录，并把客户端的的聊天对象改为该群聊
-    int HistoryMsgNum = redis.llen(command.m_option[0] + "的聊天消息队列");
-    redisReply **MsgHistory =
-        redis.lrange(command.m_option[0] + "的聊天消息队列");
-    for (int i = HistoryMsgNum - 1; i >= 0; i--) {
-      if (static_cast<string>(MsgHistory[i]->str) == "begin") {
-        continue;
-      } else {
-        string msg(MsgHistory[i]->str);
-        string end(msg, msg.find("：") + 3);
-        string sender_uid(msg, 0, msg.find("："));
-        if (sender_uid == command.m_uid) {
-          cfd_class.sendMsg("我：" + end);
-        } else {
-          string name = redis.gethash(sender_uid, "昵称");
-          cfd_class.sendMsg(name + "：" + end);
-        }
-      }
-    }
-    redis.hsetValue(command.m_uid, "聊天对象", command.m_option[0]);
-    // 将我的未读消息列表里来自好友的未读消息数量清零
-    if (redis.hashexists(command.m_uid + "的未读消息",
-                         "来自" + command.m_option[0] + "的未读消息")) {
-      redis.hsetValue(command.m_uid + "的未读消息",
-                      "来自" + command.m_option[0] + "的未读消息", "0");
+    ChatHistory history =
+        co_await LoadHistory(command.m_option[0] + "的聊天消息队列", lane);
+    if (history.archived > 0) {
+      cfd_class.sendMsg(OLDER_FRAME " " + to_string(history.archived));
     }
+    co_await SendGroupLines(cfd_class, command.m_uid,
+                            std::move(history.recent), lane);
+    // 已读位置移到刚才取回的消息序号，旧版本留下的该群未读计数一并删掉
+    string head = check[2].view().empty() ? "0" : check[2].str();
+    vector<vector<string>> enter = {
+        {"HSET", command.m_uid, "聊天对象", command.m_option[0]},
+        {"HSET", command.m_uid + "的群聊已读", command.m_option[0], head},
+        {"HDEL", command.m_uid + "的未读消息", unread}};
+    co_await asyncBatch(enter, lane);
+    userCache.invalidate(command.m_uid);
+    groupOnline.enter(command.m_uid, command.m_option[0]);
+    unreadSummary.mark(command.m_uid);
     cfd_class.sendMsg("以上为历史聊天记录");
   }
-  return;
+  co_return;
+}
+// 聊天里往前翻归档的历史：m_option是{"friend"或"group", 好友uid或群号, 还没看过的条数}，
+// 只按id区间读归档里紧挨着的HISTORY_OLDER条。回复OLDER_FRAME和翻完后还剩的条数、
+// 这一页的消息、"end"；不是好友或不在群里时回复"nofind"
+CoTask<void> History(TcpSocket cfd_class, Command command) {
+  int lane = LaneOf(command.m_flag);
+  bool group = command.m_option[0] == "group";
+  string target = command.m_option[1];
+  uint64_t before = strtoull(command.m_option[2].c_str(), NULL, 10);
+  string key, name; // 会话的键，我给好友的备注
+  if (group) {
+    RedisReply member = co_await asyncCommand(
+        lane, "HEXISTS", command.m_uid + "的群聊列表", target);
+    if (member.integer() == 0) {
+      cfd_class.sendMsg("nofind");
+      co_return;
+    }
+    key = target + "的聊天消息队列";
+  } else {
+    co_await LoadFriends(command.m_uid, lane);
+    if (!friendGraph.remarkOf(command.m_uid, target, name)) {
+      cfd_class.sendMsg("nofind");
+      co_return;
+    }
+    key = ChatLogKey(command.m_uid, target);
+  }
+  uint64_t from = before > HISTORY_OLDER ? before - HISTORY_OLDER : 0;
+  vector<string> msgs;
+  for (Archive::Record &rec : archive.read(key, from, before)) {
+    msgs.push_back(std::move(rec.data));
+  }
+  cfd_class.sendMsg(OLDER_FRAME " " + to_string(from));
+  if (group) {
+    co_await SendGroupLines(cfd_class, command.m_uid, std::move(msgs), lane);
+  } else {
+    SendFriendLines(cfd_class, command.m_uid, name, msgs);
+  }
+  cfd_class.sendMsg("end");
 }
 void FriendMsg(TcpSocket cfd_class, Command command) {
+  // 记录写进两人共用的列表，在一个脚本里原子完成
+  Message rec(command.m_uid, command.m_option[0], command.m_option[1],
+              to_string(time(NULL)));
+  RedisReply result =
+      redis->eval(FriendMsgScript, {command.m_uid, command.m_option[0],
+                                    rec.To_Json(), Session::onlineKey()});
   // 是否存在该好友
-  if (!redis.hashexists(command.m_uid + "的好友列表", command.m_option[0])) {
+  if (result.size() == 0 || result[0]->integer == 0) {
     cfd_class.sendMsg("nohave");
     return;
   }
-  // 将新的消息加入到我对他的消息队列
-  string msg0 = "我：" + command.m_option[1] + ".........." + GetNowTime();
-  redis.lpush(command.m_uid + "--" + command.m_option[0], msg0);
+  archive.touch(ChatLogKey(command.m_uid, command.m_option[0]));
+  searchIndex.add(ChatLogKey(command.m_uid, command.m_option[0]),
+                  command.m_uid, command.m_option[1], atol(rec.t_time.c_str()),
+                  result[2]->integer != 0);
   // 当前聊天界面展示我的消息
-  string my_recvfd = redis.gethash(command.m_uid, "通知套接字");
-  TcpSocket myFd_class(stoi(my_recvfd));
+  string msg0 = RenderChat(rec, command.m_uid, "");
+  PushSocket myFd_class(stoi(result[1]->str));
   myFd_class.sendMsg(UP + msg0);
   // 如果好友把自己屏蔽的话，什么都不做，直接返回
-  if (redis.scard(command.m_option[0] + "的屏蔽列表")) {
-    if (redis.sismember(command.m_option[0] + "的屏蔽列表", command.m_uid)) {
-      return;
-    }
+  if (result[2]->integer != 0) {
+    return;
   }
-  // 没有被屏蔽，消息加到他对我的消息队列，并给相应通知
-  string name0 = redis.gethash(command.m_option[0] + "的好友列表",
-                               command.m_uid); // 得到好友給我的备注
-  string msg1 =
-      name0 + "：" + command.m_option[1] + ".........." + GetNowTime();
-  redis.lpush(command.m_option[0] + "--" + command.m_uid,
-              msg1); // 把消息加入的好友的聊天队列
-
-  // 如果好友把自己屏蔽的话，啥都不做，如果没有被屏蔽，就进行下面的操作：
-  // 如果好友在线且处于和自己的聊天界面，就把消息内容发给通知套接字
-  // 否则，把消息添加到未读消息里
-  // 如果好友在线但不处于和自己的聊天界面，把提示消息发给通知套接字
-  string online = redis.gethash(command.m_option[0], "在线状态");
-  string ChatFriend = redis.gethash(command.m_option[0], "聊天对象");
-  // 好友在线且和我聊天，让通知套接字展示消息，并返回
-  if (online != "-1" && ChatFriend == command.m_uid) { // 好友在线且和我聊天
-    string friend_recvfd = redis.gethash(command.m_option[0], "通知套接字");
-    TcpSocket friendFd_class(stoi(friend_recvfd));
-    string begin = "\r\n";
-    friendFd_class.sendMsg(begin + UP + msg1);
-  } else { // 否则，好友的未读消息中的来自我的消息数量+1
-    if (redis.hashexists(command.m_option[0] + "的未读消息",
-                         "来自" + command.m_uid + "的未读消息")) {
-      string num1 = redis.gethash(command.m_option[0] + "的未读消息",
-                                  "来自" + command.m_uid + "的未读消息");
-      redis.hsetValue(command.m_option[0] + "的未读消息",
-                      "来自" + command.m_uid + "的未读消息",
-                      to_string(stoi(num1) + 1));
-    } else {
-      redis.hsetValue(command.m_option[0] + "的未读消息",
-                      "来自" + command.m_uid + "的未读消息", "1");
-    }
+  // 好友不在线或没和我聊天，他的未读消息中来自我的消息数量+1
+  if (result.view(4) == "-1" || result.view(5) != command.m_uid) {
+    unreadCounter.add(command.m_option[0],
+                      "来自" + command.m_uid + "的未读消息");
   }
+  // 好友在线且和我聊天，让通知套接字展示消息
   // 如果好友在线但是没和我聊天，让通知套接字告知来消息
-  if (online != "-1" && ChatFriend != command.m_uid) { // 好友在线但没和我聊天
-    string friend_recvfd = redis.gethash(command.m_option[0], "通知套接字");
-    TcpSocket friendFd_class(stoi(friend_recvfd));
-    friendFd_class.sendMsg(command.m_uid + "发来了一条消息");
+  if (result.view(4) != "-1") {
+    PushSocket friendFd_class(stoi(result[6]->str));
+    if (result.view(5) == command.m_uid) {
+      string begin = "\r\n";
+      friendFd_class.sendMsg(
+          begin + UP + RenderChat(rec, command.m_option[0], result[3]->str));
+    } else {
+      friendFd_class.sendMsg(command.m_uid + "发来了一条消息");
+    }
   }
   cfd_class.sendMsg("ok");
   return;
 }
+// 只遍历群的在线成员：在群里聊天的展示消息内容，其他人给一个提示消息，
+// 整批交给各成员的发送队列。不在线的成员什么都不用做，未读数已经随消息序号+1
+void PushGroup(const string &gid, const string &me, const string &show,
+               const string &notice) {
+  vector<FanOut::Push> pushes;
+  for (const GroupOnline::Member &m : groupOnline.online(gid)) {
+    unreadSummary.mark(m.uid);
+    if (m.uid == me) {
+      continue;
+    }
+    string fd = userCache.get(m.uid, UF_NOTIFY_FD);
+    if (!fd.empty() && fd != "-1") {
+      pushes.push_back({stoi(fd), m.viewing ? show : notice});
+    }
+  }
+  fanOut.pushAll(pushes);
+}
 void GroupMsg(TcpSocket cfd_class, Command command) {
+  // 写入群聊消息队列并把群的消息序号+1，在一个脚本里原子完成
+  string body = command.m_option[1] + ".........." + GetNowTime();
+  RedisReply result =
+      redis->eval(GroupMsgScript, {command.m_uid, command.m_option[0], body});
   // 是否存在该群聊
-  if (!redis.hashexists(command.m_uid + "的群聊列表", command.m_option[0])) {
+  if (result.size() == 0 || result[0]->integer == 0) {
     cfd_class.sendMsg("nohave");
     return;
   }
-  // 将新的消息加入到群聊消息队列
-  string msg0 =
-      command.m_uid + "：" + command.m_option[1] + ".........." + GetNowTime();
-  redis.lpush(command.m_option[0] + "的聊天消息队列", msg0);
+  archive.touch(command.m_option[0] + "的聊天消息队列");
+  searchIndex.add(command.m_option[0] + "的聊天消息队列", command.m_uid,
+                  command.m_option[1], time(NULL));
   // 当前聊天界面展示我的消息
-  string my_recvfd = redis.gethash(command.m_uid, "通知套接字");
-  TcpSocket myFd_class(stoi(my_recvfd));
+  PushSocket myFd_class(stoi(result[1]->str));
   string up = UP;
-  myFd_class.sendMsg(up + "我：" + command.m_option[1] + ".........." +
-                     GetNowTime());
-  // 如果群成员的聊天对象不是该群，未读消息数+1
-  // 如果群成员的聊天对象不是该群，在线，给一个提示消息，不在线就不给
-  // 如果群成员的聊天对象是该群，通知套接字展示消息内容
-  int num = redis.hlen(command.m_option[0] + "的群成员列表");
-  redisReply **members = redis.hkeys(command.m_option[0] + "的群成员列表");
-  for (int i = 0; i < num; i++) {
-    if (members[i]->str != command.m_uid) {
-      string online = redis.gethash(members[i]->str, "在线状态");
-      string Chatgroup = redis.gethash(members[i]->str, "聊天对象");
-      // 群成员在线且和我聊天，让通知套接字展示消息，并返回
-      if (online != "-1" &&
-          Chatgroup == command.m_option[0]) { // 群成员在线且和在群里聊天
-        string member_recvfd = redis.gethash(members[i]->str, "通知套接字");
-        TcpSocket friendFd_class(stoi(member_recvfd));
-        string begin = "\r\n";
-        friendFd_class.sendMsg(begin + UP + msg0);
-      } else { // 否则，群成员的未读消息中的来自群聊的消息数量+1
-        if (redis.hashexists(static_cast<string>(members[i]->str) +
-                                 "的未读消息",
-                             "来自" + command.m_option[0] + "的未读消息")) {
-          string num1 =
-              redis.gethash(static_cast<string>(members[i]->str) + "的未读消息",
-                            "来自" + command.m_option[0] + "的未读消息");
-          redis.hsetValue(static_cast<string>(members[i]->str) + "的未读消息",
-                          "来自" + command.m_option[0] + "的未读消息",
-                          to_string(stoi(num1) + 1));
-        } else {
-          redis.hsetValue(static_cast<string>(members[i]->str) + "的未读消息",
-                          "来自" + command.m_option[0] + "的未读消息", "1");
-        }
-      }
-      // 如果群成员在线但是没和我聊天，让通知套接字告知来消息
-      if (online != "-1" &&
-          Chatgroup != command.m_option[0]) { // 群成员在线但没在群里聊天
-        string member_recvfd = redis.gethash(members[i]->str, "通知套接字");
-        TcpSocket friendFd_class(stoi(member_recvfd));
-        friendFd_class.sendMsg(command.m_option[0] + "发来了一条消息");
-      }
-    }
-  }
+  myFd_class.sendMsg(up + "我：" + body);
+  string begin = "\r\n";
+  PushGroup(command.m_option[0], command.m_uid,
+            begin + UP + string(result.view(2)),
+            command.m_option[0] + "发来了一条消息");
   cfd_class.sendMsg("ok");
   return;
 }
 void ExitChatFriend(TcpSocket cfd_class, Command command) {
-  if (redis.gethash(command.m_uid, "聊天对象") == "0") {
+  if (redis->gethash(command.m_uid, "聊天对象") == "0") {
     cfd_class.sendMsg("no");
     return;
   } else {
-    redis.hsetValue(command.m_uid, "聊天对象", "0");
+    redis->hsetValue(command.m_uid, "聊天对象", "0");
+    userCache.invalidate(command.m_uid);
     cfd_class.sendMsg("ok");
     return;
   }
 }
 void ExitChatGroup(TcpSocket cfd_class, Command command) {
-  if (redis.gethash(command.m_uid, "聊天对象") == "0") {
+  string gid = redis->gethash(command.m_uid, "聊天对象");
+  if (gid == "0") {
     cfd_class.sendMsg("no");
     return;
   } else {
-    redis.hsetValue(command.m_uid, "聊天对象", "0");
+    // 在群里时新消息都直接展示过了，已读位置移到最新
+    redis->hsetValue(command.m_uid + "的群聊已读", gid, GroupHead(gid));
+    redis->hsetValue(command.m_uid, "聊天对象", "0");
+    userCache.invalidate(command.m_uid);
+    groupOnline.exit(command.m_uid);
+    unreadSummary.mark(command.m_uid);
     cfd_class.sendMsg("ok");
     return;
   }
 }
 void ShieldFriend(TcpSocket cfd_class, Command command) {
   // 不存在该好友就通知客户端并返回
-  if (!redis.hashexists(command.m_uid + "的好友列表", command.m_option[0])) {
+  if (!friendGraph.isFriend(command.m_uid, command.m_option[0])) {
     cfd_class.sendMsg("no");
     return;
   }
-  // 如果之前没有好友被屏蔽，就直接屏蔽该好友，并返回
-  int shieldNum = redis.scard(command.m_uid + "屏蔽列表");
-  if (shieldNum == 0) {
-    redis.saddvalue(command.m_uid + "的屏蔽列表", command.m_option[0]);
-    cfd_class.sendMsg("ok");
+  // 已经屏蔽了该好友就通知客户端，没有就屏蔽
+  if (!friendGraph.block(command.m_uid, command.m_option[0])) {
+    cfd_class.sendMsg("had");
     return;
   }
-  // 如果屏蔽列表里已经有了该好友，通知客户端并返回
-  redisReply **shield_list = redis.smembers(command.m_uid + "的屏蔽列表");
-  for (int i = 0; i < shieldNum; i++) {
-    if (shield_list[i]->str == command.m_option[0]) {
-      cfd_class.sendMsg("had");
-      return;
-    }
-  }
-  // 该好友没有被屏蔽，就屏蔽
-  redis.saddvalue(command.m_uid + "的屏蔽列表", command.m_option[0]);
   cfd_class.sendMsg("ok");
   return;
 }
 void DeleteFriend(TcpSocket cfd_class, Command command) {
-  if (!redis.hashexists(
-          command.m_uid + "的好友列表",
-          command.m_option[0])) { // 好友列表里没有这个人，直接返回
+  // 好友列表里没有这个人，直接返回
+  if (!friendGraph.isFriend(command.m_uid, command.m_option[0])) {
     cfd_class.sendMsg("nofind");
     return;
   }
-
-  // 双方好友列表删除对方
-  redis.delhash(command.m_uid + "的好友列表", command.m_option[0]);
-  redis.delhash(command.m_option[0] + "的好友列表", command.m_uid);
+  // 双方好友列表删除对方，双方对对方的屏蔽一起解除
+  friendGraph.unfriend(command.m_uid, command.m_option[0]);
   // 被删者未读消息中的通知消息数量+1
-  string num1 = redis.gethash(command.m_option[0] + "的未读消息", "通知消息");
-  redis.hsetValue(command.m_option[0] + "的未读消息", "通知消息",
-                  to_string(stoi(num1) + 1));
+  unreadCounter.add(command.m_option[0], "通知消息");
   // 通知消息里告诉被删者
-  redis.lpush(command.m_uid + "的通知消息",
-              command.m_uid + "解除了和您的好友关系" + GetNowTime());
+  redis->lpush(command.m_uid + "的通知消息",
+               command.m_uid + "解除了和您的好友关系" + GetNowTime());
   // 如果被删者在线，给他的通知套接字一个提醒
-  string online = redis.gethash(command.m_option[0], "在线状态");
+  string online = userCache.get(command.m_option[0], UF_ONLINE);
   if (online != "-1") {
-    string friend_recvfd = redis.gethash(command.m_option[0], "通知套接字");
-    TcpSocket friendFd_class(stoi(friend_recvfd));
+    string friend_recvfd = userCache.get(command.m_option[0], UF_NOTIFY_FD);
+    PushSocket friendFd_class(stoi(friend_recvfd));
     friendFd_class.sendMsg(command.m_uid + "解除了和您的好友关系");
   }
-  // 我的屏蔽列表里是否有该好友，有就删掉，没有就不管
-  int shieldNum = redis.scard(command.m_uid + "的屏蔽列表"); // 是否有好友被屏蔽
-  if (shieldNum != 0) {
-    redisReply **shield_list =
-        redis.smembers(command.m_uid + "的屏蔽列表"); // 该好友是否被屏蔽
-    for (int i = 0; i < shieldNum; i++) {
-      if (shield_list[i]->str == command.m_option[0]) { // 被屏蔽就解屏蔽
-        redis.sremvalue(command.m_uid + "的屏蔽列表", command.m_option[0]);
-        break;
-      }
-    }
-  }
-  // 对方的屏蔽列表里是否有该好友，有就删掉，没有就不管
-  int shieldNum1 =
-      redis.scard(command.m_uid + "的屏蔽列表"); // 是否有好友被屏蔽
-  if (shieldNum1 != 0) {
-    redisReply **shield_list1 =
-        redis.smembers(command.m_uid + "的屏蔽列表"); // 该好友是否被屏蔽
-    for (int i = 0; i < shieldNum1; i++) {
-      if (shield_list1[i]->str == command.m_option[0]) { // 被屏蔽就解屏蔽
-        redis.sremvalue(command.m_uid + "的屏蔽列表", command.m_option[0]);
-        break;
-      }
-    }
-  }
-  // 删除历史聊天记录
-  redis.delKey(command.m_uid + "--" + command.m_option[0]);
-  redis.delKey(command.m_option[0] + "--" + command.m_uid);
+  // 删除历史聊天记录，连同旧版本按人分开存的列表
+  redis->delKey(ChatLogKey(command.m_uid, command.m_option[0]));
+  archive.drop(ChatLogKey(command.m_uid, command.m_option[0]));
+  searchIndex.drop(ChatLogKey(command.m_uid, command.m_option[0]));
+  redis->delKey(command.m_uid + "--" + command.m_option[0]);
+  redis->delKey(command.m_option[0] + "--" + command.m_uid);
   cfd_class.sendMsg("ok");
   return;
 }
 void Restorefriend(TcpSocket cfd_class, Command command) {
-  if (!redis.hashexists(command.m_uid + "的好友列表",
-                        command.m_option[0])) { // 是否有该好友
+  // 是否有该好友
+  if (!friendGraph.isFriend(command.m_uid, command.m_option[0])) {
     cfd_class.sendMsg("nohave");
     return;
   }
-  // 是否有好友被屏蔽
-  int shieldNum = redis.scard(command.m_uid + "的屏蔽列表");
-  if (shieldNum == 0) {
+  // 被屏蔽就解屏蔽，没有被屏蔽就告诉客户端
+  if (!friendGraph.unblock(command.m_uid, command.m_option[0])) {
     cfd_class.sendMsg("nofind");
     return;
   }
-  redisReply **shield_list =
-      redis.smembers(command.m_uid + "的屏蔽列表"); // 该好友是否被屏蔽
-  for (int i = 0; i < shieldNum; i++) {
-    if (shield_list[i]->str == command.m_option[0]) { // 被屏蔽就解屏蔽
-      redis.sremvalue(command.m_uid + "的屏蔽列表", command.m_option[0]);
-      cfd_class.sendMsg("ok");
-      return;
-    }
-  }
-  // 没有别屏蔽就告诉客户端
-  cfd_class.sendMsg("nofind");
+  cfd_class.sendMsg("ok");
   return;
 }
-void NewMessage(TcpSocket cfd_class, Command command) {
-  int NewNum = redis.hlen(command.m_uid + "的未读消息");
-  redisReply **NewList = redis.hkeys(command.m_uid + "的未读消息");
-  for (int i = 0; i < NewNum; i++) {
-    string oneNum =
-        redis.gethash(command.m_uid + "的未读消息", NewList[i]->str);
-    string oneline = static_cast<string>(NewList[i]->str) + "：" + oneNum;
-    cfd_class.sendMsg(oneline);
+CoTask<void> NewMessage(TcpSocket cfd_class, Command command) {
+  int lane = LaneOf(command.m_flag);
+  // 在线用户的概要已经物化在内存里，直接发
+  UnreadSummary::Counts counts;
+  if (!unreadSummary.lookup(command.m_uid, counts)) {
+    // 未读消息的名目和数量一次取回，再合并上还没写回redis的增量；
+    // 读的期间发生了刷写就重读，几次都碰上刷写时用最后一次的结果
+    for (int attempt = 0; attempt < 3; attempt++) {
+      UnreadCounter::Snapshot snap = unreadCounter.snapshot(command.m_uid);
+      RedisReply NewList = co_await asyncCommand(lane, "HGETALL",
+                                                 command.m_uid + "的未读消息");
+      counts = UnreadCounter::merge(NewList, snap);
+      if (unreadCounter.stable(snap)) {
+        break;
+      }
+    }
+    // 再加上群聊的未读数：群的消息序号减去我的已读位置
+    vector<vector<string>> query = {{"HKEYS", command.m_uid + "的群聊列表"},
+                                    {"HGETALL", command.m_uid + "的群聊已读"}};
+    vector<RedisReply> mine = co_await asyncBatch(query, lane);
+    vector<vector<string>> heads;
+    for (size_t i = 0; i < mine[0].size(); i++) {
+      heads.push_back({"GET", string(mine[0].view(i)) + "的消息序号"});
+    }
+    vector<long long> head;
+    if (!heads.empty()) {
+      vector<RedisReply> seq = co_await asyncBatch(heads, lane);
+      for (const RedisReply &r : seq) {
+        head.push_back(atoll(r.str().c_str()));
+      }
+    }
+    counts = UnreadSummary::compose(std::move(counts), mine[0].get(),
+                                    mine[1].get(), head);
+  }
+  for (auto &[field, n] : counts) {
+    cfd_class.sendMsg(field + "：" + to_string(n));
   }
   cfd_class.sendMsg("end");
 }
 void LookSystem(TcpSocket cfd_class, Command command) {
-  int num = redis.hlen(command.m_uid + "的系统消息");
+  int num = redis->hlen(command.m_uid + "的系统消息");
   if (num == 0) {
     cfd_class.sendMsg("none");
     return;
   }
-  redisReply **SysMsgList = redis.hkeys(command.m_uid + "的系统消息");
+  RedisReply SysMsgList = redis->hkeys(command.m_uid + "的系统消息");
   for (int i = num - 1; i >= 0; i--) {
     string sysmsg =
-        redis.gethash(command.m_uid + "的系统消息", SysMsgList[i]->str);
+        redis->gethash(command.m_uid + "的系统消息", SysMsgList[i]->str);
     cfd_class.sendMsg(sysmsg);
   }
   cfd_class.sendMsg("end");
   return;
 }
 void LookNotice(TcpSocket cfd_class, Command command) {
-  redis.hsetValue(command.m_uid + "的未读消息", "通知消息", "0");
-  int num = redis.llen(command.m_uid + "的通知消息");
+  unreadCounter.reset(command.m_uid, "通知消息");
+  int num = redis->llen(command.m_uid + "的通知消息");
   if (num == 0) {
     cfd_class.sendMsg("none");
     return;
   }
-  redisReply **NoticList = redis.lrange(command.m_uid + "的通知消息");
+  RedisReply NoticList = redis->lrange(command.m_uid + "的通知消息");
   for (int i = num - 1; i >= 0; i--) {
     cfd_class.sendMsg(NoticList[i]->str);
   }
@@ -862,16 +1110,15 @@ void LookNotice(TcpSocket cfd_class, Command command) {
 }
 void RefuseAddFriend(TcpSocket cfd_class, Command command) {
   // 看看自己的好友列表里是否已有该好友，没有就可以修改申请，有就不可以修改申请，回复had
-  if (redis.hlen(command.m_uid + "的好友列表") == 0 ||
-      !redis.hashexists(command.m_uid + "的好友列表", command.m_option[0])) {
+  if (!friendGraph.isFriend(command.m_uid, command.m_option[0])) {
     // 系统消息列表里有没有他的申请
-    if (!redis.hashexists(command.m_uid + "的系统消息", command.m_option[0])) {
+    if (!redis->hashexists(command.m_uid + "的系统消息", command.m_option[0])) {
       cfd_class.sendMsg("nofind");
       return;
     }
     // 如果系统消息列表里有申请者的申请,但是已经处理过了，就不能在处理
     string msg =
-        redis.gethash(command.m_uid + "的系统消息", command.m_option[0]);
+        redis->gethash(command.m_uid + "的系统消息", command.m_option[0]);
     string newmsg(msg.begin(), msg.end() - 11);
     if (newmsg == "(已拒绝)" || newmsg == "(已通过)") {
       cfd_class.sendMsg("haddeal");
@@ -880,23 +1127,19 @@ void RefuseAddFriend(TcpSocket cfd_class, Command command) {
     // 更改申请者收到的申请消息状态为已拒绝
     string pass = "(已拒绝)";
     string Newmsg = newmsg + pass;
-    redis.hsetValue(command.m_uid + "的系统消息", command.m_option[0], Newmsg);
+    redis->hsetValue(command.m_uid + "的系统消息", command.m_option[0], Newmsg);
     // 拒绝者的系统消息数量-1
-    string nownum = redis.gethash(command.m_uid + "的未读消息", "系统消息");
-    redis.hsetValue(command.m_uid + "的未读消息", "系统消息",
-                    (to_string(stoi(nownum) - 1)));
+    unreadCounter.add(command.m_uid, "系统消息", -1);
     // 在申请者的通知消息里写入未通过消息
-    redis.lpush(command.m_option[0] + "的通知消息",
-                command.m_uid + "拒绝了您的好友申请." + GetNowTime());
+    redis->lpush(command.m_option[0] + "的通知消息",
+                 command.m_uid + "拒绝了您的好友申请." + GetNowTime());
     // 申请者未读消息中的通知消息数量+1
-    string num1 = redis.gethash(command.m_option[0] + "的未读消息", "通知消息");
-    redis.hsetValue(command.m_option[0] + "的未读消息", "通知消息",
-                    to_string(stoi(num1) + 1));
+    unreadCounter.add(command.m_option[0], "通知消息");
     // 如果申请者在线，给他的通知套接字一个提醒
-    string online = redis.gethash(command.m_option[0], "在线状态");
+    string online = userCache.get(command.m_option[0], UF_ONLINE);
     if (online != "-1") {
-      string friend_recvfd = redis.gethash(command.m_option[0], "通知套接字");
-      TcpSocket friendFd_class(stoi(friend_recvfd));
+      string friend_recvfd = userCache.get(command.m_option[0], UF_NOTIFY_FD);
+      PushSocket friendFd_class(stoi(friend_recvfd));
       string kaitou = UP;
       friendFd_class.sendMsg(kaitou + "\r" + command.m_uid +
                              "拒绝了您的好友申请.");
@@ -919,7 +1162,7 @@ void CreateGroup(TcpSocket cfd_class, Command command) {
   for (int i = 0; i + 4 <= len; i += 5) {
     string member(command.m_option[0].begin() + i,
                   command.m_option[0].begin() + i + 4);
-    if (!redis.hashexists(command.m_uid + "的好友列表", member)) {
+    if (!friendGraph.isFriend(command.m_uid, member)) {
       cfd_class.sendMsg("nofind" + member);
       return;
     }
@@ -929,39 +1172,39 @@ void CreateGroup(TcpSocket cfd_class, Command command) {
   srand((unsigned)time(NULL));
   while (true) {
     string new_gid = to_string((rand() + 111) % 1000);
-    if (redis.sismember(
+    if (redis->sismember(
             "群聊集合",
             new_gid)) { // 直到随机一个未注册的gid发过去，并建立群聊基本信息
       continue;
     } else if (stoi(new_gid) < 100) {
       continue;
     } else {
-      redis.saddvalue("群聊集合", new_gid);
-      redis.hsetValue(new_gid + "的基本信息", "群号", new_gid);
-      redis.hsetValue(new_gid + "的基本信息", "群名", new_gid);
-      redis.hsetValue(new_gid + "的基本信息", "创建时间", GetNowTime());
-      redis.hsetValue(new_gid + "的基本信息", "群介绍", "暂无");
-      redis.hsetValue(new_gid + "的基本信息", "群公告", "暂无");
+      redis->saddvalue("群聊集合", new_gid);
+      redis->hsetValue(new_gid + "的基本信息", "群号", new_gid);
+      redis->hsetValue(new_gid + "的基本信息", "群名", new_gid);
+      redis->hsetValue(new_gid + "的基本信息", "创建时间", GetNowTime());
+      redis->hsetValue(new_gid + "的基本信息", "群介绍", "暂无");
+      redis->hsetValue(new_gid + "的基本信息", "群公告", "暂无");
       // 为群主建立群聊基本要素：群成员列表里的身份，自己的群聊里加上这个群，自己和群聊的消息队列加结尾
-      redis.hsetValue(new_gid + "的群成员列表", command.m_uid, "群主");
-      redis.hsetValue(command.m_uid + "的群聊列表", new_gid, new_gid);
-      redis.lpush(new_gid + "的聊天消息队列", "begin");
+      redis->hsetValue(new_gid + "的群成员列表", command.m_uid, "群主");
+      redis->hsetValue(command.m_uid + "的群聊列表", new_gid, new_gid);
+      groupOnline.join(new_gid, command.m_uid);
+      redis->lpush(new_gid + "的聊天消息队列", "begin");
       // 为初始群成员建立群聊基本要素：群成员列表里的身份，自己的群聊里加上这个群，自己和群聊的消息队列加结尾
       for (auto member : members) {
         // 在初始成员的系统消息里写入加入通知
-        redis.lpush(member + "的通知消息",
-                    "您作为" + command.m_uid + "创建的群聊" + new_gid +
+        redis->lpush(member + "的通知消息",
+                     "您作为" + command.m_uid + "创建的群聊" + new_gid +
                         "的初始群成员加入了该群聊." + GetNowTime());
         // 初始成员的未读消息中的通知消息数量+1
-        string num = redis.gethash(member + "的未读消息", "通知消息");
-        redis.hsetValue(member + "的未读消息", "通知消息",
-                        to_string(stoi(num) + 1));
-        redis.hsetValue(new_gid + "的群成员列表", member, "群成员");
-        redis.hsetValue(member + "的群聊列表", new_gid, new_gid);
-        string online = redis.gethash(member, "在线状态");
+        unreadCounter.add(member, "通知消息");
+        redis->hsetValue(new_gid + "的群成员列表", member, "群成员");
+        redis->hsetValue(member + "的群聊列表", new_gid, new_gid);
+        groupOnline.join(new_gid, member);
+        string online = userCache.get(member, UF_ONLINE);
         if (online != "-1") {
-          string friend_recvfd = redis.gethash(member, "通知套接字");
-          TcpSocket friendFd_class(stoi(friend_recvfd));
+          string friend_recvfd = userCache.get(member, UF_NOTIFY_FD);
+          PushSocket friendFd_class(stoi(friend_recvfd));
           friendFd_class.sendMsg("您被您的好友拉入了一个群聊.");
         }
       }
@@ -971,15 +1214,15 @@ void CreateGroup(TcpSocket cfd_class, Command command) {
   }
 }
 void ListGroup(TcpSocket cfd_class, Command command) {
-  int GroupNum = redis.hlen(command.m_uid + "的群聊列表");
+  int GroupNum = redis->hlen(command.m_uid + "的群聊列表");
   if (GroupNum == 0) {
     cfd_class.sendMsg("none");
   } else {
     // 群聊数量不为0，就遍历群聊列表，根据在线状态发送要展示的内容
-    redisReply **g_uid = redis.hkeys(command.m_uid + "的群聊列表");
+    RedisReply g_uid = redis->hkeys(command.m_uid + "的群聊列表");
     for (int i = 0; i < GroupNum; i++) {
       string group_mark =
-          redis.gethash(command.m_uid + "的群聊列表", g_uid[i]->str);
+          redis->gethash(command.m_uid + "的群聊列表", g_uid[i]->str);
       cfd_class.sendMsg(L_GREEN + group_mark + NONE + "(" + g_uid[i]->str +
                         ")");
     }
@@ -988,16 +1231,16 @@ void ListGroup(TcpSocket cfd_class, Command command) {
 }
 void AboutGroup(TcpSocket cfd_class, Command command) {
   // 判断群聊是否存在
-  if (!redis.sismember("群聊集合", command.m_option[0])) {
+  if (!redis->sismember("群聊集合", command.m_option[0])) {
     cfd_class.sendMsg("nohave");
     return;
   }
   // 判断用户是否已在该群聊里
-  int GroupNum = redis.hlen(command.m_uid + "的群聊列表");
+  int GroupNum = redis->hlen(command.m_uid + "的群聊列表");
   if (GroupNum !=
       0) { // 群聊数量不为0时，列表中可能已经有准好友,为0时可定没有，跳过此步骤
-    redisReply **g_uid =
-        redis.hkeys(command.m_uid + "的群聊列表"); // 得到群聊列表
+    RedisReply g_uid =
+        redis->hkeys(command.m_uid + "的群聊列表"); // 得到群聊列表
     for (int i = 0; i < GroupNum; i++) { // 遍历群聊列表，看看该群聊是否在里面
       if (g_uid[i]->str ==
           command.m_option
@@ -1014,20 +1257,20 @@ void AboutGroup(TcpSocket cfd_class, Command command) {
 void RequestList(TcpSocket cfd_class, Command command) {
   // 判断查看的人是否为管理员或群主
   string position =
-      redis.gethash(command.m_option[0] + "的群成员列表", command.m_uid);
+      redis->gethash(command.m_option[0] + "的群成员列表", command.m_uid);
   if (position == "群成员") {
     cfd_class.sendMsg("cannot");
     return;
   }
   // 获得申请列表里申请的数量
-  int len = redis.hlen(command.m_option[0] + "的申请列表");
+  int len = redis->hlen(command.m_option[0] + "的申请列表");
   if (len == 0) {
     cfd_class.sendMsg("none");
   } else {
-    redisReply **applicants = redis.hkeys(command.m_option[0] + "的申请列表");
+    RedisReply applicants = redis->hkeys(command.m_option[0] + "的申请列表");
     for (int i = 0; i < len; i++) {
       string apply =
-          redis.gethash(command.m_option[0] + "的申请列表", applicants[i]->str);
+          redis->gethash(command.m_option[0] + "的申请列表", applicants[i]->str);
       cfd_class.sendMsg(apply);
     }
     cfd_class.sendMsg("end");
@@ -1037,82 +1280,80 @@ void RequestList(TcpSocket cfd_class, Command command) {
 void PassApply(TcpSocket cfd_class, Command command) {
   // 是否为群主或者管理员
   string position =
-      redis.gethash(command.m_option[0] + "的群成员列表", command.m_uid);
+      redis->gethash(command.m_option[0] + "的群成员列表", command.m_uid);
   if (position == "群成员") {
     cfd_class.sendMsg("cannot");
     return;
   }
   // 被操作人是否在群里
-  if (redis.hashexists(command.m_option[0] + "的群成员列表",
-                       command.m_option[1])) {
+  if (redis->hashexists(command.m_option[0] + "的群成员列表",
+                        command.m_option[1])) {
     cfd_class.sendMsg("had");
     return;
   }
   // 申请列表里有没有这个人的申请
-  if (!redis.hashexists(command.m_option[0] + "的申请列表",
-                        command.m_option[1])) {
+  if (!redis->hashexists(command.m_option[0] + "的申请列表",
+                         command.m_option[1])) {
     cfd_class.sendMsg("nofind");
     return;
   }
   // 如果申请列表里有申请者的申请,但是已经处理过了，就不能在处理,只能处理申请状态为未处理的申请
   string apply_old =
-      redis.gethash(command.m_option[0] + "的申请列表", command.m_option[1]);
+      redis->gethash(command.m_option[0] + "的申请列表", command.m_option[1]);
   string state(apply_old.end() - 11, apply_old.end());
   if (state == "(已拒绝)" || state == "(已通过)") {
     cfd_class.sendMsg("haddeal");
     return;
   }
   // 获取这个人进群之前的群成员列表
-  int num = redis.hlen(command.m_option[0] + "的群成员列表");
-  redisReply **members = redis.hkeys(command.m_option[0] + "的群成员列表");
+  int num = redis->hlen(command.m_option[0] + "的群成员列表");
+  RedisReply members = redis->hkeys(command.m_option[0] + "的群成员列表");
   // 群成员列表里加他
-  redis.hsetValue(command.m_option[0] + "的群成员列表", command.m_option[1],
-                  "群成员");
-  // 在新成员的群聊列表里加上该群聊
-  redis.hsetValue(command.m_option[1] + "的群聊列表", command.m_option[0],
-                  command.m_option[0]);
+  redis->hsetValue(command.m_option[0] + "的群成员列表", command.m_option[1],
+                   "群成员");
+  // 在新成员的群聊列表里加上该群聊，进群之前的消息不算他的未读
+  redis->hsetValue(command.m_option[1] + "的群聊列表", command.m_option[0],
+                   command.m_option[0]);
+  redis->hsetValue(command.m_option[1] + "的群聊已读", command.m_option[0],
+                   GroupHead(command.m_option[0]));
+  groupOnline.join(command.m_option[0], command.m_option[1]);
   // 更改申请消息为已通过
   string apply(apply_old.begin(), apply_old.end() - 11);
   string pass = "(已通过)";
   string apply_new = apply + pass;
-  redis.hsetValue(command.m_option[0] + "的申请列表", command.m_option[1],
-                  apply_new);
+  redis->hsetValue(command.m_option[0] + "的申请列表", command.m_option[1],
+                   apply_new);
   // 在申请者的通知消息里写入通过消息
-  redis.lpush(command.m_option[1] + "的通知消息", "群聊" + command.m_option[0] +
+  redis->lpush(command.m_option[1] + "的通知消息", "群聊" + command.m_option[0] +
                                                       "通过了您的入群申请." +
                                                       GetNowTime());
   // 申请者未读消息中的通知消息数量+1
-  string num1 = redis.gethash(command.m_option[1] + "的未读消息", "通知消息");
-  redis.hsetValue(command.m_option[1] + "的未读消息", "通知消息",
-                  to_string(stoi(num1) + 1));
+  unreadCounter.add(command.m_option[1], "通知消息");
   // 如果申请者在线，给他的通知套接字一个提醒
-  string online = redis.gethash(command.m_option[1], "在线状态");
+  string online = userCache.get(command.m_option[1], UF_ONLINE);
   if (online != "-1") {
-    string friend_recvfd = redis.gethash(command.m_option[1], "通知套接字");
-    TcpSocket friendFd_class(stoi(friend_recvfd));
+    string friend_recvfd = userCache.get(command.m_option[1], UF_NOTIFY_FD);
+    PushSocket friendFd_class(stoi(friend_recvfd));
     friendFd_class.sendMsg("群聊" + command.m_option[0] +
                            "通过了您的入群申请.");
   }
   // 给这个人进群之前的群成员列表中的管理员和群主通知
   for (int i = 0; i < num; i++) {
     string position =
-        redis.gethash(command.m_option[0] + "的群成员列表", members[i]->str);
+        redis->gethash(command.m_option[0] + "的群成员列表", members[i]->str);
     if (position == static_cast<string>("管理员") ||
         position == static_cast<string>("群主")) {
       if (members[i]->str != command.m_uid) {
-        string num0 = redis.gethash(
-            members[i]->str + static_cast<string>("的未读消息"), "通知消息");
-        redis.hsetValue(members[i]->str + string("的未读消息"), "通知消息",
-                        to_string(stoi(num0) + 1));
-        redis.lpush(members[i]->str + static_cast<string>("的通知消息"),
-                    "您管理的群聊" + command.m_option[0] + "同意了用户" +
+        unreadCounter.add(members[i]->str, "通知消息");
+        redis->lpush(members[i]->str + static_cast<string>("的通知消息"),
+                     "您管理的群聊" + command.m_option[0] + "同意了用户" +
                         command.m_option[1] + "的入群申请.处理人：" +
                         command.m_uid + GetNowTime());
         // 如果群主或者管理员在线，给他的通知套接字一个提醒
-        string online = redis.gethash(members[i]->str, "在线状态");
+        string online = userCache.get(members[i]->str, UF_ONLINE);
         if (online != "-1") {
-          string friend_recvfd = redis.gethash(members[i]->str, "通知套接字");
-          TcpSocket friendFd_class(stoi(friend_recvfd));
+          string friend_recvfd = userCache.get(members[i]->str, UF_NOTIFY_FD);
+          PushSocket friendFd_class(stoi(friend_recvfd));
           friendFd_class.sendMsg("您管理的群" + command.m_option[0] +
                                  "通过了一条入群申请.");
         }
@@ -1125,53 +1366,51 @@ void PassApply(TcpSocket cfd_class, Command command) {
 void DenyApply(TcpSocket cfd_class, Command command) {
   // 是否为群主或者管理员
   string position =
-      redis.gethash(command.m_option[0] + "的群成员列表", command.m_uid);
+      redis->gethash(command.m_option[0] + "的群成员列表", command.m_uid);
   if (position == "群成员") {
     cfd_class.sendMsg("cannot");
     return;
   }
   // 被操作人是否在群里
-  if (redis.hashexists(command.m_option[0] + "的群成员列表",
-                       command.m_option[1])) {
+  if (redis->hashexists(command.m_option[0] + "的群成员列表",
+                        command.m_option[1])) {
     cfd_class.sendMsg("had");
     return;
   }
   // 申请列表里有没有这个人的申请
-  if (!redis.hashexists(command.m_option[0] + "的申请列表",
-                        command.m_option[1])) {
+  if (!redis->hashexists(command.m_option[0] + "的申请列表",
+                         command.m_option[1])) {
     cfd_class.sendMsg("nofind");
     return;
   }
   // 如果申请列表里有申请者的申请,但是已经处理过了，就不能在处理,只能处理申请状态为未处理的申请
   string apply_old =
-      redis.gethash(command.m_option[0] + "的申请列表", command.m_option[1]);
+      redis->gethash(command.m_option[0] + "的申请列表", command.m_option[1]);
   string state(apply_old.end() - 11, apply_old.end());
   if (state == "(已拒绝)" || state == "(已通过)") {
     cfd_class.sendMsg("haddeal");
     return;
   }
   // 获取这个人进群之前的群成员列表
-  int num = redis.hlen(command.m_option[0] + "的群成员列表");
-  redisReply **members = redis.hkeys(command.m_option[0] + "的群成员列表");
+  int num = redis->hlen(command.m_option[0] + "的群成员列表");
+  RedisReply members = redis->hkeys(command.m_option[0] + "的群成员列表");
   // 更改申请消息为已通过
   string apply(apply_old.begin(), apply_old.end() - 11);
   string deny = "(已拒绝)";
   string apply_new = apply + deny;
-  redis.hsetValue(command.m_option[0] + "的申请列表", command.m_option[1],
-                  apply_new);
+  redis->hsetValue(command.m_option[0] + "的申请列表", command.m_option[1],
+                   apply_new);
   // 在申请者的通知消息里写入通过消息
-  redis.lpush(command.m_option[0] + "的通知消息", "群聊" + command.m_option[1] +
+  redis->lpush(command.m_option[0] + "的通知消息", "群聊" + command.m_option[1] +
                                                       "拒绝了您的入群申请." +
                                                       GetNowTime());
   // 申请者未读消息中的通知消息数量+1
-  string num1 = redis.gethash(command.m_option[0] + "的未读消息", "通知消息");
-  redis.hsetValue(command.m_option[0] + "的未读消息", "通知消息",
-                  to_string(stoi(num1) + 1));
+  unreadCounter.add(command.m_option[0], "通知消息");
   // 如果申请者在线，给他的通知套接字一个提醒
-  string online = redis.gethash(command.m_option[0], "在线状态");
+  string online = userCache.get(command.m_option[0], UF_ONLINE);
   if (online != "-1") {
-    string friend_recvfd = redis.gethash(command.m_option[0], "通知套接字");
-    TcpSocket friendFd_class(stoi(friend_recvfd));
+    string friend_recvfd = userCache.get(command.m_option[0], UF_NOTIFY_FD);
+    PushSocket friendFd_class(stoi(friend_recvfd));
     friendFd_class.sendMsg("群聊" + command.m_option[1] +
                            "拒绝了您的入群申请.");
   }
@@ -1179,23 +1418,20 @@ void DenyApply(TcpSocket cfd_class, Command command) {
   // + 1
   for (int i = 0; i < num; i++) {
     string position =
-        redis.gethash(command.m_option[0] + "的群成员列表", members[i]->str);
+        redis->gethash(command.m_option[0] + "的群成员列表", members[i]->str);
     if (position == static_cast<string>("管理员") ||
         position == static_cast<string>("群主")) {
       if (members[i]->str != command.m_uid) {
-        string num0 = redis.gethash(
-            members[i]->str + static_cast<string>("的未读消息"), "通知消息");
-        redis.hsetValue(members[i]->str + string("的未读消息"), "通知消息",
-                        to_string(stoi(num0) + 1));
-        redis.lpush(members[i]->str + static_cast<string>("的通知消息"),
-                    "您管理的群聊" + command.m_option[0] + "拒绝了用户" +
+        unreadCounter.add(members[i]->str, "通知消息");
+        redis->lpush(members[i]->str + static_cast<string>("的通知消息"),
+                     "您管理的群聊" + command.m_option[0] + "拒绝了用户" +
                         command.m_option[1] + "的入群申请.处理人：" +
                         command.m_uid + GetNowTime());
         // 如果群主或者管理员在线，给他的通知套接字一个提醒
-        string online = redis.gethash(members[i]->str, "在线状态");
+        string online = userCache.get(members[i]->str, UF_ONLINE);
         if (online != "-1") {
-          string friend_recvfd = redis.gethash(members[i]->str, "通知套接字");
-          TcpSocket friendFd_class(stoi(friend_recvfd));
+          string friend_recvfd = userCache.get(members[i]->str, UF_NOTIFY_FD);
+          PushSocket friendFd_class(stoi(friend_recvfd));
           friendFd_class.sendMsg("您管理的群" + command.m_option[0] +
                                  "拒绝了一条入群申请.");
         }
@@ -1207,20 +1443,20 @@ void DenyApply(TcpSocket cfd_class, Command command) {
 void SetMember(TcpSocket cfd_class, Command command) {
   // 操作人是否为群主
   string position =
-      redis.gethash(command.m_option[0] + "的群成员列表", command.m_uid);
+      redis->gethash(command.m_option[0] + "的群成员列表", command.m_uid);
   if (position != "群主") {
     cfd_class.sendMsg("cannot");
     return;
   }
   // 被操作人是否在群里
-  if (!redis.hashexists(command.m_option[0] + "的群成员列表",
-                        command.m_option[1])) {
+  if (!redis->hashexists(command.m_option[0] + "的群成员列表",
+                         command.m_option[1])) {
     cfd_class.sendMsg("nohave");
     return;
   }
   // 被操作人是否是群主
   string position_old =
-      redis.gethash(command.m_option[0] + "的群成员列表", command.m_option[1]);
+      redis->gethash(command.m_option[0] + "的群成员列表", command.m_option[1]);
   if (position_old == "群主") {
     cfd_class.sendMsg("cannot1");
     return;
@@ -1233,24 +1469,21 @@ void SetMember(TcpSocket cfd_class, Command command) {
   // 是否是群主转让群
   if (command.m_option[2] == "leader") {
     // 把自己改成群成员
-    redis.hsetValue(command.m_option[0] + "的群成员列表", command.m_uid,
-                    "群成员");
+    redis->hsetValue(command.m_option[0] + "的群成员列表", command.m_uid,
+                     "群成员");
     // 设置新群主
-    redis.hsetValue(command.m_option[0] + "的群成员列表", command.m_option[1],
-                    "群主");
+    redis->hsetValue(command.m_option[0] + "的群成员列表", command.m_option[1],
+                     "群主");
     // 通知新群主
-    string num = redis.gethash(
-        command.m_option[1] + static_cast<string>("的未读消息"), "通知消息");
-    redis.hsetValue(command.m_option[1] + string("的未读消息"), "通知消息",
-                    to_string(stoi(num) + 1));
-    redis.lpush(command.m_option[1] + static_cast<string>("的通知消息"),
-                "您所在的群聊" + command.m_option[0] + "的群主" +
+    unreadCounter.add(command.m_option[1], "通知消息");
+    redis->lpush(command.m_option[1] + static_cast<string>("的通知消息"),
+                 "您所在的群聊" + command.m_option[0] + "的群主" +
                     command.m_uid + "把群聊转让给了你" + GetNowTime());
     // 如果新群主在线，给他的通知套接字一个提醒
-    string online = redis.gethash(command.m_option[1], "在线状态");
+    string online = userCache.get(command.m_option[1], UF_ONLINE);
     if (online != "-1") {
-      string friend_recvfd = redis.gethash(command.m_option[1], "通知套接字");
-      TcpSocket friendFd_class(stoi(friend_recvfd));
+      string friend_recvfd = userCache.get(command.m_option[1], UF_NOTIFY_FD);
+      PushSocket friendFd_class(stoi(friend_recvfd));
       friendFd_class.sendMsg("您成为了群聊" + command.m_option[0] +
                              "的新群主.");
     }
@@ -1259,40 +1492,34 @@ void SetMember(TcpSocket cfd_class, Command command) {
   }
   // 为被操作人设置新职位
   if (command.m_option[2] == "member") {
-    redis.hsetValue(command.m_option[0] + "的群成员列表", command.m_option[1],
-                    "群成员");
+    redis->hsetValue(command.m_option[0] + "的群成员列表", command.m_option[1],
+                     "群成员");
     // 通知被操作人
-    string num = redis.gethash(
-        command.m_option[1] + static_cast<string>("的未读消息"), "通知消息");
-    redis.hsetValue(command.m_option[1] + string("的未读消息"), "通知消息",
-                    to_string(stoi(num) + 1));
-    redis.lpush(command.m_option[1] + static_cast<string>("的通知消息"),
-                "您所在的群聊" + command.m_option[0] + "的群主" +
+    unreadCounter.add(command.m_option[1], "通知消息");
+    redis->lpush(command.m_option[1] + static_cast<string>("的通知消息"),
+                 "您所在的群聊" + command.m_option[0] + "的群主" +
                     command.m_uid + "撤销了您的管理员权限" + GetNowTime());
     // 如果新群主在线，给他的通知套接字一个提醒
-    string online = redis.gethash(command.m_option[1], "在线状态");
+    string online = userCache.get(command.m_option[1], UF_ONLINE);
     if (online != "-1") {
-      string friend_recvfd = redis.gethash(command.m_option[1], "通知套接字");
-      TcpSocket friendFd_class(stoi(friend_recvfd));
+      string friend_recvfd = userCache.get(command.m_option[1], UF_NOTIFY_FD);
+      PushSocket friendFd_class(stoi(friend_recvfd));
       friendFd_class.sendMsg("您在群聊" + command.m_option[0] +
                              "的管理员权限被撤销.");
     }
   } else if (command.m_option[2] == "manager") {
-    redis.hsetValue(command.m_option[0] + "的群成员列表", command.m_option[1],
-                    "管理员");
+    redis->hsetValue(command.m_option[0] + "的群成员列表", command.m_option[1],
+                     "管理员");
     // 通知被操作人
-    string num = redis.gethash(
-        command.m_option[1] + static_cast<string>("的未读消息"), "通知消息");
-    redis.hsetValue(command.m_option[1] + string("的未读消息"), "通知消息",
-                    to_string(stoi(num) + 1));
-    redis.lpush(command.m_option[1] + static_cast<string>("的通知消息"),
-                "您所在的群聊" + command.m_option[0] + "的群主" +
+    unreadCounter.add(command.m_option[1], "通知消息");
+    redis->lpush(command.m_option[1] + static_cast<string>("的通知消息"),
+                 "您所在的群聊" + command.m_option[0] + "的群主" +
                     command.m_uid + "将你设为管理员" + GetNowTime());
     // 如果新群主在线，给他的通知套接字一个提醒
-    string online = redis.gethash(command.m_option[1], "在线状态");
+    string online = userCache.get(command.m_option[1], UF_ONLINE);
     if (online != "-1") {
-      string friend_recvfd = redis.gethash(command.m_option[1], "通知套接字");
-      TcpSocket friendFd_class(stoi(friend_recvfd));
+      string friend_recvfd = userCache.get(command.m_option[1], UF_NOTIFY_FD);
+      PushSocket friendFd_class(stoi(friend_recvfd));
       friendFd_class.sendMsg("您被设为群聊" + command.m_option[0] +
                              "的管理员.");
     }
@@ -1303,34 +1530,34 @@ void SetMember(TcpSocket cfd_class, Command command) {
 void ExitGroup(TcpSocket cfd_class, Command command) {
   // 如果是群主，他无法退群
   string position =
-      redis.gethash(command.m_option[0] + "的群成员列表", command.m_uid);
+      redis->gethash(command.m_option[0] + "的群成员列表", command.m_uid);
   if (position == "群主") {
     cfd_class.sendMsg("cannot");
     return;
   }
   // 群成员列表里删除此人，此人的群聊列表里删除该群聊
-  redis.delhash(command.m_option[0] + "的群成员列表", command.m_uid);
-  redis.delhash(command.m_uid + "的群聊列表", command.m_option[0]);
+  redis->delhash(command.m_option[0] + "的群成员列表", command.m_uid);
+  redis->delhash(command.m_uid + "的群聊列表", command.m_option[0]);
+  redis->delhash(command.m_uid + "的群聊已读", command.m_option[0]);
+  groupOnline.leave(command.m_option[0], command.m_uid);
+  unreadSummary.mark(command.m_uid);
   // 这个人退出后，通知群里剩下的群主和管理员
-  int num = redis.hlen(command.m_option[0] + "的群成员列表");
-  redisReply **members = redis.hkeys(command.m_option[0] + "的群成员列表");
+  int num = redis->hlen(command.m_option[0] + "的群成员列表");
+  RedisReply members = redis->hkeys(command.m_option[0] + "的群成员列表");
   for (int i = 0; i < num; i++) {
     string position =
-        redis.gethash(command.m_option[0] + "的群成员列表", members[i]->str);
+        redis->gethash(command.m_option[0] + "的群成员列表", members[i]->str);
     if (position == static_cast<string>("管理员") ||
         position == static_cast<string>("群主")) {
-      string num0 = redis.gethash(
-          members[i]->str + static_cast<string>("的未读消息"), "通知消息");
-      redis.hsetValue(members[i]->str + string("的未读消息"), "通知消息",
-                      to_string(stoi(num0) + 1));
-      redis.lpush(members[i]->str + static_cast<string>("的通知消息"),
-                  "用户" + command.m_uid + "退出了您管理的群聊" +
+      unreadCounter.add(members[i]->str, "通知消息");
+      redis->lpush(members[i]->str + static_cast<string>("的通知消息"),
+                   "用户" + command.m_uid + "退出了您管理的群聊" +
                       command.m_option[0] + GetNowTime());
       // 如果群主或者管理员在线，给他的通知套接字一个提醒
-      string online = redis.gethash(members[i]->str, "在线状态");
+      string online = userCache.get(members[i]->str, UF_ONLINE);
       if (online != "-1") {
-        string friend_recvfd = redis.gethash(members[i]->str, "通知套接字");
-        TcpSocket friendFd_class(stoi(friend_recvfd));
+        string friend_recvfd = userCache.get(members[i]->str, UF_NOTIFY_FD);
+        PushSocket friendFd_class(stoi(friend_recvfd));
         friendFd_class.sendMsg("一名用户退出了您管理的群聊" +
                                command.m_option[0]);
       }
@@ -1339,25 +1566,25 @@ void ExitGroup(TcpSocket cfd_class, Command command) {
   cfd_class.sendMsg("ok");
 }
 void DisplyMember(TcpSocket cfd_class, Command command) {
-  int memberdNum = redis.hlen(command.m_option[0] +
-                              "的群成员列表"); // 获得群成员列表的成员数量
+  int memberdNum = redis->hlen(command.m_option[0] +
+                               "的群成员列表"); // 获得群成员列表的成员数量
   // 群成员数量肯定不为0，就遍历成员列表，根据在线状态发送要展示的内容,先展示在线的，再展示不在线的
-  redisReply **member_uid = redis.hkeys(command.m_option[0] + "的群成员列表");
+  RedisReply member_uid = redis->hkeys(command.m_option[0] + "的群成员列表");
   for (int i = 0; i < memberdNum; i++) {
-    string member_mark = redis.gethash(member_uid[i]->str, "昵称");
-    string isonline = redis.gethash(member_uid[i]->str, "在线状态");
+    string member_mark = userCache.get(member_uid[i]->str, UF_NICKNAME);
+    string isonline = userCache.get(member_uid[i]->str, UF_ONLINE);
     string position =
-        redis.gethash(command.m_option[0] + "的群成员列表", member_uid[i]->str);
+        redis->gethash(command.m_option[0] + "的群成员列表", member_uid[i]->str);
     if (isonline != "-1") {
       cfd_class.sendMsg(L_GREEN + member_mark + NONE + "(" +
                         member_uid[i]->str + ")" + "————" + position);
     }
   }
   for (int i = 0; i < memberdNum; i++) {
-    string member_mark = redis.gethash(member_uid[i]->str, "昵称");
-    string isonline = redis.gethash(member_uid[i]->str, "在线状态");
+    string member_mark = userCache.get(member_uid[i]->str, UF_NICKNAME);
+    string isonline = userCache.get(member_uid[i]->str, UF_ONLINE);
     string position =
-        redis.gethash(command.m_option[0] + "的群成员列表", member_uid[i]->str);
+        redis->gethash(command.m_option[0] + "的群成员列表", member_uid[i]->str);
     if (isonline == "-1") {
       cfd_class.sendMsg(L_WHITE + member_mark + NONE + "(" +
                         member_uid[i]->str + ")" + "————" + position);
@@ -1368,63 +1595,60 @@ void DisplyMember(TcpSocket cfd_class, Command command) {
 void RemoveMember(TcpSocket cfd_class, Command command) {
   // 操作者是否为群主或者管理员
   string position =
-      redis.gethash(command.m_option[0] + "的群成员列表", command.m_uid);
+      redis->gethash(command.m_option[0] + "的群成员列表", command.m_uid);
   if (position == "群成员") {
     cfd_class.sendMsg("cannot");
     return;
   }
   // 只能移除群成员
   string position0 =
-      redis.gethash(command.m_option[0] + "的群成员列表", command.m_option[1]);
+      redis->gethash(command.m_option[0] + "的群成员列表", command.m_option[1]);
   if (position0 != "群成员") {
     cfd_class.sendMsg("cannot0");
     return;
   }
   // 被操作人是否在群里
-  if (!redis.hashexists(command.m_option[0] + "的群成员列表",
-                        command.m_option[1])) {
+  if (!redis->hashexists(command.m_option[0] + "的群成员列表",
+                         command.m_option[1])) {
     cfd_class.sendMsg("no");
     return;
   }
   // 群成员列表里删除此人，删此人的群聊列表里删除该群聊
-  redis.delhash(command.m_option[0] + "的群成员列表", command.m_option[1]);
-  redis.delhash(command.m_option[1] + "的群聊列表", command.m_option[0]);
+  redis->delhash(command.m_option[0] + "的群成员列表", command.m_option[1]);
+  redis->delhash(command.m_option[1] + "的群聊列表", command.m_option[0]);
+  redis->delhash(command.m_option[1] + "的群聊已读", command.m_option[0]);
+  groupOnline.leave(command.m_option[0], command.m_option[1]);
   // 通知这个人
-  string num0 = redis.gethash(command.m_option[1] + "的未读消息", "通知消息");
-  redis.hsetValue(command.m_option[1] + "的未读消息", "通知消息",
-                  to_string(stoi(num0) + 1));
-  redis.lpush(command.m_option[1] + "的通知消息",
-              "您被群聊" + command.m_option[0] + "的" + position +
+  unreadCounter.add(command.m_option[1], "通知消息");
+  redis->lpush(command.m_option[1] + "的通知消息",
+               "您被群聊" + command.m_option[0] + "的" + position +
                   command.m_uid + "移出了群聊" + GetNowTime());
   // 如果这个人在线，给他的通知套接字一个提醒
-  string online = redis.gethash(command.m_option[1], "在线状态");
+  string online = userCache.get(command.m_option[1], UF_ONLINE);
   if (online != "-1") {
-    string member_recvfd = redis.gethash(command.m_option[1], "通知套接字");
-    TcpSocket friendFd_class(stoi(member_recvfd));
+    string member_recvfd = userCache.get(command.m_option[1], UF_NOTIFY_FD);
+    PushSocket friendFd_class(stoi(member_recvfd));
     friendFd_class.sendMsg("您被移移出了群聊" + command.m_option[0]);
   }
   // 通知群主和管理员
-  int num = redis.hlen(command.m_option[0] + "的群成员列表");
-  redisReply **members = redis.hkeys(command.m_option[0] + "的群成员列表");
+  int num = redis->hlen(command.m_option[0] + "的群成员列表");
+  RedisReply members = redis->hkeys(command.m_option[0] + "的群成员列表");
   for (int i = 0; i < num; i++) {
     string position1 =
-        redis.gethash(command.m_option[0] + "的群成员列表", members[i]->str);
+        redis->gethash(command.m_option[0] + "的群成员列表", members[i]->str);
     if (position1 == static_cast<string>("管理员") ||
         position1 == static_cast<string>("群主")) {
       if (members[i]->str != command.m_uid) {
-        string num0 = redis.gethash(
-            members[i]->str + static_cast<string>("的未读消息"), "通知消息");
-        redis.hsetValue(members[i]->str + static_cast<string>("的未读消息"),
-                        "通知消息", to_string(stoi(num0) + 1));
-        redis.lpush(members[i]->str + static_cast<string>("的通知消息"),
-                    "您管理的群聊" + command.m_option[0] + "的" + position +
+        unreadCounter.add(members[i]->str, "通知消息");
+        redis->lpush(members[i]->str + static_cast<string>("的通知消息"),
+                     "您管理的群聊" + command.m_option[0] + "的" + position +
                         command.m_uid + "将用户" + command.m_option[1] +
                         "移出了群聊" + GetNowTime());
         // 如果群主或者管理员在线，给他的通知套接字一个提醒
-        string online = redis.gethash(members[i]->str, "在线状态");
+        string online = userCache.get(members[i]->str, UF_ONLINE);
         if (online != "-1") {
-          string friend_recvfd = redis.gethash(members[i]->str, "通知套接字");
-          TcpSocket friendFd_class(stoi(friend_recvfd));
+          string friend_recvfd = userCache.get(members[i]->str, UF_NOTIFY_FD);
+          PushSocket friendFd_class(stoi(friend_recvfd));
           friendFd_class.sendMsg("一名用户被移出了您管理的群聊" +
                                  command.m_option[0]);
         }
@@ -1435,7 +1659,7 @@ void RemoveMember(TcpSocket cfd_class, Command command) {
   return;
 }
 void InfoXXXX(TcpSocket cfd_class, Command command) { return; }
-void SendFile(TcpSocket cfd_class, Command command) {
+CoTask<void> SendFile(TcpSocket cfd_class, Command command) {
   // 文件在服务器本地的存储目录和文件名，文件路径
   string filepath = "/home/yuanye/Code/Code_Cpp/Chatroom/file/" +
                     command.m_uid + "-" + command.m_option[0];
@@ -1445,83 +1669,84 @@ void SendFile(TcpSocket cfd_class, Command command) {
   unsigned long size = atoi(command.m_option[2].c_str());
   string cmd = "777 " + filepath;
   system(string("mkdir -m " + cmd).c_str());
-  cout << "目录已创建." << endl;
-  cout << "接收到的文件存储位置为：" << File << endl;
+  LOG_DEBUG("目录已创建，接收到的文件存储位置为：{}", File);
   cfd_class.sendMsg("ok");
   // 写入文件内容
   int filefd;
-  unsigned long n;
   if ((filefd = open(File.c_str(), O_WRONLY | O_CREAT | O_APPEND, S_IRWXU)) <
       0) {
-    cout << "文件打开失败." << endl;
+    LOG_ERROR("文件{}打开失败: {}", File, strerror(errno));
   }
-  char buf[4096];
-  cout << "File:" << File << endl;
-  cout << "size:" << size << endl;
-  while ((n = read(cfd_class.getfd(), buf, 4096)) > 0) {
+  LOG_INFO("开始接收文件{}, 大小{}", File, size);
+  while (true) {
+    // 本线程就近分配的缓冲区，协程恢复后可能换了线程，每次重新取
+    char *buf = Affinity::threadBuffer();
+    ssize_t n = recv(cfd_class.getfd(), buf, 4096, MSG_DONTWAIT);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+      // 数据还没到，让出工作线程，等套接字可读再继续
+      if (!co_await readable(cfd_class.getfd())) {
+        close(filefd);
+        AbortConn(cfd_class.getfd());
+        co_return;
+      }
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
     unsigned long sum = write(filefd, buf, n);
     size -= sum;
-    cout << "sum:" << sum << endl;
-    cout << "size:" << size << endl;
+    LOG_DEBUG("写入{}字节，剩余{}字节", sum, size);
     if (size == 4) {
       break;
     }
   }
   close(filefd);
-  // 将新的消息加入到我对他的消息队列
-  string msg0 = "我发送了文件：" + filename + ".........." + GetNowTime();
-  redis.lpush(command.m_uid + "--" + command.m_option[0], msg0);
+  // 记录写进两人共用的列表，被好友屏蔽时只有我看得到
+  Message rec(command.m_uid, command.m_option[0], filename,
+              to_string(time(NULL)), MSG_SENDFILE);
+  rec.hidden = friendGraph.isBlocked(command.m_option[0], command.m_uid);
+  redis->lpush(ChatLogKey(command.m_uid, command.m_option[0]), rec.To_Json());
+  archive.touch(ChatLogKey(command.m_uid, command.m_option[0]));
   // 当前聊天界面展示我的消息
-  string my_recvfd = redis.gethash(command.m_uid, "通知套接字");
-  TcpSocket myFd_class(stoi(my_recvfd));
+  string msg0 = RenderChat(rec, command.m_uid, "");
+  string my_recvfd = userCache.get(command.m_uid, UF_NOTIFY_FD);
+  PushSocket myFd_class(stoi(my_recvfd));
   myFd_class.sendMsg(UP + msg0);
   // 如果好友把自己屏蔽的话，什么都不做，直接返回
-  if (redis.scard(command.m_option[0] + "的屏蔽列表")) {
-    if (redis.sismember(command.m_option[0] + "的屏蔽列表", command.m_uid)) {
-      return;
-    }
+  if (rec.hidden) {
+    co_return;
   }
-  // 没有被屏蔽，消息加到他对我的消息队列，并给相应通知
-  string name0 = redis.gethash(command.m_option[0] + "的好友列表",
-                               command.m_uid); // 得到好友給我的备注
-  string msg1 = name0 + "发送了文件：" + filename + ".........." + GetNowTime();
-  redis.lpush(command.m_option[0] + "--" + command.m_uid,
-              msg1); // 把消息加入的好友的聊天队列
+  // 没有被屏蔽，按好友给我的备注展示给他，并给相应通知
+  string name0; // 好友給我的备注
+  friendGraph.remarkOf(command.m_option[0], command.m_uid, name0);
+  string msg1 = RenderChat(rec, command.m_option[0], name0);
 
   // 如果好友把自己屏蔽的话，啥都不做，如果没有被屏蔽，就进行下面的操作：
   // 如果好友在线且处于和自己的聊天界面，就把消息内容发给通知套接字
   // 否则，把消息添加到未读消息里
   // 如果好友在线但不处于和自己的聊天界面，把提示消息发给通知套接字
-  string online = redis.gethash(command.m_option[0], "在线状态");
-  string ChatFriend = redis.gethash(command.m_option[0], "聊天对象");
+  string online = userCache.get(command.m_option[0], UF_ONLINE);
+  string ChatFriend = userCache.get(command.m_option[0], UF_CHAT_TARGET);
   // 好友在线且和我聊天，让通知套接字展示消息，并返回
   if (online != "-1" && ChatFriend == command.m_uid) { // 好友在线且和我聊天
-    string friend_recvfd = redis.gethash(command.m_option[0], "通知套接字");
-    TcpSocket friendFd_class(stoi(friend_recvfd));
+    string friend_recvfd = userCache.get(command.m_option[0], UF_NOTIFY_FD);
+    PushSocket friendFd_class(stoi(friend_recvfd));
     string begin = "\r\n";
     friendFd_class.sendMsg(begin + UP + msg1);
   } else { // 否则，好友的未读消息中的来自我的消息数量+1
-    if (redis.hashexists(command.m_option[0] + "的未读消息",
-                         "来自" + command.m_uid + "的未读消息")) {
-      string num1 = redis.gethash(command.m_option[0] + "的未读消息",
-                                  "来自" + command.m_uid + "的未读消息");
-      redis.hsetValue(command.m_option[0] + "的未读消息",
-                      "来自" + command.m_uid + "的未读消息",
-                      to_string(stoi(num1) + 1));
-    } else {
-      redis.hsetValue(command.m_option[0] + "的未读消息",
-                      "来自" + command.m_uid + "的未读消息", "1");
-    }
+    unreadCounter.add(command.m_option[0],
+                      "来自" + command.m_uid + "的未读消息");
   }
   // 如果好友在线但是没和我聊天，让通知套接字告知来消息
   if (online != "-1" && ChatFriend != command.m_uid) { // 好友在线但没和我聊天
-    string friend_recvfd = redis.gethash(command.m_option[0], "通知套接字");
-    TcpSocket friendFd_class(stoi(friend_recvfd));
+    string friend_recvfd = userCache.get(command.m_option[0], UF_NOTIFY_FD);
+    PushSocket friendFd_class(stoi(friend_recvfd));
     friendFd_class.sendMsg(command.m_uid + "发来了一个文件");
   }
   cfd_class.sendMsg("ok");
 }
-void RecvFile(TcpSocket cfd_class, Command command) {
+CoTask<void> RecvFile(TcpSocket cfd_class, Command command) {
   // 从客户端得到文件名，得到文件保存位置
   string filename = command.m_option[1];
   string filepath = "/home/yuanye/Code/Code_Cpp/Chatroom/file/" +
@@ -1529,13 +1754,13 @@ void RecvFile(TcpSocket cfd_class, Command command) {
   string File = filepath + "/" + filename;
   // 打开文件，先告诉客户端文件大小，再传输文件内容
   int filefd;
-  cout << "File:" << File << endl;
+  LOG_INFO("开始发送文件{}", File);
   if ((filefd = open(File.c_str(), O_RDONLY)) < 0) {
-    cout << "文件打开失败或不存在该文件." << endl;
+    LOG_WARN("文件{}打开失败或不存在该文件.", File);
     int ret = cfd_class.sendMsg("no");
     if (ret == 0 || ret == -1) {
-      cout << "对端已关闭." << endl;
-      return;
+      LOG_INFO("对端已关闭.");
+      co_return;
     }
   } else {
     assert(filefd > 0);
@@ -1543,67 +1768,80 @@ void RecvFile(TcpSocket cfd_class, Command command) {
     fstat(filefd, &stat_buf);
     int ret = cfd_class.sendMsg(to_string(stat_buf.st_size));
     if (ret == 0 || ret == -1) {
-      cout << "对端已关闭." << endl;
-      return;
+      LOG_INFO("对端已关闭.");
+      co_return;
+    }
+    // 套接字临时设为非阻塞，发送缓冲区满时让出工作线程，等可写再继续
+    int fd = cfd_class.getfd();
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    off_t offset = 0;
+    while (offset < stat_buf.st_size) {
+      ssize_t n = sendfile(fd, filefd, &offset, stat_buf.st_size - offset);
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      if (n == -1 && errno == EAGAIN) {
+        if (!co_await writable(fd)) {
+          close(filefd);
+          AbortConn(fd);
+          co_return;
+        }
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
     }
-    sendfile(cfd_class.getfd(), filefd, NULL, stat_buf.st_size);
+    fcntl(fd, F_SETFL, flags);
     close(filefd);
   }
-  cout << "文件发送成功." << endl;
-  // 将新的消息加入到我对他的消息队列
-  string msg0 = "我接收了文件：" + filename + ".........." + GetNowTime();
-  redis.lpush(command.m_uid + "--" + command.m_option[0], msg0);
+  LOG_INFO("文件{}发送成功.", File);
+  // 记录写进两人共用的列表，被好友屏蔽时只有我看得到
+  Message rec(command.m_uid, command.m_option[0], filename,
+              to_string(time(NULL)), MSG_RECVFILE);
+  rec.hidden = friendGraph.isBlocked(command.m_option[0], command.m_uid);
+  redis->lpush(ChatLogKey(command.m_uid, command.m_option[0]), rec.To_Json());
+  archive.touch(ChatLogKey(command.m_uid, command.m_option[0]));
   // 当前聊天界面展示我的消息
-  string my_recvfd = redis.gethash(command.m_uid, "通知套接字");
-  TcpSocket myFd_class(stoi(my_recvfd));
+  string msg0 = RenderChat(rec, command.m_uid, "");
+  string my_recvfd = userCache.get(command.m_uid, UF_NOTIFY_FD);
+  PushSocket myFd_class(stoi(my_recvfd));
   myFd_class.sendMsg(UP + msg0);
   // 如果好友把自己屏蔽的话，什么都不做，直接返回
-  if (redis.scard(command.m_option[0] + "的屏蔽列表")) {
-    if (redis.sismember(command.m_option[0] + "的屏蔽列表", command.m_uid)) {
-      return;
-    }
+  if (rec.hidden) {
+    co_return;
   }
-  // 没有被屏蔽，消息加到他对我的消息队列，并给相应通知
-  string name0 = redis.gethash(command.m_option[0] + "的好友列表",
-                               command.m_uid); // 得到好友給我的备注
-  string msg1 = name0 + "接收了文件：" + filename + ".........." + GetNowTime();
-  redis.lpush(command.m_option[0] + "--" + command.m_uid,
-              msg1); // 把消息加入的好友的聊天队列
+  // 没有被屏蔽，按好友给我的备注展示给他，并给相应通知
+  string name0; // 好友給我的备注
+  friendGraph.remarkOf(command.m_option[0], command.m_uid, name0);
+  string msg1 = RenderChat(rec, command.m_option[0], name0);
 
   // 如果好友把自己屏蔽的话，啥都不做，如果没有被屏蔽，就进行下面的操作：
   // 如果好友在线且处于和自己的聊天界面，就把消息内容发给通知套接字
   // 否则，把消息添加到未读消息里
   // 如果好友在线但不处于和自己的聊天界面，把提示消息发给通知套接字
-  string online = redis.gethash(command.m_option[0], "在线状态");
-  string ChatFriend = redis.gethash(command.m_option[0], "聊天对象");
+  string online = userCache.get(command.m_option[0], UF_ONLINE);
+  string ChatFriend = userCache.get(command.m_option[0], UF_CHAT_TARGET);
   // 好友在线且和我聊天，让通知套接字展示消息，并返回
   if (online != "-1" && ChatFriend == command.m_uid) { // 好友在线且和我聊天
-    string friend_recvfd = redis.gethash(command.m_option[0], "通知套接字");
-    TcpSocket friendFd_class(stoi(friend_recvfd));
+    string friend_recvfd = userCache.get(command.m_option[0], UF_NOTIFY_FD);
+    PushSocket friendFd_class(stoi(friend_recvfd));
     string begin = "\r\n";
     friendFd_class.sendMsg(begin + UP + msg1);
   } else { // 否则，好友的未读消息中的来自我的消息数量+1
-    if (redis.hashexists(command.m_option[0] + "的未读消息",
-                         "来自" + command.m_uid + "的未读消息")) {
-      string num1 = redis.gethash(command.m_option[0] + "的未读消息",
-                                  "来自" + command.m_uid + "的未读消息");
-      redis.hsetValue(command.m_option[0] + "的未读消息",
-                      "来自" + command.m_uid + "的未读消息",
-                      to_string(stoi(num1) + 1));
-    } else {
-      redis.hsetValue(command.m_option[0] + "的未读消息",
-                      "来自" + command.m_uid + "的未读消息", "1");
-    }
+    unreadCounter.add(command.m_option[0],
+                      "来自" + command.m_uid + "的未读消息");
   }
   // 如果好友在线但是没和我聊天，让通知套接字告知来消息
   if (online != "-1" && ChatFriend != command.m_uid) { // 好友在线但没和我聊天
-    string friend_recvfd = redis.gethash(command.m_option[0], "通知套接字");
-    TcpSocket friendFd_class(stoi(friend_recvfd));
+    string friend_recvfd = userCache.get(command.m_option[0], UF_NOTIFY_FD);
+    PushSocket friendFd_class(stoi(friend_recvfd));
     friendFd_class.sendMsg(command.m_uid + "接收了文件");
   }
   cfd_class.sendMsg("ok");
 }
-void SendFile_G(TcpSocket cfd_class, Command command) {
+CoTask<void> SendFile_G(TcpSocket cfd_class, Command command) {
   // 文件在服务器本地的存储目录和文件名，文件路径
   string filepath = "/home/yuanye/Code/Code_Cpp/Chatroom/file/" +
                     command.m_uid + "-" + command.m_option[0];
@@ -1612,24 +1850,34 @@ void SendFile_G(TcpSocket cfd_class, Command command) {
   system(string("rem -f " + File).c_str());
   unsigned long size = atoi(command.m_option[2].c_str());
   system(string("mkdir -m 777 " + filepath).c_str());
-  cout << "目录已创建." << endl;
-  cout << "接收到的文件存储位置为：" << File << endl;
+  LOG_DEBUG("目录已创建，接收到的文件存储位置为：{}", File);
   cfd_class.sendMsg("ok");
   // 写入文件内容
   int filefd;
-  unsigned long n;
   if ((filefd = open(File.c_str(), O_WRONLY | O_CREAT | O_APPEND, S_IRWXU)) <
       0) {
-    cout << "文件打开失败." << endl;
+    LOG_ERROR("文件{}打开失败: {}", File, strerror(errno));
   }
-  char buf[4096];
-  cout << "File:" << File << endl;
-  cout << "size:" << size << endl;
-  while ((n = read(cfd_class.getfd(), buf, 4096)) > 0) {
+  LOG_INFO("开始接收文件{}, 大小{}", File, size);
+  while (true) {
+    // 本线程就近分配的缓冲区，协程恢复后可能换了线程，每次重新取
+    char *buf = Affinity::threadBuffer();
+    ssize_t n = recv(cfd_class.getfd(), buf, 4096, MSG_DONTWAIT);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+      // 数据还没到，让出工作线程，等套接字可读再继续
+      if (!co_await readable(cfd_class.getfd())) {
+        close(filefd);
+        AbortConn(cfd_class.getfd());
+        co_return;
+      }
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
     unsigned long sum = write(filefd, buf, n);
     size -= sum;
-    cout << "sum:" << sum << endl;
-    cout << "size:" << size << endl;
+    LOG_DEBUG("写入{}字节，剩余{}字节", sum, size);
     if (size == 0) {
       break;
     }
@@ -1638,57 +1886,22 @@ void SendFile_G(TcpSocket cfd_class, Command command) {
   // 将新的消息加入到群聊消息队列
   string msg0 =
       command.m_uid + "上传了文件：" + filename + ".........." + GetNowTime();
-  redis.lpush(command.m_option[0] + "的聊天消息队列", msg0);
+  redis->lpush(command.m_option[0] + "的聊天消息队列", msg0);
+  archive.touch(command.m_option[0] + "的聊天消息队列");
+  redis->incr(command.m_option[0] + "的消息序号");
   // 当前聊天界面展示我的消息
-  string my_recvfd = redis.gethash(command.m_uid, "通知套接字");
-  TcpSocket myFd_class(stoi(my_recvfd));
+  string my_recvfd = userCache.get(command.m_uid, UF_NOTIFY_FD);
+  PushSocket myFd_class(stoi(my_recvfd));
   string up = UP;
   myFd_class.sendMsg(up + "我上传了文件：" + filename + ".........." +
                      GetNowTime());
-  // 如果群成员的聊天对象不是该群，未读消息数+1
-  // 如果群成员的聊天对象不是该群，在线，给一个提示消息，不在线就不给
-  // 如果群成员的聊天对象是该群，通知套接字展示消息内容
-  int num = redis.hlen(command.m_option[0] + "的群成员列表");
-  redisReply **members = redis.hkeys(command.m_option[0] + "的群成员列表");
-  for (int i = 0; i < num; i++) {
-    if (members[i]->str != command.m_uid) {
-      string online = redis.gethash(members[i]->str, "在线状态");
-      string Chatgroup = redis.gethash(members[i]->str, "聊天对象");
-      // 群成员在线且和我聊天，让通知套接字展示消息，并返回
-      if (online != "-1" &&
-          Chatgroup == command.m_option[0]) { // 群成员在线且和在群里聊天
-        string member_recvfd = redis.gethash(members[i]->str, "通知套接字");
-        TcpSocket friendFd_class(stoi(member_recvfd));
-        string begin = "\r\n";
-        friendFd_class.sendMsg(begin + UP + msg0);
-      } else { // 否则，群成员的未读消息中的来自群聊的消息数量+1
-        if (redis.hashexists(static_cast<string>(members[i]->str) +
-                                 "的未读消息",
-                             "来自" + command.m_option[0] + "的未读消息")) {
-          string num1 =
-              redis.gethash(static_cast<string>(members[i]->str) + "的未读消息",
-                            "来自" + command.m_option[0] + "的未读消息");
-          redis.hsetValue(static_cast<string>(members[i]->str) + "的未读消息",
-                          "来自" + command.m_option[0] + "的未读消息",
-                          to_string(stoi(num1) + 1));
-        } else {
-          redis.hsetValue(static_cast<string>(members[i]->str) + "的未读消息",
-                          "来自" + command.m_option[0] + "的未读消息", "1");
-        }
-      }
-      // 如果群成员在线但是没和我聊天，让通知套接字告知来消息
-      if (online != "-1" &&
-          Chatgroup != command.m_option[0]) { // 群成员在线但没在群里聊天
-        string member_recvfd = redis.gethash(members[i]->str, "通知套接字");
-        TcpSocket friendFd_class(stoi(member_recvfd));
-        friendFd_class.sendMsg(command.m_option[0] + "发来了一条消息");
-      }
-    }
-  }
+  string begin = "\r\n";
+  PushGroup(command.m_option[0], command.m_uid, begin + UP + msg0,
+            command.m_option[0] + "发来了一条消息");
   cfd_class.sendMsg("ok");
-  return;
+  co_return;
 }
-void RecvFile_G(TcpSocket cfd_class, Command command) {
+CoTask<void> RecvFile_G(TcpSocket cfd_class, Command command) {
   // 从客户端得到文件名，得到文件保存位置
   string filename = command.m_option[1];
   string filepath = "/home/yuanye/Code/Code_Cpp/Chatroom/file/" +
@@ -1696,13 +1909,13 @@ void RecvFile_G(TcpSocket cfd_class, Command command) {
   string File = filepath + "/" + filename;
   // 打开文件，先告诉客户端文件大小，再传输文件内容
   int filefd;
-  cout << "File:" << File << endl;
+  LOG_INFO("开始发送文件{}", File);
   if ((filefd = open(File.c_str(), O_RDONLY)) < 0) {
-    cout << "文件打开失败或不存在该文件." << endl;
+    LOG_WARN("文件{}打开失败或不存在该文件.", File);
     int ret = cfd_class.sendMsg("no");
     if (ret == 0 || ret == -1) {
-      cout << "对端已关闭." << endl;
-      return;
+      LOG_INFO("对端已关闭.");
+      co_return;
     }
   } else {
     assert(filefd > 0);
@@ -1710,43 +1923,124 @@ void RecvFile_G(TcpSocket cfd_class, Command command) {
     fstat(filefd, &stat_buf);
     int ret = cfd_class.sendMsg(to_string(stat_buf.st_size));
     if (ret == 0 || ret == -1) {
-      cout << "对端已关闭." << endl;
-      return;
+      LOG_INFO("对端已关闭.");
+      co_return;
     }
-    sendfile(cfd_class.getfd(), filefd, NULL, stat_buf.st_size);
+    // 套接字临时设为非阻塞，发送缓冲区满时让出工作线程，等可写再继续
+    int fd = cfd_class.getfd();
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    off_t offset = 0;
+    while (offset < stat_buf.st_size) {
+      ssize_t n = sendfile(fd, filefd, &offset, stat_buf.st_size - offset);
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      if (n == -1 && errno == EAGAIN) {
+        if (!co_await writable(fd)) {
+          close(filefd);
+          AbortConn(fd);
+          co_return;
+        }
+        continue;
+      }
+      if (n <= 0) {
+        break;
+      }
+    }
+    fcntl(fd, F_SETFL, flags);
     close(filefd);
   }
-  cout << "文件发送成功." << endl;
+  LOG_INFO("文件{}发送成功.", File);
 }
 void Dissolve(TcpSocket cfd_class, Command command) {
   // 如果不是群主，他无法解散群
   string position =
-      redis.gethash(command.m_option[0] + "的群成员列表", command.m_uid);
+      redis->gethash(command.m_option[0] + "的群成员列表", command.m_uid);
   if (position != "群主") {
     cfd_class.sendMsg("cannot");
     return;
   }
   // 遍历群成员，在每个人的群聊列表里删除该群聊
-  int num = redis.hlen(command.m_option[0] + "的群成员列表");
-  redisReply **members = redis.hkeys(command.m_option[0] + "的群成员列表");
+  int num = redis->hlen(command.m_option[0] + "的群成员列表");
+  RedisReply members = redis->hkeys(command.m_option[0] + "的群成员列表");
   for (int i = 0; i < num; i++) {
-    redis.delhash(members[i]->str + string("的群聊列表"), command.m_option[0]);
-    string num0 = redis.gethash(
-        members[i]->str + static_cast<string>("的未读消息"), "通知消息");
-    redis.hsetValue(members[i]->str + string("的未读消息"), "通知消息",
-                    to_string(stoi(num0) + 1));
-    redis.lpush(members[i]->str + static_cast<string>("的通知消息"),
-                "您所在的群聊" + command.m_option[0] + "已被群主解散." +
+    redis->delhash(members[i]->str + string("的群聊列表"), command.m_option[0]);
+    redis->delhash(members[i]->str + string("的群聊已读"), command.m_option[0]);
+    unreadCounter.add(members[i]->str, "通知消息");
+    redis->lpush(members[i]->str + static_cast<string>("的通知消息"),
+                 "您所在的群聊" + command.m_option[0] + "已被群主解散." +
                     GetNowTime());
     // 如果群主或者管理员在线，给他的通知套接字一个提醒
-    string online = redis.gethash(members[i]->str, "在线状态");
+    string online = userCache.get(members[i]->str, UF_ONLINE);
     if (online != "-1") {
-      string friend_recvfd = redis.gethash(members[i]->str, "通知套接字");
-      TcpSocket friendFd_class(stoi(friend_recvfd));
+      string friend_recvfd = userCache.get(members[i]->str, UF_NOTIFY_FD);
+      PushSocket friendFd_class(stoi(friend_recvfd));
       friendFd_class.sendMsg("您所在的一个群聊：" + command.m_option[0] +
                              "已被群主解散.");
     }
   }
+  groupOnline.dissolve(command.m_option[0]);
   cfd_class.sendMsg("ok");
 }
+// 在和好友或群聊的聊天记录里搜索，option为{好友uid或群号, 关键词, 页码}；
+// 每条结果按聊天记录的格式展示，最后是页码行和"more"（还有下一页）或"end"
+CoTask<void> Search(TcpSocket cfd_class, Command command) {
+  int lane = LaneOf(command.m_flag);
+  // 对象是好友还是加入的群聊：好友查好友图并取出备注，不是好友再查群聊列表
+  co_await LoadFriends(command.m_uid, lane);
+  string remark;
+  bool isFriend =
+      friendGraph.remarkOf(command.m_uid, command.m_option[0], remark);
+  if (!isFriend) {
+    RedisReply joined = co_await asyncCommand(
+        lane, "HEXISTS", command.m_uid + "的群聊列表", command.m_option[0]);
+    if (joined.integer() == 0) {
+      cfd_class.sendMsg("nofind");
+      co_return;
+    }
+  }
+  string key = isFriend ? ChatLogKey(command.m_uid, command.m_option[0])
+                        : command.m_option[0] + "的聊天消息队列";
+  int page = command.m_option.size() > 2 ? atoi(command.m_option[2].c_str()) : 1;
+  page = max(page, 1);
+  size_t total;
+  vector<SearchIndex::Hit> hits = searchIndex.search(
+      key, command.m_option[1], command.m_uid, page, total);
+  if (hits.empty()) {
+    cfd_class.sendMsg("none");
+    co_return;
+  }
+  // 群聊里这一页不重复的发送者的昵称一次取回
+  unordered_map<string, string> names;
+  if (!isFriend) {
+    vector<string> senders;
+    unordered_set<string> seen;
+    for (const SearchIndex::Hit &hit : hits) {
+      if (hit.sender != command.m_uid && seen.insert(hit.sender).second) {
+        senders.push_back(hit.sender);
+      }
+    }
+    names = co_await LoadNicknames(std::move(senders), lane);
+  }
+  for (const SearchIndex::Hit &hit : hits) {
+    if (isFriend) {
+      Message rec(hit.sender, command.m_option[0], hit.content,
+                  to_string(hit.time));
+      cfd_class.sendMsg(RenderChat(rec, command.m_uid, remark));
+      continue;
+    }
+    string when = ".........." + FormatTime(hit.time);
+    if (hit.sender == command.m_uid) {
+      cfd_class.sendMsg("我：" + hit.content + when);
+      continue;
+    }
+    cfd_class.sendMsg(names[hit.sender] + "：" + hit.content + when);
+  }
+  size_t pages = (total + SEARCH_PAGE_SIZE - 1) / SEARCH_PAGE_SIZE;
+  cfd_class.sendMsg("第" + to_string(page) + "/" + to_string(pages) + "页，共" +
+                    to_string(total) + "条");
+  cfd_class.sendMsg((size_t)page < pages ? "more" : "end");
+  co_return;
+}
 #endif
\ No newline at end of file
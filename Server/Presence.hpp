@@ -0,0 +1,170 @@
+#ifndef PRESENCE_HPP
+#define PRESENCE_HPP
+
+#include "FanOut.hpp"
+#include "FriendGraph.hpp"
+#include "Log.hpp"
+#include "UserCache.hpp"
+#include "redis.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#define PRESENCE_MAX_UID (1 << 24) // 位图覆盖的uid范围，2MB
+#define PRESENCE_FRAME "@presence" // 上下线推送帧的前缀
+
+using namespace std;
+
+// 在线状态的进程内位图：数字uid每个占一位，登录时置1、断开时清0，读的时候不加锁。
+// redis里的在线用户表继续保留给脚本读，两者在登录和断开的同一处先后修改，不是原子的，
+// 中间的短暂窗口里两边可能不一致：位图只用于展示和推送，判断能否登录等仍以redis为准；
+// 重启后两者都从全部离线开始。
+// 上下线由后台线程推送给在线且没有屏蔽对方的好友，好友和屏蔽关系从好友图里查：
+// 一轮里攒下的变化按接收者合成一帧
+// "@presence +1234 -5678"，同一个uid在一轮里多次变化只发最后的状态
+class Presence {
+public:
+  Presence() : m_bits(new atomic<uint64_t>[PRESENCE_MAX_UID / 64]()) {}
+  ~Presence();
+  // 启动推送线程：好友关系从graph查，不在内存里时从pool借连接读入；
+  // 通知套接字从cache查，推送交给fanOut
+  void start(RedisPool *pool, FriendGraph *graph, UserCache *cache,
+             FanOut *fanOut);
+  // uid上线或下线
+  void set(const string &uid, bool online);
+  bool isOnline(string_view uid) const;
+  // 数字uid转成位图下标，不是数字或超出范围时返回false
+  static bool slotOf(string_view uid, uint32_t &slot);
+
+private:
+  void notify(const unordered_map<string, bool> &changes);
+  static void *notifier(void *arg);
+
+  unique_ptr<atomic<uint64_t>[]> m_bits;
+  RedisPool *m_pool = nullptr;
+  FriendGraph *m_graph = nullptr;
+  UserCache *m_cache = nullptr;
+  FanOut *m_fanOut = nullptr;
+  pthread_t m_thread;
+  atomic<bool> m_running{false};
+  pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER; // 保护m_changes
+  pthread_cond_t m_wake = PTHREAD_COND_INITIALIZER;
+  unordered_map<string, bool> m_changes; // 还没推送的变化：uid -> 最新状态
+};
+
+Presence::~Presence() {
+  if (m_running) {
+    pthread_mutex_lock(&m_lock);
+    m_running = false;
+    pthread_cond_signal(&m_wake);
+    pthread_mutex_unlock(&m_lock);
+    pthread_join(m_thread, NULL);
+  }
+}
+
+void Presence::start(RedisPool *pool, FriendGraph *graph, UserCache *cache,
+                     FanOut *fanOut) {
+  m_pool = pool;
+  m_graph = graph;
+  m_cache = cache;
+  m_fanOut = fanOut;
+  m_running = true;
+  pthread_create(&m_thread, NULL, notifier, this);
+}
+
+bool Presence::slotOf(string_view uid, uint32_t &slot) {
+  if (uid.empty() || uid.size() > 8) {
+    return false;
+  }
+  slot = 0;
+  for (char c : uid) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    slot = slot * 10 + (c - '0');
+  }
+  return slot < PRESENCE_MAX_UID;
+}
+
+void Presence::set(const string &uid, bool online) {
+  uint32_t slot;
+  if (!slotOf(uid, slot)) {
+    LOG_WARN("uid {}不是位图能表示的数字，在线状态不进位图", uid);
+    return;
+  }
+  uint64_t bit = 1ull << (slot % 64);
+  if (online) {
+    m_bits[slot / 64].fetch_or(bit, memory_order_relaxed);
+  } else {
+    m_bits[slot / 64].fetch_and(~bit, memory_order_relaxed);
+  }
+  if (!m_running) {
+    return;
+  }
+  pthread_mutex_lock(&m_lock);
+  m_changes[uid] = online;
+  pthread_cond_signal(&m_wake);
+  pthread_mutex_unlock(&m_lock);
+}
+
+bool Presence::isOnline(string_view uid) const {
+  uint32_t slot;
+  if (!slotOf(uid, slot)) {
+    return false;
+  }
+  return m_bits[slot / 64].load(memory_order_relaxed) >> (slot % 64) & 1;
+}
+
+void Presence::notify(const unordered_map<string, bool> &changes) {
+  // 好友图常驻时不碰redis，没读入的用户用借来的连接读入
+  RedisGuard guard(*m_pool);
+  unordered_map<string, string> frames; // 接收者 -> 帧
+  for (const auto &[uid, online] : changes) {
+    // 在线且没有屏蔽uid的好友是接收者
+    for (const FriendGraph::Friend &f : m_graph->list(uid)) {
+      if (!isOnline(f.uid) || m_graph->isBlocked(f.uid, uid)) {
+        continue;
+      }
+      string &frame = frames[f.uid];
+      if (frame.empty()) {
+        frame = PRESENCE_FRAME;
+      }
+      frame += online ? " +" : " -";
+      frame += uid;
+    }
+  }
+  vector<FanOut::Push> pushes;
+  for (auto &kv : frames) {
+    string fd = m_cache->get(kv.first, UF_NOTIFY_FD);
+    if (!fd.empty() && fd != "-1") {
+      pushes.push_back({stoi(fd), std::move(kv.second)});
+    }
+  }
+  m_fanOut->pushAll(pushes);
+}
+
+void *Presence::notifier(void *arg) {
+  Presence *self = static_cast<Presence *>(arg);
+  while (true) {
+    pthread_mutex_lock(&self->m_lock);
+    while (self->m_running && self->m_changes.empty()) {
+      pthread_cond_wait(&self->m_wake, &self->m_lock);
+    }
+    unordered_map<string, bool> changes;
+    changes.swap(self->m_changes);
+    bool running = self->m_running;
+    pthread_mutex_unlock(&self->m_lock);
+    if (!running) {
+      break;
+    }
+    self->notify(changes);
+  }
+  return NULL;
+}
+
+#endif
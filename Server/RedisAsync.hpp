@@ -0,0 +1,325 @@
+#ifndef __REDIS_ASYNC_H__
+#define __REDIS_ASYNC_H__
+
+#include "Coroutine.hpp"
+#include "Log.hpp"
+#include "redis.hpp"
+#include <cerrno>
+#include <cstring>
+#include <hiredis/async.h>
+#include <pthread.h>
+#include <string>
+#include <sys/epoll.h>
+#include <utility>
+#include <vector>
+
+// 回调返回后不自动释放回复，由RedisReply接管
+#ifndef REDIS_NO_AUTO_FREE_REPLIES
+#define REDIS_NO_AUTO_FREE_REPLIES 0x400
+#endif
+
+using namespace std;
+
+// 挂在反应堆epoll上的异步redis连接。协程发出命令后挂起，等回复期间不占线程；
+// 反应堆在连接可读时解析回复，一批命令的回复全部到齐后把协程交给线程池恢复
+class RedisAsync {
+public:
+  // 一批等待回复的命令，由awaiter持有，协程恢复前地址不变
+  struct Call {
+    struct Slot {
+      Call *call;
+      int index;
+    };
+    vector<vector<string>> cmds;
+    vector<RedisReply> replies; // 与cmds一一对应，失败的命令为空句柄
+    vector<Slot> slots;
+    int lane = 0;      // 恢复时进入的调度通道
+    int remaining = 0; // 还没收到回复的命令数
+    coroutine_handle<> handle;
+  };
+
+  // 设置反应堆的epoll实例并建立连接
+  static bool init(int epfd, string addr = "127.0.0.1", int port = 6379);
+  // 改用进程内的存储：命令在提交时同步执行，协程不挂起
+  static void useLocal(Storage *store) { s_local = store; }
+  // 发出一批命令，没有任何命令发出去时返回false，调用方不应挂起
+  static bool submit(Call *call);
+  // 反应堆调用：fd是否为异步连接的符
+  static bool owns(int fd);
+  // 反应堆调用：处理连接上的读写事件，收到的回复交给对应的命令批
+  static void handleEvents(uint32_t events);
+  // 反应堆调用：取出一个回复已到齐的协程及其调度通道
+  static bool takeReady(coroutine_handle<> &h, int &lane);
+  // 已发出还没收到回复的命令数
+  static size_t pending();
+
+private:
+  static bool connect(); // 持锁调用
+  static void updateEvents();
+  static void onReply(redisAsyncContext *c, void *r, void *privdata);
+  static void onConnect(const redisAsyncContext *c, int status);
+  static void onDisconnect(const redisAsyncContext *c, int status);
+  // hiredis的事件适配接口，都在持锁时被调用
+  static void addRead(void *privdata);
+  static void delRead(void *privdata);
+  static void addWrite(void *privdata);
+  static void delWrite(void *privdata);
+  static void cleanup(void *privdata);
+
+  static Storage *s_local;
+  static int s_epfd;
+  static string s_addr;
+  static int s_port;
+  static pthread_mutex_t s_lock;
+  static redisAsyncContext *s_ctx; // 断开后为nullptr，下次发命令时重连
+  static int s_fd;
+  static uint32_t s_events; // 当前关注的epoll事件
+  static bool s_registered; // s_fd是否已加入epoll
+  static size_t s_pending;
+  static vector<pair<coroutine_handle<>, int>> s_ready;
+};
+
+// co_await asyncCommand(...)得到一条命令的回复，co_await asyncBatch(...)得到一批命令的回复，
+// 恢复时可能已换到另一个工作线程
+struct RedisCallAwaiter {
+  RedisAsync::Call call;
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(coroutine_handle<> h) {
+    // 提交成功后协程可能立刻在别的线程被恢复，之后不能再访问本对象
+    call.handle = h;
+    return RedisAsync::submit(&call);
+  }
+  RedisReply await_resume() { return std::move(call.replies[0]); }
+};
+
+struct RedisBatchAwaiter {
+  RedisAsync::Call call;
+  bool await_ready() const noexcept { return call.cmds.empty(); }
+  bool await_suspend(coroutine_handle<> h) {
+    call.handle = h;
+    return RedisAsync::submit(&call);
+  }
+  vector<RedisReply> await_resume() {
+    call.replies.resize(call.cmds.size());
+    return std::move(call.replies);
+  }
+};
+
+// 参数逐个传入而不是用大括号列表：GCC 12不支持co_await的操作数里含初始化列表临时对象，
+// asyncBatch的命令也要先放进一个具名的vector
+template <typename... Args>
+RedisCallAwaiter asyncCommand(int lane, const Args &...args) {
+  RedisCallAwaiter a;
+  a.call.cmds.push_back(vector<string>{string(args)...});
+  a.call.lane = lane;
+  return a;
+}
+
+inline RedisBatchAwaiter asyncBatch(const vector<vector<string>> &cmds,
+                                    int lane = 0) {
+  RedisBatchAwaiter a;
+  a.call.cmds = cmds;
+  a.call.lane = lane;
+  return a;
+}
+
+Storage *RedisAsync::s_local = nullptr;
+int RedisAsync::s_epfd = -1;
+string RedisAsync::s_addr = "127.0.0.1";
+int RedisAsync::s_port = 6379;
+pthread_mutex_t RedisAsync::s_lock = PTHREAD_MUTEX_INITIALIZER;
+redisAsyncContext *RedisAsync::s_ctx = nullptr;
+int RedisAsync::s_fd = -1;
+uint32_t RedisAsync::s_events = 0;
+bool RedisAsync::s_registered = false;
+size_t RedisAsync::s_pending = 0;
+vector<pair<coroutine_handle<>, int>> RedisAsync::s_ready;
+
+bool RedisAsync::init(int epfd, string addr, int port) {
+  pthread_mutex_lock(&s_lock);
+  s_epfd = epfd;
+  s_addr = addr;
+  s_port = port;
+  bool ok = connect();
+  pthread_mutex_unlock(&s_lock);
+  return ok;
+}
+
+bool RedisAsync::connect() {
+  s_ctx = redisAsyncConnect(s_addr.c_str(), s_port);
+  if (s_ctx == nullptr || s_ctx->err) {
+    LOG_ERROR("异步redis连接失败: {}",
+              s_ctx == nullptr ? "内存不足" : s_ctx->errstr);
+    if (s_ctx != nullptr) {
+      redisAsyncFree(s_ctx);
+    }
+    s_ctx = nullptr;
+    return false;
+  }
+  s_ctx->c.flags |= REDIS_NO_AUTO_FREE_REPLIES;
+  s_fd = s_ctx->c.fd;
+  s_events = 0;
+  s_registered = false;
+  s_ctx->ev.data = nullptr;
+  s_ctx->ev.addRead = &RedisAsync::addRead;
+  s_ctx->ev.delRead = &RedisAsync::delRead;
+  s_ctx->ev.addWrite = &RedisAsync::addWrite;
+  s_ctx->ev.delWrite = &RedisAsync::delWrite;
+  s_ctx->ev.cleanup = &RedisAsync::cleanup;
+  redisAsyncSetConnectCallback(s_ctx, &RedisAsync::onConnect);
+  redisAsyncSetDisconnectCallback(s_ctx, &RedisAsync::onDisconnect);
+  return true;
+}
+
+bool RedisAsync::submit(Call *call) {
+  int n = call->cmds.size();
+  call->replies.resize(n);
+  call->slots.resize(n);
+  call->remaining = 0;
+  if (s_local != nullptr) {
+    for (int i = 0; i < n; i++) {
+      vector<string_view> argv(call->cmds[i].begin(), call->cmds[i].end());
+      call->replies[i] = RedisReply(s_local->execute(argv.data(), argv.size()));
+    }
+    return false;
+  }
+  pthread_mutex_lock(&s_lock);
+  if (s_ctx == nullptr && s_epfd != -1) {
+    LOG_WARN("异步redis连接已断开，重新连接");
+    connect();
+  }
+  for (int i = 0; i < n && s_ctx != nullptr; i++) {
+    const vector<string> &cmd = call->cmds[i];
+    vector<const char *> argv;
+    vector<size_t> lens;
+    for (const string &arg : cmd) {
+      argv.push_back(arg.data());
+      lens.push_back(arg.size());
+    }
+    call->slots[i] = {call, i};
+    if (redisAsyncCommandArgv(s_ctx, &RedisAsync::onReply, &call->slots[i],
+                              cmd.size(), argv.data(),
+                              lens.data()) == REDIS_OK) {
+      call->remaining++;
+    } else {
+      LOG_ERROR("异步redis:{}发送失败", cmd.empty() ? "" : cmd[0]);
+    }
+  }
+  s_pending += call->remaining;
+  // 回复只会在反应堆持锁时到达，解锁前remaining不会变
+  bool suspend = call->remaining > 0;
+  pthread_mutex_unlock(&s_lock);
+  return suspend;
+}
+
+bool RedisAsync::owns(int fd) {
+  pthread_mutex_lock(&s_lock);
+  bool ret = fd != -1 && fd == s_fd;
+  pthread_mutex_unlock(&s_lock);
+  return ret;
+}
+
+void RedisAsync::handleEvents(uint32_t events) {
+  pthread_mutex_lock(&s_lock);
+  if (s_ctx != nullptr && (events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+    redisAsyncHandleRead(s_ctx);
+  }
+  // 读的时候连接可能已断开并被释放
+  if (s_ctx != nullptr && (events & EPOLLOUT)) {
+    redisAsyncHandleWrite(s_ctx);
+  }
+  pthread_mutex_unlock(&s_lock);
+}
+
+bool RedisAsync::takeReady(coroutine_handle<> &h, int &lane) {
+  pthread_mutex_lock(&s_lock);
+  if (s_ready.empty()) {
+    pthread_mutex_unlock(&s_lock);
+    return false;
+  }
+  h = s_ready.back().first;
+  lane = s_ready.back().second;
+  s_ready.pop_back();
+  pthread_mutex_unlock(&s_lock);
+  return true;
+}
+
+size_t RedisAsync::pending() {
+  pthread_mutex_lock(&s_lock);
+  size_t n = s_pending;
+  pthread_mutex_unlock(&s_lock);
+  return n;
+}
+
+// 收到一条回复（连接断开时r为nullptr），整批到齐就把协程放进就绪表
+void RedisAsync::onReply(redisAsyncContext *, void *r, void *privdata) {
+  Call::Slot *slot = static_cast<Call::Slot *>(privdata);
+  Call *call = slot->call;
+  call->replies[slot->index] = RedisReply(static_cast<redisReply *>(r));
+  s_pending--;
+  if (--call->remaining == 0) {
+    s_ready.push_back({call->handle, call->lane});
+  }
+}
+
+void RedisAsync::onConnect(const redisAsyncContext *c, int status) {
+  if (status != REDIS_OK) {
+    LOG_ERROR("异步redis连接失败: {}", c->errstr);
+    s_ctx = nullptr; // hiredis随后释放连接
+    return;
+  }
+  LOG_INFO("异步redis连接成功");
+}
+
+void RedisAsync::onDisconnect(const redisAsyncContext *c, int status) {
+  if (status != REDIS_OK) {
+    LOG_WARN("异步redis连接断开: {}", c->errstr);
+  }
+  s_ctx = nullptr;
+}
+
+void RedisAsync::updateEvents() {
+  struct epoll_event ev;
+  ev.data.fd = s_fd;
+  ev.events = s_events;
+  if (!s_registered) {
+    s_registered = epoll_ctl(s_epfd, EPOLL_CTL_ADD, s_fd, &ev) == 0;
+  } else {
+    epoll_ctl(s_epfd, EPOLL_CTL_MOD, s_fd, &ev);
+  }
+  if (!s_registered) {
+    LOG_ERROR("异步redis连接加入epoll失败: {}", strerror(errno));
+  }
+}
+
+void RedisAsync::addRead(void *) {
+  s_events |= EPOLLIN;
+  updateEvents();
+}
+
+void RedisAsync::delRead(void *) {
+  s_events &= ~EPOLLIN;
+  updateEvents();
+}
+
+void RedisAsync::addWrite(void *) {
+  s_events |= EPOLLOUT;
+  updateEvents();
+}
+
+void RedisAsync::delWrite(void *) {
+  s_events &= ~EPOLLOUT;
+  updateEvents();
+}
+
+// 连接被释放前摘符
+void RedisAsync::cleanup(void *) {
+  if (s_registered) {
+    epoll_ctl(s_epfd, EPOLL_CTL_DEL, s_fd, NULL);
+  }
+  s_fd = -1;
+  s_events = 0;
+  s_registered = false;
+}
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef SCRIPTS_HPP
+#define SCRIPTS_HPP
+
+#include "../lib/Message.hpp"
+#include "Log.hpp"
+#include "redis.hpp"
+#include <string>
+
+using namespace std;
+
+// 复合操作的Lua脚本，每个脚本在redis里原子执行、一次往返完成，返回C++端推送通知要用的数据。
+// 未读计数不在脚本里改，由C++端根据返回值交给UnreadCounter（群聊没有计数，见GroupMsg）。
+// 参数都从ARGV传uid，键名在脚本里拼出（单机redis）；要看在线状态的脚本，
+// 最后一个ARGV是本次运行的在线用户表。
+// 查不到的字段按C++端原来的习惯处理：通知套接字、在线状态缺省为"-1"，其它缺省为空串。
+// 每个脚本还有一个逐行对应的C++版本，内嵌存储没有Lua，执行的是它
+
+// 取哈希表的字段，不存在时返回def，对应Lua里的 redis.call('HGET', ...) or def
+static string HGetOr(Redis &db, const string &key, const string &field,
+                     const string &def) {
+  return db.hashexists(key, field) ? db.gethash(key, field) : def;
+}
+
+// 两人共用的私聊记录列表，uid小的在前；uid都是数字，Lua里按字符串比较的结果相同
+static string ChatLogKey(const string &a, const string &b) {
+  return a < b ? a + "和" + b + "的聊天记录" : b + "和" + a + "的聊天记录";
+}
+
+// Lua的string.sub(s, -11)和string.sub(s, 1, -12)，按字节截取
+static string TailOf(const string &s) {
+  return s.size() > 11 ? s.substr(s.size() - 11) : s;
+}
+static string HeadOf(const string &s) {
+  return s.size() > 11 ? s.substr(0, s.size() - 11) : "";
+}
+
+static redisReply *FriendMsgNative(Redis &db, const vector<string> &args) {
+  const string &me = args[0], &fr = args[1], &rec = args[2], &online = args[3];
+  if (!db.hashexists(me + "的好友列表", fr)) {
+    return MakeArray({MakeInteger(0)});
+  }
+  string myFd = HGetOr(db, me, "通知套接字", "-1");
+  string log = ChatLogKey(me, fr);
+  if (db.sismember(fr + "的屏蔽列表", me) == 1) {
+    Message r;
+    r.From_Json(rec);
+    r.hidden = true;
+    db.lpush(log, r.To_Json());
+    return MakeArray({MakeInteger(1), MakeString(myFd), MakeInteger(1)});
+  }
+  db.lpush(log, rec);
+  string remark = HGetOr(db, fr + "的好友列表", me, "");
+  return MakeArray({MakeInteger(1), MakeString(myFd), MakeInteger(0),
+                    MakeString(remark), MakeString(HGetOr(db, online, fr, "-1")),
+                    MakeString(HGetOr(db, fr, "聊天对象", "")),
+                    MakeString(HGetOr(db, fr, "通知套接字", "-1"))});
+}
+
+static redisReply *GroupMsgNative(Redis &db, const vector<string> &args) {
+  const string &me = args[0], &gid = args[1], &body = args[2];
+  if (!db.hashexists(me + "的群聊列表", gid)) {
+    return MakeArray({MakeInteger(0)});
+  }
+  string msg = me + "：" + body;
+  db.lpush(gid + "的聊天消息队列", msg);
+  db.incr(gid + "的消息序号");
+  return MakeArray({MakeInteger(1),
+                    MakeString(HGetOr(db, me, "通知套接字", "-1")),
+                    MakeString(msg)});
+}
+
+static redisReply *AgreeFriendNative(Redis &db, const vector<string> &args) {
+  const string &me = args[0], &ap = args[1], &notice = args[2],
+               &begin = args[3], &online = args[4];
+  if (db.hlen(me + "的好友列表") == 0 && db.hashexists(me + "的好友列表", ap)) {
+    return MakeArray({MakeString("had")});
+  }
+  if (!db.hashexists(me + "的系统消息", ap)) {
+    return MakeArray({MakeString("nofind")});
+  }
+  string msg = db.gethash(me + "的系统消息", ap);
+  string state = TailOf(msg);
+  if (state == "(已拒绝)" || state == "(已通过)") {
+    return MakeArray({MakeString("haddeal")});
+  }
+  db.hsetValue(me + "的系统消息", ap, HeadOf(msg) + "(已通过)");
+  string fd = HGetOr(db, ap, "通知套接字", "-1");
+  db.hsetValue(me + "的好友列表", ap, HGetOr(db, ap, "昵称", ""));
+  db.hsetValue(ap + "的好友列表", me, HGetOr(db, me, "昵称", ""));
+  db.lpush(ChatLogKey(me, ap), begin);
+  db.lpush(ap + "的通知消息", notice);
+  return MakeArray({MakeString("ok"), MakeString(HGetOr(db, online, ap, "-1")),
+                    MakeString(fd)});
+}
+
+static redisReply *AddGroupNative(Redis &db, const vector<string> &args) {
+  const string &me = args[0], &gid = args[1], &apply = args[2],
+               &notice = args[3], &online = args[4];
+  if (db.sismember("群聊集合", gid) != 1) {
+    return MakeArray({MakeString("nofind")});
+  }
+  if (db.hashexists(me + "的群聊列表", gid)) {
+    return MakeArray({MakeString("had")});
+  }
+  if (db.hashexists(gid + "的申请列表", me) &&
+      TailOf(db.gethash(gid + "的申请列表", me)) == "(未处理)") {
+    return MakeArray({MakeString("cannot")});
+  }
+  db.hsetValue(gid + "的申请列表", me, apply);
+  vector<redisReply *> result = {MakeString("ok")};
+  RedisReply members = db.hkeys(gid + "的群成员列表");
+  for (size_t i = 0; i < members.size(); i++) {
+    string m(members.view(i));
+    string position = db.gethash(gid + "的群成员列表", m);
+    if (position == "管理员" || position == "群主") {
+      db.lpush(m + "的通知消息", notice);
+      string fd = db.hashexists(online, m) ? HGetOr(db, m, "通知套接字", "-1")
+                                           : "-1";
+      result.push_back(MakeString(m));
+      result.push_back(MakeString(fd));
+    }
+  }
+  return MakeArray(result);
+}
+
+// 私聊发消息。ARGV: 我, 好友, 私聊记录（Message的json）, 在线用户表
+// 记录写进两人共用的列表，被好友屏蔽时标记为只有我看得到
+// 返回 {0}：不是好友
+//      {1, 我的通知套接字, 1}：已写入记录，但被好友屏蔽
+//      {1, 我的通知套接字, 0, 好友给我的备注, 好友在线状态, 好友聊天对象, 好友通知套接字}
+RedisScript FriendMsgScript("FriendMsg", R"lua(
+local me, fr, rec, online = ARGV[1], ARGV[2], ARGV[3], ARGV[4]
+if redis.call('HEXISTS', me .. '的好友列表', fr) == 0 then
+  return {0}
+end
+local myFd = redis.call('HGET', me, '通知套接字') or '-1'
+local lo, hi = me, fr
+if hi < lo then
+  lo, hi = hi, lo
+end
+local log = lo .. '和' .. hi .. '的聊天记录'
+if redis.call('SISMEMBER', fr .. '的屏蔽列表', me) == 1 then
+  local r = cjson.decode(rec)
+  r.hidden = true
+  redis.call('LPUSH', log, cjson.encode(r))
+  return {1, myFd, 1}
+end
+redis.call('LPUSH', log, rec)
+local remark = redis.call('HGET', fr .. '的好友列表', me) or ''
+local st = redis.call('HMGET', fr, '聊天对象', '通知套接字')
+local frOnline = redis.call('HGET', online, fr) or '-1'
+return {1, myFd, 0, remark, frOnline, st[1] or '', st[2] or '-1'}
+)lua", FriendMsgNative);
+
+// 群聊发消息。ARGV: 我, 群号, 消息正文（含时间）
+// 消息进队列的同时群的消息序号+1，成员的未读数由序号和各自的已读位置算出；
+// 推给哪些成员由C++端查群的在线成员索引，不在脚本里遍历群成员列表
+// 返回 {0}：不在该群
+//      {1, 我的通知套接字, 群消息}
+RedisScript GroupMsgScript("GroupMsg", R"lua(
+local me, gid, body = ARGV[1], ARGV[2], ARGV[3]
+if redis.call('HEXISTS', me .. '的群聊列表', gid) == 0 then
+  return {0}
+end
+local msg = me .. '：' .. body
+redis.call('LPUSH', gid .. '的聊天消息队列', msg)
+redis.call('INCR', gid .. '的消息序号')
+return {1, redis.call('HGET', me, '通知套接字') or '-1', msg}
+)lua", GroupMsgNative);
+
+// 同意好友申请。ARGV: 我, 申请者, 给申请者的通知消息（含时间）, 私聊记录的分隔线, 在线用户表
+// 返回 {"had"} / {"nofind"} / {"haddeal"}，或 {"ok", 申请者在线状态, 申请者通知套接字}
+RedisScript AgreeFriendScript("AgreeAddFriend", R"lua(
+local me, ap, notice, begin = ARGV[1], ARGV[2], ARGV[3], ARGV[4]
+local online = ARGV[5]
+if redis.call('HLEN', me .. '的好友列表') == 0 and
+   redis.call('HEXISTS', me .. '的好友列表', ap) == 1 then
+  return {'had'}
+end
+local msg = redis.call('HGET', me .. '的系统消息', ap)
+if not msg then
+  return {'nofind'}
+end
+local state = string.sub(msg, -11)
+if state == '(已拒绝)' or state == '(已通过)' then
+  return {'haddeal'}
+end
+redis.call('HSET', me .. '的系统消息', ap, string.sub(msg, 1, -12) .. '(已通过)')
+local info = redis.call('HMGET', ap, '昵称', '通知套接字')
+redis.call('HSET', me .. '的好友列表', ap, info[1] or '')
+redis.call('HSET', ap .. '的好友列表', me, redis.call('HGET', me, '昵称') or '')
+local lo, hi = me, ap
+if hi < lo then
+  lo, hi = hi, lo
+end
+redis.call('LPUSH', lo .. '和' .. hi .. '的聊天记录', begin)
+redis.call('LPUSH', ap .. '的通知消息', notice)
+return {'ok', redis.call('HGET', online, ap) or '-1', info[2] or '-1'}
+)lua", AgreeFriendNative);
+
+// 申请加入群聊。ARGV: 我, 群号, 申请消息, 给群主和管理员的通知消息, 在线用户表
+// 返回 {"nofind"} / {"had"} / {"cannot"}，
+//      或 {"ok", 群主或管理员1, 他的通知套接字（不在线为"-1"）, ...}
+RedisScript AddGroupScript("AddGroup", R"lua(
+local me, gid, apply, notice = ARGV[1], ARGV[2], ARGV[3], ARGV[4]
+local online = ARGV[5]
+if redis.call('SISMEMBER', '群聊集合', gid) == 0 then
+  return {'nofind'}
+end
+if redis.call('HEXISTS', me .. '的群聊列表', gid) == 1 then
+  return {'had'}
+end
+local old = redis.call('HGET', gid .. '的申请列表', me)
+if old and string.sub(old, -11) == '(未处理)' then
+  return {'cannot'}
+end
+redis.call('HSET', gid .. '的申请列表', me, apply)
+local result = {'ok'}
+local members = redis.call('HGETALL', gid .. '的群成员列表')
+for i = 1, #members, 2 do
+  local m, position = members[i], members[i + 1]
+  if position == '管理员' or position == '群主' then
+    redis.call('LPUSH', m .. '的通知消息', notice)
+    local fd = '-1'
+    if redis.call('HEXISTS', online, m) == 1 then
+      fd = redis.call('HGET', m, '通知套接字') or '-1'
+    end
+    table.insert(result, m)
+    table.insert(result, fd)
+  end
+end
+return result
+)lua", AddGroupNative);
+
+// 启动时把所有脚本预加载到redis，失败的脚本执行时改用EVAL
+void LoadScripts(Redis *conn) {
+  RedisScript *scripts[] = {&FriendMsgScript, &GroupMsgScript,
+                            &AgreeFriendScript, &AddGroupScript};
+  int loaded = 0;
+  for (RedisScript *script : scripts) {
+    loaded += conn->loadScript(*script);
+  }
+  LOG_INFO("预加载Lua脚本{}/{}个", loaded, sizeof(scripts) / sizeof(*scripts));
+}
+
+#endif
@@ -0,0 +1,964 @@
+#ifndef SEARCH_INDEX_HPP
+#define SEARCH_INDEX_HPP
+
+#include "Archive.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <memory>
+#include <pthread.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#define SEARCH_PAGE_SIZE 10           // 每页的搜索结果数
+#define SEARCH_SEAL_DOCS 256          // 会话的新消息攒够这么多条就压成一个段
+#define SEARCH_MAX_PENDING 100000     // 等待建索引的消息上限，超出的不进索引
+#define SEARCH_MAGIC 0x49535243       // 段文件头"CRSI"
+#define SEARCH_HIDDEN 1               // 文档标记：只有发送者能搜到
+// 常驻内存的索引上限，超出时按CLOCK卸下会话
+#ifndef SEARCH_RESIDENT_BYTES
+#define SEARCH_RESIDENT_BYTES (256ull << 20)
+#endif
+
+using namespace std;
+
+// 聊天记录的全文索引：每个会话（键同Archive）一份，消息从旧到新编号0,1,2...
+// 分词：连续的字母数字按小写整词算一个词元，连续的中日韩文字取相邻两字（只有一个字时取单字），
+// 标点和空白断开。词元只存64位哈希，倒排表里只有文档号，命中的文档再用原文逐条核对。
+// 新消息先进内存里的尾部，同时追加到会话目录下的tail.log；攒够SEARCH_SEAL_DOCS条压成一个
+// 只读段文件"<首条编号>.seg"：文档（发送者、时间、正文）、按哈希排序的词表和差分后varint
+// 编码的倒排表。相邻两段一样大时合并，段数保持在消息数的对数级别。
+// 建索引在后台线程里做，收发消息的路径只是入队。
+// 建索引只需要尾部和各段的段头，段的内容到搜索时才读入。内存里的索引合计不超过
+// SEARCH_RESIDENT_BYTES，超出时按CLOCK算法卸下最近没用过的会话，它的段和tail.log都在磁盘上，
+// 下次用到再读回
+class SearchIndex {
+public:
+  struct Hit {
+    string sender;
+    string content;
+    int64_t time;
+  };
+  struct Stats {
+    uint64_t resident = 0;  // 常驻内存的会话数
+    uint64_t bytes = 0;     // 它们的索引字节数
+    uint64_t evictions = 0; // 超出上限被卸下的会话数
+    uint64_t pending = 0;   // 等待建索引的消息数
+  };
+
+  SearchIndex() = default;
+  ~SearchIndex();
+  // 打开索引目录并启动建索引的线程；目录为空或建不起来时不建索引，搜索都没有结果
+  bool start(const string &dir);
+  bool enabled() const { return m_running; }
+  // 会话key里的一条新消息，hidden为true时只有发送者能搜到
+  void add(const string &key, const string &sender, const string &content,
+           int64_t time, bool hidden = false);
+  // 在会话key里搜索query：空白分隔的每个词都要出现在正文里，按相关度从高到低、
+  // 同分时新消息在前，返回第page页（从1起），total为命中的总条数
+  vector<Hit> search(const string &key, const string &query,
+                     const string &viewer, int page, size_t &total);
+  // 会话被删除，删掉它的索引，还在排队的消息也不再建索引
+  void drop(const string &key);
+  Stats stats();
+
+  // 分词，返回去重后的词元哈希；query为true时单个的中日韩文字不出词元，由核对原文来匹配
+  static vector<uint64_t> tokenize(string_view text, bool query = false);
+
+private:
+  struct Doc {
+    uint32_t offset; // 在text里的位置，先是发送者再是正文
+    uint32_t len;    // 正文长度
+    uint32_t time;
+    uint16_t senderLen;
+    uint16_t flags;
+  };
+  struct Term {
+    uint64_t hash;
+    uint32_t offset; // 在postings里的位置
+    uint32_t df;     // 包含该词元的文档数
+  };
+  struct Segment {
+    uint64_t first = 0; // 首条文档的编号
+    uint64_t count = 0; // 文档数；只读了段头时docs等都是空的
+    vector<Doc> docs;
+    string text;
+    vector<Term> terms; // 按hash排序
+    string postings;    // 每个词元的文档号（相对first）差分后varint编码
+  };
+  struct Conv {
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    atomic<uint64_t> epoch{0}; // 每次drop加一，之前入队的消息作废
+    bool opened = false; // 尾部和段头已读入，可以追加
+    bool loaded = false; // 段的内容也已读入，可以搜索
+    atomic<bool> ref{false}; // CLOCK的访问位
+    size_t bytes = 0;        // 记在m_bytes里的索引字节数
+    string dir;
+    vector<Segment> segments;
+    Segment tail; // 还没压成段的消息，只用docs和text
+    unordered_map<uint64_t, vector<uint32_t>> tailPostings; // 相对tail.first
+    uint64_t textBytes = 0; // 全部正文的字节数，算平均长度用
+    uint64_t total() const { return tail.first + tail.docs.size(); }
+  };
+  struct Pending {
+    Conv *conv;
+    uint64_t epoch;
+    string sender;
+    string content;
+    int64_t time;
+    bool hidden;
+  };
+  struct Header {
+    uint32_t magic;
+    uint32_t crc; // 头之后全部内容的CRC32
+    uint64_t first;
+    uint64_t docs;
+    uint64_t textBytes;
+    uint64_t terms;
+    uint64_t postingBytes;
+  };
+
+  Conv &convOf(const string &key);
+  string path(const Conv &conv, uint64_t first) const;
+  // 第一次用到时读入各段的段头并重放tail.log；调用方持有conv.lock
+  void loadTail(Conv &conv);
+  // 再读入全部段的内容，搜索前调用；调用方持有conv.lock
+  void load(Conv &conv);
+  bool readSegment(const string &file, Segment &seg);
+  // seg的内容在内存里时直接返回它，只有段头时读进buf，读不出来返回nullptr
+  const Segment *contentOf(const Conv &conv, const Segment &seg, Segment &buf);
+  bool writeSegment(const Conv &conv, const Segment &seg);
+  void index(Conv &conv, const string &sender, const string &content,
+             int64_t time, uint16_t flags);
+  void appendLog(Conv &conv, string &log); // 追加到tail.log并清空log
+  void seal(Conv &conv);                    // 尾部压成段，再按大小合并
+  void reset(Conv &conv);
+  // 重新估算conv占的内存并记账；调用方持有conv.lock
+  void account(Conv &conv);
+  // 超出上限时卸下没在用的会话；调用方不持有任何会话的锁
+  void shrink();
+  static void *worker(void *arg);
+
+  static Segment merge(const Segment &a, const Segment &b);
+  static void putPosting(Segment &seg, uint64_t hash,
+                         const vector<uint32_t> &ids);
+  static vector<uint32_t> postingOf(const Segment &seg, uint64_t hash);
+  static string record(const Doc &doc, const string &text);
+
+  string m_dir;
+  pthread_t m_thread;
+  bool m_running = false;
+  pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER; // 保护m_convs和m_pending
+  pthread_cond_t m_wake = PTHREAD_COND_INITIALIZER;
+  unordered_map<string, unique_ptr<Conv>> m_convs;
+  vector<Pending> m_pending;
+  bool m_warned = false; // 本轮队列溢出是否已经告警
+  vector<Conv *> m_resident; // 已加载的会话，CLOCK的环；m_lock保护
+  size_t m_hand = 0;         // CLOCK的指针
+  atomic<uint64_t> m_bytes{0};
+  atomic<uint64_t> m_evictions{0};
+};
+
+extern SearchIndex searchIndex;
+
+SearchIndex::~SearchIndex() {
+  if (m_running) {
+    // 排队的消息建完索引再退出
+    pthread_mutex_lock(&m_lock);
+    m_running = false;
+    pthread_cond_signal(&m_wake);
+    pthread_mutex_unlock(&m_lock);
+    pthread_join(m_thread, NULL);
+  }
+}
+
+bool SearchIndex::start(const string &dir) {
+  if (dir.empty()) {
+    LOG_INFO("未设置搜索索引目录，不建全文索引");
+    return false;
+  }
+  if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+    LOG_ERROR("搜索索引目录{}创建失败: {}，不建全文索引", dir,
+              strerror(errno));
+    return false;
+  }
+  m_dir = dir;
+  m_running = true;
+  pthread_create(&m_thread, NULL, worker, this);
+  LOG_INFO("聊天记录的全文索引放在{}", dir);
+  return true;
+}
+
+// 中日韩文字：U+2E80起的表意文字、假名和谚文，去掉U+3000~U+303F的全角标点；
+// 全角的字母数字、标点（U+FF00~U+FFEF）和其它符号都当作分隔
+static bool IsCJK(uint32_t cp) {
+  return (cp >= 0x2E80 && cp < 0x3000) || (cp >= 0x3040 && cp < 0xA000) ||
+         (cp >= 0xAC00 && cp < 0xD7B0) || (cp >= 0xF900 && cp < 0xFB00) ||
+         (cp >= 0x20000 && cp < 0x32000);
+}
+
+// 解出text[pos]开始的一个UTF-8字符，len为它的字节数；不合法的字节当作单字节的分隔符
+static uint32_t DecodeUtf8(string_view text, size_t pos, size_t &len) {
+  unsigned char c = text[pos];
+  len = c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+  if (len == 1 || pos + len > text.size()) {
+    len = 1;
+    return c < 0x80 ? c : 0xFFFD;
+  }
+  uint32_t cp = c & (0x7F >> len);
+  for (size_t i = 1; i < len; i++) {
+    cp = cp << 6 | ((unsigned char)text[pos + i] & 0x3F);
+  }
+  return cp;
+}
+
+static uint64_t HashToken(string_view token) {
+  uint64_t h = 14695981039346656037ull; // FNV-1a
+  for (unsigned char c : token) {
+    h = (h ^ c) * 1099511628211ull;
+  }
+  return h;
+}
+
+vector<uint64_t> SearchIndex::tokenize(string_view text, bool query) {
+  vector<uint64_t> tokens;
+  string word;
+  size_t prevPos = 0, prevLen = 0; // 上一个中日韩文字
+  int run = 0;                     // 连续的中日韩文字个数
+  auto endRun = [&] {
+    if (run == 1 && !query) {
+      tokens.push_back(HashToken(text.substr(prevPos, prevLen)));
+    }
+    run = 0;
+  };
+  for (size_t pos = 0; pos < text.size();) {
+    size_t len;
+    uint32_t cp = DecodeUtf8(text, pos, len);
+    if (cp < 0x80 && isalnum(cp)) {
+      endRun();
+      word += tolower(cp);
+    } else {
+      if (!word.empty()) {
+        tokens.push_back(HashToken(word));
+        word.clear();
+      }
+      if (IsCJK(cp)) {
+        if (run > 0) {
+          tokens.push_back(
+              HashToken(text.substr(prevPos, pos + len - prevPos)));
+        }
+        prevPos = pos;
+        prevLen = len;
+        run++;
+      } else {
+        endRun();
+      }
+    }
+    pos += len;
+  }
+  if (!word.empty()) {
+    tokens.push_back(HashToken(word));
+  }
+  endRun();
+  sort(tokens.begin(), tokens.end());
+  tokens.erase(unique(tokens.begin(), tokens.end()), tokens.end());
+  return tokens;
+}
+
+void SearchIndex::add(const string &key, const string &sender,
+                      const string &content, int64_t time, bool hidden) {
+  if (!m_running) {
+    return;
+  }
+  pthread_mutex_lock(&m_lock);
+  if (m_pending.size() >= SEARCH_MAX_PENDING) {
+    if (!m_warned) {
+      LOG_WARN("等待建索引的消息超过{}条，新消息不进搜索索引",
+               SEARCH_MAX_PENDING);
+      m_warned = true;
+    }
+    pthread_mutex_unlock(&m_lock);
+    return;
+  }
+  m_warned = false;
+  Conv &conv = convOf(key);
+  m_pending.push_back({&conv, conv.epoch.load(), sender, content, time,
+                       hidden});
+  pthread_cond_signal(&m_wake);
+  pthread_mutex_unlock(&m_lock);
+}
+
+// 调用方持有m_lock
+SearchIndex::Conv &SearchIndex::convOf(const string &key) {
+  unique_ptr<Conv> &conv = m_convs[key];
+  if (conv == nullptr) {
+    conv.reset(new Conv);
+    conv->dir = m_dir + "/" + Archive::encode(key);
+  }
+  return *conv;
+}
+
+string SearchIndex::path(const Conv &conv, uint64_t first) const {
+  char name[32];
+  snprintf(name, sizeof(name), "/%020llu.seg", (unsigned long long)first);
+  return conv.dir + name;
+}
+
+static void PutVarint(string &buf, uint32_t v) {
+  while (v >= 0x80) {
+    buf += (char)(v | 0x80);
+    v >>= 7;
+  }
+  buf += (char)v;
+}
+
+void SearchIndex::putPosting(Segment &seg, uint64_t hash,
+                             const vector<uint32_t> &ids) {
+  seg.terms.push_back({hash, (uint32_t)seg.postings.size(),
+                       (uint32_t)ids.size()});
+  uint32_t last = 0;
+  for (uint32_t id : ids) {
+    PutVarint(seg.postings, id - last);
+    last = id;
+  }
+}
+
+vector<uint32_t> SearchIndex::postingOf(const Segment &seg, uint64_t hash) {
+  vector<uint32_t> ids;
+  auto it = lower_bound(
+      seg.terms.begin(), seg.terms.end(), hash,
+      [](const Term &t, uint64_t h) { return t.hash < h; });
+  if (it == seg.terms.end() || it->hash != hash) {
+    return ids;
+  }
+  ids.reserve(it->df);
+  const unsigned char *p =
+      (const unsigned char *)seg.postings.data() + it->offset;
+  uint32_t last = 0;
+  for (uint32_t i = 0; i < it->df; i++) {
+    uint32_t v = 0;
+    for (int shift = 0;; shift += 7) {
+      v |= (uint32_t)(*p & 0x7F) << shift;
+      if (!(*p++ & 0x80)) {
+        break;
+      }
+    }
+    last += v;
+    ids.push_back(last);
+  }
+  return ids;
+}
+
+// tail.log里的一条记录：标记(1) 发送者 '\0' 正文
+string SearchIndex::record(const Doc &doc, const string &text) {
+  string data(1, (char)doc.flags);
+  data.append(text, doc.offset, doc.senderLen);
+  data += '\0';
+  data.append(text, doc.offset + doc.senderLen, doc.len);
+  return data;
+}
+
+bool SearchIndex::readSegment(const string &file, Segment &seg) {
+  string buf;
+  if (!ReadFile(file, 0, buf) || buf.size() < sizeof(Header)) {
+    return false;
+  }
+  Header h;
+  memcpy(&h, buf.data(), sizeof(Header));
+  uint64_t body = h.docs * sizeof(Doc) + h.textBytes + h.terms * sizeof(Term) +
+                  h.postingBytes;
+  if (h.magic != SEARCH_MAGIC || buf.size() - sizeof(Header) != body ||
+      Archive::crc32(0, buf.data() + sizeof(Header), body) != h.crc) {
+    return false;
+  }
+  const char *p = buf.data() + sizeof(Header);
+  seg.first = h.first;
+  seg.count = h.docs;
+  seg.docs.resize(h.docs);
+  memcpy(seg.docs.data(), p, h.docs * sizeof(Doc));
+  p += h.docs * sizeof(Doc);
+  seg.text.assign(p, h.textBytes);
+  p += h.textBytes;
+  seg.terms.resize(h.terms);
+  memcpy(seg.terms.data(), p, h.terms * sizeof(Term));
+  p += h.terms * sizeof(Term);
+  seg.postings.assign(p, h.postingBytes);
+  return true;
+}
+
+// 先写临时文件并落盘，再改名覆盖，崩溃时旧段仍然完整
+bool SearchIndex::writeSegment(const Conv &conv, const Segment &seg) {
+  string body;
+  body.append((const char *)seg.docs.data(), seg.docs.size() * sizeof(Doc));
+  body += seg.text;
+  body.append((const char *)seg.terms.data(), seg.terms.size() * sizeof(Term));
+  body += seg.postings;
+  Header h = {SEARCH_MAGIC,
+              Archive::crc32(0, body.data(), body.size()),
+              seg.first,
+              seg.docs.size(),
+              seg.text.size(),
+              seg.terms.size(),
+              seg.postings.size()};
+  string file = path(conv, seg.first);
+  string tmp = file + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  bool ok = fd >= 0 && WriteAll(fd, string((const char *)&h, sizeof(h))) &&
+            WriteAll(fd, body) && fdatasync(fd) == 0;
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (!ok || rename(tmp.c_str(), file.c_str()) < 0) {
+    LOG_ERROR("写搜索索引{}失败: {}", file, strerror(errno));
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+void SearchIndex::loadTail(Conv &conv) {
+  conv.ref = true;
+  if (conv.opened) {
+    return;
+  }
+  conv.opened = true;
+  pthread_mutex_lock(&m_lock);
+  m_resident.push_back(&conv);
+  pthread_mutex_unlock(&m_lock);
+  DIR *dir = opendir(conv.dir.c_str());
+  if (dir == nullptr) {
+    return; // 还没有建过索引
+  }
+  vector<uint64_t> firsts;
+  while (struct dirent *ent = readdir(dir)) {
+    unsigned long long first;
+    char ext[8];
+    if (sscanf(ent->d_name, "%20llu.%3s", &first, ext) == 2 &&
+        strcmp(ext, "seg") == 0 && strlen(ent->d_name) == 24) {
+      firsts.push_back(first);
+    }
+  }
+  closedir(dir);
+  sort(firsts.begin(), firsts.end());
+  uint64_t next = 0;
+  for (uint64_t first : firsts) {
+    string file = path(conv, first);
+    if (first < next) {
+      // 合并后的新段已经改名生效，被并掉的旧段还没来得及删
+      unlink(file.c_str());
+      continue;
+    }
+    // 这里只核对段头和文件大小，CRC到读入内容时再核对
+    string buf;
+    Header h;
+    struct stat st;
+    bool ok = first == next && ReadFile(file, 0, buf, sizeof(Header)) &&
+              buf.size() == sizeof(Header) && stat(file.c_str(), &st) == 0;
+    if (ok) {
+      memcpy(&h, buf.data(), sizeof(Header));
+      ok = h.magic == SEARCH_MAGIC && h.first == first &&
+           (uint64_t)st.st_size ==
+               sizeof(Header) + h.docs * sizeof(Doc) + h.textBytes +
+                   h.terms * sizeof(Term) + h.postingBytes;
+    }
+    if (!ok) {
+      LOG_ERROR("搜索索引{}缺失或损坏，第{}条之后的消息搜不到", file, next);
+      unlink(file.c_str());
+      continue;
+    }
+    Segment seg;
+    seg.first = first;
+    seg.count = h.docs;
+    next = first + seg.count;
+    conv.segments.push_back(std::move(seg));
+  }
+  conv.tail.first = next;
+  // 重放还没压成段的消息，压段前已经写进段里的记录跳过
+  string buf;
+  ReadFile(conv.dir + "/tail.log", 0, buf);
+  size_t pos = 0;
+  Archive::Record rec;
+  while (Archive::unpack(buf, pos, rec)) {
+    size_t sep = rec.data.find('\0', 1);
+    if (rec.id < conv.total() || sep == string::npos) {
+      continue;
+    }
+    if (rec.id > conv.total()) {
+      break;
+    }
+    index(conv, rec.data.substr(1, sep - 1), rec.data.substr(sep + 1),
+          rec.time, (uint8_t)rec.data[0]);
+  }
+  if (pos < buf.size()) {
+    ::truncate((conv.dir + "/tail.log").c_str(), pos);
+  }
+  account(conv);
+}
+
+void SearchIndex::load(Conv &conv) {
+  loadTail(conv);
+  if (conv.loaded) {
+    return;
+  }
+  conv.loaded = true;
+  conv.textBytes = 0;
+  for (Segment &seg : conv.segments) {
+    if (seg.docs.size() != seg.count &&
+        !readSegment(path(conv, seg.first), seg)) {
+      // 段头完好但内容损坏：留着段头保持编号连续，这一段的消息搜不到
+      LOG_ERROR("搜索索引{}损坏，其中的{}条消息搜不到", path(conv, seg.first),
+                seg.count);
+      continue;
+    }
+    for (const Doc &doc : seg.docs) {
+      conv.textBytes += doc.len;
+    }
+  }
+  for (const Doc &doc : conv.tail.docs) {
+    conv.textBytes += doc.len;
+  }
+  account(conv);
+}
+
+const SearchIndex::Segment *SearchIndex::contentOf(const Conv &conv,
+                                                   const Segment &seg,
+                                                   Segment &buf) {
+  if (seg.docs.size() == seg.count) {
+    return &seg;
+  }
+  return readSegment(path(conv, seg.first), buf) ? &buf : nullptr;
+}
+
+void SearchIndex::index(Conv &conv, const string &sender,
+                        const string &content, int64_t time, uint16_t flags) {
+  Segment &tail = conv.tail;
+  uint32_t id = tail.docs.size();
+  tail.docs.push_back({(uint32_t)tail.text.size(), (uint32_t)content.size(),
+                       (uint32_t)time, (uint16_t)sender.size(), flags});
+  tail.text += sender;
+  tail.text += content;
+  conv.textBytes += content.size();
+  for (uint64_t token : tokenize(content)) {
+    conv.tailPostings[token].push_back(id);
+  }
+}
+
+SearchIndex::Segment SearchIndex::merge(const Segment &a, const Segment &b) {
+  Segment out;
+  out.first = a.first;
+  out.count = a.count + b.count;
+  out.docs = a.docs;
+  out.text = a.text + b.text;
+  for (Doc doc : b.docs) {
+    doc.offset += a.text.size();
+    out.docs.push_back(doc);
+  }
+  uint32_t shift = a.docs.size();
+  size_t i = 0, j = 0;
+  while (i < a.terms.size() || j < b.terms.size()) {
+    bool takeA = j == b.terms.size() ||
+                 (i < a.terms.size() && a.terms[i].hash <= b.terms[j].hash);
+    bool takeB = i == a.terms.size() ||
+                 (j < b.terms.size() && b.terms[j].hash <= a.terms[i].hash);
+    uint64_t hash = takeA ? a.terms[i].hash : b.terms[j].hash;
+    vector<uint32_t> ids;
+    if (takeA) {
+      ids = postingOf(a, hash);
+      i++;
+    }
+    if (takeB) {
+      for (uint32_t id : postingOf(b, hash)) {
+        ids.push_back(id + shift);
+      }
+      j++;
+    }
+    putPosting(out, hash, ids);
+  }
+  return out;
+}
+
+// tail.log只write不落盘：进程崩溃时内容还在页缓存里，整机掉电才会丢掉最近没压成段的消息，
+// 丢的只是索引，聊天记录本身不受影响
+void SearchIndex::appendLog(Conv &conv, string &log) {
+  if (log.empty()) {
+    return;
+  }
+  if (mkdir(conv.dir.c_str(), 0755) < 0 && errno != EEXIST) {
+    LOG_ERROR("搜索索引目录{}创建失败: {}", conv.dir, strerror(errno));
+    log.clear();
+    return;
+  }
+  int fd = open((conv.dir + "/tail.log").c_str(),
+                O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0 || !WriteAll(fd, log)) {
+    LOG_ERROR("写搜索索引{}/tail.log失败: {}", conv.dir, strerror(errno));
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  log.clear();
+}
+
+void SearchIndex::seal(Conv &conv) {
+  Segment seg;
+  seg.first = conv.tail.first;
+  seg.count = conv.tail.docs.size();
+  seg.docs.swap(conv.tail.docs);
+  seg.text.swap(conv.tail.text);
+  vector<uint64_t> hashes;
+  hashes.reserve(conv.tailPostings.size());
+  for (auto &kv : conv.tailPostings) {
+    hashes.push_back(kv.first);
+  }
+  sort(hashes.begin(), hashes.end());
+  for (uint64_t hash : hashes) {
+    putPosting(seg, hash, conv.tailPostings[hash]);
+  }
+  conv.tailPostings.clear();
+  conv.tail.first = seg.first + seg.docs.size();
+  if (!writeSegment(conv, seg)) {
+    // 段没写成，tail.log还在，下次加载时重放
+    conv.segments.push_back(std::move(seg));
+    return;
+  }
+  int fd = open((conv.dir + "/tail.log").c_str(),
+                O_WRONLY | O_TRUNC | O_CLOEXEC);
+  if (fd >= 0) {
+    close(fd);
+  }
+  conv.segments.push_back(std::move(seg));
+  // 和前一段一样大就合并，段的大小依次翻倍；没在搜索的会话只留段头，合并时从磁盘读
+  while (conv.segments.size() >= 2) {
+    Segment &a = conv.segments[conv.segments.size() - 2];
+    Segment &b = conv.segments.back();
+    if (a.count > b.count) {
+      break;
+    }
+    Segment bufA, bufB;
+    const Segment *pa = contentOf(conv, a, bufA);
+    const Segment *pb = contentOf(conv, b, bufB);
+    if (pa == nullptr || pb == nullptr) {
+      break;
+    }
+    Segment merged = merge(*pa, *pb);
+    if (!writeSegment(conv, merged)) {
+      break;
+    }
+    unlink(path(conv, b.first).c_str());
+    conv.segments.pop_back();
+    conv.segments.back() = std::move(merged);
+  }
+  if (!conv.loaded) {
+    // 换出来再析构：移动赋值一个空string不会释放原来的内存
+    Segment shell;
+    shell.first = conv.segments.back().first;
+    shell.count = conv.segments.back().count;
+    swap(conv.segments.back(), shell);
+  }
+}
+
+void SearchIndex::reset(Conv &conv) {
+  conv.segments.clear();
+  conv.tail = Segment();
+  conv.tailPostings.clear();
+  conv.textBytes = 0;
+  account(conv);
+}
+
+void SearchIndex::account(Conv &conv) {
+  size_t bytes = 0;
+  for (const Segment &seg : conv.segments) {
+    bytes += seg.docs.capacity() * sizeof(Doc) + seg.text.capacity() +
+             seg.terms.capacity() * sizeof(Term) + seg.postings.capacity();
+  }
+  bytes += conv.tail.docs.capacity() * sizeof(Doc) + conv.tail.text.capacity();
+  for (const auto &kv : conv.tailPostings) {
+    // 哈希表的节点和桶按每项约48字节估
+    bytes += 48 + kv.second.capacity() * sizeof(uint32_t);
+  }
+  m_bytes += bytes - conv.bytes;
+  conv.bytes = bytes;
+}
+
+void SearchIndex::shrink() {
+  if (m_bytes <= SEARCH_RESIDENT_BYTES) {
+    return;
+  }
+  pthread_mutex_lock(&m_lock);
+  // 每个会话最多看两遍：第一遍清访问位，第二遍卸下；正在用的（锁被占着）跳过
+  for (size_t step = 2 * m_resident.size();
+       step > 0 && m_resident.size() > 1 && m_bytes > SEARCH_RESIDENT_BYTES;
+       step--) {
+    m_hand %= m_resident.size();
+    Conv &conv = *m_resident[m_hand];
+    if (conv.ref.exchange(false) || pthread_mutex_trylock(&conv.lock) != 0) {
+      m_hand++;
+      continue;
+    }
+    Segment tail;
+    swap(conv.tail, tail);
+    conv.segments = vector<Segment>();
+    conv.tailPostings = unordered_map<uint64_t, vector<uint32_t>>();
+    conv.textBytes = 0;
+    m_bytes -= conv.bytes;
+    conv.bytes = 0;
+    conv.opened = false;
+    conv.loaded = false;
+    pthread_mutex_unlock(&conv.lock);
+    m_resident[m_hand] = m_resident.back();
+    m_resident.pop_back();
+    m_evictions++;
+  }
+  pthread_mutex_unlock(&m_lock);
+}
+
+SearchIndex::Stats SearchIndex::stats() {
+  Stats stats;
+  pthread_mutex_lock(&m_lock);
+  stats.resident = m_resident.size();
+  stats.pending = m_pending.size();
+  pthread_mutex_unlock(&m_lock);
+  stats.bytes = m_bytes;
+  stats.evictions = m_evictions;
+  return stats;
+}
+
+vector<SearchIndex::Hit> SearchIndex::search(const string &key,
+                                             const string &query,
+                                             const string &viewer, int page,
+                                             size_t &total) {
+  total = 0;
+  vector<Hit> out;
+  if (!m_running) {
+    return out;
+  }
+  // 查询词按空白切开，字母统一小写，每个词各自分词
+  vector<string> words;
+  vector<vector<uint64_t>> wordTokens;
+  string word;
+  for (size_t i = 0; i <= query.size(); i++) {
+    if (i == query.size() || isspace((unsigned char)query[i])) {
+      if (!word.empty()) {
+        wordTokens.push_back(tokenize(word, true));
+        words.push_back(std::move(word));
+        word.clear();
+      }
+    } else {
+      word += tolower((unsigned char)query[i]);
+    }
+  }
+  if (words.empty()) {
+    return out;
+  }
+  vector<uint64_t> tokens;
+  for (const vector<uint64_t> &t : wordTokens) {
+    tokens.insert(tokens.end(), t.begin(), t.end());
+  }
+  sort(tokens.begin(), tokens.end());
+  tokens.erase(unique(tokens.begin(), tokens.end()), tokens.end());
+
+  pthread_mutex_lock(&m_lock);
+  Conv &conv = convOf(key);
+  pthread_mutex_unlock(&m_lock);
+  pthread_mutex_lock(&conv.lock);
+  load(conv);
+  struct Match {
+    const Segment *seg;
+    uint32_t local;
+    vector<uint32_t> tf; // 每个查询词在正文里出现的次数
+    double score;
+  };
+  vector<Match> matches;
+  vector<uint64_t> df(words.size(), 0); // 每个词的文档频率（取它最少见的词元估计）
+  vector<const Segment *> segs;
+  for (const Segment &seg : conv.segments) {
+    if (seg.docs.size() == seg.count) {
+      segs.push_back(&seg); // 内容损坏的段只有段头
+    }
+  }
+  segs.push_back(&conv.tail);
+  for (const Segment *seg : segs) {
+    bool isTail = seg == &conv.tail;
+    // 候选文档：所有词元倒排表的交集，短的先交；没有词元时逐条核对
+    vector<vector<uint32_t>> lists;
+    for (uint64_t token : tokens) {
+      if (isTail) {
+        auto it = conv.tailPostings.find(token);
+        lists.push_back(it == conv.tailPostings.end() ? vector<uint32_t>()
+                                                      : it->second);
+      } else {
+        lists.push_back(postingOf(*seg, token));
+      }
+    }
+    for (size_t w = 0; w < words.size(); w++) {
+      if (wordTokens[w].empty()) {
+        continue; // 只能逐条核对的词，文档频率取最终的命中数
+      }
+      uint64_t least = seg->docs.size();
+      for (uint64_t token : wordTokens[w]) {
+        size_t k = lower_bound(tokens.begin(), tokens.end(), token) -
+                   tokens.begin();
+        least = min<uint64_t>(least, lists[k].size());
+      }
+      df[w] += least;
+    }
+    vector<uint32_t> cand;
+    if (lists.empty()) {
+      cand.resize(seg->docs.size());
+      for (uint32_t i = 0; i < cand.size(); i++) {
+        cand[i] = i;
+      }
+    } else {
+      sort(lists.begin(), lists.end(),
+           [](const vector<uint32_t> &a, const vector<uint32_t> &b) {
+             return a.size() < b.size();
+           });
+      cand = lists[0];
+      for (size_t k = 1; k < lists.size() && !cand.empty(); k++) {
+        vector<uint32_t> both;
+        set_intersection(cand.begin(), cand.end(), lists[k].begin(),
+                         lists[k].end(), back_inserter(both));
+        cand.swap(both);
+      }
+    }
+    // 核对原文：哈希冲突、两字词元不相邻、单字查询都在这里排除
+    for (uint32_t local : cand) {
+      const Doc &doc = seg->docs[local];
+      string_view sender(seg->text.data() + doc.offset, doc.senderLen);
+      if ((doc.flags & SEARCH_HIDDEN) && sender != viewer) {
+        continue;
+      }
+      string body = seg->text.substr(doc.offset + doc.senderLen, doc.len);
+      for (char &c : body) {
+        c = tolower((unsigned char)c);
+      }
+      Match m = {seg, local, {}, 0};
+      for (const string &w : words) {
+        uint32_t n = 0;
+        for (size_t at = body.find(w); at != string::npos;
+             at = body.find(w, at + w.size())) {
+          n++;
+        }
+        if (n == 0) {
+          break;
+        }
+        m.tf.push_back(n);
+      }
+      if (m.tf.size() == words.size()) {
+        matches.push_back(std::move(m));
+      }
+    }
+  }
+  // BM25打分，同分时新消息在前
+  double docs = max<uint64_t>(conv.total(), 1);
+  double avgLen = max(conv.textBytes / docs, 1.0);
+  for (Match &m : matches) {
+    double len = m.seg->docs[m.local].len;
+    for (size_t w = 0; w < words.size(); w++) {
+      double n = df[w] == 0 ? matches.size() : df[w];
+      double idf = log(1 + (docs - n + 0.5) / (n + 0.5));
+      double tf = m.tf[w];
+      m.score += idf * tf * 2.2 / (tf + 1.2 * (0.25 + 0.75 * len / avgLen));
+    }
+  }
+  total = matches.size();
+  size_t begin = (size_t)max(page - 1, 0) * SEARCH_PAGE_SIZE;
+  size_t end = min(total, begin + SEARCH_PAGE_SIZE);
+  auto newer = [](const Match &a, const Match &b) {
+    if (a.score != b.score) {
+      return a.score > b.score;
+    }
+    return a.seg->first + a.local > b.seg->first + b.local;
+  };
+  if (begin < end) {
+    partial_sort(matches.begin(), matches.begin() + end, matches.end(), newer);
+    for (size_t i = begin; i < end; i++) {
+      const Segment &seg = *matches[i].seg;
+      const Doc &doc = seg.docs[matches[i].local];
+      out.push_back({seg.text.substr(doc.offset, doc.senderLen),
+                     seg.text.substr(doc.offset + doc.senderLen, doc.len),
+                     doc.time});
+    }
+  }
+  pthread_mutex_unlock(&conv.lock);
+  shrink();
+  return out;
+}
+
+void SearchIndex::drop(const string &key) {
+  if (!m_running) {
+    return;
+  }
+  pthread_mutex_lock(&m_lock);
+  Conv &conv = convOf(key);
+  pthread_mutex_unlock(&m_lock);
+  pthread_mutex_lock(&conv.lock);
+  conv.epoch++;
+  loadTail(conv);
+  for (const Segment &seg : conv.segments) {
+    unlink(path(conv, seg.first).c_str());
+  }
+  unlink((conv.dir + "/tail.log").c_str());
+  rmdir(conv.dir.c_str());
+  reset(conv);
+  pthread_mutex_unlock(&conv.lock);
+}
+
+void *SearchIndex::worker(void *arg) {
+  SearchIndex *self = static_cast<SearchIndex *>(arg);
+  while (true) {
+    pthread_mutex_lock(&self->m_lock);
+    while (self->m_running && self->m_pending.empty()) {
+      pthread_cond_wait(&self->m_wake, &self->m_lock);
+    }
+    vector<Pending> batch;
+    batch.swap(self->m_pending);
+    bool running = self->m_running;
+    pthread_mutex_unlock(&self->m_lock);
+    if (batch.empty() && !running) {
+      break;
+    }
+    // 同一会话的消息按入队顺序一起处理，每个会话只加一次锁、写一次tail.log
+    stable_sort(batch.begin(), batch.end(),
+                [](const Pending &a, const Pending &b) {
+                  return a.conv < b.conv;
+                });
+    for (size_t i = 0; i < batch.size();) {
+      Conv &conv = *batch[i].conv;
+      pthread_mutex_lock(&conv.lock);
+      self->loadTail(conv);
+      string log;
+      for (; i < batch.size() && batch[i].conv == &conv; i++) {
+        Pending &p = batch[i];
+        if (p.epoch != conv.epoch.load()) {
+          continue; // 会话在入队后被删除了
+        }
+        uint16_t flags = p.hidden ? SEARCH_HIDDEN : 0;
+        self->index(conv, p.sender, p.content, p.time, flags);
+        Archive::pack(log, {conv.total() - 1, p.time,
+                            record(conv.tail.docs.back(), conv.tail.text)});
+        if (conv.tail.docs.size() >= SEARCH_SEAL_DOCS) {
+          self->appendLog(conv, log);
+          self->seal(conv);
+        }
+      }
+      self->appendLog(conv, log);
+      self->account(conv);
+      pthread_mutex_unlock(&conv.lock);
+    }
+    self->shrink();
+  }
+  return NULL;
+}
+
+#endif
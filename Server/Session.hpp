@@ -0,0 +1,74 @@
+#ifndef SESSION_HPP
+#define SESSION_HPP
+
+#include "Log.hpp"
+#include "redis.hpp"
+#include <string>
+
+#define SESSION_EPOCH_KEY "服务器启动代数" // 每次启动加一
+
+using namespace std;
+
+// 会话代数：在线状态和fd-uid对应表都放在带启动代数的表里，
+// 服务器重启后换一代新表，上次运行留下的会话状态自然失效，启动时不用扫描所有账号
+class Session {
+public:
+  // 启动时调用一次：代数加一，上一代的表交给redis后台删除
+  static bool init(Redis *conn);
+  // 本次运行的在线用户表：uid -> 交互套接字，不在表里就是不在线
+  static const string &onlineKey() { return s_onlineKey; }
+  // 本次运行的fd-uid对应表
+  static const string &fdKey() { return s_fdKey; }
+  // uid的在线状态，按原来的习惯在线为交互套接字，不在线为"-1"
+  static string online(const string &uid);
+  static bool isOnline(const string &uid);
+
+private:
+  static string onlineKeyOf(long long epoch);
+  static string fdKeyOf(long long epoch);
+
+  static long long s_epoch;
+  static string s_onlineKey;
+  static string s_fdKey;
+};
+
+long long Session::s_epoch = 0;
+string Session::s_onlineKey;
+string Session::s_fdKey;
+
+string Session::onlineKeyOf(long long epoch) {
+  return "在线用户表:" + to_string(epoch);
+}
+
+string Session::fdKeyOf(long long epoch) {
+  return "fd-uid对应表:" + to_string(epoch);
+}
+
+bool Session::init(Redis *conn) {
+  RedisBatch incr(conn);
+  incr.add({"INCR", SESSION_EPOCH_KEY});
+  if (!incr.exec()) {
+    LOG_ERROR("获取启动代数失败");
+    return false;
+  }
+  s_epoch = incr.integer(0);
+  s_onlineKey = onlineKeyOf(s_epoch);
+  s_fdKey = fdKeyOf(s_epoch);
+  // UNLINK只摘键，表里的内容由redis在后台释放，不随用户数变慢
+  RedisBatch drop(conn);
+  drop.add({"UNLINK", onlineKeyOf(s_epoch - 1), fdKeyOf(s_epoch - 1)});
+  drop.exec();
+  LOG_INFO("第{}代会话启动", s_epoch);
+  return true;
+}
+
+string Session::online(const string &uid) {
+  string fd = redis->gethash(s_onlineKey, uid);
+  return fd.empty() ? "-1" : fd;
+}
+
+bool Session::isOnline(const string &uid) {
+  return redis->hashexists(s_onlineKey, uid);
+}
+
+#endif
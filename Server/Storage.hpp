@@ -0,0 +1,80 @@
+#ifndef STORAGE_HPP
+#define STORAGE_HPP
+
+#include <cstdlib>
+#include <cstring>
+#include <hiredis/hiredis.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+class RedisScript;
+
+// 存储后端接口：按redis命令的参数数组执行命令，回复与hiredis的redisReply结构相同，
+// 调用方用freeReplyObject释放。Redis类的各项操作、RedisBatch、异步命令和Lua脚本都经过它，
+// 所以处理函数不关心数据是在redis-server里还是在进程内
+class Storage {
+public:
+  virtual ~Storage() = default;
+  // 连接管理，只对远端存储有意义
+  virtual bool connect(struct timeval) { return true; }
+  virtual bool disConnect() { return true; }
+  virtual bool reconnect() { return true; }
+  virtual bool broken() const { return false; }
+  // 执行一条命令，连接出错时返回nullptr
+  virtual redisReply *execute(const string_view *argv, size_t argc) = 0;
+  // 按顺序执行一批命令，回复依次放进replies，出错时返回false；
+  // transaction为true时整批原子执行，replies里只放一个回复：EXEC的数组回复
+  virtual bool pipeline(const vector<vector<string>> &cmds, bool transaction,
+                        vector<redisReply *> &replies) = 0;
+  // 脚本
+  virtual bool loadScript(RedisScript &script) = 0;
+  virtual redisReply *eval(const RedisScript &script,
+                           const vector<string> &args) = 0;
+  // 最近一次出错的原因
+  virtual const char *errstr() const { return ""; }
+};
+
+// 构造回复，内存的分配方式与hiredis一致，可以用freeReplyObject释放
+redisReply *MakeStr(int type, string_view s) {
+  redisReply *r = (redisReply *)calloc(1, sizeof(redisReply));
+  r->type = type;
+  r->len = s.size();
+  r->str = (char *)malloc(s.size() + 1);
+  memcpy(r->str, s.data(), s.size());
+  r->str[s.size()] = '\0';
+  return r;
+}
+
+redisReply *MakeString(string_view s) { return MakeStr(REDIS_REPLY_STRING, s); }
+redisReply *MakeStatus(string_view s) { return MakeStr(REDIS_REPLY_STATUS, s); }
+redisReply *MakeError(string_view s) { return MakeStr(REDIS_REPLY_ERROR, s); }
+
+redisReply *MakeNil() {
+  redisReply *r = (redisReply *)calloc(1, sizeof(redisReply));
+  r->type = REDIS_REPLY_NIL;
+  return r;
+}
+
+redisReply *MakeInteger(long long n) {
+  redisReply *r = (redisReply *)calloc(1, sizeof(redisReply));
+  r->type = REDIS_REPLY_INTEGER;
+  r->integer = n;
+  return r;
+}
+
+// 元素的所有权转给数组回复
+redisReply *MakeArray(const vector<redisReply *> &elements) {
+  redisReply *r = (redisReply *)calloc(1, sizeof(redisReply));
+  r->type = REDIS_REPLY_ARRAY;
+  r->elements = elements.size();
+  if (!elements.empty()) {
+    r->element = (redisReply **)malloc(elements.size() * sizeof(redisReply *));
+    memcpy(r->element, elements.data(), elements.size() * sizeof(redisReply *));
+  }
+  return r;
+}
+
+#endif
@@ -1,5 +1,7 @@
 #include "TCPServer.hpp"
+#include "Log.hpp"
 #include <asm-generic/socket.h>
+#include <cerrno>
 #include <sys/socket.h>
 
 TcpServer::TcpServer() {
@@ -18,18 +20,17 @@ int TcpServer::setListen(unsigned short port) {
   saddr.sin_addr.s_addr = INADDR_ANY; // 0 = 0.0.0.0
   int ret = bind(m_fd, (struct sockaddr *)&saddr, sizeof(saddr));
   if (ret == -1) {
-    perror("bind");
+    LOG_ERROR("bind: {}", strerror(errno));
     return -1;
   }
-  cout << "套接字绑定成功, ip: " << inet_ntoa(saddr.sin_addr)
-       << ", port: " << port << endl;
+  LOG_INFO("套接字绑定成功, ip: {}, port: {}", inet_ntoa(saddr.sin_addr), port);
 
   ret = listen(m_fd, 128);
   if (ret == -1) {
-    perror("listen");
+    LOG_ERROR("listen: {}", strerror(errno));
     return -1;
   }
-  cout << "设置监听成功..." << endl;
+  LOG_INFO("设置监听成功...");
 
   return ret;
 }
@@ -38,7 +39,7 @@ TcpSocket *TcpServer::acceptConn(sockaddr_in *addr) {
   socklen_t addrlen = sizeof(struct sockaddr_in);
   int cfd = accept(m_fd, (struct sockaddr *)addr, &addrlen);
   if (cfd == -1) {
-    perror("accept");
+    LOG_ERROR("accept: {}", strerror(errno));
     return nullptr;
   }
   // cout << "成功和客户端建立连接..." << endl;
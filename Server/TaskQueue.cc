@@ -1,6 +1,7 @@
 #include "TaskQueue.hpp"
 
-template <typename T> TaskQueue<T>::TaskQueue() {
+template <typename T>
+TaskQueue<T>::TaskQueue(int laneNum) : m_queue(laneNum < 1 ? 1 : laneNum) {
   pthread_mutex_init(&m_mutex, NULL);
 }
 
@@ -10,26 +11,42 @@ template <typename T> TaskQueue<T>::~TaskQueue() {
 
 template <typename T> void TaskQueue<T>::addTask(Task<T> &task) {
   pthread_mutex_lock(&m_mutex);
-  m_queue.push(task);
+  // 通道号越界的任务放进0号通道
+  if (task.lane < 0 || task.lane >= (int)m_queue.size()) {
+    task.lane = 0;
+  }
+  m_queue[task.lane].push(task);
+  m_total++;
   pthread_mutex_unlock(&m_mutex);
 }
 
 template <typename T> void TaskQueue<T>::addTask(callback func, void *arg) {
-  pthread_mutex_lock(&m_mutex);
-  Task<T> task;
-  task.function = func;
-  task.arg = arg;
-  m_queue.push(task);
-  pthread_mutex_unlock(&m_mutex);
+  Task<T> task(func, arg);
+  addTask(task);
 }
 
-template <typename T> Task<T> TaskQueue<T>::takeTask() {
+template <typename T> Task<T> TaskQueue<T>::takeTask(int lane) {
   Task<T> t;
   pthread_mutex_lock(&m_mutex);
-  if (m_queue.size() > 0) {
-    t = m_queue.front();
-    m_queue.pop();
+  if (m_queue[lane].size() > 0) {
+    t = m_queue[lane].front();
+    m_queue[lane].pop();
+    m_total--;
   }
   pthread_mutex_unlock(&m_mutex);
   return t;
 }
+
+template <typename T> int TaskQueue<T>::taskNumber() {
+  pthread_mutex_lock(&m_mutex);
+  int n = m_total;
+  pthread_mutex_unlock(&m_mutex);
+  return n;
+}
+
+template <typename T> int TaskQueue<T>::taskNumber(int lane) {
+  pthread_mutex_lock(&m_mutex);
+  int n = m_queue[lane].size();
+  pthread_mutex_unlock(&m_mutex);
+  return n;
+}
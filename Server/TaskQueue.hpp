@@ -1,42 +1,78 @@
 #ifndef TASK_QUEUE_H
 #define TASK_QUEUE_H
 
+#include <cstdint>
 #include <pthread.h>
 #include <queue>
+#include <string>
+#include <vector>
+
+#define LANE_WAIT_BUCKETS 32 // 排队时间直方图的桶数，第i个桶为[2^(i-1), 2^i)微秒
+
 // 定义任务结构体
 using callback = void (*)(void *);
 template <typename T> struct Task {
-  Task<T>() {
+  Task() {
     function = nullptr;
     arg = nullptr;
   }
-  Task<T>(callback f, void *arg) {
+  Task(callback f, void *arg, int lane = 0) {
     function = f;
     this->arg = static_cast<T *>(arg);
+    this->lane = lane;
   }
   callback function;
   T *arg;
+  int lane = 0;             // 所属调度通道
+  uint64_t enqueueTime = 0; // 到达（入队）时间（单调时钟纳秒），由线程池填写
+  uint64_t deadline = 0;    // 最晚开始执行的时间，0表示不限，由线程池按通道填写
+  bool sheddable = true; // 能否因超时或超过SLO丢弃，恢复协程的任务不能丢
+};
+
+// 调度通道配置
+struct LaneConfig {
+  std::string name;
+  int weight;         // 加权轮询的权重
+  int reserved;       // 为本通道保留的工作线程数，其它通道不能占用
+  int deadlineMs = 0; // 排队超过该时间的任务不再执行，0表示不限
+  int sloMs = 0;      // 入队时预计排队时间超过该值就直接拒绝，0表示不限
+};
+
+// 调度通道的统计（queued/running为当前值，waitMaxNs每个统计周期清零，其余为累计值）
+struct LaneStats {
+  uint64_t enqueued = 0;    // 入队的任务数
+  uint64_t done = 0;        // 已开始执行的任务数（含超时丢弃的）
+  uint64_t waitSumNs = 0;   // 排队时间总和
+  uint64_t waitMaxNs = 0;   // 最近一个统计周期内的最大排队时间
+  uint64_t shedExpired = 0; // 排队超过截止时间被丢弃的任务数
+  uint64_t shedEarly = 0;   // 入队时预计排队超过SLO被拒绝的任务数
+  uint64_t serviceNs = 0;   // 执行时间的指数滑动平均
+  int queued = 0;           // 当前排队数
+  int running = 0;          // 当前正在执行的任务数
+  uint64_t waitHist[LANE_WAIT_BUCKETS] = {}; // 排队时间直方图
 };
 
-// 任务队列
+// 任务队列，每个调度通道一个先进先出队列
 template <typename T> class TaskQueue {
 public:
-  TaskQueue();
+  TaskQueue(int laneNum = 1);
   ~TaskQueue();
 
   // 添加任务
   void addTask(callback func, void *arg);
   void addTask(Task<T> &task);
 
-  // 取出一个任务
-  Task<T> takeTask();
+  // 取出一个任务（lane为通道号）
+  Task<T> takeTask(int lane = 0);
 
   // 获取当前队列中任务个数
-  inline int taskNumber() { return m_queue.size(); }
+  int taskNumber();
+  int taskNumber(int lane);
 
 private:
-  pthread_mutex_t m_mutex;     // 互斥锁
-  std::queue<Task<T>> m_queue; // 任务队列
+  pthread_mutex_t m_mutex;                  // 互斥锁
+  std::vector<std::queue<Task<T>>> m_queue; // 每个通道的任务队列
+  int m_total = 0;                          // 所有通道的任务总数
 };
 
-#endif
\ No newline at end of file
+#endif
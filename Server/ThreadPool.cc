@@ -1,14 +1,35 @@
 #include "ThreadPool.hpp"
-#include <iostream>
+#include "Log.hpp"
+#include <algorithm>
 #include <pthread.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 using namespace std;
 
-template <typename T> ThreadPool<T>::ThreadPool(int minNum, int maxNum) {
+template <typename T>
+ThreadPool<T>::ThreadPool(int minNum, int maxNum, threadInit init,
+                          const vector<LaneConfig> &lanes)
+    : m_init(init), m_lanes(lanes) {
+  if (m_lanes.empty()) {
+    m_lanes.push_back({"默认", 1, 0});
+  }
+  // 保留的线程总数至少要比最小线程数少1，否则没有保留的通道可能永远拿不到线程
+  int reserved = 0;
+  for (LaneConfig &lane : m_lanes) {
+    lane.weight = max(lane.weight, 1);
+    lane.reserved = max(min(lane.reserved, minNum - 1 - reserved), 0);
+    reserved += lane.reserved;
+    LOG_INFO("调度通道{}: 权重{}, 保留线程{}, 截止时间{}ms, SLO {}ms",
+             lane.name, lane.weight, lane.reserved, lane.deadlineMs,
+             lane.sloMs);
+  }
+  m_laneStats.resize(m_lanes.size());
+  m_lastStats.resize(m_lanes.size());
+  m_laneCredit.assign(m_lanes.size(), 0);
   // 实例化任务队列
-  m_taskQ = new TaskQueue<T>;
+  m_taskQ = new TaskQueue<T>(m_lanes.size());
   do {
     // 初始化线程池
     m_minNum = minNum;
@@ -19,8 +40,7 @@ template <typename T> ThreadPool<T>::ThreadPool(int minNum, int maxNum) {
     // 根据线程的最大上限给线程数组分配内存
     m_threadIDs = new pthread_t[maxNum];
     if (m_threadIDs == nullptr) {
-      cout << "malloc thread_t[] 失败...." << endl;
-      ;
+      LOG_ERROR("malloc thread_t[] 失败....");
       break;
     }
     // 初始化
@@ -28,7 +48,7 @@ template <typename T> ThreadPool<T>::ThreadPool(int minNum, int maxNum) {
     // 初始化互斥锁,条件变量
     if (pthread_mutex_init(&m_lock, NULL) != 0 ||
         pthread_cond_init(&m_notEmpty, NULL) != 0) {
-      cout << "init mutex or condition fail..." << endl;
+      LOG_ERROR("init mutex or condition fail...");
       break;
     }
 
@@ -36,7 +56,7 @@ template <typename T> ThreadPool<T>::ThreadPool(int minNum, int maxNum) {
     for (int i = 0; i < minNum; ++i) {
       pthread_create(&m_threadIDs[i], NULL, worker, this);
       pthread_detach(m_threadIDs[i]);
-      cout << "创建子线程, ID: " << to_string(m_threadIDs[i]) << endl;
+      LOG_INFO("创建子线程, ID: {}", m_threadIDs[i]);
     }
     // 创建管理者线程, 1个
     pthread_create(&m_managerID, NULL, manager, this);
@@ -65,10 +85,46 @@ template <typename T> void ThreadPool<T>::addTask(Task<T> task) {
   if (m_shutdown) {
     return;
   }
-  // 添加任务，不需要加锁，任务队列中有锁
+  if (task.lane < 0 || task.lane >= (int)m_lanes.size()) {
+    task.lane = 0;
+  }
+  const LaneConfig &lane = m_lanes[task.lane];
+  task.enqueueTime = now();
+  if (lane.deadlineMs > 0 && task.sheddable) {
+    task.deadline = task.enqueueTime + lane.deadlineMs * 1000000ull;
+  }
+  // 持有线程池的锁入队，工作线程判断有无可执行任务和进入等待之间不会漏掉唤醒
+  pthread_mutex_lock(&m_lock);
+  LaneStats &stats = m_laneStats[task.lane];
+  stats.enqueued++;
+  // 预计排队时间已经超过SLO，与其让它排到超时不如现在就拒绝
+  if (task.sheddable && lane.sloMs > 0 &&
+      projectedWait(task.lane) > lane.sloMs * 1000000ull) {
+    stats.shedEarly++;
+    pthread_mutex_unlock(&m_lock);
+    if (m_shed != nullptr) {
+      m_shed(task.arg);
+    }
+    delete task.arg;
+    return;
+  }
   m_taskQ->addTask(task);
+  stats.queued++;
   // 唤醒工作的线程
   pthread_cond_signal(&m_notEmpty);
+  pthread_mutex_unlock(&m_lock);
+}
+
+template <typename T> void ThreadPool<T>::setShedHandler(callback shed) {
+  pthread_mutex_lock(&m_lock);
+  m_shed = shed;
+  pthread_mutex_unlock(&m_lock);
+}
+
+template <typename T> uint64_t ThreadPool<T>::projectedWait(int lane) {
+  // 排在前面的任务（含新任务）由所有存活线程分摊执行，还没有执行时间样本时不估算
+  const LaneStats &stats = m_laneStats[lane];
+  return (stats.queued + 1) * stats.serviceNs / max(m_aliveNum, 1);
 }
 
 template <typename T> int ThreadPool<T>::getAliveNumber() {
@@ -79,6 +135,102 @@ template <typename T> int ThreadPool<T>::getAliveNumber() {
   return threadNum;
 }
 
+template <typename T> LaneStats ThreadPool<T>::getLaneStats(int lane) {
+  pthread_mutex_lock(&m_lock);
+  LaneStats stats = m_laneStats[lane];
+  pthread_mutex_unlock(&m_lock);
+  return stats;
+}
+
+template <typename T> uint64_t ThreadPool<T>::now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+template <typename T> bool ThreadPool<T>::laneRunnable(int lane) {
+  // 其它通道还没用上的保留线程数
+  int otherReserve = 0;
+  for (size_t i = 0; i < m_lanes.size(); i++) {
+    if ((int)i != lane) {
+      otherReserve += max(m_lanes[i].reserved - m_laneStats[i].running, 0);
+    }
+  }
+  // 本通道的保留线程没用完，或者空闲线程去掉其它通道的保留后还有剩余
+  return m_laneStats[lane].running < m_lanes[lane].reserved ||
+         m_aliveNum - m_busyNum > otherReserve;
+}
+
+template <typename T> int ThreadPool<T>::pickLane() {
+  // 平滑加权轮询：每个可执行的通道加上自己的权重，选当前值最大的，再减去权重和
+  int best = -1;
+  int total = 0;
+  for (size_t i = 0; i < m_lanes.size(); i++) {
+    if (m_laneStats[i].queued == 0 || !laneRunnable(i)) {
+      continue;
+    }
+    m_laneCredit[i] += m_lanes[i].weight;
+    total += m_lanes[i].weight;
+    if (best == -1 || m_laneCredit[i] > m_laneCredit[best]) {
+      best = i;
+    }
+  }
+  if (best != -1) {
+    m_laneCredit[best] -= total;
+  }
+  return best;
+}
+
+template <typename T>
+void ThreadPool<T>::recordWait(int lane, uint64_t waitNs) {
+  LaneStats &stats = m_laneStats[lane];
+  stats.done++;
+  stats.waitSumNs += waitNs;
+  stats.waitMaxNs = max(stats.waitMaxNs, waitNs);
+  uint64_t us = waitNs / 1000;
+  int bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+  stats.waitHist[min(bucket, LANE_WAIT_BUCKETS - 1)]++;
+}
+
+template <typename T> void ThreadPool<T>::reportLanes() {
+  pthread_mutex_lock(&m_lock);
+  vector<LaneStats> cur = m_laneStats;
+  for (LaneStats &stats : m_laneStats) {
+    stats.waitMaxNs = 0;
+  }
+  pthread_mutex_unlock(&m_lock);
+  for (size_t i = 0; i < cur.size(); i++) {
+    LaneStats &last = m_lastStats[i];
+    uint64_t done = cur[i].done - last.done;
+    uint64_t expired = cur[i].shedExpired - last.shedExpired;
+    uint64_t early = cur[i].shedEarly - last.shedEarly;
+    if (done == 0 && early == 0 && cur[i].queued == 0) {
+      continue;
+    }
+    uint64_t avgUs =
+        done ? (cur[i].waitSumNs - last.waitSumNs) / done / 1000 : 0;
+    // 本周期排队时间的p99（取所在直方图桶的上界）
+    uint64_t p99Us = 0;
+    uint64_t seen = 0;
+    for (int b = 0; b < LANE_WAIT_BUCKETS && done > 0; b++) {
+      seen += cur[i].waitHist[b] - last.waitHist[b];
+      if (seen * 100 >= done * 99) {
+        p99Us = 1ull << b;
+        break;
+      }
+    }
+    LOG_INFO("通道{}: 本周期执行{}个，排队中{}个，排队时间 平均{}us p99<{}us "
+             "最大{}us",
+             m_lanes[i].name, done, cur[i].queued, avgUs, p99Us,
+             cur[i].waitMaxNs / 1000);
+    if (expired > 0 || early > 0) {
+      LOG_WARN("通道{}: 本周期超时丢弃{}个，超过SLO拒绝{}个，平均执行时间{}us",
+               m_lanes[i].name, expired, early, cur[i].serviceNs / 1000);
+    }
+    last = cur[i];
+  }
+}
+
 template <typename T> int ThreadPool<T>::getBusyNumber() {
   int busyNum = 0;
   pthread_mutex_lock(&m_lock);
@@ -90,13 +242,18 @@ template <typename T> int ThreadPool<T>::getBusyNumber() {
 // 工作线程任务函数
 template <typename T> void *ThreadPool<T>::worker(void *arg) {
   ThreadPool *pool = static_cast<ThreadPool *>(arg);
+  // 线程初始化（绑定CPU等），之后本线程分配的内存都在绑定的节点上
+  if (pool->m_init != nullptr) {
+    pool->m_init(pool->m_startedNum++);
+  }
   // 一直不停的工作
   while (true) {
     // 访问任务队列(共享资源)加锁
     pthread_mutex_lock(&pool->m_lock);
-    // 判断任务队列是否为空, 如果为空工作线程阻塞
-    while (pool->m_taskQ->taskNumber() == 0 && !pool->m_shutdown) {
-      cout << "thread " << to_string(pthread_self()) << " waiting..." << endl;
+    // 没有可执行的任务（队列为空，或排队的通道都被保留线程挡住）时工作线程阻塞
+    int lane;
+    while ((lane = pool->pickLane()) == -1 && !pool->m_shutdown) {
+      LOG_DEBUG("thread {} waiting...", pthread_self());
       // 阻塞线程
       pthread_cond_wait(&pool->m_notEmpty, &pool->m_lock);
 
@@ -116,23 +273,45 @@ template <typename T> void *ThreadPool<T>::worker(void *arg) {
       pool->threadExit();
     }
 
-    // 从任务队列中取出一个任务
-    Task<T> task = pool->m_taskQ->takeTask();
+    // 从选中的通道取出一个任务
+    Task<T> task = pool->m_taskQ->takeTask(lane);
+    uint64_t start = now();
+    pool->m_laneStats[lane].queued--;
+    pool->m_laneStats[lane].running++;
+    pool->recordWait(lane, start - task.enqueueTime);
+    // 排队已经超过截止时间，客户端多半已经放弃，不再执行，只调用丢弃函数
+    bool expired = task.deadline != 0 && start > task.deadline;
+    callback function = task.function;
+    if (expired) {
+      pool->m_laneStats[lane].shedExpired++;
+      function = pool->m_shed;
+    }
     // 工作的线程+1
     pool->m_busyNum++;
     // 线程池解锁
     pthread_mutex_unlock(&pool->m_lock);
     // 执行任务
-    cout << "thread " << to_string(pthread_self()) << " start working..."
-         << endl;
-    task.function(task.arg);
+    LOG_DEBUG("thread {} start working...", pthread_self());
+    if (function != nullptr) {
+      function(task.arg);
+    }
     delete task.arg;
     task.arg = nullptr;
+    uint64_t cost = now() - start;
 
     // 任务处理结束
-    cout << "thread " << to_string(pthread_self()) << " end working..." << endl;
+    LOG_DEBUG("thread {} end working...", pthread_self());
     pthread_mutex_lock(&pool->m_lock);
     pool->m_busyNum--;
+    pool->m_laneStats[lane].running--;
+    if (!expired) {
+      uint64_t &service = pool->m_laneStats[lane].serviceNs;
+      service = service == 0 ? cost : (service * 7 + cost) / 8;
+    }
+    // 占用的线程少了，之前被保留线程挡住的任务可能可以执行了
+    if (pool->m_taskQ->taskNumber() > 0) {
+      pthread_cond_signal(&pool->m_notEmpty);
+    }
     pthread_mutex_unlock(&pool->m_lock);
   }
 
@@ -152,12 +331,20 @@ template <typename T> void *ThreadPool<T>::manager(void *arg) {
     int queueSize = pool->m_taskQ->taskNumber();
     int liveNum = pool->m_aliveNum;
     int busyNum = pool->m_busyNum;
+    // 有任务在排队却因保留线程拿不到线程的通道
+    bool starved = false;
+    for (size_t i = 0; i < pool->m_lanes.size(); i++) {
+      if (pool->m_laneStats[i].queued > 0 && !pool->laneRunnable(i)) {
+        starved = true;
+      }
+    }
     pthread_mutex_unlock(&pool->m_lock);
+    pool->reportLanes();
 
     // 创建线程
     const int NUMBER = 2;
-    // 当前任务个数>存活的线程数 && 存活的线程数<最大线程个数
-    if (queueSize > liveNum && liveNum < pool->m_maxNum) {
+    // (当前任务个数>存活的线程数 || 有通道拿不到线程) && 存活的线程数<最大线程个数
+    if ((queueSize > liveNum || starved) && liveNum < pool->m_maxNum) {
       // 线程池加锁
       pthread_mutex_lock(&pool->m_lock);
       int num = 0;
@@ -193,8 +380,7 @@ template <typename T> void ThreadPool<T>::threadExit() {
   pthread_t tid = pthread_self();
   for (int i = 0; i < m_maxNum; ++i) {
     if (m_threadIDs[i] == tid) {
-      cout << "threadExit() function: thread " << to_string(pthread_self())
-           << " exiting..." << endl;
+      LOG_INFO("threadExit() function: thread {} exiting...", pthread_self());
       m_threadIDs[i] = 0;
       break;
     }
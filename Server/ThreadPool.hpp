@@ -3,18 +3,29 @@
 
 #include "TaskQueue.cc"
 #include "TaskQueue.hpp"
+#include <atomic>
+#include <vector>
+
+// 线程初始化函数，参数为线程的创建序号（如用于绑定CPU）
+using threadInit = void (*)(int);
 
 template <typename T> class ThreadPool {
 public:
-  ThreadPool(int min, int max);
+  // lanes为调度通道配置，为空时只有一个不保留线程的默认通道
+  ThreadPool(int min, int max, threadInit init = nullptr,
+             const std::vector<LaneConfig> &lanes = {});
   ~ThreadPool();
 
-  // 添加任务
+  // 添加任务，按task.lane放入对应的通道
   void addTask(Task<T> task);
   // 获取忙线程的个数
   int getBusyNumber();
   // 获取活着的线程个数
   int getAliveNumber();
+  // 获取一个通道的统计
+  LaneStats getLaneStats(int lane);
+  // 设置丢弃任务时调用的函数（代替任务函数执行一次，如快速回复客户端），之后照常释放参数
+  void setShedHandler(callback shed);
 
 private:
   // 工作的线程的任务函数
@@ -22,6 +33,17 @@ private:
   // 管理者线程的任务函数
   static void *manager(void *arg);
   void threadExit();
+  // 通道是否还能再占用一个工作线程（持有m_lock时调用）
+  bool laneRunnable(int lane);
+  // 按保留线程数和权重选出下一个要执行的通道，没有可执行的返回-1（持有m_lock时调用）
+  int pickLane();
+  // 记录一个任务的排队时间（持有m_lock时调用）
+  void recordWait(int lane, uint64_t waitNs);
+  // 按通道的平均执行时间估算新任务的排队时间（持有m_lock时调用）
+  uint64_t projectedWait(int lane);
+  // 把各通道本周期的排队统计写进日志
+  void reportLanes();
+  static uint64_t now();
 
 private:
   pthread_mutex_t m_lock;
@@ -35,6 +57,13 @@ private:
   int m_aliveNum;
   int m_exitNum;
   bool m_shutdown = false;
+  threadInit m_init;                // 每个工作线程开始工作前调用
+  std::atomic<int> m_startedNum{0}; // 已创建过的工作线程数，作为线程序号
+  std::vector<LaneConfig> m_lanes;    // 调度通道配置
+  std::vector<LaneStats> m_laneStats; // 每个通道的统计
+  std::vector<LaneStats> m_lastStats; // 上次输出统计时的快照
+  std::vector<int> m_laneCredit;      // 平滑加权轮询的当前值
+  callback m_shed = nullptr;          // 丢弃任务时调用的函数
 };
 
 #endif
\ No newline at end of file
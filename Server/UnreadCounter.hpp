@@ -0,0 +1,293 @@
+#ifndef UNREAD_COUNTER_HPP
+#define UNREAD_COUNTER_HPP
+
+#include "Log.hpp"
+#include "redis.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define UNREAD_SHARDS 16          // 增量表的分片数
+#define UNREAD_FLUSH_MS 50        // 定时刷写的间隔
+#define UNREAD_FLUSH_ENTRIES 1024 // 积攒的不同计数器达到该数量时提前刷写
+
+using namespace std;
+
+// 未读计数服务："uid的未读消息"哈希表里的各项计数（来自X的未读消息、系统消息、通知消息）
+// 先在进程内按uid分片累积，由后台线程定时合并成HINCRBY/HSET，用一个事务批量写回redis。
+// 所有对未读计数的修改都要经过这里，读的时候把还没写回的增量合并进redis里的值
+class UnreadCounter {
+public:
+  // 一个计数器未写回的变化：reset为true表示先清零再加delta
+  struct Delta {
+    bool reset = false;
+    long long delta = 0;
+  };
+  // 某个用户未写回的变化的快照，gen用来判断读redis期间是否发生了刷写
+  struct Snapshot {
+    uint64_t gen;
+    unordered_map<string, Delta> fields;
+  };
+
+  UnreadCounter() = default;
+  ~UnreadCounter();
+  // 启动后台刷写线程，写回时从pool借连接
+  void start(RedisPool *pool);
+  // uid的field计数加delta
+  void add(const string &uid, const string &field, long long delta = 1);
+  // uid的field计数清零，之前没写回的增量作废
+  void reset(const string &uid, const string &field);
+  // uid的field有没有还没写回的变化
+  bool hasPending(const string &uid, const string &field);
+
+  // 读计数：先取快照，再读redis里的"uid的未读消息"，用merge合并；
+  // stable返回false说明读redis期间发生了刷写，结果可能重复或遗漏，应重读
+  Snapshot snapshot(const string &uid);
+  bool stable(const Snapshot &snap) const;
+  static vector<pair<string, long long>> merge(const redisReply *hgetall,
+                                               const Snapshot &snap);
+  static vector<pair<string, long long>> merge(const RedisReply &hgetall,
+                                               const Snapshot &snap) {
+    return merge(hgetall.get(), snap);
+  }
+  // 每次add或reset之后用uid调用hook，未读概要据此重算
+  void setHook(function<void(const string &uid)> hook) { m_hook = hook; }
+
+  // 立即把所有增量写回redis
+  void flush();
+
+private:
+  using Fields = unordered_map<string, Delta>; // field -> 变化
+  using UidMap = unordered_map<string, Fields>; // uid -> 该用户的计数器
+  struct Shard {
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    UidMap pending;
+  };
+
+  Shard &shardOf(const string &uid);
+  static void combine(Delta &older, const Delta &newer);
+  static void *flusher(void *arg);
+
+  Shard m_shards[UNREAD_SHARDS];
+  RedisPool *m_pool = nullptr;
+  pthread_t m_thread;
+  atomic<bool> m_running{false};
+  pthread_mutex_t m_flushLock = PTHREAD_MUTEX_INITIALIZER; // 同一时间只有一个刷写
+  pthread_mutex_t m_wakeLock = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t m_wake = PTHREAD_COND_INITIALIZER;
+  atomic<int> m_entries{0};  // 上次刷写后新出现的计数器数
+  atomic<uint64_t> m_gen{0}; // 刷写代数，奇数表示正在刷写
+  function<void(const string &uid)> m_hook;
+  // 统计：累计的修改次数和写回redis的命令数
+  atomic<uint64_t> m_updates{0};
+  atomic<uint64_t> m_commands{0};
+};
+
+UnreadCounter::~UnreadCounter() {
+  if (m_running) {
+    // 在m_wakeLock下改状态，刷写线程不会在检查之后、等待之前错过唤醒
+    pthread_mutex_lock(&m_wakeLock);
+    m_running = false;
+    pthread_cond_signal(&m_wake);
+    pthread_mutex_unlock(&m_wakeLock);
+    pthread_join(m_thread, NULL);
+    flush();
+  }
+}
+
+void UnreadCounter::start(RedisPool *pool) {
+  m_pool = pool;
+  m_running = true;
+  pthread_create(&m_thread, NULL, flusher, this);
+}
+
+UnreadCounter::Shard &UnreadCounter::shardOf(const string &uid) {
+  return m_shards[hash<string>()(uid) % UNREAD_SHARDS];
+}
+
+// 把较新的变化叠加到较旧的上
+void UnreadCounter::combine(Delta &older, const Delta &newer) {
+  if (newer.reset) {
+    older = newer;
+  } else {
+    older.delta += newer.delta;
+  }
+}
+
+void UnreadCounter::add(const string &uid, const string &field,
+                        long long delta) {
+  Shard &shard = shardOf(uid);
+  pthread_mutex_lock(&shard.lock);
+  Fields &fields = shard.pending[uid];
+  bool fresh = fields.find(field) == fields.end();
+  fields[field].delta += delta;
+  pthread_mutex_unlock(&shard.lock);
+  m_updates++;
+  if (m_hook) {
+    m_hook(uid);
+  }
+  if (fresh && ++m_entries == UNREAD_FLUSH_ENTRIES) {
+    pthread_cond_signal(&m_wake);
+  }
+}
+
+void UnreadCounter::reset(const string &uid, const string &field) {
+  Shard &shard = shardOf(uid);
+  pthread_mutex_lock(&shard.lock);
+  Fields &fields = shard.pending[uid];
+  bool fresh = fields.find(field) == fields.end();
+  fields[field] = Delta{true, 0};
+  pthread_mutex_unlock(&shard.lock);
+  m_updates++;
+  if (m_hook) {
+    m_hook(uid);
+  }
+  if (fresh && ++m_entries == UNREAD_FLUSH_ENTRIES) {
+    pthread_cond_signal(&m_wake);
+  }
+}
+
+bool UnreadCounter::hasPending(const string &uid, const string &field) {
+  Shard &shard = shardOf(uid);
+  pthread_mutex_lock(&shard.lock);
+  auto it = shard.pending.find(uid);
+  bool ret = it != shard.pending.end() && it->second.count(field) != 0;
+  pthread_mutex_unlock(&shard.lock);
+  return ret;
+}
+
+UnreadCounter::Snapshot UnreadCounter::snapshot(const string &uid) {
+  Snapshot snap;
+  snap.gen = m_gen.load();
+  Shard &shard = shardOf(uid);
+  pthread_mutex_lock(&shard.lock);
+  auto it = shard.pending.find(uid);
+  if (it != shard.pending.end()) {
+    snap.fields = it->second;
+  }
+  pthread_mutex_unlock(&shard.lock);
+  return snap;
+}
+
+// 取快照时没有在刷写，到现在也没开始新的刷写：redis里正好是快照之外的全部已写回的值
+bool UnreadCounter::stable(const Snapshot &snap) const {
+  return snap.gen % 2 == 0 && m_gen.load() == snap.gen;
+}
+
+vector<pair<string, long long>>
+UnreadCounter::merge(const redisReply *hgetall, const Snapshot &snap) {
+  vector<pair<string, long long>> counts;
+  Fields rest = snap.fields;
+  size_t size = hgetall != nullptr && hgetall->type == REDIS_REPLY_ARRAY
+                    ? hgetall->elements
+                    : 0;
+  for (size_t i = 0; i + 1 < size; i += 2) {
+    string field = hgetall->element[i]->str;
+    long long n = strtoll(hgetall->element[i + 1]->str, NULL, 10);
+    auto it = rest.find(field);
+    if (it != rest.end()) {
+      n = it->second.reset ? it->second.delta : n + it->second.delta;
+      rest.erase(it);
+    }
+    counts.push_back({field, n});
+  }
+  // 还没写回过redis的计数器排在后面
+  for (auto &[field, d] : rest) {
+    counts.push_back({field, d.delta});
+  }
+  return counts;
+}
+
+void UnreadCounter::flush() {
+  pthread_mutex_lock(&m_flushLock);
+  UidMap batch[UNREAD_SHARDS];
+  m_gen++; // 进入刷写
+  m_entries = 0;
+  size_t total = 0;
+  for (int i = 0; i < UNREAD_SHARDS; i++) {
+    pthread_mutex_lock(&m_shards[i].lock);
+    batch[i].swap(m_shards[i].pending);
+    pthread_mutex_unlock(&m_shards[i].lock);
+    total += batch[i].size();
+  }
+  if (total == 0) {
+    m_gen++;
+    pthread_mutex_unlock(&m_flushLock);
+    return;
+  }
+  // 每个计数器合并成一条命令，放在一个事务里，要么全部写回要么都没写回
+  Redis *conn = m_pool->acquire();
+  RedisBatch tx(conn, true);
+  for (int i = 0; i < UNREAD_SHARDS; i++) {
+    for (auto &[uid, fields] : batch[i]) {
+      for (auto &[field, d] : fields) {
+        if (d.reset) {
+          tx.add({"HSET", uid + "的未读消息", field, to_string(d.delta)});
+        } else if (d.delta != 0) {
+          tx.add({"HINCRBY", uid + "的未读消息", field, to_string(d.delta)});
+        }
+      }
+    }
+  }
+  bool ok = tx.exec();
+  m_pool->release(conn);
+  if (ok) {
+    m_commands += tx.size();
+    LOG_DEBUG("未读计数写回{}条命令", tx.size());
+  } else {
+    // 写回失败，把这批变化放回去，排在之后的变化前面，下次再写
+    LOG_WARN("未读计数写回失败，{}条命令等待重试", tx.size());
+    for (int i = 0; i < UNREAD_SHARDS; i++) {
+      pthread_mutex_lock(&m_shards[i].lock);
+      for (auto &[uid, fields] : m_shards[i].pending) {
+        for (auto &[field, d] : fields) {
+          combine(batch[i][uid][field], d);
+        }
+      }
+      batch[i].swap(m_shards[i].pending);
+      pthread_mutex_unlock(&m_shards[i].lock);
+    }
+  }
+  m_gen++; // 刷写结束
+  pthread_mutex_unlock(&m_flushLock);
+}
+
+void *UnreadCounter::flusher(void *arg) {
+  UnreadCounter *self = static_cast<UnreadCounter *>(arg);
+  uint64_t lastUpdates = 0, lastCommands = 0;
+  time_t lastReport = time(NULL);
+  while (self->m_running) {
+    // 等到下一个刷写时间，或积攒的计数器太多被提前唤醒
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += UNREAD_FLUSH_MS * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    pthread_mutex_lock(&self->m_wakeLock);
+    if (self->m_running && self->m_entries < UNREAD_FLUSH_ENTRIES) {
+      pthread_cond_timedwait(&self->m_wake, &self->m_wakeLock, &deadline);
+    }
+    pthread_mutex_unlock(&self->m_wakeLock);
+    self->flush();
+    // 每分钟报告一次合并效果
+    if (time(NULL) - lastReport >= 60) {
+      uint64_t updates = self->m_updates - lastUpdates;
+      uint64_t commands = self->m_commands - lastCommands;
+      if (updates > 0) {
+        LOG_INFO("未读计数: {}次修改合并为{}条redis命令", updates, commands);
+      }
+      lastUpdates += updates;
+      lastCommands += commands;
+      lastReport = time(NULL);
+    }
+  }
+  return NULL;
+}
+
+#endif
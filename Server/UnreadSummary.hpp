@@ -0,0 +1,321 @@
+#ifndef UNREAD_SUMMARY_HPP
+#define UNREAD_SUMMARY_HPP
+
+#include "FanOut.hpp"
+#include "Log.hpp"
+#include "UnreadCounter.hpp"
+#include "UserCache.hpp"
+#include "redis.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <pthread.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unistd.h>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#define UNREAD_FRAME "@unread" // 未读概要推送帧的前缀
+#define UNREAD_RETRY_MS 100    // 读redis失败后隔多久重算
+
+using namespace std;
+
+// 在线用户的未读概要（NEWMESSAGE展示的那些"名目：数量"）的物化视图。
+// 通知套接字登记后算出完整的概要整帧推一次，之后各处改了未读计数、已读位置、
+// 群的消息序号或群聊列表就mark受影响的用户，后台线程一轮把攒下的用户一起重算：
+// 一个pipeline读回各人的计数、群聊列表和已读位置，再一个pipeline读回涉及的群的消息序号
+// （同一个群的序号只读一次）。和上一次的概要比较，只把变了的名目推给客户端：
+// "@unread 系统消息=1 来自1234的未读消息=3 -来自201的未读消息"，前缀-表示这个名目没有了。
+// 客户端据此维护本地的概要，不再在每次展示菜单前发NEWMESSAGE
+class UnreadSummary {
+public:
+  using Counts = vector<pair<string, long long>>;
+
+  ~UnreadSummary();
+  // 启动重算线程：从pool借连接，未写回的计数从counter合并，通知套接字从cache查
+  void start(RedisPool *pool, UnreadCounter *counter, UserCache *cache,
+             FanOut *fanOut);
+  // uid的通知套接字登记了，开始为他维护概要；下线时detach
+  void attach(const string &uid);
+  void detach(const string &uid);
+  // uid的未读可能变了，不在线的用户忽略
+  void mark(const string &uid);
+  // uid的概要已经算好、而且之后没有再被mark过时取出
+  bool lookup(const string &uid, Counts &counts);
+
+  // 未读计数加上群聊的未读数，和原来NEWMESSAGE的规则一致：
+  // 群聊的未读数是群的消息序号减去已读位置，没有已读位置时按0算，读过的群为0时也列出；
+  // 旧版本留下的该群计数字段加到一起。heads[i]是groups第i个群的消息序号
+  static Counts compose(Counts counts, const redisReply *groups,
+                        const redisReply *cursors,
+                        const vector<long long> &heads);
+
+private:
+  struct Entry {
+    Counts counts;
+    bool ready = false; // 完整的概要推过一次了
+    uint64_t marks = 0; // 被mark的次数
+    uint64_t done = 0;  // counts是第几次mark之后重算的
+  };
+
+  // uids里的每一项是用户和取出时他被mark的次数
+  void refresh(const vector<pair<string, uint64_t>> &uids);
+  // 这次没算成的用户放回m_dirty，已经下线的不管
+  void requeue(const vector<string> &uids);
+  // 从before到after的变化，没有变化时返回空串
+  static string diff(const Counts &before, const Counts &after);
+  static void *worker(void *arg);
+
+  RedisPool *m_pool = nullptr;
+  UnreadCounter *m_counter = nullptr;
+  UserCache *m_cache = nullptr;
+  FanOut *m_fanOut = nullptr;
+  pthread_t m_thread;
+  bool m_running = false;
+  pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER; // 保护下面两项
+  pthread_cond_t m_wake = PTHREAD_COND_INITIALIZER;
+  unordered_map<string, Entry> m_users; // 在线用户 -> 概要
+  unordered_set<string> m_dirty;        // 等待重算的在线用户
+};
+
+UnreadSummary::~UnreadSummary() {
+  if (m_running) {
+    pthread_mutex_lock(&m_lock);
+    m_running = false;
+    pthread_cond_signal(&m_wake);
+    pthread_mutex_unlock(&m_lock);
+    pthread_join(m_thread, NULL);
+  }
+}
+
+void UnreadSummary::start(RedisPool *pool, UnreadCounter *counter,
+                          UserCache *cache, FanOut *fanOut) {
+  m_pool = pool;
+  m_counter = counter;
+  m_cache = cache;
+  m_fanOut = fanOut;
+  m_running = true;
+  pthread_create(&m_thread, NULL, worker, this);
+}
+
+void UnreadSummary::attach(const string &uid) {
+  pthread_mutex_lock(&m_lock);
+  m_users[uid] = Entry();
+  m_users[uid].marks = 1;
+  m_dirty.insert(uid);
+  pthread_cond_signal(&m_wake);
+  pthread_mutex_unlock(&m_lock);
+}
+
+void UnreadSummary::detach(const string &uid) {
+  pthread_mutex_lock(&m_lock);
+  m_users.erase(uid);
+  m_dirty.erase(uid);
+  pthread_mutex_unlock(&m_lock);
+}
+
+void UnreadSummary::mark(const string &uid) {
+  pthread_mutex_lock(&m_lock);
+  auto it = m_users.find(uid);
+  if (it != m_users.end()) {
+    it->second.marks++;
+    m_dirty.insert(uid);
+    pthread_cond_signal(&m_wake);
+  }
+  pthread_mutex_unlock(&m_lock);
+}
+
+bool UnreadSummary::lookup(const string &uid, Counts &counts) {
+  pthread_mutex_lock(&m_lock);
+  auto it = m_users.find(uid);
+  // 重算还没赶上最近的改动时不用，让调用者自己读
+  bool ready = it != m_users.end() && it->second.ready &&
+               it->second.done == it->second.marks;
+  if (ready) {
+    counts = it->second.counts;
+  }
+  pthread_mutex_unlock(&m_lock);
+  return ready;
+}
+
+UnreadSummary::Counts UnreadSummary::compose(Counts counts,
+                                             const redisReply *groups,
+                                             const redisReply *cursors,
+                                             const vector<long long> &heads) {
+  unordered_map<string_view, long long> cursor;
+  for (size_t i = 0; cursors != nullptr && i + 1 < cursors->elements; i += 2) {
+    cursor[RedisReply::viewOf(cursors->element[i])] =
+        atoll(cursors->element[i + 1]->str);
+  }
+  for (size_t i = 0; groups != nullptr && i < groups->elements; i++) {
+    string_view gid = RedisReply::viewOf(groups->element[i]);
+    auto it = cursor.find(gid);
+    bool read = it != cursor.end();
+    long long n = heads[i] - (read ? it->second : 0);
+    if (n <= 0 && !read) {
+      continue;
+    }
+    n = max(n, 0LL);
+    // 旧版本留下的计数字段还在的话加到一起，不重复展示
+    string field = "来自" + string(gid) + "的未读消息";
+    auto old = find_if(counts.begin(), counts.end(),
+                       [&](auto &c) { return c.first == field; });
+    if (old != counts.end()) {
+      old->second += n;
+    } else {
+      counts.push_back({field, n});
+    }
+  }
+  return counts;
+}
+
+string UnreadSummary::diff(const Counts &before, const Counts &after) {
+  string frame;
+  unordered_map<string_view, long long> old;
+  for (const auto &[field, n] : before) {
+    old[field] = n;
+  }
+  for (const auto &[field, n] : after) {
+    auto it = old.find(field);
+    if (it == old.end() || it->second != n) {
+      frame += " " + field + "=" + to_string(n);
+    }
+    if (it != old.end()) {
+      old.erase(it);
+    }
+  }
+  for (const auto &kv : old) {
+    frame += " -" + string(kv.first);
+  }
+  return frame;
+}
+
+void UnreadSummary::refresh(const vector<pair<string, uint64_t>> &uids) {
+  RedisGuard guard(*m_pool);
+  // 先取未写回计数的快照，再读redis，和NEWMESSAGE的读法一样
+  vector<UnreadCounter::Snapshot> snaps;
+  RedisBatch mine(redis);
+  for (const auto &[uid, marks] : uids) {
+    snaps.push_back(m_counter->snapshot(uid));
+    mine.add({"HGETALL", uid + "的未读消息"});
+    mine.add({"HKEYS", uid + "的群聊列表"});
+    mine.add({"HGETALL", uid + "的群聊已读"});
+  }
+  // 读redis失败时worker已经清掉了m_dirty，放回去稍后重算，否则概要一直停在旧值
+  auto fail = [&]() {
+    vector<string> all;
+    for (const auto &uid : uids) {
+      all.push_back(uid.first);
+    }
+    requeue(all);
+    usleep(UNREAD_RETRY_MS * 1000);
+  };
+  if (!mine.exec()) {
+    fail();
+    return;
+  }
+  // 涉及的群的消息序号，每个群只读一次
+  unordered_map<string, long long> heads;
+  vector<string> gids;
+  for (size_t k = 0; k < uids.size(); k++) {
+    redisReply *groups = mine.reply(3 * k + 1);
+    for (size_t i = 0; groups != nullptr && i < groups->elements; i++) {
+      string gid(RedisReply::viewOf(groups->element[i]));
+      if (heads.emplace(gid, 0).second) {
+        gids.push_back(gid);
+      }
+    }
+  }
+  RedisBatch seq(redis);
+  for (const string &gid : gids) {
+    seq.add({"GET", gid + "的消息序号"});
+  }
+  if (!gids.empty() && !seq.exec()) {
+    fail();
+    return;
+  }
+  for (size_t i = 0; i < gids.size(); i++) {
+    heads[gids[i]] = atoll(seq.str(i).c_str());
+  }
+  vector<pair<string, string>> frames; // uid -> 帧
+  vector<string> retry;
+  for (size_t k = 0; k < uids.size(); k++) {
+    // 读redis期间发生了刷写，计数可能重复或遗漏，下一轮重算
+    if (!m_counter->stable(snaps[k])) {
+      retry.push_back(uids[k].first);
+      continue;
+    }
+    redisReply *groups = mine.reply(3 * k + 1);
+    vector<long long> head;
+    for (size_t i = 0; groups != nullptr && i < groups->elements; i++) {
+      head.push_back(heads[string(RedisReply::viewOf(groups->element[i]))]);
+    }
+    Counts counts =
+        compose(UnreadCounter::merge(mine.reply(3 * k), snaps[k]), groups,
+                mine.reply(3 * k + 2), head);
+    pthread_mutex_lock(&m_lock);
+    auto it = m_users.find(uids[k].first);
+    if (it != m_users.end()) {
+      string delta = diff(it->second.counts, counts);
+      // 第一次总要推一帧，没有任何名目时客户端也知道概要到了
+      if (!delta.empty() || !it->second.ready) {
+        frames.push_back({uids[k].first, UNREAD_FRAME + delta});
+      }
+      it->second.counts = std::move(counts);
+      it->second.ready = true;
+      it->second.done = uids[k].second;
+    }
+    pthread_mutex_unlock(&m_lock);
+  }
+  if (!retry.empty()) {
+    requeue(retry);
+    usleep(1000); // 等这次刷写结束
+  }
+  vector<FanOut::Push> pushes;
+  for (auto &[uid, frame] : frames) {
+    string fd = m_cache->get(uid, UF_NOTIFY_FD);
+    if (!fd.empty() && fd != "-1") {
+      pushes.push_back({stoi(fd), std::move(frame)});
+    }
+  }
+  m_fanOut->pushAll(pushes);
+}
+
+void UnreadSummary::requeue(const vector<string> &uids) {
+  pthread_mutex_lock(&m_lock);
+  for (const string &uid : uids) {
+    if (m_users.count(uid) != 0) {
+      m_dirty.insert(uid);
+    }
+  }
+  pthread_mutex_unlock(&m_lock);
+}
+
+void *UnreadSummary::worker(void *arg) {
+  UnreadSummary *self = static_cast<UnreadSummary *>(arg);
+  while (true) {
+    pthread_mutex_lock(&self->m_lock);
+    while (self->m_running && self->m_dirty.empty()) {
+      pthread_cond_wait(&self->m_wake, &self->m_lock);
+    }
+    vector<pair<string, uint64_t>> uids;
+    for (const string &uid : self->m_dirty) {
+      auto it = self->m_users.find(uid);
+      if (it != self->m_users.end()) {
+        uids.push_back({uid, it->second.marks});
+      }
+    }
+    self->m_dirty.clear();
+    bool running = self->m_running;
+    pthread_mutex_unlock(&self->m_lock);
+    if (!running) {
+      break;
+    }
+    self->refresh(uids);
+  }
+  return NULL;
+}
+
+#endif
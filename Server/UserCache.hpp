@@ -0,0 +1,442 @@
+#ifndef USER_CACHE_HPP
+#define USER_CACHE_HPP
+
+#include "Log.hpp"
+#include "Session.hpp"
+#include "redis.hpp"
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <functional>
+#include <hiredis/hiredis.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#define USER_CACHE_SHARDS 16       // 缓存的分片数
+#define USER_CACHE_CAPACITY 65536  // 最多缓存的用户数
+#define USER_CACHE_REPORT_SEC 60   // 命中率报告的间隔
+#define USER_CACHE_RETRY_SEC 1     // 订阅连接断开后的重连间隔
+
+// 缓存的用户字段
+#define UF_NICKNAME 0    // 昵称
+#define UF_CHAT_TARGET 1 // 聊天对象
+#define UF_NOTIFY_FD 2   // 通知套接字
+#define UF_ONLINE 3      // 在线状态：会话表里的交互套接字，不在线为"-1"
+#define UF_COUNT 4
+
+// 阻塞连接的标志位，订阅连接收完订阅确认后清掉它，读回复时不再阻塞
+#ifndef REDIS_BLOCK
+#define REDIS_BLOCK 0x1
+#endif
+
+using namespace std;
+
+// 热点用户字段的进程内缓存：按uid缓存昵称、聊天对象、通知套接字和在线状态，
+// 不命中时一次读回整条记录。容量有限，按CLOCK算法淘汰。
+// 失效靠redis的键事件通知：后台线程订阅hash和通用事件，某个uid的哈希表被改动就把它踢出缓存；
+// 在线状态和用户哈希表总是在同一次登录/退出里一起改，所以也由这个事件失效。
+// 本进程里的写操作写完后再调用invalidate，保证自己写的马上能读到
+class UserCache {
+public:
+  using Profile = array<string, UF_COUNT>;
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;     // 容量满被淘汰的记录数
+    uint64_t invalidations = 0; // 因键事件或本地写被踢出的记录数
+    uint64_t staleFills = 0;    // 读redis期间被改动、没有放进缓存的记录数
+  };
+
+  UserCache();
+  ~UserCache();
+  // 打开redis的键事件通知并启动订阅线程；订阅没有建立时缓存不生效，读都直接走redis
+  void start(string addr = "127.0.0.1", int port = 6379);
+  // 数据在进程内存储里时用它代替start：不订阅，由存储的写回调调用keyChanged失效
+  void startLocal();
+
+  // 读uid的一个字段，不命中时用当前线程的redis连接读回整条记录
+  string get(const string &uid, int field);
+
+  // 协程里用异步连接读：先lookup，不命中时记下version，
+  // co_await asyncBatch(fetch(uid))，再fill(uid, parse(...), version)
+  bool lookup(const string &uid, int field, string &value);
+  uint64_t version(const string &uid);
+  static vector<vector<string>> fetch(const string &uid);
+  static Profile parse(const RedisReply &fields, const RedisReply &online);
+  void fill(const string &uid, const Profile &profile, uint64_t ver);
+
+  void invalidate(const string &uid);
+  // 某个键被改动，是用户哈希表时踢出对应的uid
+  void keyChanged(string_view key);
+  void clear();
+  // 别的进程内索引借用这里的键事件失效：每个被改动的键都转给hook，
+  // 订阅断开等可能漏掉事件时转一个空键，表示什么都可能变了
+  void setKeyHook(function<void(string_view key)> hook) { m_keyHook = hook; }
+  Stats stats();
+
+private:
+  struct Slot {
+    string uid;
+    Profile profile;
+    bool used = false;
+    bool ref = false; // CLOCK的访问位
+  };
+  struct Shard {
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    unordered_map<string, int> index; // uid -> 槽号
+    vector<Slot> slots;
+    size_t hand = 0;
+    uint64_t gen = 0; // 每次有uid被踢出就加一，读redis前后对比判断是否过期
+  };
+
+  Shard &shardOf(const string &uid);
+  bool subscribe(); // 订阅线程调用，成功后缓存生效
+  void report(uint64_t &lastHits, uint64_t &lastMisses);
+  static bool isUid(const char *key, size_t len);
+  static void *subscriber(void *arg);
+
+  Shard m_shards[USER_CACHE_SHARDS];
+  string m_addr;
+  int m_port = 6379;
+  redisContext *m_sub = nullptr;
+  pthread_t m_thread;
+  atomic<bool> m_running{false};
+  atomic<bool> m_live{false}; // 订阅正常时为true
+  bool m_local = false;       // 进程内存储，不需要订阅
+  function<void(string_view key)> m_keyHook;
+  atomic<uint64_t> m_hits{0};
+  atomic<uint64_t> m_misses{0};
+  atomic<uint64_t> m_evictions{0};
+  atomic<uint64_t> m_invalidations{0};
+  atomic<uint64_t> m_staleFills{0};
+};
+
+UserCache::UserCache() {
+  for (Shard &shard : m_shards) {
+    shard.slots.resize(USER_CACHE_CAPACITY / USER_CACHE_SHARDS);
+  }
+}
+
+UserCache::~UserCache() {
+  if (m_running) {
+    m_running = false;
+    pthread_join(m_thread, NULL);
+  }
+  if (m_sub != nullptr) {
+    redisFree(m_sub);
+  }
+}
+
+void UserCache::start(string addr, int port) {
+  m_addr = addr;
+  m_port = port;
+  m_running = true;
+  pthread_create(&m_thread, NULL, subscriber, this);
+}
+
+void UserCache::startLocal() {
+  m_local = true;
+  m_live = true;
+  m_running = true;
+  pthread_create(&m_thread, NULL, subscriber, this);
+}
+
+UserCache::Shard &UserCache::shardOf(const string &uid) {
+  return m_shards[hash<string>()(uid) % USER_CACHE_SHARDS];
+}
+
+bool UserCache::lookup(const string &uid, int field, string &value) {
+  if (m_live) {
+    Shard &shard = shardOf(uid);
+    pthread_mutex_lock(&shard.lock);
+    auto it = shard.index.find(uid);
+    if (it != shard.index.end()) {
+      Slot &slot = shard.slots[it->second];
+      slot.ref = true;
+      value = slot.profile[field];
+      pthread_mutex_unlock(&shard.lock);
+      m_hits++;
+      return true;
+    }
+    pthread_mutex_unlock(&shard.lock);
+  }
+  m_misses++;
+  return false;
+}
+
+uint64_t UserCache::version(const string &uid) {
+  Shard &shard = shardOf(uid);
+  pthread_mutex_lock(&shard.lock);
+  uint64_t gen = shard.gen;
+  pthread_mutex_unlock(&shard.lock);
+  return gen;
+}
+
+vector<vector<string>> UserCache::fetch(const string &uid) {
+  return {{"HMGET", uid, "昵称", "聊天对象", "通知套接字"},
+          {"HGET", Session::onlineKey(), uid}};
+}
+
+// 和原来gethash的习惯一致：字段不存在为空串，不在线为"-1"
+UserCache::Profile UserCache::parse(const RedisReply &fields,
+                                    const RedisReply &online) {
+  Profile profile;
+  profile[UF_NICKNAME] = fields.view(0);
+  profile[UF_CHAT_TARGET] = fields.view(1);
+  profile[UF_NOTIFY_FD] = fields.view(2);
+  profile[UF_ONLINE] =
+      online.type() == REDIS_REPLY_STRING ? online.str() : "-1";
+  return profile;
+}
+
+void UserCache::fill(const string &uid, const Profile &profile, uint64_t ver) {
+  if (!m_live) {
+    return;
+  }
+  Shard &shard = shardOf(uid);
+  pthread_mutex_lock(&shard.lock);
+  if (shard.gen != ver) {
+    // 读redis期间这个分片有记录失效过，读回的值可能已经旧了
+    pthread_mutex_unlock(&shard.lock);
+    m_staleFills++;
+    return;
+  }
+  auto it = shard.index.find(uid);
+  if (it != shard.index.end()) {
+    shard.slots[it->second].profile = profile;
+    pthread_mutex_unlock(&shard.lock);
+    return;
+  }
+  // CLOCK：跳过最近访问过的槽（清掉访问位），淘汰第一个没访问过的
+  size_t n = shard.slots.size();
+  while (shard.slots[shard.hand].used && shard.slots[shard.hand].ref) {
+    shard.slots[shard.hand].ref = false;
+    shard.hand = (shard.hand + 1) % n;
+  }
+  Slot &slot = shard.slots[shard.hand];
+  if (slot.used) {
+    shard.index.erase(slot.uid);
+    m_evictions++;
+  }
+  slot.uid = uid;
+  slot.profile = profile;
+  slot.used = true;
+  slot.ref = false;
+  shard.index[uid] = shard.hand;
+  shard.hand = (shard.hand + 1) % n;
+  pthread_mutex_unlock(&shard.lock);
+}
+
+string UserCache::get(const string &uid, int field) {
+  string value;
+  if (lookup(uid, field, value)) {
+    return value;
+  }
+  uint64_t ver = version(uid);
+  RedisBatch read(redis);
+  for (const vector<string> &cmd : fetch(uid)) {
+    read.add(cmd);
+  }
+  if (!read.exec()) {
+    return field == UF_ONLINE ? "-1" : "";
+  }
+  Profile profile;
+  for (int i = 0; i < UF_ONLINE; i++) {
+    profile[i] = read.str(0, i);
+  }
+  profile[UF_ONLINE] = read.isNil(1) ? "-1" : read.str(1);
+  fill(uid, profile, ver);
+  return profile[field];
+}
+
+void UserCache::invalidate(const string &uid) {
+  Shard &shard = shardOf(uid);
+  pthread_mutex_lock(&shard.lock);
+  shard.gen++;
+  auto it = shard.index.find(uid);
+  if (it != shard.index.end()) {
+    Slot &slot = shard.slots[it->second];
+    slot.used = false;
+    slot.ref = false;
+    slot.uid.clear();
+    shard.index.erase(it);
+    m_invalidations++;
+  }
+  pthread_mutex_unlock(&shard.lock);
+}
+
+void UserCache::clear() {
+  for (Shard &shard : m_shards) {
+    pthread_mutex_lock(&shard.lock);
+    shard.gen++;
+    shard.index.clear();
+    for (Slot &slot : shard.slots) {
+      slot = Slot();
+    }
+    pthread_mutex_unlock(&shard.lock);
+  }
+  if (m_keyHook) {
+    m_keyHook(string_view());
+  }
+}
+
+UserCache::Stats UserCache::stats() {
+  Stats s;
+  s.hits = m_hits;
+  s.misses = m_misses;
+  s.evictions = m_evictions;
+  s.invalidations = m_invalidations;
+  s.staleFills = m_staleFills;
+  return s;
+}
+
+void UserCache::keyChanged(string_view key) {
+  if (isUid(key.data(), key.size())) {
+    invalidate(string(key));
+  } else if (m_keyHook) {
+    m_keyHook(key);
+  }
+}
+
+// 用户哈希表的键就是uid，全是数字；其它键（好友列表、消息队列等）不用管
+bool UserCache::isUid(const char *key, size_t len) {
+  if (len == 0) {
+    return false;
+  }
+  for (size_t i = 0; i < len; i++) {
+    if (!isdigit((unsigned char)key[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool UserCache::subscribe() {
+  struct timeval timeout = {1, 500000};
+  m_sub = redisConnectWithTimeout(m_addr.c_str(), m_port, timeout);
+  if (m_sub == nullptr || m_sub->err) {
+    LOG_ERROR("用户缓存订阅连接失败: {}",
+              m_sub == nullptr ? "内存不足" : m_sub->errstr);
+    if (m_sub != nullptr) {
+      redisFree(m_sub);
+      m_sub = nullptr;
+    }
+    return false;
+  }
+  // 在原有的通知配置上加上键事件(E)、hash命令(h)和DEL等通用命令(g)
+  redisReply *r = (redisReply *)redisCommand(
+      m_sub, "CONFIG GET notify-keyspace-events");
+  string flags;
+  if (r != nullptr && r->type == REDIS_REPLY_ARRAY && r->elements == 2) {
+    flags = r->element[1]->str;
+  }
+  freeReplyObject(r);
+  for (char c : string("Ehg")) {
+    // A是除键未命中外所有类别的简写，已经包含h和g
+    bool covered = c != 'E' && flags.find('A') != string::npos;
+    if (!covered && flags.find(c) == string::npos) {
+      flags += c;
+    }
+  }
+  r = (redisReply *)redisCommand(m_sub, "CONFIG SET notify-keyspace-events %s",
+                                 flags.c_str());
+  bool ok = r != nullptr && r->type == REDIS_REPLY_STATUS;
+  freeReplyObject(r);
+  if (!ok) {
+    LOG_ERROR("打开redis键事件通知失败，用户缓存不生效");
+    redisFree(m_sub);
+    m_sub = nullptr;
+    return false;
+  }
+  r = (redisReply *)redisCommand(
+      m_sub, "SUBSCRIBE __keyevent@0__:hset __keyevent@0__:hdel "
+             "__keyevent@0__:del __keyevent@0__:expired");
+  ok = r != nullptr && r->type == REDIS_REPLY_ARRAY;
+  freeReplyObject(r);
+  if (!ok) {
+    LOG_ERROR("订阅redis键事件失败: {}", m_sub->errstr);
+    redisFree(m_sub);
+    m_sub = nullptr;
+    return false;
+  }
+  // 之后只读不写，改成非阻塞，没有完整的回复时redisGetReply立刻返回
+  m_sub->flags &= ~REDIS_BLOCK;
+  fcntl(m_sub->fd, F_SETFL, fcntl(m_sub->fd, F_GETFL) | O_NONBLOCK);
+  // 订阅建立前可能漏掉了事件，清空后再生效
+  clear();
+  m_live = true;
+  LOG_INFO("用户缓存已订阅redis键事件");
+  return true;
+}
+
+void UserCache::report(uint64_t &lastHits, uint64_t &lastMisses) {
+  uint64_t hits = m_hits - lastHits;
+  uint64_t misses = m_misses - lastMisses;
+  if (hits + misses > 0) {
+    LOG_INFO("用户缓存: 命中{}次 未命中{}次 命中率{}% 淘汰{} 失效{}", hits,
+             misses, hits * 100 / (hits + misses), m_evictions.load(),
+             m_invalidations.load());
+  }
+  lastHits += hits;
+  lastMisses += misses;
+}
+
+void *UserCache::subscriber(void *arg) {
+  UserCache *self = static_cast<UserCache *>(arg);
+  uint64_t lastHits = 0, lastMisses = 0;
+  time_t lastReport = time(NULL);
+  while (self->m_running) {
+    if (self->m_local) {
+      // 进程内存储的改动由写回调同步失效，线程只负责报告
+      sleep(1);
+    } else {
+      if (self->m_sub == nullptr && !self->subscribe()) {
+        sleep(USER_CACHE_RETRY_SEC);
+        continue;
+      }
+      // 每秒醒一次，检查是否该退出、该报告
+      struct pollfd pfd = {self->m_sub->fd, POLLIN, 0};
+      int ret = poll(&pfd, 1, 1000);
+      bool broken = ret < 0 && errno != EINTR;
+      if (ret > 0 && redisBufferRead(self->m_sub) != REDIS_OK) {
+        broken = true;
+      }
+      void *reply = nullptr;
+      while (!broken && redisGetReply(self->m_sub, &reply) == REDIS_OK &&
+             reply != nullptr) {
+        // 事件消息为 ["message", 频道, 键名]
+        redisReply *r = static_cast<redisReply *>(reply);
+        if (r->type == REDIS_REPLY_ARRAY && r->elements == 3 &&
+            r->element[2]->type == REDIS_REPLY_STRING) {
+          self->keyChanged(
+              string_view(r->element[2]->str, r->element[2]->len));
+        }
+        freeReplyObject(reply);
+        reply = nullptr;
+      }
+      if (broken || self->m_sub->err) {
+        // 断开期间收不到失效事件，缓存作废，重连后重新开始
+        LOG_WARN("用户缓存订阅连接断开: {}", self->m_sub->errstr);
+        self->m_live = false;
+        self->clear();
+        redisFree(self->m_sub);
+        self->m_sub = nullptr;
+      }
+    }
+    if (time(NULL) - lastReport >= USER_CACHE_REPORT_SEC) {
+      self->report(lastHits, lastMisses);
+      lastReport = time(NULL);
+    }
+  }
+  return NULL;
+}
+
+#endif
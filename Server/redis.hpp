@@ -1,25 +1,164 @@
 #ifndef __REDIS_HANDLER_H__
 #define __REDIS_HANDLER_H__
 
+#include "Log.hpp"
+#include "Storage.hpp"
+#include <algorithm>
 #include <cstring>
 #include <hiredis/hiredis.h>
 #include <iostream>
+#include <pthread.h>
+#include <initializer_list>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#define REDIS_MAX_ARGC 8 // 参数不超过这个数的命令在栈上组装参数数组
 
 using namespace std;
 
+// redis回复的句柄：独占一个redisReply，析构时释放，只能移动不能拷贝。
+// view()和元素的view(i)直接指向回复内部的缓冲区，句柄销毁后不能再使用
+class RedisReply {
+public:
+  RedisReply(redisReply *r = nullptr) : m_reply(r) {}
+  ~RedisReply() {
+    if (m_reply != nullptr) {
+      freeReplyObject(m_reply);
+    }
+  }
+  RedisReply(RedisReply &&other) : m_reply(other.m_reply) {
+    other.m_reply = nullptr;
+  }
+  RedisReply &operator=(RedisReply &&other) {
+    if (this != &other) {
+      this->~RedisReply();
+      m_reply = other.m_reply;
+      other.m_reply = nullptr;
+    }
+    return *this;
+  }
+  RedisReply(const RedisReply &) = delete;
+  RedisReply &operator=(const RedisReply &) = delete;
+
+  explicit operator bool() const { return m_reply != nullptr; } // 命令是否执行成功
+  redisReply *get() const { return m_reply; }
+  // 交出回复的所有权
+  redisReply *release() {
+    redisReply *r = m_reply;
+    m_reply = nullptr;
+    return r;
+  }
+  int type() const { return m_reply == nullptr ? -1 : m_reply->type; }
+  bool isNil() const {
+    return m_reply == nullptr || m_reply->type == REDIS_REPLY_NIL;
+  }
+  bool isError() const {
+    return m_reply != nullptr && m_reply->type == REDIS_REPLY_ERROR;
+  }
+  long long integer() const {
+    return m_reply == nullptr ? 0 : m_reply->integer;
+  }
+  // 字符串回复（二进制安全），nil回复为空
+  string_view view() const { return viewOf(m_reply); }
+  string str() const { return string(view()); }
+
+  // 数组回复的元素个数和元素，非数组回复当作空数组
+  size_t size() const {
+    return m_reply == nullptr || m_reply->type != REDIS_REPLY_ARRAY
+               ? 0
+               : m_reply->elements;
+  }
+  const redisReply *operator[](size_t i) const { return m_reply->element[i]; }
+  string_view view(size_t i) const { return viewOf(m_reply->element[i]); }
+  redisReply *const *begin() const {
+    return size() == 0 ? nullptr : m_reply->element;
+  }
+  redisReply *const *end() const { return begin() + size(); }
+
+  static string_view viewOf(const redisReply *r) {
+    if (r == nullptr || r->str == nullptr) {
+      return string_view();
+    }
+    return string_view(r->str, r->len);
+  }
+
+private:
+  redisReply *m_reply;
+};
+
+class Redis;
+
+// 服务端脚本：redis-server上是Lua脚本，启动时用SCRIPT LOAD预加载，之后按SHA1用EVALSHA调用；
+// 内嵌存储没有Lua，执行与之等价的C++函数native，函数内对db的操作整体原子执行
+class RedisScript {
+public:
+  using Native = redisReply *(*)(Redis &db, const vector<string> &args);
+  RedisScript(string name, string source, Native native = nullptr)
+      : m_name(std::move(name)), m_source(std::move(source)),
+        m_native(native) {}
+  const string &name() const { return m_name; }
+  Native native() const { return m_native; }
+
+private:
+  string m_name;
+  string m_source;
+  string m_sha; // 预加载成功后的SHA1，为空时用EVAL发送源码
+  Native m_native;
+
+  friend class HiredisStorage;
+};
+
+// redis-server上的存储：一个阻塞的hiredis连接
+class HiredisStorage : public Storage {
+public:
+  HiredisStorage(string addr, int port) : redis_addr(addr), redis_port(port) {}
+  ~HiredisStorage();
+  bool connect(struct timeval timeout) override; // 全0为阻塞连接
+  bool disConnect() override;
+  bool reconnect() override; // 用原来的地址和超时重新连接
+  bool broken() const override {
+    return redis_s == nullptr || redis_s->err != 0;
+  }
+  redisReply *execute(const string_view *argv, size_t argc) override;
+  // 先全部追加到发送缓冲区，第一次读回复时一次写出，整批只有一次往返
+  bool pipeline(const vector<vector<string>> &cmds, bool transaction,
+                vector<redisReply *> &replies) override;
+  bool loadScript(RedisScript &script) override;
+  redisReply *eval(const RedisScript &script,
+                   const vector<string> &args) override;
+  const char *errstr() const override {
+    return redis_s == nullptr ? "未连接" : redis_s->errstr;
+  }
+
+private:
+  string redis_addr = "127.0.0.1"; // redis IP地址，默认环回地址
+  int redis_port = 6379;           // redis端口号，默认6379
+  redisContext *redis_s = nullptr; // redis句柄
+  struct timeval redis_timeout = {0, 0}; // 连接超时，全0表示阻塞连接
+};
+
+// 处理函数使用的存储操作，命令交给背后的Storage执行：
+// 用地址和端口构造时是自己的一个redis连接，用Storage构造时共用进程内的存储
 class Redis {
 public:
-  Redis() = default;
-  Redis(string addr, int port)
-      : redis_addr(addr), redis_port(port) {} // 指定redis ip地址和端口
+  Redis() : Redis("127.0.0.1", 6379) {}
+  Redis(string addr, int port) // 指定redis ip地址和端口
+      : m_store(new HiredisStorage(addr, port)), m_owned(true) {}
+  explicit Redis(Storage *store) : m_store(store), m_owned(false) {}
   ~Redis();
+  Redis(const Redis &) = delete;
+  Redis &operator=(const Redis &) = delete;
   bool connect();                       // 阻塞连接redis数据库
   bool connect(struct timeval timeout); // 超时连接redis
   bool disConnect();                    // 断开连接
+  bool reconnect();                     // 用原来的地址和超时重新连接
+  bool broken() const { return m_store->broken(); } // 连接是否已失效
   bool setValue(const string &key, const string &value); // 添加或修改键值对
   string getValue(const string &key); // 获取键对应的值
   bool delKey(const string &key);     // 删除键
+  long long incr(const string &key);  // 计数器加一，返回加后的值
   // 哈希表相关操作
   bool hsetValue(const string &key, const string &field,
                  const string &value); // 指定key哈希表field字段的值
@@ -30,278 +169,557 @@ public:
   bool delhash(const string &key,
                const string &field);     // 从哈希表删除指定的元素
   int hlen(const string &key);           // 返回哈希表中的元素个数
-  redisReply **hkeys(const string &key); // 返回哈希表中所有字段
+  RedisReply hkeys(const string &key);   // 返回哈希表中所有字段
                                          // set相关操作
   int scard(const string &key);          // 返回set集合里的元素个数
   int saddvalue(const string &key, const string &value); // 插入到集合
   int sismember(const string &key, const string &value); // 查看数据是否存在
   int sremvalue(const string &key, const string &value); // 将数据从set中移出
-  redisReply **smembers(const string &key); // 返回set中所有成员
+  RedisReply smembers(const string &key); // 返回set中所有成员
   // list相关操作
   int lpush(const string &key, const string &value); // 插入一条消息
   int llen(const string &key);                       // 获取列表长度
-  redisReply **lrange(const string &key);            // 返回列表所有元素
-  redisReply **lrange(const string &key, string a,
-                      string b); // 返回列表中指定的元素
+  RedisReply lrange(const string &key);              // 返回列表所有元素
+  RedisReply lrange(const string &key, string a,
+                    string b);   // 返回列表中指定的元素
   int ltrim(const string &key);  // 删除列表中的所有元素
+  // 脚本相关操作
+  bool loadScript(RedisScript &script); // 预加载脚本，记下SHA1
+  // 执行脚本，args为脚本的ARGV（不传KEYS）；脚本缓存丢失（如redis重启）时改用EVAL
+  RedisReply eval(const RedisScript &script, const vector<string> &args);
 
 private:
-  string redis_addr = "127.0.0.1"; // redis IP地址，默认环回地址
-  int redis_port = 6379;           // redis端口号，默认6379
-  redisContext *redis_s = nullptr; // redis句柄
-  redisReply *reply = nullptr;     // redisCommand返回的结构体
+  // 按参数数组执行一条命令，失败时返回空句柄
+  RedisReply command(initializer_list<string_view> args);
+  // 参数个数不定的命令
+  RedisReply commandArgv(const vector<string> &args);
+
+  Storage *m_store;
+  bool m_owned; // m_store是否由本对象创建
+
+  friend class RedisBatch;
 };
 
-Redis::~Redis() {
-  disConnect();
+// 一批命令：交给存储的pipeline一起执行，redis-server上整批只有一次往返。
+// transaction为true时整批包在MULTI/EXEC里原子执行。
+// 批内的命令不能依赖同一批里其它命令的结果
+class RedisBatch {
+public:
+  RedisBatch(Redis *conn, bool transaction = false)
+      : m_conn(conn), m_transaction(transaction) {}
+  ~RedisBatch();
+  RedisBatch(const RedisBatch &) = delete;
+  RedisBatch &operator=(const RedisBatch &) = delete;
+  // 追加一条命令（每个参数一个字符串，二进制安全），返回它在本批中的序号
+  int add(const vector<string> &argv);
+  // 发出所有命令并读回回复，网络错误、某条命令出错或事务被放弃时返回false
+  bool exec();
+  int size() const { return m_cmds.size(); }
+  // exec之后按序号取回复，序号无效时分别返回nullptr、0、空串
+  redisReply *reply(int i);
+  long long integer(int i);
+  string str(int i);
+  string str(int i, int j); // 数组回复（如HMGET）的第j个元素
+  bool isNil(int i);
+
+private:
+  Redis *m_conn;
+  bool m_transaction;
+  vector<vector<string>> m_cmds;
+  vector<redisReply *> m_raw;     // 读回的原始回复，析构时释放
+  vector<redisReply *> m_replies; // 每条命令的回复（事务时指向EXEC回复的元素）
+};
+
+// redis连接池：每个连接同一时间只借给一个线程，不够时新建（不超过上限），用完归还
+class RedisPool {
+public:
+  RedisPool() = default;
+  ~RedisPool();
+  // 预先建立min个连接，最多max个
+  bool init(int min, int max, struct timeval timeout,
+            string addr = "127.0.0.1", int port = 6379);
+  // 使用进程内的共享存储，每个"连接"只是它的一个Redis外壳，最多max个
+  bool init(Storage *shared, int max);
+  // 借出一个连接：优先本线程上次用过的，其次任意空闲的，都没有就新建，到上限则等待归还；
+  // 借出前发现连接已失效会先重连
+  Redis *acquire();
+  void release(Redis *conn);
+  int size();      // 已建立的连接数
+  int idleCount(); // 空闲的连接数
+
+private:
+  Redis *create();
+
+  pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t m_released = PTHREAD_COND_INITIALIZER;
+  vector<Redis *> m_all;  // 所有连接
+  vector<Redis *> m_idle; // 空闲连接
+  int m_creating = 0;     // 正在新建的连接数
+  int m_max = 1;
+  struct timeval m_timeout = {0, 0};
+  string m_addr = "127.0.0.1";
+  int m_port = 6379;
+  Storage *m_shared = nullptr; // 非空时不连接redis
+};
+
+// 当前线程借到的连接，由RedisGuard设置
+extern thread_local Redis *redis;
+
+// 在作用域内从连接池借一个连接作为当前线程的redis，离开作用域时归还
+class RedisGuard {
+public:
+  RedisGuard(RedisPool &pool) : m_pool(pool), m_prev(redis) {
+    m_conn = pool.acquire();
+    redis = m_conn;
+  }
+  ~RedisGuard() {
+    redis = m_prev;
+    m_pool.release(m_conn);
+  }
+  RedisGuard(const RedisGuard &) = delete;
+  RedisGuard &operator=(const RedisGuard &) = delete;
+
+private:
+  RedisPool &m_pool;
+  Redis *m_prev;
+  Redis *m_conn;
+};
+
+HiredisStorage::~HiredisStorage() { disConnect(); }
+// 连接redis，超时全0时阻塞连接
+bool HiredisStorage::connect(struct timeval timeout) {
+  redis_timeout = timeout;
+  if (timeout.tv_sec == 0 && timeout.tv_usec == 0) {
+    redis_s = redisConnect(redis_addr.c_str(), redis_port);
+  } else {
+    redis_s = redisConnectWithTimeout(redis_addr.c_str(), redis_port, timeout);
+  }
+  if (redis_s == nullptr || redis_s->err) {
+    LOG_ERROR("redis连接失败");
+    return false;
+  }
+  return true;
+}
+// 断开链接
+bool HiredisStorage::disConnect() {
+  redisFree(redis_s);
   redis_s = nullptr;
-  reply = nullptr;
+  return true;
 }
-// 阻塞连接redis
-bool Redis::connect() {
-  redis_s = redisConnect(redis_addr.c_str(), redis_port);
-  if (redis_s == nullptr || redis_s->err) {
-    cerr << "redis连接失败" << endl;
+// 重新连接，沿用原来的地址和超时
+bool HiredisStorage::reconnect() {
+  if (redis_s != nullptr && redisReconnect(redis_s) == REDIS_OK) {
+    LOG_INFO("redis重连成功");
+    return true;
+  }
+  redisFree(redis_s);
+  redis_s = nullptr;
+  return connect(redis_timeout);
+}
+
+// 按参数数组执行一条命令，参数不经过格式化，可以含空格、%和任意二进制数据
+redisReply *HiredisStorage::execute(const string_view *args, size_t argc) {
+  const char *stackArgv[REDIS_MAX_ARGC];
+  size_t stackLens[REDIS_MAX_ARGC];
+  vector<const char *> heapArgv;
+  vector<size_t> heapLens;
+  const char **argv = stackArgv;
+  size_t *lens = stackLens;
+  if (argc > REDIS_MAX_ARGC) {
+    heapArgv.resize(argc);
+    heapLens.resize(argc);
+    argv = heapArgv.data();
+    lens = heapLens.data();
+  }
+  for (size_t i = 0; i < argc; i++) {
+    argv[i] = args[i].data();
+    lens[i] = args[i].size();
+  }
+  return (redisReply *)redisCommandArgv(redis_s, argc, argv, lens);
+}
+
+// 把一条命令按参数数组追加到发送缓冲区
+static int appendArgv(redisContext *c, const vector<string> &cmd) {
+  vector<const char *> argv;
+  vector<size_t> lens;
+  for (const string &arg : cmd) {
+    argv.push_back(arg.data());
+    lens.push_back(arg.size());
+  }
+  return redisAppendCommandArgv(c, cmd.size(), argv.data(), lens.data());
+}
+
+bool HiredisStorage::pipeline(const vector<vector<string>> &cmds,
+                              bool transaction, vector<redisReply *> &replies) {
+  if (redis_s == nullptr) {
     return false;
   }
+  size_t total = cmds.size();
+  if (transaction) {
+    appendArgv(redis_s, {"MULTI"});
+    total += 2;
+  }
+  for (const vector<string> &cmd : cmds) {
+    appendArgv(redis_s, cmd);
+  }
+  if (transaction) {
+    appendArgv(redis_s, {"EXEC"});
+  }
+  // redisGetReply第一次调用时把缓冲区里的所有命令一起写出
+  for (size_t i = 0; i < total; i++) {
+    void *r = nullptr;
+    if (redisGetReply(redis_s, &r) != REDIS_OK || r == nullptr) {
+      return false;
+    }
+    // 事务只留EXEC的回复，MULTI的OK和各条命令的QUEUED直接释放
+    if (transaction && i + 1 < total) {
+      freeReplyObject(r);
+    } else {
+      replies.push_back(static_cast<redisReply *>(r));
+    }
+  }
   return true;
 }
-// 超时连接redis
-bool Redis::connect(struct timeval timeout) {
-  redis_s = redisConnect(redis_addr.c_str(), redis_port);
-  if (redis_s == nullptr || redis_s->err) {
-    cerr << "redis连接失败" << endl;
+
+bool HiredisStorage::loadScript(RedisScript &script) {
+  string_view argv[] = {"SCRIPT", "LOAD", script.m_source};
+  RedisReply r(execute(argv, 3));
+  if (!r || r.type() != REDIS_REPLY_STRING) {
+    LOG_ERROR("redis:预加载脚本{}失败: {}", script.m_name, r.str());
     return false;
   }
+  script.m_sha = r.str();
   return true;
 }
+
+redisReply *HiredisStorage::eval(const RedisScript &script,
+                                 const vector<string> &args) {
+  vector<string_view> argv = {"EVALSHA", script.m_sha, "0"};
+  argv.insert(argv.end(), args.begin(), args.end());
+  RedisReply r;
+  if (!script.m_sha.empty()) {
+    r = RedisReply(execute(argv.data(), argv.size()));
+  }
+  // 没有预加载或redis的脚本缓存已清空，发送源码执行（同时重新缓存脚本）
+  if (script.m_sha.empty() ||
+      (r.isError() && r.view().substr(0, 8) == "NOSCRIPT")) {
+    argv[0] = "EVAL";
+    argv[1] = script.m_source;
+    r = RedisReply(execute(argv.data(), argv.size()));
+  }
+  return r.release();
+}
+
+Redis::~Redis() {
+  if (m_owned) {
+    delete m_store;
+  }
+}
+// 阻塞连接redis
+bool Redis::connect() { return m_store->connect({0, 0}); }
+// 超时连接redis
+bool Redis::connect(struct timeval timeout) {
+  return m_store->connect(timeout);
+}
 // 断开链接
-bool Redis::disConnect() {
-  freeReplyObject(reply);
-  redisFree(redis_s);
+bool Redis::disConnect() { return m_store->disConnect(); }
+// 重新连接，沿用原来的地址和超时
+bool Redis::reconnect() { return m_store->reconnect(); }
+
+RedisBatch::~RedisBatch() {
+  for (redisReply *r : m_raw) {
+    freeReplyObject(r);
+  }
+}
+
+int RedisBatch::add(const vector<string> &argv) {
+  m_cmds.push_back(argv);
+  return m_cmds.size() - 1;
+}
+
+bool RedisBatch::exec() {
+  if (m_cmds.empty()) {
+    return true;
+  }
+  if (!m_conn->m_store->pipeline(m_cmds, m_transaction, m_raw)) {
+    LOG_ERROR("redis:批量执行{}条命令失败: {}", m_cmds.size(),
+              m_conn->m_store->errstr());
+    return false;
+  }
+  bool ok = true;
+  if (m_transaction) {
+    redisReply *result = m_raw.back();
+    if (result->type != REDIS_REPLY_ARRAY ||
+        result->elements != m_cmds.size()) {
+      LOG_ERROR("redis:事务被放弃: {}",
+                result->type == REDIS_REPLY_ERROR ? result->str : "");
+      return false;
+    }
+    m_replies.assign(result->element, result->element + result->elements);
+  } else {
+    m_replies = m_raw;
+  }
+  for (size_t i = 0; i < m_replies.size(); i++) {
+    if (m_replies[i]->type == REDIS_REPLY_ERROR) {
+      LOG_ERROR("redis:{}失败: {}", m_cmds[i][0], m_replies[i]->str);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+redisReply *RedisBatch::reply(int i) {
+  if (i < 0 || i >= (int)m_replies.size()) {
+    return nullptr;
+  }
+  return m_replies[i];
+}
+
+long long RedisBatch::integer(int i) {
+  redisReply *r = reply(i);
+  return r != nullptr && r->type == REDIS_REPLY_INTEGER ? r->integer : 0;
+}
+
+string RedisBatch::str(int i) {
+  redisReply *r = reply(i);
+  if (r == nullptr || r->str == nullptr) {
+    return "";
+  }
+  return string(r->str, r->len);
+}
+
+string RedisBatch::str(int i, int j) {
+  redisReply *r = reply(i);
+  if (r == nullptr || r->type != REDIS_REPLY_ARRAY || j < 0 ||
+      j >= (int)r->elements || r->element[j]->str == nullptr) {
+    return "";
+  }
+  return string(r->element[j]->str, r->element[j]->len);
+}
+
+bool RedisBatch::isNil(int i) {
+  redisReply *r = reply(i);
+  return r == nullptr || r->type == REDIS_REPLY_NIL;
+}
+
+RedisPool::~RedisPool() {
+  for (Redis *conn : m_all) {
+    delete conn;
+  }
+}
+
+bool RedisPool::init(int min, int max, struct timeval timeout, string addr,
+                     int port) {
+  m_max = std::max(max, 1);
+  m_timeout = timeout;
+  m_addr = addr;
+  m_port = port;
+  bool ok = true;
+  for (int i = 0; i < min && i < m_max; i++) {
+    Redis *conn = create();
+    ok = ok && !conn->broken();
+    pthread_mutex_lock(&m_lock);
+    m_all.push_back(conn);
+    m_idle.push_back(conn);
+    pthread_mutex_unlock(&m_lock);
+  }
+  LOG_INFO("redis连接池: 预建{}个连接，上限{}", min, m_max);
+  return ok;
+}
+
+bool RedisPool::init(Storage *shared, int max) {
+  m_shared = shared;
+  m_max = std::max(max, 1);
+  LOG_INFO("redis连接池: 使用内嵌存储，上限{}", m_max);
   return true;
 }
+
+Redis *RedisPool::create() {
+  if (m_shared != nullptr) {
+    return new Redis(m_shared);
+  }
+  Redis *conn = new Redis(m_addr, m_port);
+  conn->connect(m_timeout);
+  return conn;
+}
+
+// 每个线程上次借到的连接，再借时优先给它
+static thread_local Redis *t_lastConn = nullptr;
+
+Redis *RedisPool::acquire() {
+  Redis *conn = nullptr;
+  pthread_mutex_lock(&m_lock);
+  while (true) {
+    auto it = find(m_idle.begin(), m_idle.end(), t_lastConn);
+    if (it == m_idle.end() && !m_idle.empty()) {
+      it = m_idle.end() - 1;
+    }
+    if (it != m_idle.end()) {
+      conn = *it;
+      m_idle.erase(it);
+      break;
+    }
+    // 没有空闲连接，还没到上限就新建一个（建连接时不持有锁）
+    if ((int)m_all.size() + m_creating < m_max) {
+      m_creating++;
+      pthread_mutex_unlock(&m_lock);
+      conn = create();
+      pthread_mutex_lock(&m_lock);
+      m_creating--;
+      m_all.push_back(conn);
+      LOG_INFO("redis连接池扩容到{}个连接", m_all.size());
+      break;
+    }
+    pthread_cond_wait(&m_released, &m_lock);
+  }
+  pthread_mutex_unlock(&m_lock);
+  // 连接在上次使用时出错（如redis重启），借出前重连
+  if (conn->broken()) {
+    LOG_WARN("redis连接已失效，重新连接");
+    conn->reconnect();
+  }
+  t_lastConn = conn;
+  return conn;
+}
+
+void RedisPool::release(Redis *conn) {
+  if (conn == nullptr) {
+    return;
+  }
+  pthread_mutex_lock(&m_lock);
+  m_idle.push_back(conn);
+  pthread_cond_signal(&m_released);
+  pthread_mutex_unlock(&m_lock);
+}
+
+int RedisPool::size() {
+  pthread_mutex_lock(&m_lock);
+  int n = m_all.size();
+  pthread_mutex_unlock(&m_lock);
+  return n;
+}
+
+int RedisPool::idleCount() {
+  pthread_mutex_lock(&m_lock);
+  int n = m_idle.size();
+  pthread_mutex_unlock(&m_lock);
+  return n;
+}
+RedisReply Redis::command(initializer_list<string_view> args) {
+  RedisReply r(m_store->execute(args.begin(), args.size()));
+  if (!r) {
+    LOG_ERROR("redis:{} {}失败", string(args.begin()[0]),
+              string(args.begin()[1]));
+  }
+  return r;
+}
+RedisReply Redis::commandArgv(const vector<string> &args) {
+  vector<string_view> argv(args.begin(), args.end());
+  RedisReply r(m_store->execute(argv.data(), argv.size()));
+  if (!r) {
+    LOG_ERROR("redis:{}失败", args.empty() ? "" : args[0]);
+  }
+  return r;
+}
 // 设置键值
 bool Redis::setValue(const string &key, const string &value) {
-  string cmd = "set  " + key + "  " + value;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return false;
-  } else {
-    return true;
-  };
+  return bool(command({"SET", key, value}));
 }
 // 获取键对应的值
 string Redis::getValue(const string &key) {
-  string cmd = "get  " + key;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return "false";
-  } else {
-    return reply->str;
-  };
+  RedisReply r = command({"GET", key});
+  return r ? r.str() : "false";
 }
 // 删除键值
-bool Redis::delKey(const string &key) {
-  string cmd = "del  " + key;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return false;
-  } else {
-    return true;
-  };
+bool Redis::delKey(const string &key) { return bool(command({"DEL", key})); }
+// 计数器加一
+long long Redis::incr(const string &key) {
+  return command({"INCR", key}).integer();
 }
 // 插入哈希表
 bool Redis::hsetValue(const string &key, const string &field,
                       const string &value) {
-  string cmd = "hset  " + key + " " + field + " " + value;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return false;
-  } else {
-    return true;
-  };
+  return bool(command({"HSET", key, field, value}));
 }
 // 哈希表是否存在
 bool Redis::hashexists(const string &key, const string &field) {
-  string cmd = "hexists  " + key + "  " + field;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return false;
-  } else {
-    if (reply->integer == 0) {
-      return false;
-    } else {
-      return true;
-    }
-  };
+  return command({"HEXISTS", key, field}).integer() != 0;
 }
 // 获取对应的hash_value
 string Redis::gethash(const string &key, const string &field) {
-  string cmd = "hget  " + key + "  " + field;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return "false";
-  } else {
-    return reply->str;
-  };
+  RedisReply r = command({"HGET", key, field});
+  return r ? r.str() : "false";
 }
 // 从哈希表删除指定的元素
 bool Redis::delhash(const string &key, const string &field) {
-  string cmd = "hdel  " + key + "  " + field;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return false;
-  } else {
-    return true;
-  };
+  return bool(command({"HDEL", key, field}));
 }
 
 int Redis::hlen(const string &key) { // 返回哈希表中的元素个数
-  string cmd = "hlen  " + key;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return -1;
-  } else {
-    return reply->integer;
-  };
+  RedisReply r = command({"HLEN", key});
+  return r ? r.integer() : -1;
 }
 
-redisReply **Redis::hkeys(const string &key) {
-  string cmd = "hkeys  " + key;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return nullptr;
-  } else {
-    return reply->element;
-  };
-}
+RedisReply Redis::hkeys(const string &key) { return command({"HKEYS", key}); }
 
 int Redis::scard(const string &key) // 返回set集合里的元素个数
 {
-  string cmd = "scard  " + key;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return -1;
-  } else {
-    return reply->integer;
-  };
+  RedisReply r = command({"SCARD", key});
+  return r ? r.integer() : -1;
 }
 int Redis::saddvalue(const string &key, const string &value) // 插入到集合
 {
-  string cmd = "sadd  " + key + "  " + value;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return -1;
-  } else {
-    return reply->type;
-  };
+  return command({"SADD", key, value}).type();
 }
 int Redis::sismember(const string &key, const string &value) // 查看数据是否存在
 {
-  string cmd = "sismember  " + key + "  " + value;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return -1;
-  } else {
-    if (reply->integer == 0) {
-      return false;
-    } else {
-      return true;
-    }
-  };
+  RedisReply r = command({"SISMEMBER", key, value});
+  return r ? r.integer() != 0 : -1;
 }
 int Redis::sremvalue(const string &key,
                      const string &value) // 将数据从set中移出
 {
-  string cmd = "srem  " + key + "  " + value;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return -1;
-  } else {
-    return reply->integer;
-  };
-}
-redisReply **Redis::smembers(const string &key) {
-  string cmd = "smembers  " + key;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return nullptr;
-  } else {
-    return reply->element;
-  };
+  RedisReply r = command({"SREM", key, value});
+  return r ? r.integer() : -1;
+}
+RedisReply Redis::smembers(const string &key) {
+  return command({"SMEMBERS", key});
 }
 
 int Redis::lpush(const string &key, const string &value) {
-  string cmd = "lpush  " + key + " " + value;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return -1;
-  } else {
-    return reply->type;
-  };
+  return command({"LPUSH", key, value}).type();
 }
 int Redis::llen(const string &key) {
-  string cmd = "llen  " + key;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return -1;
-  } else {
-    return reply->integer;
-  };
+  RedisReply r = command({"LLEN", key});
+  return r ? r.integer() : -1;
 }
 
-redisReply **Redis::lrange(const string &key) // 返回所有消息
+RedisReply Redis::lrange(const string &key) // 返回所有消息
 {
-  string cmd = "lrange  " + key + "  0" + "  -1";
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return nullptr;
-  } else {
-    return reply->element;
-  };
+  return command({"LRANGE", key, "0", "-1"});
 }
 
-redisReply **Redis::lrange(const string &key, string a,
-                           string b) // 返回指定的消息记录
+RedisReply Redis::lrange(const string &key, string a,
+                         string b) // 返回指定的消息记录
 {
-  string cmd = "lrange  " + key + "  " + a + "  " + b;
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return nullptr;
-  } else {
-    return reply->element;
-  };
+  return command({"LRANGE", key, a, b});
 }
 
 int Redis::ltrim(const string &key) // 删除链表中的所有元素
 {
-  string cmd = "ltrim  " + key + " 1 " + " 0 ";
-  reply = (redisReply *)redisCommand(redis_s, cmd.c_str());
-  if (reply == nullptr) {
-    cerr << "redis:" << cmd << "失败" << endl;
-    return -1;
-  } else {
-    return reply->type;
-  };
+  return command({"LTRIM", key, "1", "0"}).type();
+}
+
+bool Redis::loadScript(RedisScript &script) {
+  return m_store->loadScript(script);
+}
+
+RedisReply Redis::eval(const RedisScript &script, const vector<string> &args) {
+  RedisReply r(m_store->eval(script, args));
+  if (r.isError()) {
+    LOG_ERROR("redis:脚本{}执行失败: {}", script.name(), r.str());
+  }
+  return r;
 }
 
 #endif
@@ -1,3 +1,6 @@
+#include "Affinity.hpp"
+#include "Coroutine.hpp"
+#include "Log.hpp"
 #include "Option.hpp"
 #include "ThreadPool.cc"
 #include "ThreadPool.hpp"
@@ -12,35 +15,112 @@
 #define LOCALPORT 6666
 
 int epfd;
-Redis redis;
+MemStorage memStore; // 进程内存储，连接池的连接会指向它，定义在redisPool之前
+RedisPool redisPool;
+FriendGraph friendGraph; // 用户缓存的键事件会转给它，比userCache晚析构
+GroupOnline groupOnline; // 同上，重读线程借连接，比redisPool先析构
+UserCache userCache; // 进程内存储的写回调会用到，比unreadCounter晚析构
+UnreadCounter unreadCounter; // 析构时还要借连接写回，定义在redisPool之后
+FanOut fanOut;
+Archive archive; // 归档线程借连接，比redisPool先析构
+SearchIndex searchIndex;
+Presence presence; // 推送线程借连接，比redisPool先析构
+UnreadSummary unreadSummary; // 重算线程用到上面的几个服务，比它们先析构
+thread_local Redis *redis = nullptr;
 using namespace std;
 
 int main() {
-  // 连接redis服务端
-  struct timeval timeout = {1, 500000};
-  redis.connect(timeout); // 超时连接
-  // 将每个账号的在线状态改为-1
-  int num = redis.scard("用户uid集合");
-  redisReply **allAccounts = redis.smembers("用户uid集合");
-  for (int i = 0; i < num; i++) {
-    redis.hsetValue(allAccounts[i]->str, "在线状态", "-1");
+  // 启动异步日志
+  Logger::start();
+  // 读取NUMA拓扑和CPU绑定配置并打印
+  Affinity::init();
+  // 存储后端：默认连redis-server；CHATROOM_STORAGE=memory时数据放在进程内，
+  // CHATROOM_AOF指定持久化文件，不指定时只在内存里
+  const char *backend = getenv("CHATROOM_STORAGE");
+  bool local = backend != nullptr && string(backend) == "memory";
+  if (local) {
+    const char *aof = getenv("CHATROOM_AOF");
+    if (aof != nullptr && !memStore.open(aof)) {
+      // 退出前等写线程把队列里的日志写完，不然失败原因会丢
+      Logger::stop();
+      exit(1);
+    }
+    memStore.setWriteHook(
+        [](const string &key) { userCache.keyChanged(key); });
+    // 连接池的连接都是进程内存储的门面，异步命令也同步执行
+    redisPool.init(&memStore, 16);
+    RedisAsync::useLocal(&memStore);
+    LOG_INFO("使用进程内存储");
+  } else {
+    // 建立redis连接池，每个工作线程处理命令时借一个连接
+    struct timeval timeout = {1, 500000};
+    redisPool.init(4, 16, timeout); // 超时连接
+  }
+  // 未读计数的每次修改都让未读概要重算
+  unreadCounter.setHook([](const string &uid) { unreadSummary.mark(uid); });
+  unreadCounter.start(&redisPool);
+  // 历史消息的归档目录：CHATROOM_ARCHIVE指定，未设置时用archive，设为空串时不归档
+  const char *archiveDir = getenv("CHATROOM_ARCHIVE");
+  archive.start(&redisPool, archiveDir != nullptr ? archiveDir : "archive");
+  // 全文索引的目录：CHATROOM_SEARCH指定，未设置时用search，设为空串时不建索引
+  const char *searchDir = getenv("CHATROOM_SEARCH");
+  searchIndex.start(searchDir != nullptr ? searchDir : "search");
+  // 好友图和群的在线成员索引借用用户缓存的键事件失效
+  userCache.setKeyHook([](string_view key) {
+    friendGraph.keyChanged(key);
+    groupOnline.keyChanged(key);
+  });
+  groupOnline.start(&redisPool);
+  if (local) {
+    userCache.startLocal();
+  } else {
+    // 用户字段缓存靠redis键事件失效，订阅线程在后台连接
+    userCache.start();
+  }
+  // 通知套接字的推送线程
+  fanOut.start();
+  // 好友上下线的推送线程
+  presence.start(&redisPool, &friendGraph, &userCache, &fanOut);
+  // 在线用户未读概要的重算线程
+  unreadSummary.start(&redisPool, &unreadCounter, &userCache, &fanOut);
+  // 反应堆线程自己长期占用一个连接
+  RedisGuard reactorRedis(redisPool);
+  // 预加载复合操作的Lua脚本
+  LoadScripts(redis);
+  // 换一代会话表，上次运行的在线状态随之失效
+  if (!Session::init(redis)) {
+    Logger::stop();
+    exit(1);
   }
 
-  ThreadPool<Argc_func> pool(2, 10);    // 创建一个线程池类
+  // 创建一个线程池类，命令按类别分通道调度
+  ThreadPool<Argc_func> pool(2, 10, Affinity::pinWorker, ChatLanes());
+  // 排队超时或过载被拒绝的命令快速回复客户端
+  pool.setShedHandler(&ShedTask);
+  // 线程池建好后再绑定反应堆线程，避免线程池的线程继承反应堆的CPU集合
+  Affinity::pinReactor();
   TcpServer sfd_class;                  // 创建服务器的socket
   map<string, int> uid_cfd;             // 一个uid对应一个cfd的表
   int ret;                              // 检测返回值
   ret = sfd_class.setListen(LOCALPORT); // 设置监听返回监听符.内部报错
   if (ret == -1) {
+    Logger::stop();
     exit(1);
   }
 
   // 创建epoll实例，并把listenfd加进去，监视可读事件
   epfd = epoll_create(5);
   if (epfd == -1) {
-    exit(1);
+    my_error("epoll_create() failed.");
+  }
+  CoReactor::init(epfd);
+  // 协程处理函数用的异步redis连接也挂在这个epoll上
+  if (!local) {
+    RedisAsync::init(epfd);
   }
   struct epoll_event temp, ep[1024];
+  coroutine_handle<> handle; // 等待I/O的协程
+  int lane;                  // 协程恢复时进入的调度通道
   temp.data.fd = sfd_class.getfd();
   temp.events = EPOLLIN;
   ret = epoll_ctl(epfd, EPOLL_CTL_ADD, sfd_class.getfd(), &temp);
@@ -58,31 +138,62 @@ int main() {
         temp.data.fd = cfd_class->getfd();
         temp.events = EPOLLIN;
         epoll_ctl(epfd, EPOLL_CTL_ADD, cfd_class->getfd(), &temp);
-        redis.hsetValue("fd-uid对应表", to_string(ep[i].data.fd), "-1");
-        cout << "客户端套接字连接成功，套接字为：" << ep[i].data.fd << endl;
+        redis->hsetValue(Session::fdKey(), to_string(ep[i].data.fd), "-1");
+        LOG_INFO("客户端套接字连接成功，套接字为：{}", temp.data.fd);
+      }
+      // 如果是异步redis连接的符，就解析回复，回复到齐的协程交给线程池恢复
+      else if (RedisAsync::owns(ep[i].data.fd)) {
+        RedisAsync::handleEvents(ep[i].events);
+        // 协程已经处理到一半，恢复的任务不计截止时间和SLO，不会被丢弃
+        while (RedisAsync::takeReady(handle, lane)) {
+          Task<Argc_func> resume(&taskfunc, new Argc_func(handle), lane);
+          resume.sheddable = false;
+          pool.addTask(resume);
+        }
+      }
+      // 如果是协程在等待的符，说明协程等的I/O就绪了，交给线程池恢复协程
+      else if (CoReactor::take(ep[i].data.fd, handle)) {
+        Task<Argc_func> resume(&taskfunc, new Argc_func(handle), LANE_BULK);
+        resume.sheddable = false;
+        pool.addTask(resume);
       }
       // 如果是客户端的符，就接收消息，并处理
       else {
         TcpSocket cfd_class(ep[i].data.fd); // 用这个符创一个类来交互信息
         string command_string = cfd_class.recvMsg(); // 接收命令json字符串
-        cout << "接收到的命令字符串为：" << command_string << endl;
+        LOG_DEBUG("接收到的命令字符串为：{}", command_string);
 
         // 如果命令字符串是说客户端挂了，socket类里关fd，并修改用户信息，摘符
         if (command_string == "close" || command_string == "-1" ||
             command_string == "quit") {
-          if (!redis.hashexists("fd-uid对应表", to_string(ep[i].data.fd))) {
+          string closefd = to_string(ep[i].data.fd);
+          // 符已经关了，还没发出的推送作废
+          fanOut.forget(ep[i].data.fd);
+          if (!redis->hashexists(Session::fdKey(), closefd)) {
             break;
           }
-          string cuid = redis.gethash("fd-uid对应表", to_string(ep[i].data.fd));
-          cout << "退出的客户端的uid为：" << cuid << endl;
+          string cuid = redis->gethash(Session::fdKey(), closefd);
+          LOG_INFO("退出的客户端的uid为：{}", cuid);
           if (cuid.size() == 4) {
-            cout << "cuid : " << cuid << endl;
-            redis.hsetValue(cuid, "在线状态", "-1");
-            redis.hsetValue(cuid, "通知套接字", "-1");
+            redis->delhash(Session::onlineKey(), cuid);
+            presence.set(cuid, false);
+            unreadSummary.detach(cuid);
+            groupOnline.logout(cuid);
+            redis->hsetValue(cuid, "通知套接字", "-1");
+            userCache.invalidate(cuid);
+          } else if (cuid.size() > 4) {
+            // 只有通知套接字（记为"uid(通)"）断了：符号马上会被新连接复用，
+            // 登记的通知套接字作废，免得推送写进别的连接
+            string uid = cuid.substr(0, 4);
+            if (userCache.get(uid, UF_NOTIFY_FD) == closefd) {
+              redis->hsetValue(uid, "通知套接字", "-1");
+              userCache.invalidate(uid);
+            }
+            unreadSummary.detach(uid);
           }
           epoll_ctl(epfd, EPOLL_CTL_DEL, cfd_class.getfd(), &temp);
-          redis.hsetValue("fd-uid对应表", to_string(ep[i].data.fd), "-1");
-          cout << "客户端断开连接" << endl;
+          redis->hsetValue(Session::fdKey(), closefd, "-1");
+          LOG_INFO("客户端断开连接");
           continue;
         } else {
           // 命令类将sring格式的字符串转为josn格式的字符串
@@ -90,23 +201,23 @@ int main() {
           command.From_Json(command_string);
           // 如果是通知套接字来消息，说明是告诉服务器该通知套接字属于哪个账号，更改这个账号的通知套接字并加在fd-uid对应表里，不运行任务函数
           if (command.m_flag == SETRECVFD) {
-            redis.hsetValue(command.m_uid, "通知套接字",
-                            to_string(ep[i].data.fd));
-            redis.hsetValue("fd-uid对应表", to_string(ep[i].data.fd),
-                            command.m_uid + "(通)");
+            redis->hsetValue(command.m_uid, "通知套接字",
+                             to_string(ep[i].data.fd));
+            redis->hsetValue(Session::fdKey(), to_string(ep[i].data.fd),
+                             command.m_uid + "(通)");
+            userCache.invalidate(command.m_uid);
+            // 通知套接字有了，算出未读概要推过去
+            unreadSummary.attach(command.m_uid);
           }
           // 不是通知套接字消息，说明是用户的命令，把命令和客户端套接字传进任务函数进行处理
           else {
             Argc_func *argc_func = new Argc_func(cfd_class, command_string);
             // 摘符
             epoll_ctl(epfd, EPOLL_CTL_DEL, cfd_class.getfd(), &temp);
-            // 调用任务函数，传发过来的json字符串格式过去
-            pool.addTask(
-                Task<Argc_func>(&taskfunc, static_cast<void *>(argc_func)));
-            // 上符
-            temp.data.fd = cfd_class.getfd();
-            temp.events = EPOLLIN;
-            epoll_ctl(epfd, EPOLL_CTL_ADD, temp.data.fd, &temp);
+            // 调用任务函数，传发过来的json字符串格式过去，命令处理完后由任务函数上符
+            pool.addTask(Task<Argc_func>(&taskfunc,
+                                         static_cast<void *>(argc_func),
+                                         LaneOf(command.m_flag)));
           }
         }
       }
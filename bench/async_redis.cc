@@ -0,0 +1,126 @@
+// 异步redis的基准：并发请求很多时，少量线程上的协程对比每个请求占一个线程的同步调用。
+// 用法：bench_async_redis [并发数=256] [秒数=3] [redis端口=6379]，需要一个在运行的redis-server。
+// async：反应堆线程+2个工作线程，并发数个协程各自循环co_await asyncCommand(HGET)；
+// sync-2：2个线程各用一条同步连接循环HGET；sync-N：并发数个线程各用一条同步连接
+#include "../Server/Log.hpp"
+#include "../Server/RedisAsync.hpp"
+#include "../Server/ThreadPool.cc"
+#include "../Server/ThreadPool.hpp"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+thread_local Redis *redis = nullptr;
+
+using Clock = chrono::steady_clock;
+
+struct Resume {
+  coroutine_handle<> handle;
+};
+
+static atomic<bool> stopping{false};
+static atomic<uint64_t> ops{0};
+static atomic<int> running{0};
+
+static void ResumeTask(void *arg) { static_cast<Resume *>(arg)->handle.resume(); }
+
+static CoDetached Client(int id) {
+  string field = "f";
+  field += to_string(id % 64);
+  while (!stopping) {
+    RedisReply reply = co_await asyncCommand(0, "HGET", "bench_async", field);
+    if (!reply) {
+      break; // 连接断了
+    }
+    ops++;
+  }
+  running--;
+}
+
+static double Async(int concurrency, int seconds, int port) {
+  int epfd = epoll_create(5);
+  RedisAsync::init(epfd, "127.0.0.1", port);
+  // 线程池的析构不等工作线程，跑完随进程退出
+  ThreadPool<Resume> &pool = *new ThreadPool<Resume>(2, 2);
+  stopping = false;
+  ops = 0;
+  running = concurrency;
+  for (int i = 0; i < concurrency; i++) {
+    Client(i);
+  }
+  Clock::time_point t0 = Clock::now();
+  Clock::time_point end = t0 + chrono::seconds(seconds);
+  struct epoll_event ev[64];
+  coroutine_handle<> handle;
+  int lane;
+  uint64_t counted = 0;
+  while (running > 0) {
+    if (!stopping && Clock::now() >= end) {
+      counted = ops;
+      stopping = true;
+    }
+    int n = epoll_wait(epfd, ev, 64, 10);
+    for (int i = 0; i < n; i++) {
+      if (RedisAsync::owns(ev[i].data.fd)) {
+        RedisAsync::handleEvents(ev[i].events);
+        while (RedisAsync::takeReady(handle, lane)) {
+          pool.addTask(Task<Resume>(&ResumeTask, new Resume{handle}, lane));
+        }
+      }
+    }
+  }
+  return counted / chrono::duration<double>(end - t0).count();
+}
+
+static double Sync(int threads, int seconds, int port) {
+  stopping = false;
+  ops = 0;
+  vector<thread> ts;
+  for (int t = 0; t < threads; t++) {
+    ts.emplace_back([t, port] {
+      Redis conn("127.0.0.1", port);
+      if (!conn.connect()) {
+        return;
+      }
+      string field = "f";
+      field += to_string(t % 64);
+      while (!stopping) {
+        conn.gethash("bench_async", field);
+        ops++;
+      }
+    });
+  }
+  this_thread::sleep_for(chrono::seconds(seconds));
+  uint64_t counted = ops;
+  stopping = true;
+  for (thread &t : ts) {
+    t.join();
+  }
+  return counted / (double)seconds;
+}
+
+int main(int argc, char **argv) {
+  int concurrency = argc > 1 ? atoi(argv[1]) : 256;
+  int seconds = argc > 2 ? atoi(argv[2]) : 3;
+  int port = argc > 3 ? atoi(argv[3]) : 6379;
+  Logger::start(LOG_LEVEL_WARN);
+  Redis setup("127.0.0.1", port);
+  if (!setup.connect()) {
+    fprintf(stderr, "连不上127.0.0.1:%d上的redis-server\n", port);
+    Logger::stop();
+    return 1;
+  }
+  for (int i = 0; i < 64; i++) {
+    string field = "f";
+    field += to_string(i);
+    setup.hsetValue("bench_async", field, "value");
+  }
+  printf("concurrency=%d\n", concurrency);
+  printf("sync-2  %9.0f ops/s\n", Sync(2, seconds, port));
+  printf("sync-N  %9.0f ops/s\n", Sync(concurrency, seconds, port));
+  printf("async   %9.0f ops/s (reactor + 2 workers)\n",
+         Async(concurrency, seconds, port));
+  setup.delKey("bench_async");
+  Logger::stop();
+  return 0;
+}
@@ -0,0 +1,155 @@
+// 群消息推送的基准：在线成员很多的群里发一条消息，处理函数占用的时间和全部送达的时间。
+// 用法：bench_fanout [每种群发的消息数=20] [群人数=10,1000,10000]
+// 群聊列表放在进程内存储里，在线成员由GroupOnline登记，一半成员正在群里聊天。
+// 每个在线成员的通知套接字是一对socketpair的一端，另一端由一个epoll线程读空并计字节数。
+// inline：没启动推送线程的FanOut，处理函数自己逐个阻塞发送；
+// queued：和server相同，整批交给FANOUT_WORKERS个推送线程。
+// 在线成员数受fd上限限制，最多(上限-64)/2个，超出的成员不在线
+#include "../Server/FanOut.hpp"
+#include "../Server/GroupOnline.hpp"
+#include "../Server/MemStorage.hpp"
+#include <chrono>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <thread>
+
+FanOut fanOut;
+thread_local Redis *redis = nullptr;
+
+using Clock = chrono::steady_clock;
+
+static atomic<uint64_t> received{0};
+
+static double Ms(Clock::time_point a, Clock::time_point b) {
+  return chrono::duration<double, milli>(b - a).count();
+}
+
+// 读空所有对端，只计字节数
+static void Drain(int epfd) {
+  struct epoll_event ev[256];
+  char buf[65536];
+  for (;;) {
+    int n = epoll_wait(epfd, ev, 256, 100);
+    if (n < 0 && errno != EINTR) {
+      return;
+    }
+    for (int i = 0; i < n; i++) {
+      ssize_t r;
+      while ((r = read(ev[i].data.fd, buf, sizeof(buf))) > 0) {
+        received += r;
+      }
+    }
+  }
+}
+
+// 和Option.hpp里的PushGroup相同，用户缓存换成了uid到fd的表
+static void PushGroup(FanOut &engine, GroupOnline &index,
+                      const unordered_map<string, int> &fds, const string &gid,
+                      const string &show, const string &notice) {
+  vector<FanOut::Push> pushes;
+  for (const GroupOnline::Member &m : index.online(gid)) {
+    auto it = fds.find(m.uid);
+    if (it != fds.end()) {
+      pushes.push_back({it->second, m.viewing ? show : notice});
+    }
+  }
+  engine.pushAll(pushes);
+}
+
+static void Bench(int size, int online, int rounds, int epfd) {
+  MemStorage store;
+  Redis local(&store);
+  redis = &local;
+  GroupOnline index;
+  string gid = to_string(90000 + size);
+  unordered_map<string, int> fds;
+  vector<int> peers;
+  for (int i = 0; i < size; i++) {
+    string uid = to_string(100000 + i);
+    local.hsetValue(uid + "的群聊列表", gid, "成员");
+    if (i >= online) {
+      continue;
+    }
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+      fprintf(stderr, "socketpair: %s\n", strerror(errno));
+      break;
+    }
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = sv[1];
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sv[1], &ev);
+    fds[uid] = sv[0];
+    peers.push_back(sv[1]);
+    index.login(uid);
+    if (i % 2 == 0) {
+      index.enter(uid, gid);
+    }
+  }
+  string show = "\r\n";
+  show += "1000：大家好，这是一条群消息..........2026-10-19 10:00:00";
+  string notice = gid;
+  notice += "群有一条新消息";
+  uint64_t perRound = 0;
+  for (size_t i = 0; i < peers.size(); i++) {
+    perRound += 4 + (i % 2 == 0 ? show.size() : notice.size());
+  }
+  FanOut direct; // 不启动推送线程
+  FanOut *engines[] = {&direct, &fanOut};
+  const char *names[] = {"inline", "queued"};
+  for (int e = 0; e < 2; e++) {
+    received = 0;
+    vector<double> lat;
+    Clock::time_point t0 = Clock::now();
+    for (int r = 0; r < rounds; r++) {
+      Clock::time_point a = Clock::now();
+      PushGroup(*engines[e], index, fds, gid, show, notice);
+      lat.push_back(Ms(a, Clock::now()));
+    }
+    while (received < perRound * rounds && Ms(t0, Clock::now()) < 60000) {
+      usleep(100);
+    }
+    double all = Ms(t0, Clock::now());
+    sort(lat.begin(), lat.end());
+    printf("group %6d online %6zu %-6s handler p50 %8.3f ms  max %8.3f ms  "
+           "all delivered %8.1f ms (%lu/%lu bytes)\n",
+           size, peers.size(), names[e], lat[lat.size() / 2], lat.back(), all,
+           (unsigned long)received.load(), (unsigned long)(perRound * rounds));
+    fflush(stdout);
+  }
+  for (auto &kv : fds) {
+    fanOut.forget(kv.second);
+    close(kv.second);
+  }
+  for (int fd : peers) {
+    close(fd); // 关闭时自动从epoll里摘掉
+  }
+  redis = nullptr;
+}
+
+int main(int argc, char **argv) {
+  int rounds = argc > 1 ? atoi(argv[1]) : 20;
+  vector<int> sizes;
+  for (const char *p = argc > 2 ? argv[2] : "10,1000,10000"; *p != '\0';) {
+    char *end;
+    sizes.push_back(strtol(p, &end, 10));
+    p = *end == ',' ? end + 1 : end + strlen(end);
+  }
+  Logger::start(LOG_LEVEL_WARN);
+  // 每个在线成员两个fd，软上限提到硬上限
+  struct rlimit lim;
+  getrlimit(RLIMIT_NOFILE, &lim);
+  lim.rlim_cur = lim.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &lim);
+  int maxOnline = (int)min<rlim_t>((lim.rlim_cur - 64) / 2, 1 << 20);
+  fanOut.start();
+  int epfd = epoll_create(5);
+  thread(Drain, epfd).detach();
+  for (int size : sizes) {
+    Bench(size, min(size, maxOnline), rounds, epfd);
+  }
+  Logger::stop();
+  return 0;
+}
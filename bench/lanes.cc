@@ -0,0 +1,95 @@
+// 调度通道的基准：大文件传输占满线程时，交互命令的排队时间。
+// 用法：bench_lanes [秒数=5]
+// 每1ms来一个交互任务（计算200us），每5ms来一个传输任务（阻塞60ms），传输的需求超过线程池上限。
+// 依次用一个先进先出通道、加了截止时间的一个通道、和ChatLanes()相同的通道配置各跑一遍
+#include "../Server/Log.hpp"
+#include "../Server/ThreadPool.cc"
+#include "../Server/ThreadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <sys/wait.h>
+
+#define BENCH_INTERACTIVE 0
+#define BENCH_BULK 2
+
+struct Job {
+  int lane;
+  uint64_t enqueued;
+};
+
+static pthread_mutex_t waitsLock = PTHREAD_MUTEX_INITIALIZER;
+static vector<uint64_t> waits; // 交互任务从入队到开始执行的纳秒数
+static atomic<int> shed{0};
+
+static uint64_t Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void RunJob(void *arg) {
+  Job *job = static_cast<Job *>(arg);
+  uint64_t start = Now();
+  if (job->lane == BENCH_INTERACTIVE) {
+    pthread_mutex_lock(&waitsLock);
+    waits.push_back(start - job->enqueued);
+    pthread_mutex_unlock(&waitsLock);
+    while (Now() - start < 200000) {
+    }
+  } else {
+    usleep(60000);
+  }
+}
+
+static void ShedJob(void *) { shed++; }
+
+// 每种配置在子进程里跑：线程池的析构不等工作线程，跑完直接退出进程
+static void Bench(const char *name, const vector<LaneConfig> &lanes,
+                  bool split, int seconds) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid != 0) {
+    waitpid(pid, NULL, 0);
+    return;
+  }
+  Logger::start(LOG_LEVEL_WARN);
+  ThreadPool<Job> *pool = new ThreadPool<Job>(2, 10, nullptr, lanes);
+  pool->setShedHandler(&ShedJob);
+  uint64_t end = Now() + seconds * 1000000000ull;
+  for (int tick = 0; Now() < end; tick++) {
+    pool->addTask(Task<Job>(&RunJob, new Job{BENCH_INTERACTIVE, Now()},
+                            BENCH_INTERACTIVE));
+    if (tick % 5 == 0) {
+      pool->addTask(Task<Job>(&RunJob, new Job{BENCH_BULK, Now()},
+                              split ? BENCH_BULK : BENCH_INTERACTIVE));
+    }
+    usleep(1000);
+  }
+  pthread_mutex_lock(&waitsLock);
+  vector<uint64_t> w = waits;
+  pthread_mutex_unlock(&waitsLock);
+  sort(w.begin(), w.end());
+  size_t n = w.size();
+  printf("%-7s interactive started %5zu  wait p50 %8.2f ms  p99 %8.2f ms  "
+         "max %8.2f ms  shed %d\n",
+         name, n, n ? w[n / 2] / 1e6 : 0, n ? w[n * 99 / 100] / 1e6 : 0,
+         n ? w[n - 1] / 1e6 : 0, shed.load());
+  fflush(stdout);
+  Logger::stop();
+  _exit(0);
+}
+
+int main(int argc, char **argv) {
+  int seconds = argc > 1 ? atoi(argv[1]) : 5;
+  Bench("fifo", {{"全部", 1, 0, 0, 0}}, false, seconds);
+  // 一个通道，但排队超过3s丢弃、预计排队超过1s直接拒绝
+  Bench("fifo-dl", {{"全部", 1, 0, 3000, 1000}}, false, seconds);
+  // 和Option.hpp里ChatLanes()的默认配置相同
+  Bench("lanes",
+        {{"交互", 8, 1, 3000, 1000},
+         {"列表历史", 4, 0, 5000, 2000},
+         {"文件传输", 1, 0, 0, 0},
+         {"群管理", 2, 0, 5000, 0}},
+        true, seconds);
+  return 0;
+}
@@ -0,0 +1,112 @@
+// 异步日志的基准：每个线程写日志的开销，对比同步的cout<<endl。
+// 用法：bench_log_ring [线程数=4] [每线程条数=200000]
+// burst：每次写不满一个环形缓冲区，等写线程取走再写，只计调用方的时间；
+// flood：不停地写，环满时新日志被丢掉，统计实际写出的行数；
+// filtered：级别低于当前级别的调用，只有一次原子读
+#include "../Server/Log.hpp"
+#include <chrono>
+#include <fcntl.h>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using Clock = chrono::steady_clock;
+
+static double Ns(Clock::time_point a, Clock::time_point b) {
+  return chrono::duration<double, nano>(b - a).count();
+}
+
+// threads个线程各调用n次f，返回每次调用的平均纳秒（各线程取平均）
+template <typename F> static double Run(int threads, long n, F f) {
+  vector<double> per(threads);
+  vector<thread> ts;
+  for (int t = 0; t < threads; t++) {
+    ts.emplace_back([&, t] { per[t] = f(n) / n; });
+  }
+  for (thread &t : ts) {
+    t.join();
+  }
+  double sum = 0;
+  for (double x : per) {
+    sum += x;
+  }
+  return sum / threads;
+}
+
+static long CountLines(const char *file) {
+  FILE *f = fopen(file, "r");
+  long lines = 0;
+  for (int c; f != nullptr && (c = fgetc(f)) != EOF;) {
+    lines += c == '\n';
+  }
+  if (f != nullptr) {
+    fclose(f);
+  }
+  return lines;
+}
+
+int main(int argc, char **argv) {
+  int threads = argc > 1 ? atoi(argv[1]) : 4;
+  long n = argc > 2 ? atol(argv[2]) : 200000;
+  const char *out = "/tmp/bench_log_ring.out";
+
+  // cout：每条都加锁、格式化、刷新
+  int saved = dup(1);
+  int null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  dup2(null, 1);
+  double cout_ns = Run(threads, n, [](long n) {
+    Clock::time_point t0 = Clock::now();
+    for (long i = 0; i < n; i++) {
+      cout << "thread " << to_string(pthread_self()) << " start working..."
+           << endl;
+    }
+    return Ns(t0, Clock::now());
+  });
+  dup2(saved, 1);
+
+  Logger::start(LOG_LEVEL_INFO, null);
+  double burst_ns = Run(threads, n, [](long n) {
+    double sum = 0;
+    for (long b = 0; b < n / 1000; b++) {
+      Clock::time_point t0 = Clock::now();
+      for (int i = 0; i < 1000; i++) {
+        LOG_INFO("thread {} start working...", (unsigned long)pthread_self());
+      }
+      sum += Ns(t0, Clock::now());
+      this_thread::sleep_for(chrono::milliseconds(3));
+    }
+    return sum * n / (n / 1000 * 1000);
+  });
+  double filtered_ns = Run(threads, n, [](long n) {
+    Clock::time_point t0 = Clock::now();
+    for (long i = 0; i < n; i++) {
+      LOG_DEBUG("thread {} start working...", (unsigned long)pthread_self());
+    }
+    return Ns(t0, Clock::now());
+  });
+  Logger::stop();
+
+  int fd = open(out, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  Logger::start(LOG_LEVEL_INFO, fd);
+  double flood_ns = Run(threads, n, [](long n) {
+    Clock::time_point t0 = Clock::now();
+    for (long i = 0; i < n; i++) {
+      LOG_INFO("thread {} start working...", (unsigned long)pthread_self());
+    }
+    return Ns(t0, Clock::now());
+  });
+  Logger::stop();
+  close(fd);
+  close(null);
+
+  printf("threads=%d calls/thread=%ld\n", threads, n);
+  printf("cout<<endl   %8.1f ns/call\n", cout_ns);
+  printf("LOG burst    %8.1f ns/call\n", burst_ns);
+  printf("LOG filtered %8.1f ns/call\n", filtered_ns);
+  // 丢弃的日志会另外写一行"丢弃了N条日志"，这里按行数粗略统计写出的比例
+  printf("LOG flood    %8.1f ns/call, %ld of %ld lines written\n", flood_ns,
+         CountLines(out), threads * n);
+  unlink(out);
+  return 0;
+}
@@ -0,0 +1,131 @@
+// 全文索引的基准：往N个会话里写合成消息，量建索引的吞吐、常驻内存和查询延迟。
+// 用法：bench_search [消息总数=1000000] [会话数=100] [索引目录=/tmp/bench_search]
+// 要看真实的数字用Release构建：cmake -DCMAKE_BUILD_TYPE=Release
+#include "../Server/Archive.hpp"
+#include "../Server/SearchIndex.hpp"
+#include <chrono>
+#include <random>
+
+SearchIndex searchIndex;
+thread_local Redis *redis = nullptr;
+
+using Clock = chrono::steady_clock;
+
+static double Ms(Clock::time_point a, Clock::time_point b) {
+  return chrono::duration<double, milli>(b - a).count();
+}
+
+// 常驻内存，单位MB
+static long RssMB() {
+  long pages = 0, rss = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f != nullptr) {
+    if (fscanf(f, "%ld %ld", &pages, &rss) != 2) {
+      rss = 0;
+    }
+    fclose(f);
+  }
+  return rss * sysconf(_SC_PAGESIZE) >> 20;
+}
+
+static void WaitIdle(SearchIndex &index) {
+  while (index.stats().pending > 0) {
+    usleep(1000);
+  }
+}
+
+int main(int argc, char **argv) {
+  long total = argc > 1 ? atol(argv[1]) : 1000000;
+  int convs = argc > 2 ? atoi(argv[2]) : 100;
+  string dir = argc > 3 ? argv[3] : "/tmp/bench_search";
+  Logger::start(LOG_LEVEL_WARN);
+  if (system(("rm -rf " + dir).c_str()) != 0) {
+    return 1;
+  }
+  const char *zh[] = {"开会", "明天", "下午", "项目", "进度", "报告", "吃饭",
+                      "周末", "电影", "会议室", "需求", "评审", "上线", "测试",
+                      "问题", "修复", "版本", "发布", "数据库", "服务器",
+                      "客户", "合同", "预算", "老板", "同事", "加班", "请假",
+                      "快递", "天气", "下雨", "地铁", "迟到", "咖啡", "奶茶",
+                      "火锅", "生日", "礼物", "旅游", "机票", "酒店", "好的",
+                      "收到", "谢谢", "没问题", "稍等", "马上", "哈哈", "晚安",
+                      "早上好", "辛苦了"};
+  const char *en[] = {"ok",     "meeting", "deadline", "bug",      "fix",
+                      "deploy", "release", "review",   "lunch",    "coffee",
+                      "tomorrow", "today", "please",   "thanks",   "server",
+                      "database", "client", "report",  "budget",   "weekend",
+                      "api",    "latency", "cache",    "redis",    "ticket",
+                      "sprint", "demo",    "build",    "test",     "merge"};
+  mt19937_64 rng(42);
+  // 词频大致服从Zipf分布，越靠前的词越常见
+  auto pick = [&](int n) {
+    double u = uniform_real_distribution<double>(0, 1)(rng);
+    return (int)(n * u * u * u);
+  };
+  vector<string> keys;
+  for (int i = 0; i < convs; i++) {
+    keys.push_back("c" + to_string(i) + "的聊天记录");
+  }
+
+  searchIndex.start(dir);
+  Clock::time_point t0 = Clock::now();
+  string msg;
+  for (long i = 0; i < total; i++) {
+    msg.clear();
+    int words = 2 + rng() % 8;
+    for (int w = 0; w < words; w++) {
+      if (rng() % 3 != 0) {
+        msg += zh[pick(50)];
+      } else {
+        msg += en[pick(30)];
+        msg += ' ';
+      }
+    }
+    msg += to_string(rng() % 1000);
+    searchIndex.add(keys[i % convs], to_string(1000 + i % 7), msg,
+                    1790000000 + i / 1000);
+    // 队列有上限，超出的消息会被丢掉，写得比建得快时等一等
+    if (i % 10000 == 0) {
+      while (searchIndex.stats().pending > SEARCH_MAX_PENDING / 2) {
+        usleep(1000);
+      }
+    }
+  }
+  WaitIdle(searchIndex);
+  usleep(100000); // 最后一批可能还在建
+  Clock::time_point t1 = Clock::now();
+  SearchIndex::Stats st = searchIndex.stats();
+  printf("indexed %ld msgs in %d convs: %.0f msgs/s\n", total, convs,
+         total / (Ms(t0, t1) / 1000));
+  printf("resident %lu convs, %lu MB of index (cap %llu MB), %lu evictions, "
+         "rss %ld MB\n",
+         (unsigned long)st.resident, (unsigned long)(st.bytes >> 20),
+         (unsigned long long)(SEARCH_RESIDENT_BYTES >> 20),
+         (unsigned long)st.evictions, RssMB());
+
+  // 随机挑会话查询；常驻上限放不下全部会话时一部分查询要先从磁盘读回
+  const char *queries[] = {"开会",        "数据库",       "meeting",
+                           "开会 deadline", "预算 老板 客户", "会",
+                           "latency 42",  "不存在的词"};
+  for (const char *q : queries) {
+    vector<double> lat;
+    size_t hits = 0;
+    for (int r = 0; r < 200; r++) {
+      size_t n;
+      Clock::time_point a = Clock::now();
+      searchIndex.search(keys[rng() % convs], q, "1000", 1, n);
+      lat.push_back(Ms(a, Clock::now()));
+      hits += n;
+    }
+    sort(lat.begin(), lat.end());
+    printf("query %-16s avg hits %7zu  p50 %.3f ms  p99 %.3f ms\n", q,
+           hits / lat.size(), lat[lat.size() / 2], lat[lat.size() * 99 / 100]);
+  }
+  st = searchIndex.stats();
+  printf("after queries: resident %lu convs, %lu MB, %lu evictions, rss %ld "
+         "MB\n",
+         (unsigned long)st.resident, (unsigned long)(st.bytes >> 20),
+         (unsigned long)st.evictions, RssMB());
+  Logger::stop();
+  return 0;
+}
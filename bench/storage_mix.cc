@@ -0,0 +1,193 @@
+// 存储后端的基准：同一套处理函数分别跑在进程内存储和redis-server上，量整条命令链路的吞吐。
+// 用法：bench_storage_mix [server路径=./server] [组数=4] [秒数=10]
+// 依次用CHATROOM_STORAGE=memory和默认的redis后端各启动一次server（redis后端需要
+// 127.0.0.1:6379上的redis-server，数据不清空，每次都注册新用户）。每组6个用户互为好友、
+// 同在一个群，每个用户一个连接循环执行：好友列表、进入私聊、发私聊消息、退出私聊、发群消息、
+// 未读消息。归档和全文索引关掉，只比存储
+#include "../lib/Command.hpp"
+#include "../lib/TCPSocket.hpp"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <fcntl.h>
+#include <mutex>
+#include <netinet/tcp.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <thread>
+
+#define BENCH_PORT 6666 // server.cc里的LOCALPORT
+#define BENCH_GROUP 6   // 每组的用户数
+
+using Clock = chrono::steady_clock;
+
+static atomic<uint64_t> done{0};
+static atomic<uint64_t> busy{0};
+static mutex registering; // 注册一个一个来，和客户端一样
+
+struct Client {
+  TcpSocket sock;
+  string uid = "0"; // 注册前为0
+
+  bool connect() {
+    if (sock.connectToHost("127.0.0.1", BENCH_PORT) < 0) {
+      return false;
+    }
+    struct timeval tv = {20, 0};
+    setsockopt(sock.getfd(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return true;
+  }
+  string call(int flag, const vector<string> &option) {
+    sock.sendMsg(Command(uid, flag, option).To_Json());
+    return recv();
+  }
+  // server的多行回复是一条一条写的，延迟确认会让后面的每一条多等几十毫秒，
+  // 每次读之前重新打开TCP_QUICKACK（它不是持久的），量的才是存储而不是等ACK
+  string recv() {
+    int one = 1;
+    setsockopt(sock.getfd(), IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+    return sock.recvMsg();
+  }
+  // 读到结束标记为止；被丢弃的命令只回一个busy
+  void until(const string &first, const vector<string> &ends) {
+    for (string msg = first; msg != "close";) {
+      if (msg == "busy") {
+        busy++;
+        return;
+      }
+      for (const string &end : ends) {
+        if (msg == end) {
+          return;
+        }
+      }
+      msg = recv();
+    }
+  }
+};
+
+// 通知连接上的推送只读不处理；不走recvMsg，免得server退出时每条连接打一行"对端已关闭"
+static void Drain(int fd) {
+  char buf[4096];
+  while (read(fd, buf, sizeof(buf)) > 0) {
+  }
+  close(fd);
+}
+
+static bool Login(Client &c, const string &pwd) {
+  if (!c.connect()) {
+    return false;
+  }
+  {
+    lock_guard<mutex> guard(registering);
+    c.uid = c.call(2, {pwd});
+  }
+  if (c.call(1, {pwd}) != "ok") {
+    return false;
+  }
+  TcpSocket notify;
+  if (notify.connectToHost("127.0.0.1", BENCH_PORT) < 0) {
+    return false;
+  }
+  notify.sendMsg(Command(c.uid, -1, {"空"}).To_Json());
+  thread(Drain, notify.getfd()).detach();
+  return true;
+}
+
+static void RunGroup(int group, Clock::time_point start, int seconds) {
+  vector<Client> users(BENCH_GROUP);
+  for (int i = 0; i < BENCH_GROUP; i++) {
+    string pwd = "p";
+    pwd += to_string(group * BENCH_GROUP + i);
+    if (!Login(users[i], pwd)) {
+      fprintf(stderr, "第%d组第%d个用户登录失败\n", group, i);
+      return;
+    }
+  }
+  Client &owner = users[0];
+  string members;
+  for (int i = 1; i < BENCH_GROUP; i++) {
+    owner.call(3, {users[i].uid, "hi"});
+    users[i].call(4, {owner.uid});
+    members += i > 1 ? "," : "";
+    members += users[i].uid;
+  }
+  string gid = owner.call(15, {members});
+  this_thread::sleep_until(start);
+  Clock::time_point end = start + chrono::seconds(seconds);
+  vector<thread> ts;
+  for (int k = 0; k < BENCH_GROUP; k++) {
+    ts.emplace_back([&, k] {
+      Client &c = users[k];
+      string peer = k == 0 ? users[1].uid : owner.uid;
+      while (Clock::now() < end) {
+        c.until(c.call(5, {"x"}), {"end", "none"});
+        string r = c.call(6, {peer});
+        c.until(r == "have" ? c.recv() : r, {"以上为历史聊天记录"});
+        c.until(c.call(7, {peer, "m"}), {"ok", "nohave"});
+        c.until(c.call(8, {"x"}), {"ok"});
+        c.until(c.call(30, {gid, "g"}), {"ok"});
+        c.until(c.call(12, {"x"}), {"end"});
+        done += 6;
+      }
+    });
+  }
+  for (thread &t : ts) {
+    t.join();
+  }
+  for (Client &c : users) {
+    c.sock.sendMsg("quit");
+  }
+}
+
+static double Run(const char *server, bool memory, int groups, int seconds) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (memory) {
+      setenv("CHATROOM_STORAGE", "memory", 1);
+    } else {
+      unsetenv("CHATROOM_STORAGE");
+    }
+    setenv("CHATROOM_ARCHIVE", "", 1);
+    setenv("CHATROOM_SEARCH", "", 1);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, 1);
+    execl(server, server, (char *)NULL);
+    _exit(127);
+  }
+  // 等server开始监听
+  for (int i = 0; i < 50; i++) {
+    usleep(100000);
+    TcpSocket probe;
+    if (probe.connectToHost("127.0.0.1", BENCH_PORT) == 0) {
+      probe.sendMsg("quit");
+      close(probe.getfd());
+      break;
+    }
+  }
+  done = 0;
+  busy = 0;
+  Clock::time_point start = Clock::now() + chrono::seconds(2);
+  vector<thread> ts;
+  for (int g = 0; g < groups; g++) {
+    ts.emplace_back(RunGroup, g, start, seconds);
+  }
+  for (thread &t : ts) {
+    t.join();
+  }
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  return done / (double)seconds;
+}
+
+int main(int argc, char **argv) {
+  const char *server = argc > 1 ? argv[1] : "./server";
+  int groups = argc > 2 ? atoi(argv[2]) : 4;
+  int seconds = argc > 3 ? atoi(argv[3]) : 10;
+  signal(SIGPIPE, SIG_IGN);
+  printf("%d connections, %d s\n", groups * BENCH_GROUP, seconds);
+  double mem = Run(server, true, groups, seconds);
+  printf("memory  %8.0f cmds/s, %lu busy\n", mem, (unsigned long)busy.load());
+  double rds = Run(server, false, groups, seconds);
+  printf("redis   %8.0f cmds/s, %lu busy\n", rds, (unsigned long)busy.load());
+  return 0;
+}
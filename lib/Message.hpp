@@ -4,20 +4,31 @@
 #include <nlohmann/json.hpp>
 #include <string>
 
+// 私聊记录的类别
+#define MSG_TEXT "text"         // 文字消息
+#define MSG_SENDFILE "sendfile" // 发送了文件，content为文件名
+#define MSG_RECVFILE "recvfile" // 接收了文件，content为文件名
+#define MSG_BEGIN "begin"       // 成为好友时的分隔线
+
 using namespace std;
 using json = nlohmann::json;
 
+// 一条私聊记录，两人共用一份，展示成"我：..."还是"好友备注：..."在读取时决定
 struct Message {
 public:
   Message() = default;
   ~Message() = default;
-  Message(string SendUid, string RecvUid, string content, string t_time)
-      : SendUid(SendUid), RecvUid(RecvUid), content(content), t_time(t_time) {}
+  Message(string SendUid, string RecvUid, string content, string t_time,
+          string kind = MSG_TEXT)
+      : SendUid(SendUid), RecvUid(RecvUid), content(content), t_time(t_time),
+        kind(kind) {}
 
   string SendUid;
   string RecvUid;
   string content;
-  string t_time;
+  string t_time;          // 发送时间，秒级时间戳
+  string kind = MSG_TEXT; // 记录的类别
+  bool hidden = false;    // 发送时已被对方屏蔽，只有发送者看得到
   // 讲一个json字符串转为类
   void From_Json(string message_js) {
     json jn = json::parse(message_js);
@@ -25,17 +36,25 @@ public:
     jn.at("RecvUid").get_to(RecvUid);
     jn.at("content").get_to(content);
     jn.at("t_time").get_to(t_time);
+    kind = jn.value("kind", MSG_TEXT);
+    hidden = jn.value("hidden", false);
   }
-  // 将类转为json字符串
+  // 将类转为json字符串，缺省的类别和屏蔽标记不写出
   string To_Json() {
     json jn = json{
-        {"SendUidd", SendUid},
+        {"SendUid", SendUid},
         {"RecvUid", RecvUid},
         {"content", content},
         {"t_time", t_time},
     };
+    if (kind != MSG_TEXT) {
+      jn["kind"] = kind;
+    }
+    if (hidden) {
+      jn["hidden"] = true;
+    }
     return jn.dump();
   }
 };
 
-#endif
\ No newline at end of file
+#endif